@@ -58,6 +58,7 @@
 #define SEC_TAG_CLI_4                  0xc004 /* CS_CLUSTER? */
 #define SEC_TAG_CLI_MONITOR            0xc005 /* CS_MONITOR */
 #define SEC_TAG_CLI_MONITOR_EX         0xc008 /* CS_MONITOR_EX */
+#define SEC_TAG_CLI_MCS_MSGCHANNEL     0xc006 /* CS_MCS_MSGCHANNEL */
 
 /* Client Core Data: colorDepth, postBeta2ColorDepth (2.2.1.3.2) */
 #define RNS_UD_COLOR_4BPP              0xCA00
@@ -66,6 +67,9 @@
 #define RNS_UD_COLOR_16BPP_565         0xCA03
 #define RNS_UD_COLOR_24BPP             0xCA04
 
+/* Client Core Data: earlyCapabilityFlags (2.2.1.3.2) */
+#define RNS_UD_CS_SUPPORT_NETCHAR_AUTODETECT 0x0080
+
 /* Client Core Data: connectionType  (2.2.1.3.2) */
 #define CONNECTION_TYPE_MODEM          0x01
 #define CONNECTION_TYPE_BROADBAND_LOW  0x02
@@ -127,6 +131,7 @@
 #define RDP_LOGON_AUTO                 0x0008
 #define RDP_LOGON_NORMAL               0x0033
 #define RDP_COMPRESSION                0x0080
+#define RDP_COMPRESSION_TYPE_MASK      0x1E00 /* CompressionTypeMask */
 #define RDP_LOGON_BLOB                 0x0100
 #define RDP_LOGON_LEAVE_AUDIO          0x2000
 #define RDP_LOGON_RAIL                 0x8000
@@ -438,10 +443,13 @@
 #define SEC_ENCRYPT                    0x0008
 #define SEC_LOGON_INFO                 0x0040 /* SEC_INFO_PKT */
 #define SEC_LICENCE_NEG                0x0080 /* SEC_LICENSE_PKT */
+#define SEC_AUTODETECT_REQ             0x1000
+#define SEC_AUTODETECT_RSP             0x2000
 
 #define SEC_TAG_SRV_INFO               0x0c01 /* SC_CORE */
 #define SEC_TAG_SRV_CRYPT              0x0c02 /* SC_SECURITY */
 #define SEC_TAG_SRV_CHANNELS           0x0c03 /* SC_NET? */
+#define SEC_TAG_SRV_MCS_MSGCHANNEL     0x0c04 /* SC_MCS_MSGCHANNEL */
 
 /* Slow-Path Input Event: messageType (2.2.8.1.1.3.1.1) */
 /* TODO: to be renamed */
@@ -560,6 +568,26 @@
 #define CMDTYPE_FRAME_MARKER           0x0004
 #define CMDTYPE_STREAM_SURFACE_BITS    0x0006
 
+/* Auto-Detect Request / Response: headerTypeId (2.2.14.3, 2.2.14.4) */
+#define TYPE_ID_AUTODETECT_REQUEST     0x00
+#define TYPE_ID_AUTODETECT_RESPONSE    0x01
+
+/* Auto-Detect Request: requestType (2.2.14.1) */
+#define RDP_RTT_REQUEST_CONTINUOUS     0x0001
+#define RDP_RTT_REQUEST_CONNECT_TIME   0x1001
+#define RDP_BW_START_CONTINUOUS        0x0014
+#define RDP_BW_START_CONNECT_TIME      0x1014
+#define RDP_BW_PAYLOAD                 0x0002
+#define RDP_BW_STOP_CONNECT_TIME       0x002B
+#define RDP_BW_STOP_CONTINUOUS         0x0429
+#define RDP_NETCHAR_RESULT_ALL         0x08C0 /* baseRTT, bandwidth, averageRTT */
+
+/* Auto-Detect Response: responseType (2.2.14.2) */
+#define RDP_RTT_RESPONSE               0x0000
+#define RDP_BW_RESULTS_CONNECT_TIME    0x0003
+#define RDP_BW_RESULTS_CONTINUOUS      0x000B
+#define RDP_NETCHAR_SYNC               0x0018
+
 /* Compression Flags (3.1.8.2.1) */
 /* TODO: to be renamed, not used anywhere */
 #define RDP_MPPC_COMPRESSED            0x20
@@ -56,4 +56,8 @@
 #define TS_CACHE_BRUSH                      0x07
 #define TS_CACHE_BITMAP_COMPRESSED_REV3     0x08
 
+/* GlyphIndex order rgbData fragment operations (2.2.2.2.1.1.2.13) */
+#define GLYPH_FRAGMENT_USE                  0xFE
+#define GLYPH_FRAGMENT_ADD                  0xFF
+
 #endif /* MS_RDPEGDI_H */
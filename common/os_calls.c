@@ -96,6 +96,8 @@ extern char **environ;
 
 #if defined(__linux__)
 #include <linux/unistd.h>
+#include <linux/errqueue.h>
+#include <sys/eventfd.h>
 #endif
 
 /* sys/ucred.h needs to be included to use struct xucred
@@ -104,6 +106,17 @@ extern char **environ;
 #include <sys/ucred.h>
 #endif
 
+/* wait objects are the read descriptor in the low 16 bits and the write
+   descriptor above it. An eventfd is both, a pipe is two */
+#define WAIT_OBJ_IS_EVENTFD(obj) (((obj) >> 16) == ((obj) & 0xffff))
+
+/* user space state of each wait object, indexed by its read descriptor.
+   WAIT_OBJ_SET can only be trusted with WAIT_OBJ_PRIVATE, which is
+   cleared by a fork as another process could then reset the object */
+#define WAIT_OBJ_PRIVATE 1
+#define WAIT_OBJ_SET 2
+static unsigned char g_wait_obj_state[0x10000];
+
 /* for solaris */
 #if !defined(PF_LOCAL)
 #define PF_LOCAL AF_UNIX
@@ -516,6 +529,50 @@ g_sck_get_send_buffer_bytes(int sck, int *bytes)
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+g_tcp_set_notsent_lowat(int sck, int bytes)
+{
+#if defined(TCP_NOTSENT_LOWAT)
+    int option_value;
+    socklen_t option_len;
+
+    option_value = bytes;
+    option_len = sizeof(option_value);
+    if (setsockopt(sck, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (char *)&option_value,
+                   option_len) != 0)
+    {
+        return 1;
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+g_sck_set_max_pacing_rate(int sck, unsigned int bytes_per_sec)
+{
+#if defined(SO_MAX_PACING_RATE)
+    unsigned int option_value;
+    socklen_t option_len;
+
+    option_value = bytes_per_sec;
+    option_len = sizeof(option_value);
+    if (setsockopt(sck, SOL_SOCKET, SO_MAX_PACING_RATE, (char *)&option_value,
+                   option_len) != 0)
+    {
+        return 1;
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -1385,6 +1442,127 @@ g_sck_send(int sck, const void *ptr, unsigned int len, int flags)
 #endif
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+g_sck_set_zerocopy(int sck)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int option_value;
+    socklen_t option_len;
+
+    option_value = 1;
+    option_len = sizeof(option_value);
+    if (setsockopt(sck, SOL_SOCKET, SO_ZEROCOPY, (char *)&option_value,
+                   option_len) != 0)
+    {
+        return 1;
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/*****************************************************************************/
+int
+g_sck_send_zerocopy(int sck, const void *ptr, unsigned int len)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    return send(sck, ptr, len, MSG_ZEROCOPY);
+#else
+    return g_sck_send(sck, ptr, len, 0);
+#endif
+}
+
+/*****************************************************************************/
+int
+g_sck_zerocopy_done(int sck, unsigned int *done, int *copied)
+{
+    int rv = 0;
+#if defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    union
+    {
+        struct cmsghdr cm;
+        unsigned char control[256];
+    } control_un;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *serr;
+
+    while (1)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control_un.control;
+        msg.msg_controllen = sizeof(control_un.control);
+        /* never blocks, fails once the error queue is empty */
+        if (recvmsg(sck, &msg, MSG_ERRQUEUE) < 0)
+        {
+            break;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == IPPROTO_IP &&
+                    cmsg->cmsg_type == IP_RECVERR) &&
+                    !(cmsg->cmsg_level == IPPROTO_IPV6 &&
+                      cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 ||
+                    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+            /* sends ee_info to ee_data, counting from 0, are done */
+            if ((int) (serr->ee_data + 1 - *done) > 0)
+            {
+                *done = serr->ee_data + 1;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                *copied = 1;
+            }
+            rv++;
+        }
+    }
+#endif
+    return rv;
+}
+
+/*****************************************************************************/
+int
+g_sck_send_vec(int sck, const char *const bufs[], const int lens[],
+               int count)
+{
+#if defined(_WIN32)
+    if (count < 1)
+    {
+        return 0;
+    }
+    return send(sck, bufs[0], lens[0], 0);
+#else
+    struct msghdr msg = {0};
+    struct iovec iov[G_SCK_SEND_VEC_MAX];
+    int index;
+
+    if (count > G_SCK_SEND_VEC_MAX)
+    {
+        count = G_SCK_SEND_VEC_MAX;
+    }
+    for (index = 0; index < count; index++)
+    {
+        iov[index].iov_base = (void *)bufs[index];
+        iov[index].iov_len = lens[index];
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(sck, &msg, 0);
+#endif
+}
+
 /*****************************************************************************/
 int
 g_sck_recv_fd_set(int sck, void *ptr, unsigned int len,
@@ -1706,6 +1884,15 @@ g_create_wait_obj(const char *name)
     int fds[2];
     int error;
 
+#if defined(__linux__)
+    fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0] > 0)
+    {
+        g_wait_obj_state[fds[0] & 0xffff] = WAIT_OBJ_PRIVATE;
+        return (fds[0] << 16) | fds[0];
+    }
+    /* fall back to a pipe */
+#endif
     error = pipe(fds);
     if (error != 0)
     {
@@ -1725,6 +1912,7 @@ g_create_wait_obj(const char *name)
     }
     g_file_set_cloexec(fds[0], 1);
     g_file_set_cloexec(fds[1], 1);
+    g_wait_obj_state[fds[0] & 0xffff] = WAIT_OBJ_PRIVATE;
     return (fds[1] << 16) | fds[0];
 #endif
 }
@@ -1775,24 +1963,32 @@ g_delete_wait_obj_from_socket(tintptr wait_obj)
 }
 
 /*****************************************************************************/
-/* returns error */
-int
-g_set_wait_obj(tintptr obj)
+/* makes the descriptor readable, the user space flag is left alone
+   returns error */
+static int
+wait_obj_signal(tintptr obj)
 {
-#ifdef _WIN32
-#error "Win32 is no longer supported."
-#else
     int error;
     int fd;
     int written;
     int to_write;
     char buf[4] = "sig";
+    uint64_t value;
 
-    if (obj == 0)
+    fd = obj & USHRT_MAX;
+    if (WAIT_OBJ_IS_EVENTFD(obj))
     {
+        value = 1;
+        while (write(fd, &value, sizeof(value)) != sizeof(value))
+        {
+            if (errno != EINTR)
+            {
+                /* EAGAIN, the counter is full so it's set anyway */
+                return (errno == EAGAIN) ? 0 : 1;
+            }
+        }
         return 0;
     }
-    fd = obj & USHRT_MAX;
     if (g_fd_can_read(fd))
     {
         /* already signalled */
@@ -1827,9 +2023,64 @@ g_set_wait_obj(tintptr obj)
         }
     }
     return 0;
+}
+
+/*****************************************************************************/
+static void
+wait_obj_clear_set(int fd)
+{
+    __atomic_fetch_and(g_wait_obj_state + fd, (unsigned char) ~WAIT_OBJ_SET,
+                       __ATOMIC_ACQ_REL);
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+g_set_wait_obj(tintptr obj)
+{
+#ifdef _WIN32
+#error "Win32 is no longer supported."
+#else
+    int fd;
+
+    if (obj == 0)
+    {
+        return 0;
+    }
+    fd = obj & USHRT_MAX;
+    if (__atomic_fetch_or(g_wait_obj_state + fd, WAIT_OBJ_SET,
+                          __ATOMIC_ACQ_REL) ==
+            (WAIT_OBJ_PRIVATE | WAIT_OBJ_SET))
+    {
+        /* already signalled, and not reset since */
+        return 0;
+    }
+    if (wait_obj_signal(obj) != 0)
+    {
+        /* not signalled, so the next set must not be skipped */
+        wait_obj_clear_set(fd);
+        return 1;
+    }
+    return 0;
 #endif
 }
 
+/*****************************************************************************/
+/* called after a reset has drained the descriptor. A set since the flag
+   was cleared may have had its write read by the drain, so the
+   descriptor is signalled again to agree with the flag
+   returns error */
+static int
+wait_obj_resignal(tintptr obj)
+{
+    if (__atomic_load_n(g_wait_obj_state + (obj & 0xffff),
+                        __ATOMIC_ACQUIRE) & WAIT_OBJ_SET)
+    {
+        return wait_obj_signal(obj);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -1846,12 +2097,23 @@ g_reset_wait_obj(tintptr obj)
     char buf[4];
     int error;
     int fd;
+    uint64_t value;
 
     if (obj == 0)
     {
         return 0;
     }
     fd = obj & 0xffff;
+    /* cleared before draining, so a set from here on is not skipped */
+    wait_obj_clear_set(fd);
+    if (WAIT_OBJ_IS_EVENTFD(obj))
+    {
+        /* one read takes the whole count */
+        while (read(fd, &value, sizeof(value)) < 0 && errno == EINTR)
+        {
+        }
+        return wait_obj_resignal(obj);
+    }
     while (g_fd_can_read(fd))
     {
         error = read(fd, buf, 4);
@@ -1873,7 +2135,7 @@ g_reset_wait_obj(tintptr obj)
             return 1;
         }
     }
-    return 0;
+    return wait_obj_resignal(obj);
 #endif
 }
 
@@ -1897,6 +2159,12 @@ g_is_wait_obj_set(tintptr obj)
     {
         return 0;
     }
+    if (__atomic_load_n(g_wait_obj_state + (obj & 0xffff),
+                        __ATOMIC_ACQUIRE) ==
+            (WAIT_OBJ_PRIVATE | WAIT_OBJ_SET))
+    {
+        return 1;
+    }
     return g_fd_can_read(obj & 0xffff);
 #endif
 }
@@ -1919,8 +2187,12 @@ g_delete_wait_obj(tintptr obj)
     {
         return 0;
     }
+    g_wait_obj_state[obj & 0xffff] = 0;
     close(obj & 0xffff);
-    close(obj >> 16);
+    if (!WAIT_OBJ_IS_EVENTFD(obj))
+    {
+        close(obj >> 16);
+    }
     return 0;
 #endif
 }
@@ -3027,6 +3299,11 @@ g_fork(void)
             "Process fork failed with errno: %d, description: %s",
             g_get_errno(), g_get_strerror());
     }
+    else
+    {
+        /* the other process can now reset the existing wait objects */
+        g_memset(g_wait_obj_state, 0, sizeof(g_wait_obj_state));
+    }
 
     return rv;
 #endif
@@ -3595,6 +3872,22 @@ g_time3(void)
 #endif
 }
 
+/*****************************************************************************/
+/* returns microseconds from a clock which only goes forward, only the
+   difference between two calls means anything */
+tui64
+g_time_usec(void)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (tui64) tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+#endif
+}
+
 /******************************************************************************/
 /******************************************************************************/
 struct bmp_magic
@@ -70,6 +70,18 @@ int      g_tcp_set_keepalive(int sck);
 int      g_tcp_socket(void);
 int      g_sck_set_send_buffer_bytes(int sck, int bytes);
 int      g_sck_get_send_buffer_bytes(int sck, int *bytes);
+/**
+ * Only report the socket as writeable while fewer than this many bytes
+ * are waiting to be sent (TCP_NOTSENT_LOWAT)
+ * @return 0 for success, non-zero if not supported or an error
+ */
+int      g_tcp_set_notsent_lowat(int sck, int bytes);
+/**
+ * Cap the rate the kernel paces the socket's output at
+ * (SO_MAX_PACING_RATE)
+ * @return 0 for success, non-zero if not supported or an error
+ */
+int      g_sck_set_max_pacing_rate(int sck, unsigned int bytes_per_sec);
 int      g_sck_set_recv_buffer_bytes(int sck, int bytes);
 int      g_sck_get_recv_buffer_bytes(int sck, int *bytes);
 int      g_sck_local_socket(void);
@@ -89,6 +101,40 @@ int      g_sck_listen(int sck);
 int      g_sck_accept(int sck);
 int      g_sck_recv(int sck, void *ptr, unsigned int len, int flags);
 int      g_sck_send(int sck, const void *ptr, unsigned int len, int flags);
+/**
+ * Lets the kernel send from user memory without copying it (SO_ZEROCOPY)
+ * @return 0 for success, non-zero if not supported or an error
+ */
+int      g_sck_set_zerocopy(int sck);
+/**
+ * Sends with MSG_ZEROCOPY, so the buffer must not be changed or freed
+ * until g_sck_zerocopy_done() says the kernel has finished with it
+ * @return Bytes sent, or < 0 for error.
+ */
+int      g_sck_send_zerocopy(int sck, const void *ptr, unsigned int len);
+/**
+ * Reads MSG_ZEROCOPY completions from the socket error queue
+ *
+ * @param sck - Socket g_sck_send_zerocopy() was used on
+ * @param[in,out] done - Number of zero copy sends finished with
+ * @param[out] copied - Set if the kernel had to copy the data after all
+ * @return Number of completions read
+ */
+int      g_sck_zerocopy_done(int sck, unsigned int *done, int *copied);
+/**
+ * Sends data from several buffers with one call
+ *
+ * @param sck - Socket to send on
+ * @param bufs - Array of buffer pointers
+ * @param lens - Array of buffer lengths
+ * @param count - Number of buffers. At most G_SCK_SEND_VEC_MAX are used
+ * @return Bytes sent, or < 0 for error.
+ *
+ * As with g_sck_send(), fewer bytes than asked for may be sent.
+ */
+#define G_SCK_SEND_VEC_MAX 64
+int      g_sck_send_vec(int sck, const char *const bufs[], const int lens[],
+                        int count);
 /**
  * Receives data and file descriptors on a unix domain socket
  *
@@ -179,6 +225,16 @@ g_sck_get_peer_description(int sck,
 void     g_sleep(int msecs);
 int      g_pipe(int fd[2]);
 
+/**
+ * Create a wait object
+ *
+ * On Linux this is an eventfd, elsewhere a pipe. Setting an object
+ * which is already set, or testing one set by the same process, needs
+ * no system call.
+ *
+ * @param name Not used
+ * @return wait object, or 0 on error
+ */
 tintptr  g_create_wait_obj(const char *name);
 tintptr  g_create_wait_obj_from_socket(tintptr socket, int write);
 void     g_delete_wait_obj_from_socket(tintptr wait_obj);
@@ -327,6 +383,7 @@ int      g_check_user_in_group(const char *username, int gid, int *ok);
 int      g_time1(void);
 int      g_time2(void);
 int      g_time3(void);
+tui64    g_time_usec(void);
 int      g_save_to_bmp(const char *filename, char *data, int stride_bytes,
                        int width, int height, int depth, int bits_per_pixel);
 void    *g_shmat(int shmid);
@@ -0,0 +1,524 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/reactor.c
+ * @brief   Persistent set of wait objects
+ *
+ * Each object is kept in a table indexed by its descriptor, and the
+ * descriptors with events registered are also kept in the 'active'
+ * array so the set can be walked without scanning the whole table.
+ *
+ * Objects are registered once and stay registered until reactor_del().
+ * The kernel drops an epoll registration when the file is closed, but a
+ * closed file which is still open elsewhere keeps it. So if an object
+ * turns out to have been closed before it was removed, the epoll
+ * instance is made again from the table before the next wait.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include "reactor.h"
+#include "defines.h"
+#include "log.h"
+#include "os_calls.h"
+
+/* most ready descriptors taken from the kernel in one wait */
+#define REACTOR_WAIT_MAX 64
+
+struct reactor_fd
+{
+    tintptr obj;
+    int events; /* registered with the kernel */
+    int index; /* in active */
+};
+
+struct reactor
+{
+#if defined(__linux__)
+    int epfd;
+#else
+    struct pollfd *pollfd;
+#endif
+    struct reactor_fd *fds;
+    int fds_size;
+    int *active;
+    int active_count;
+    int active_size;
+    int rebuild; /* the kernel may hold registrations for closed files */
+};
+
+/*****************************************************************************/
+/* sockets and the read end of a wait object */
+static int
+reactor_obj_fd(tintptr obj)
+{
+    return obj & 0xffff;
+}
+
+/*****************************************************************************/
+/* returns the table entry for a descriptor, growing the table if needed,
+   or NULL for no memory */
+static struct reactor_fd *
+reactor_get_fd(struct reactor *self, int fd)
+{
+    struct reactor_fd *fds;
+    int new_size;
+
+    if (fd >= self->fds_size)
+    {
+        new_size = self->fds_size * 2;
+        while (new_size <= fd)
+        {
+            new_size *= 2;
+        }
+        fds = (struct reactor_fd *)
+              realloc(self->fds, sizeof(struct reactor_fd) * new_size);
+        if (fds == NULL)
+        {
+            return NULL;
+        }
+        g_memset(fds + self->fds_size, 0,
+                 sizeof(struct reactor_fd) * (new_size - self->fds_size));
+        self->fds = fds;
+        self->fds_size = new_size;
+    }
+    return self->fds + fd;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+reactor_active_add(struct reactor *self, int fd)
+{
+    int *active;
+    int new_size;
+#if !defined(__linux__)
+    struct pollfd *pollfd;
+#endif
+
+    if (self->active_count >= self->active_size)
+    {
+        new_size = self->active_size * 2;
+        active = (int *)realloc(self->active, sizeof(int) * new_size);
+        if (active == NULL)
+        {
+            return 1;
+        }
+#if !defined(__linux__)
+        pollfd = (struct pollfd *)
+                 realloc(self->pollfd, sizeof(struct pollfd) * new_size);
+        if (pollfd == NULL)
+        {
+            self->active = active;
+            return 1;
+        }
+        self->pollfd = pollfd;
+#endif
+        self->active = active;
+        self->active_size = new_size;
+    }
+    self->fds[fd].index = self->active_count;
+    self->active[self->active_count++] = fd;
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+reactor_active_remove(struct reactor *self, int fd)
+{
+    int index;
+    int last;
+
+    index = self->fds[fd].index;
+    last = self->active[--self->active_count];
+    self->active[index] = last;
+    self->fds[last].index = index;
+    self->fds[fd].events = 0;
+}
+
+#if defined(__linux__)
+/*****************************************************************************/
+static int
+reactor_epoll_events(int events)
+{
+    int rv;
+
+    rv = 0;
+    if (events & REACTOR_READ)
+    {
+        rv |= EPOLLIN;
+    }
+    if (events & REACTOR_WRITE)
+    {
+        rv |= EPOLLOUT;
+    }
+    if (events & REACTOR_EDGE)
+    {
+        rv |= EPOLLET;
+    }
+    return rv;
+}
+#endif
+
+/*****************************************************************************/
+/* tells the kernel about new events for a descriptor, 0 to remove it
+   returns error */
+static int
+reactor_ctl(struct reactor *self, int fd, int events)
+{
+#if defined(__linux__)
+    struct epoll_event ev;
+    int registered;
+
+    registered = self->fds[fd].events;
+    g_memset(&ev, 0, sizeof(ev));
+    ev.events = reactor_epoll_events(events);
+    ev.data.fd = fd;
+    if (events == 0)
+    {
+        if (epoll_ctl(self->epfd, EPOLL_CTL_DEL, fd, &ev) != 0)
+        {
+            /* closed before it was removed */
+            self->rebuild = 1;
+        }
+        return 0;
+    }
+    if (registered == 0)
+    {
+        if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+        {
+            return 0;
+        }
+        if (errno != EEXIST)
+        {
+            LOG(LOG_LEVEL_ERROR, "reactor: can't add descriptor %d: %s",
+                fd, g_get_strerror());
+            return 1;
+        }
+    }
+    if (epoll_ctl(self->epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+    {
+        return 0;
+    }
+    if (errno == ENOENT &&
+            epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    {
+        /* closed and reused without being removed */
+        self->rebuild = 1;
+        return 0;
+    }
+    LOG(LOG_LEVEL_ERROR, "reactor: can't change descriptor %d: %s",
+        fd, g_get_strerror());
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+/* sets the events for a descriptor, keeping active up to date
+   returns error */
+static int
+reactor_set_fd(struct reactor *self, int fd, tintptr obj, int events)
+{
+    struct reactor_fd *rfd;
+
+    rfd = self->fds + fd;
+    if (events == rfd->events)
+    {
+        rfd->obj = obj;
+        return 0;
+    }
+    if (reactor_ctl(self, fd, events) != 0)
+    {
+        return 1;
+    }
+    if (events == 0)
+    {
+        reactor_active_remove(self, fd);
+        return 0;
+    }
+    if (rfd->events == 0 && reactor_active_add(self, fd) != 0)
+    {
+        reactor_ctl(self, fd, 0);
+        return 1;
+    }
+    rfd->obj = obj;
+    rfd->events = events;
+    return 0;
+}
+
+/*****************************************************************************/
+/* makes a new epoll instance and registers everything in the table
+   again, dropping anything the kernel kept for closed files
+   returns error */
+static int
+reactor_rebuild(struct reactor *self)
+{
+#if defined(__linux__)
+    struct epoll_event ev;
+    int index;
+    int fd;
+
+    self->rebuild = 0;
+    close(self->epfd);
+    self->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epfd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "reactor: epoll_create1 failed: %s",
+            g_get_strerror());
+        return 1;
+    }
+    /* backwards, as active shrinks if a descriptor has gone */
+    for (index = self->active_count - 1; index >= 0; index--)
+    {
+        fd = self->active[index];
+        g_memset(&ev, 0, sizeof(ev));
+        ev.events = reactor_epoll_events(self->fds[fd].events);
+        ev.data.fd = fd;
+        if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "reactor: descriptor %d was closed "
+                "without being removed", fd);
+            reactor_active_remove(self, fd);
+        }
+    }
+#endif
+    return 0;
+}
+
+/*****************************************************************************/
+struct reactor *
+reactor_create(void)
+{
+    struct reactor *self;
+
+    self = g_new0(struct reactor, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->fds_size = 64;
+    self->fds = g_new0(struct reactor_fd, self->fds_size);
+    self->active_size = 16;
+    self->active = g_new(int, self->active_size);
+#if defined(__linux__)
+    self->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epfd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "reactor: epoll_create1 failed: %s",
+            g_get_strerror());
+    }
+    if (self->fds == NULL || self->active == NULL || self->epfd < 0)
+#else
+    self->pollfd = g_new(struct pollfd, self->active_size);
+    if (self->fds == NULL || self->active == NULL || self->pollfd == NULL)
+#endif
+    {
+        reactor_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+reactor_delete(struct reactor *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+#if defined(__linux__)
+    if (self->epfd >= 0)
+    {
+        close(self->epfd);
+    }
+#else
+    g_free(self->pollfd);
+#endif
+    g_free(self->fds);
+    g_free(self->active);
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+reactor_add(struct reactor *self, tintptr obj, int events)
+{
+    int fd;
+
+    fd = reactor_obj_fd(obj);
+    if (fd <= 0 || events == 0 || reactor_get_fd(self, fd) == NULL)
+    {
+        return 1;
+    }
+    if (self->fds[fd].events != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "reactor_add: descriptor %d already added", fd);
+        return 1;
+    }
+    return reactor_set_fd(self, fd, obj, events);
+}
+
+/*****************************************************************************/
+int
+reactor_mod(struct reactor *self, tintptr obj, int events)
+{
+    int fd;
+
+    fd = reactor_obj_fd(obj);
+    if (fd <= 0 || fd >= self->fds_size || self->fds[fd].events == 0 ||
+            events == 0)
+    {
+        return 1;
+    }
+    return reactor_set_fd(self, fd, obj, events);
+}
+
+/*****************************************************************************/
+int
+reactor_del(struct reactor *self, tintptr obj)
+{
+    int fd;
+
+    fd = reactor_obj_fd(obj);
+    if (fd <= 0 || fd >= self->fds_size || self->fds[fd].events == 0)
+    {
+        return 1;
+    }
+    return reactor_set_fd(self, fd, obj, 0);
+}
+
+/*****************************************************************************/
+int
+reactor_wait(struct reactor *self, struct reactor_event *events,
+             int max_events, int mstimeout)
+{
+#if defined(__linux__)
+    struct epoll_event ev[REACTOR_WAIT_MAX];
+    int count;
+    int index;
+    int fd;
+
+    if (self->rebuild && reactor_rebuild(self) != 0)
+    {
+        return -1;
+    }
+    if (mstimeout < 1)
+    {
+        mstimeout = -1;
+    }
+    if (events == NULL || max_events < 1)
+    {
+        max_events = 1;
+    }
+    count = epoll_wait(self->epfd, ev, MIN(max_events, REACTOR_WAIT_MAX),
+                       mstimeout);
+    if (count < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (events == NULL)
+    {
+        return 0;
+    }
+    for (index = 0; index < count; index++)
+    {
+        fd = ev[index].data.fd;
+        events[index].obj = self->fds[fd].obj;
+        events[index].events = 0;
+        /* errors and hangups show up as readable, as with poll() */
+        if (ev[index].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            events[index].events |= REACTOR_READ;
+        }
+        if (ev[index].events & EPOLLOUT)
+        {
+            events[index].events |= REACTOR_WRITE;
+        }
+    }
+    return count;
+#else
+    struct pollfd *pfd;
+    int count;
+    int index;
+    int fd;
+
+    if (mstimeout < 1)
+    {
+        mstimeout = -1;
+    }
+    for (index = 0; index < self->active_count; index++)
+    {
+        fd = self->active[index];
+        pfd = self->pollfd + index;
+        pfd->fd = fd;
+        pfd->events = 0;
+        pfd->revents = 0;
+        if (self->fds[fd].events & REACTOR_READ)
+        {
+            pfd->events |= POLLIN;
+        }
+        if (self->fds[fd].events & REACTOR_WRITE)
+        {
+            pfd->events |= POLLOUT;
+        }
+    }
+    if (poll(self->pollfd, self->active_count, mstimeout) < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (events == NULL)
+    {
+        return 0;
+    }
+    count = 0;
+    for (index = 0; index < self->active_count && count < max_events;
+            index++)
+    {
+        pfd = self->pollfd + index;
+        if (pfd->revents != 0)
+        {
+            events[count].obj = self->fds[pfd->fd].obj;
+            events[count].events = 0;
+            if (pfd->revents & (POLLIN | POLLERR | POLLHUP))
+            {
+                events[count].events |= REACTOR_READ;
+            }
+            if (pfd->revents & POLLOUT)
+            {
+                events[count].events |= REACTOR_WRITE;
+            }
+            count++;
+        }
+    }
+    return count;
+#endif
+}
@@ -0,0 +1,122 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/reactor.h
+ * @brief   Persistent set of wait objects
+ *
+ * A reactor remembers the objects it is waiting on between calls, so
+ * unlike g_obj_wait() the set doesn't have to be passed to the kernel
+ * again for each wait, and there is no limit on its size. On Linux this
+ * is an epoll instance, elsewhere poll() is used.
+ *
+ * Objects are the same as for g_obj_wait(), i.e. sockets, or the values
+ * returned by g_create_wait_obj(). An object is added once when it is
+ * created, changed with reactor_mod() when the events it is waited on
+ * for change, and removed before it is closed.
+ */
+
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#include "arch.h"
+
+/* events for reactor_add() / reactor_mod(), and the events reported
+   by reactor_wait() */
+#define REACTOR_READ 1
+#define REACTOR_WRITE 2
+/* report a change to readable or writeable once, rather than while it
+   lasts. Linux only, elsewhere this is ignored */
+#define REACTOR_EDGE 4
+
+struct reactor;
+
+struct reactor_event
+{
+    tintptr obj;
+    int events; /* REACTOR_READ and / or REACTOR_WRITE */
+};
+
+/**
+ * Create a new reactor
+ *
+ * @return reactor, or NULL on error
+ */
+struct reactor *
+reactor_create(void);
+
+/**
+ * Delete a reactor
+ *
+ * The objects in it are not affected
+ *
+ * @param self reactor to delete (may be NULL)
+ */
+void
+reactor_delete(struct reactor *self);
+
+/**
+ * Start waiting on an object
+ *
+ * An object must be removed with reactor_del() before it is closed.
+ *
+ * @param self reactor
+ * @param obj object to add, which must not already be in the reactor
+ * @param events REACTOR_* flags to wait for
+ * @return 0 for success
+ */
+int
+reactor_add(struct reactor *self, tintptr obj, int events);
+
+/**
+ * Change the events being waited for on an object
+ *
+ * @param self reactor
+ * @param obj object already in the reactor
+ * @param events REACTOR_* flags to wait for
+ * @return 0 for success
+ */
+int
+reactor_mod(struct reactor *self, tintptr obj, int events);
+
+/**
+ * Stop waiting on an object
+ *
+ * @param self reactor
+ * @param obj object in the reactor
+ * @return 0 for success
+ */
+int
+reactor_del(struct reactor *self, tintptr obj);
+
+/**
+ * Wait for at least one object to become readable or writeable
+ *
+ * @param self reactor
+ * @param events Array to receive the ready objects, or NULL if the
+ *               caller will poll its objects itself
+ * @param max_events Number of elements in events
+ * @param mstimeout Timeout in milliseconds. <= 0 means an infinite timeout.
+ * @return Number of entries in events, or -1 for an error. A signal
+ *         interrupting the wait is not an error.
+ */
+int
+reactor_wait(struct reactor *self, struct reactor_event *events,
+             int max_events, int mstimeout);
+
+#endif
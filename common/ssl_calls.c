@@ -40,6 +40,7 @@
 #include "arch.h"
 #include "ssl_calls.h"
 #include "trans.h"
+#include "thread_calls.h"
 #include "log.h"
 
 #define SSL_WANT_READ_WRITE_TIMEOUT 100
@@ -63,8 +64,23 @@ struct ssl_tls
     struct trans *trans;
     tintptr rwo; /* wait obj */
     int error_logged; /* Error has already been logged */
+    int ktls_send; /* the kernel encrypts output */
 };
 
+/* server context built once and shared by connections, so that the
+   certificate is only loaded once and clients can resume sessions */
+struct ssl_shared_ctx
+{
+    SSL_CTX *ctx;
+    char *key;
+    char *cert;
+    long ssl_protocols;
+    char *tls_ciphers;
+};
+
+static struct ssl_shared_ctx g_shared_ctx;
+static tbus g_shared_ctx_mutex;
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 static inline HMAC_CTX *
 HMAC_CTX_new(void)
@@ -81,6 +97,13 @@ HMAC_CTX_free(HMAC_CTX *hmac_ctx)
     g_free(hmac_ctx);
 }
 
+static inline int
+SSL_CTX_up_ref(SSL_CTX *ctx)
+{
+    CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+    return 1;
+}
+
 static inline void
 RSA_get0_key(const RSA *key, const BIGNUM **n, const BIGNUM **e,
              const BIGNUM **d)
@@ -161,6 +184,7 @@ ssl_init(void)
 {
     SSL_load_error_strings();
     SSL_library_init();
+    g_shared_ctx_mutex = tc_mutex_create();
 
     return 0;
 }
@@ -169,6 +193,9 @@ ssl_init(void)
 int
 ssl_finish(void)
 {
+    ssl_tls_ctx_free();
+    tc_mutex_delete(g_shared_ctx_mutex);
+    g_shared_ctx_mutex = 0;
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
     /* De-allocate any allocated globals
      * For OpenSSL 3, these can all safely be passed a NULL pointer */
@@ -1023,12 +1050,13 @@ log_encrypted_file_unsupported(char *buf, int size, int rwflag, void *u)
 }
 
 /*****************************************************************************/
-
-int
-ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
+/* returns a server context with the certificate loaded, or NULL on an
+   error, which has been logged */
+static SSL_CTX *
+ssl_ctx_create(const char *key, const char *cert, long ssl_protocols,
                const char *tls_ciphers)
 {
-    int connection_status;
+    SSL_CTX *ctx;
     long options = 0;
 
     ERR_clear_error();
@@ -1074,19 +1102,19 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
      */
     options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
 
-    self->ctx = SSL_CTX_new(SSLv23_server_method());
-    if (self->ctx == NULL)
+    ctx = SSL_CTX_new(SSLv23_server_method());
+    if (ctx == NULL)
     {
         LOG(LOG_LEVEL_ERROR, "Unable to negotiate a TLS connection with the client");
-        dump_ssl_error_stack(self);
-        return 1;
+        dump_error_stack("SSL");
+        return NULL;
     }
 
     /* set context options */
-    SSL_CTX_set_mode(self->ctx,
+    SSL_CTX_set_mode(ctx,
                      SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
                      SSL_MODE_ENABLE_PARTIAL_WRITE);
-    SSL_CTX_set_options(self->ctx, options);
+    SSL_CTX_set_options(ctx, options);
 
     /* set DH parameters */
 #if OPENSSL_VERSION_NUMBER < 0x30000000L
@@ -1094,26 +1122,30 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
     if (dh == NULL)
     {
         LOG(LOG_LEVEL_ERROR, "Unable to generate DHE parameters for TLS");
-        return 1;
+        SSL_CTX_free(ctx);
+        return NULL;
     }
 
-    if (SSL_CTX_set_tmp_dh(self->ctx, dh) != 1)
+    if (SSL_CTX_set_tmp_dh(ctx, dh) != 1)
     {
         LOG(LOG_LEVEL_ERROR, "Unable to setup DHE parameters for TLS");
-        dump_ssl_error_stack(self);
-        return 1;
+        dump_error_stack("SSL");
+        DH_free(dh);
+        SSL_CTX_free(ctx);
+        return NULL;
     }
     DH_free(dh); // ok to free, copied into ctx by SSL_CTX_set_tmp_dh()
 #else
-    if (!SSL_CTX_set_dh_auto(self->ctx, 1))
+    if (!SSL_CTX_set_dh_auto(ctx, 1))
     {
         LOG(LOG_LEVEL_ERROR, "TLS DHE auto failed to be enabled");
-        dump_ssl_error_stack(self);
-        return 1;
+        dump_error_stack("SSL");
+        SSL_CTX_free(ctx);
+        return NULL;
     }
 #endif
 #if defined(SSL_CTX_set_ecdh_auto)
-    if (!SSL_CTX_set_ecdh_auto(self->ctx, 1))
+    if (!SSL_CTX_set_ecdh_auto(ctx, 1))
     {
         LOG(LOG_LEVEL_WARNING, "TLS ecdh auto failed to be enabled");
     }
@@ -1122,37 +1154,45 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
     if (g_strlen(tls_ciphers) > 1)
     {
         LOG(LOG_LEVEL_TRACE, "tls_ciphers=%s", tls_ciphers);
-        if (SSL_CTX_set_cipher_list(self->ctx, tls_ciphers) == 0)
+        if (SSL_CTX_set_cipher_list(ctx, tls_ciphers) == 0)
         {
             LOG(LOG_LEVEL_ERROR, "Invalid TLS cipher options %s", tls_ciphers);
-            dump_ssl_error_stack(self);
-            return 1;
+            dump_error_stack("SSL");
+            SSL_CTX_free(ctx);
+            return NULL;
         }
     }
 
-    SSL_CTX_set_read_ahead(self->ctx, 0);
+    SSL_CTX_set_read_ahead(ctx, 0);
+
+    /* a client which reconnects can resume its session, from the
+       session cache or with a ticket, instead of a full handshake */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "xrdp", 4);
 
     /*
      * We don't currently handle encrypted private keys - set a callback
      * to tell the user if one is provided */
-    SSL_CTX_set_default_passwd_cb(self->ctx, log_encrypted_file_unsupported);
-    SSL_CTX_set_default_passwd_cb_userdata(self->ctx, self->key);
+    SSL_CTX_set_default_passwd_cb(ctx, log_encrypted_file_unsupported);
+    SSL_CTX_set_default_passwd_cb_userdata(ctx, (void *) key);
 
-    if (SSL_CTX_use_PrivateKey_file(self->ctx, self->key, SSL_FILETYPE_PEM)
+    if (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM)
             <= 0)
     {
-        LOG(LOG_LEVEL_ERROR, "Error loading TLS private key from %s", self->key);
-        dump_ssl_error_stack(self);
-        return 1;
+        LOG(LOG_LEVEL_ERROR, "Error loading TLS private key from %s", key);
+        dump_error_stack("SSL");
+        SSL_CTX_free(ctx);
+        return NULL;
     }
-    SSL_CTX_set_default_passwd_cb(self->ctx, NULL);
-    SSL_CTX_set_default_passwd_cb_userdata(self->ctx, NULL);
+    SSL_CTX_set_default_passwd_cb(ctx, NULL);
+    SSL_CTX_set_default_passwd_cb_userdata(ctx, NULL);
 
-    if (SSL_CTX_use_certificate_chain_file(self->ctx, self->cert) <= 0)
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) <= 0)
     {
-        LOG(LOG_LEVEL_ERROR, "Error loading TLS certificate chain from %s", self->cert);
-        dump_ssl_error_stack(self);
-        return 1;
+        LOG(LOG_LEVEL_ERROR, "Error loading TLS certificate chain from %s", cert);
+        dump_error_stack("SSL");
+        SSL_CTX_free(ctx);
+        return NULL;
     }
 
     /*
@@ -1160,15 +1200,124 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
      * certificate chains are not handled in the same way - see
      * SSL_CTX_check_private_key(3ssl) */
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L
-    if (!SSL_CTX_check_private_key(self->ctx))
+    if (!SSL_CTX_check_private_key(ctx))
     {
         LOG(LOG_LEVEL_ERROR, "Private key %s and certificate %s do not match",
-            self->key, self->cert);
-        dump_ssl_error_stack(self);
-        return 1;
+            key, cert);
+        dump_error_stack("SSL");
+        SSL_CTX_free(ctx);
+        return NULL;
     }
 #endif
 
+    return ctx;
+}
+
+/*****************************************************************************/
+static int
+ssl_str_eq(const char *s1, const char *s2)
+{
+    return g_strcmp(s1 == NULL ? "" : s1, s2 == NULL ? "" : s2) == 0;
+}
+
+/*****************************************************************************/
+/* returns a reference to the shared context if it was built with these
+   settings, else NULL */
+static SSL_CTX *
+ssl_shared_ctx_get(const char *key, const char *cert, long ssl_protocols,
+                   const char *tls_ciphers)
+{
+    SSL_CTX *ctx;
+
+    ctx = NULL;
+    if (g_shared_ctx_mutex == 0)
+    {
+        return NULL;
+    }
+    tc_mutex_lock(g_shared_ctx_mutex);
+    if (g_shared_ctx.ctx != NULL &&
+            ssl_str_eq(key, g_shared_ctx.key) &&
+            ssl_str_eq(cert, g_shared_ctx.cert) &&
+            ssl_protocols == g_shared_ctx.ssl_protocols &&
+            ssl_str_eq(tls_ciphers, g_shared_ctx.tls_ciphers) &&
+            SSL_CTX_up_ref(g_shared_ctx.ctx))
+    {
+        ctx = g_shared_ctx.ctx;
+    }
+    tc_mutex_unlock(g_shared_ctx_mutex);
+    return ctx;
+}
+
+/*****************************************************************************/
+int
+ssl_tls_ctx_load(const char *key, const char *cert, long ssl_protocols,
+                 const char *tls_ciphers)
+{
+    SSL_CTX *ctx;
+
+    if (g_shared_ctx_mutex == 0)
+    {
+        return 1;
+    }
+    ctx = ssl_ctx_create(key, cert, ssl_protocols, tls_ciphers);
+    if (ctx == NULL)
+    {
+        /* anything loaded before stays in use */
+        return 1;
+    }
+    tc_mutex_lock(g_shared_ctx_mutex);
+    /* connections using the old one hold their own reference */
+    SSL_CTX_free(g_shared_ctx.ctx);
+    g_free(g_shared_ctx.key);
+    g_free(g_shared_ctx.cert);
+    g_free(g_shared_ctx.tls_ciphers);
+    g_shared_ctx.ctx = ctx;
+    g_shared_ctx.key = g_strdup(key);
+    g_shared_ctx.cert = g_strdup(cert);
+    g_shared_ctx.ssl_protocols = ssl_protocols;
+    g_shared_ctx.tls_ciphers = g_strdup(tls_ciphers);
+    tc_mutex_unlock(g_shared_ctx_mutex);
+    LOG(LOG_LEVEL_INFO, "Loaded TLS certificate %s", cert);
+    return 0;
+}
+
+/*****************************************************************************/
+void
+ssl_tls_ctx_free(void)
+{
+    if (g_shared_ctx_mutex == 0)
+    {
+        return;
+    }
+    tc_mutex_lock(g_shared_ctx_mutex);
+    SSL_CTX_free(g_shared_ctx.ctx);
+    g_free(g_shared_ctx.key);
+    g_free(g_shared_ctx.cert);
+    g_free(g_shared_ctx.tls_ciphers);
+    g_memset(&g_shared_ctx, 0, sizeof(g_shared_ctx));
+    tc_mutex_unlock(g_shared_ctx_mutex);
+}
+
+/*****************************************************************************/
+int
+ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
+               const char *tls_ciphers, int ktls)
+{
+    int connection_status;
+
+    self->ctx = ssl_shared_ctx_get(self->key, self->cert, ssl_protocols,
+                                   tls_ciphers);
+    if (self->ctx == NULL)
+    {
+        self->ctx = ssl_ctx_create(self->key, self->cert, ssl_protocols,
+                                   tls_ciphers);
+        if (self->ctx == NULL)
+        {
+            self->error_logged = 1;
+            return 1;
+        }
+    }
+
     self->ssl = SSL_new(self->ctx);
 
     if (self->ssl == NULL)
@@ -1186,6 +1335,15 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
         return 1;
     }
 
+#if defined(SSL_OP_ENABLE_KTLS)
+    if (ktls)
+    {
+        /* OpenSSL falls back to user space encryption by itself if
+           the kernel or the cipher can't do it */
+        SSL_set_options(self->ssl, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
     while (1)
     {
         /*
@@ -1225,9 +1383,33 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
 
     LOG(LOG_LEVEL_TRACE, "TLS connection accepted");
 
+    if (ktls)
+    {
+#if defined(SSL_OP_ENABLE_KTLS)
+        self->ktls_send = BIO_get_ktls_send(SSL_get_wbio(self->ssl));
+#endif
+        if (self->ktls_send)
+        {
+            LOG(LOG_LEVEL_INFO, "TLS output is encrypted by the kernel");
+        }
+        else
+        {
+            LOG(LOG_LEVEL_INFO, "Kernel TLS is not available for %s with "
+                "cipher %s, TLS output is encrypted by OpenSSL",
+                SSL_get_version(self->ssl), SSL_get_cipher_name(self->ssl));
+        }
+    }
+
     return 0;
 }
 
+/*****************************************************************************/
+int
+ssl_tls_ktls_send(const struct ssl_tls *self)
+{
+    return self->ktls_send;
+}
+
 /*****************************************************************************/
 /* returns error, */
 int
@@ -88,9 +88,37 @@ ssl_gen_key_xrdp1(int key_size_in_bits, const char *exp, int exp_len,
 /* xrdp_tls.c */
 struct ssl_tls *
 ssl_tls_create(struct trans *trans, const char *key, const char *cert);
+/**
+ * Builds the TLS server context shared by later connections
+ *
+ * @param key Private key file
+ * @param cert Certificate chain file
+ * @param ssl_protocols Protocols to disable, see
+ *                      ssl_get_protocols_from_string()
+ * @param tls_ciphers Cipher list, or empty for the default
+ * @return 0 for success
+ *
+ * Connections accepted with the same settings use this context rather
+ * than loading the certificate again, and clients can resume earlier
+ * sessions. Calling this again replaces the context; on failure the
+ * previous one stays in use.
+ */
+int
+ssl_tls_ctx_load(const char *key, const char *cert, long ssl_protocols,
+                 const char *tls_ciphers);
+void
+ssl_tls_ctx_free(void);
 int
 ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
-               const char *tls_ciphers);
+               const char *tls_ciphers, int ktls);
+/**
+ * Is the kernel encrypting output (kTLS)?
+ *
+ * If so, plain socket writes are sent as TLS application data and
+ * need not go through ssl_tls_write()
+ */
+int
+ssl_tls_ktls_send(const struct ssl_tls *self);
 int
 ssl_tls_disconnect(struct ssl_tls *self);
 void
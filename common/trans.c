@@ -25,13 +25,25 @@
 #include "os_calls.h"
 #include "string_calls.h"
 #include "trans.h"
+#include "reactor.h"
 #include "arch.h"
 #include "parse.h"
 #include "ssl_calls.h"
 #include "log.h"
+#include "defines.h"
 
 #define MAX_SBYTES 0
 
+/** Most queued streams handed to one send call */
+#define TRANS_SEND_VEC_MAX 16
+/** Small TLS writes are joined up to this size, one TLS record */
+#define TRANS_TLS_BATCH_BYTES (16 * 1024)
+/** While corked, output is held back until this much is waiting, and
+    queued in streams this big, one full TLS record */
+#define TRANS_CORK_BYTES (16 * 1024)
+/** Queued streams this big are sent with MSG_ZEROCOPY, if set up */
+#define TRANS_ZEROCOPY_BYTES (32 * 1024)
+
 /** Time between polls of is_term when connecting */
 #define CONNECT_TERM_POLL_MS 3000
 /** Time we wait before another connect() attempt if one fails immediately */
@@ -59,6 +71,35 @@ trans_tls_send(struct trans *self, const char *data, int len)
     return ssl_tls_write(self->tls, data, len);
 }
 
+/*****************************************************************************/
+/* joins small buffers so they go out in one TLS record */
+int
+trans_tls_send_vec(struct trans *self, const char *const bufs[],
+                   const int lens[], int count)
+{
+    char batch[TRANS_TLS_BATCH_BYTES];
+    int index;
+    int bytes;
+    int len;
+
+    if (self->tls == NULL)
+    {
+        return 1;
+    }
+    if (count < 2 || lens[0] >= TRANS_TLS_BATCH_BYTES / 2)
+    {
+        return ssl_tls_write(self->tls, bufs[0], lens[0]);
+    }
+    bytes = 0;
+    for (index = 0; index < count && bytes < TRANS_TLS_BATCH_BYTES; index++)
+    {
+        len = MIN(lens[index], TRANS_TLS_BATCH_BYTES - bytes);
+        g_memcpy(batch + bytes, bufs[index], len);
+        bytes += len;
+    }
+    return ssl_tls_write(self->tls, batch, bytes);
+}
+
 /*****************************************************************************/
 int
 trans_tls_can_recv(struct trans *self, int sck, int millis)
@@ -84,6 +125,14 @@ trans_tcp_send(struct trans *self, const char *data, int len)
     return g_tcp_send(self->sck, data, len, 0);
 }
 
+/*****************************************************************************/
+int
+trans_tcp_send_vec(struct trans *self, const char *const bufs[],
+                   const int lens[], int count)
+{
+    return g_sck_send_vec(self->sck, bufs, lens, count);
+}
+
 /*****************************************************************************/
 int
 trans_tcp_can_recv(struct trans *self, int sck, int millis)
@@ -91,6 +140,145 @@ trans_tcp_can_recv(struct trans *self, int sck, int millis)
     return g_sck_can_recv(sck, millis);
 }
 
+/*****************************************************************************/
+/* registers obj in place of the object registered before, calling the
+   reactor only when something has changed
+   returns error */
+static int
+trans_reactor_set(struct reactor *reactor, tbus *reg_obj, int *reg_events,
+                  tbus obj, int events)
+{
+    int rv;
+
+    if (obj <= 0)
+    {
+        events = 0;
+    }
+    if (*reg_events != 0 && (*reg_obj != obj || events == 0))
+    {
+        reactor_del(reactor, *reg_obj);
+        *reg_events = 0;
+    }
+    rv = 0;
+    if (events != *reg_events)
+    {
+        if (*reg_events == 0)
+        {
+            rv = reactor_add(reactor, obj, events);
+        }
+        else
+        {
+            rv = reactor_mod(reactor, obj, events);
+        }
+        if (rv == 0)
+        {
+            *reg_obj = obj;
+            *reg_events = events;
+        }
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+/* returns the events the socket is waited on for in the reactor, as
+   trans_get_wait_objs_rw() */
+static int
+trans_reactor_events(struct trans *self)
+{
+    int events;
+
+    if (self->status != TRANS_STATUS_UP)
+    {
+        return 0;
+    }
+    if (self->type1 == TRANS_TYPE_LISTENER)
+    {
+        return REACTOR_READ;
+    }
+    events = 0;
+    if (self->si == 0 || self->si->source[self->my_source] <= MAX_SBYTES)
+    {
+        events |= REACTOR_READ;
+    }
+    if (self->wait_s != 0 || self->send_lowat_wait)
+    {
+        events |= REACTOR_WRITE;
+    }
+    return events;
+}
+
+/*****************************************************************************/
+/* brings the registration in the reactor up to date with the state of
+   the transport
+   returns error */
+static int
+trans_reactor_update(struct trans *self)
+{
+    int events;
+    int rv;
+    tbus rwo;
+
+    if (self->reactor == NULL)
+    {
+        return 0;
+    }
+    if (self->si != 0 && self->my_source != XRDP_SOURCE_NONE)
+    {
+        self->si->source_trans[self->my_source] = self;
+    }
+    events = trans_reactor_events(self);
+    rv = trans_reactor_set(self->reactor, &self->reactor_sck,
+                           &self->reactor_sck_events, self->sck, events);
+    /* input already decrypted, only read along with the socket */
+    rwo = (self->tls != NULL) ? ssl_get_rwo(self->tls) : 0;
+    rv |= trans_reactor_set(self->reactor, &self->reactor_rwo,
+                            &self->reactor_rwo_events, rwo,
+                            events & REACTOR_READ);
+    return rv;
+}
+
+/*****************************************************************************/
+/* takes everything out of the reactor, before it is closed */
+static void
+trans_reactor_remove(struct trans *self)
+{
+    if (self->reactor == NULL)
+    {
+        return;
+    }
+    trans_reactor_set(self->reactor, &self->reactor_sck,
+                      &self->reactor_sck_events, 0, 0);
+    trans_reactor_set(self->reactor, &self->reactor_rwo,
+                      &self->reactor_rwo_events, 0, 0);
+    if (self->si != 0 && self->si->source_trans[self->my_source] == self)
+    {
+        self->si->source_trans[self->my_source] = 0;
+    }
+}
+
+/*****************************************************************************/
+/* the count for a source has gone past MAX_SBYTES one way or the other,
+   so the transport reading from it starts or stops waiting for input */
+static void
+trans_source_changed(struct source_info *si, const int *source)
+{
+    struct trans *trans;
+
+    trans = si->source_trans[source - si->source];
+    if (trans != 0)
+    {
+        trans_reactor_update(trans);
+    }
+}
+
+/*****************************************************************************/
+static void
+trans_set_down(struct trans *self)
+{
+    self->status = TRANS_STATUS_DOWN;
+    trans_reactor_update(self);
+}
+
 /*****************************************************************************/
 struct trans *
 trans_create(int mode, int in_size, int out_size)
@@ -111,6 +299,7 @@ trans_create(int mode, int in_size, int out_size)
         /* assign tcp calls by default */
         self->trans_recv = trans_tcp_recv;
         self->trans_send = trans_tcp_send;
+        self->trans_send_vec = trans_tcp_send_vec;
         self->trans_can_recv = trans_tcp_can_recv;
     }
 
@@ -121,11 +310,15 @@ trans_create(int mode, int in_size, int out_size)
 void
 trans_delete(struct trans *self)
 {
+    struct stream *temp_s;
+
     if (self == 0)
     {
         return;
     }
 
+    trans_reactor_remove(self);
+
     /* Call the user-specified destructor if one exists */
     if (self->extra_destructor != NULL)
     {
@@ -135,6 +328,20 @@ trans_delete(struct trans *self)
     free_stream(self->in_s);
     free_stream(self->out_s);
 
+    while (self->wait_s != 0)
+    {
+        temp_s = self->wait_s;
+        self->wait_s = temp_s->next;
+        free_stream(temp_s);
+    }
+    while (self->zc_s != 0)
+    {
+        temp_s = self->zc_s;
+        self->zc_s = temp_s->next;
+        free_stream(temp_s);
+    }
+    g_free(self->read_ahead);
+
     if (self->sck >= 0)
     {
         g_tcp_close(self->sck);
@@ -171,6 +378,9 @@ trans_delete_from_child(struct trans *self)
         self->listen_filename = 0;
     }
 
+    /* the reactor is shared with the parent, leave it alone */
+    self->reactor = 0;
+
     trans_delete(self);
 }
 
@@ -225,7 +435,7 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
         }
     }
 
-    if (self->wait_s != 0)
+    if (self->wait_s != 0 || self->send_lowat_wait)
     {
         wobjs[*wcount] = self->sck;
         (*wcount)++;
@@ -235,71 +445,403 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
 }
 
 /*****************************************************************************/
-int
-trans_send_waiting(struct trans *self, int block)
+/* drop bytes that have been sent from the front of the wait queue */
+static void
+trans_wait_s_consume(struct trans *self, int bytes)
+{
+    struct stream *temp_s;
+    int len;
+
+    while (bytes > 0 && self->wait_s != 0)
+    {
+        temp_s = self->wait_s;
+        len = MIN(bytes, (int) (temp_s->end - temp_s->p));
+        temp_s->p += len;
+        self->wait_bytes -= len;
+        if (temp_s->source != 0)
+        {
+            temp_s->source[0] -= len;
+            if (self->si != 0 && temp_s->source[0] <= MAX_SBYTES &&
+                    temp_s->source[0] + len > MAX_SBYTES)
+            {
+                trans_source_changed(self->si, temp_s->source);
+            }
+        }
+        bytes -= len;
+        if (temp_s->p >= temp_s->end)
+        {
+            self->wait_s = temp_s->next;
+            if (self->wait_s == 0)
+            {
+                self->wait_s_tail = 0;
+            }
+            if (self->zc_front && self->zc_sent != self->zc_done)
+            {
+                /* the kernel may still be reading it */
+                temp_s->next = self->zc_s;
+                self->zc_s = temp_s;
+            }
+            else
+            {
+                free_stream(temp_s);
+            }
+            self->zc_front = 0;
+        }
+    }
+    trans_reactor_update(self);
+}
+
+/*****************************************************************************/
+/* free output sent with MSG_ZEROCOPY once the kernel is done with it */
+static void
+trans_zerocopy_reap(struct trans *self)
+{
+    struct stream *temp_s;
+    int copied;
+
+    if (self->zc_sent == self->zc_done)
+    {
+        return;
+    }
+    copied = 0;
+    if (g_sck_zerocopy_done(self->sck, &self->zc_done, &copied) > 0 &&
+            copied && self->zerocopy)
+    {
+        LOG(LOG_LEVEL_DEBUG, "trans_zerocopy_reap: the kernel copied "
+            "anyway, not using MSG_ZEROCOPY");
+        self->zerocopy = 0;
+    }
+    if (self->zc_sent == self->zc_done)
+    {
+        while (self->zc_s != 0)
+        {
+            temp_s = self->zc_s;
+            self->zc_s = temp_s->next;
+            free_stream(temp_s);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* send the front of the wait queue with MSG_ZEROCOPY
+   returns bytes sent, 0 if nothing was, or -1 on error */
+static int
+trans_send_zerocopy(struct trans *self)
 {
     struct stream *temp_s;
-    int bytes;
     int sent;
+
+    temp_s = self->wait_s;
+    sent = g_sck_send_zerocopy(self->sck, temp_s->p,
+                               (int) (temp_s->end - temp_s->p));
+    if (sent == 0)
+    {
+        return -1;
+    }
+    if (sent < 0)
+    {
+        if (g_tcp_last_error_would_block(self->sck))
+        {
+            return 0;
+        }
+        /* e.g. ENOBUFS with too many sends in flight, copy instead */
+        LOG(LOG_LEVEL_DEBUG, "trans_send_zerocopy: send failed, not "
+            "using MSG_ZEROCOPY");
+        self->zerocopy = 0;
+        return 0;
+    }
+    self->zc_sent++;
+    self->zc_front = 1;
+    trans_wait_s_consume(self, sent);
+    return sent;
+}
+
+/*****************************************************************************/
+/* send the front of the wait queue with one call, followed by extra_data
+   if all the queue fits in that call
+   returns the number of bytes of extra_data sent or -1 on error */
+static int
+trans_send_queue(struct trans *self, const char *extra_data, int extra_len)
+{
+    const char *bufs[TRANS_SEND_VEC_MAX];
+    int lens[TRANS_SEND_VEC_MAX];
+    struct stream *temp_s;
+    int count;
+    int queued;
+    int sent;
+
+    trans_zerocopy_reap(self);
+    if (self->zerocopy && self->wait_s != 0 &&
+            self->wait_s->end - self->wait_s->p >= TRANS_ZEROCOPY_BYTES)
+    {
+        sent = trans_send_zerocopy(self);
+        if (sent != 0 || self->zerocopy)
+        {
+            return sent < 0 ? -1 : 0;
+        }
+    }
+    count = 0;
+    queued = 0;
+    temp_s = self->wait_s;
+    while (temp_s != 0 && count < TRANS_SEND_VEC_MAX)
+    {
+        bufs[count] = temp_s->p;
+        lens[count] = (int) (temp_s->end - temp_s->p);
+        queued += lens[count];
+        count++;
+        temp_s = temp_s->next;
+    }
+    if (temp_s == 0 && extra_len > 0 && count < TRANS_SEND_VEC_MAX)
+    {
+        bufs[count] = extra_data;
+        lens[count] = extra_len;
+        count++;
+    }
+    if (count < 1)
+    {
+        return 0;
+    }
+    if (count == 1 || self->trans_send_vec == 0)
+    {
+        sent = self->trans_send(self, bufs[0], lens[0]);
+    }
+    else
+    {
+        sent = self->trans_send_vec(self, bufs, lens, count);
+    }
+    if (sent == 0)
+    {
+        return -1;
+    }
+    if (sent < 0)
+    {
+        return g_tcp_last_error_would_block(self->sck) ? 0 : -1;
+    }
+    trans_wait_s_consume(self, MIN(sent, queued));
+    return sent > queued ? sent - queued : 0;
+}
+
+/*****************************************************************************/
+int
+trans_set_reactor(struct trans *self, struct reactor *reactor)
+{
+    trans_reactor_remove(self);
+    self->reactor = reactor;
+    return trans_reactor_update(self);
+}
+
+/*****************************************************************************/
+int
+trans_send_waiting(struct trans *self, int block)
+{
     int timeout;
-    int cont;
 
     timeout = block ? 100 : 0;
-    cont = 1;
-    while (cont)
+    while (self->wait_s != 0)
     {
-        if (self->wait_s != 0)
+        if (g_tcp_can_send(self->sck, timeout))
+        {
+            if (trans_send_queue(self, 0, 0) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (block)
         {
-            temp_s = self->wait_s;
-            if (g_tcp_can_send(self->sck, timeout))
+            /* check for term here */
+            if (self->is_term != 0)
             {
-                bytes = (int) (temp_s->end - temp_s->p);
-                sent = self->trans_send(self, temp_s->p, bytes);
-                if (sent > 0)
+                if (self->is_term())
                 {
-                    temp_s->p += sent;
-                    if (temp_s->source != 0)
-                    {
-                        temp_s->source[0] -= sent;
-                    }
-                    if (temp_s->p >= temp_s->end)
-                    {
-                        self->wait_s = temp_s->next;
-                        free_stream(temp_s);
-                    }
+                    /* term */
+                    return 1;
                 }
-                else if (sent == 0)
+            }
+        }
+        if (!block)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_is_congested(struct trans *self)
+{
+    if (self->wait_bytes_max > 0 &&
+            self->wait_bytes > self->wait_bytes_max / 2)
+    {
+        return 1;
+    }
+    if (!self->send_lowat)
+    {
+        return 0;
+    }
+    if (self->wait_s != 0 && !self->corked)
+    {
+        /* already waiting to write */
+        return 1;
+    }
+    /* the kernel only reports the socket writeable once most of what it
+       holds has gone, so output waits for that rather than queueing */
+    self->send_lowat_wait = !g_sck_can_send(self->sck, 0);
+    trans_reactor_update(self);
+    return self->send_lowat_wait;
+}
+
+/*****************************************************************************/
+int
+trans_input_pending(struct trans *self)
+{
+    if (self->status != TRANS_STATUS_UP)
+    {
+        return 0;
+    }
+    if (self->read_ahead_end > self->read_ahead_start)
+    {
+        return 1;
+    }
+    return self->trans_can_recv(self, self->sck, 0);
+}
+
+/*****************************************************************************/
+int
+trans_set_read_ahead(struct trans *self, int bytes)
+{
+    char *read_ahead;
+
+    if (self->read_ahead_end > self->read_ahead_start)
+    {
+        /* would lose what is buffered */
+        return 1;
+    }
+    read_ahead = (char *) g_malloc(bytes, 0);
+    if (read_ahead == NULL)
+    {
+        return 1;
+    }
+    g_free(self->read_ahead);
+    self->read_ahead = read_ahead;
+    self->read_ahead_size = bytes;
+    self->read_ahead_start = 0;
+    self->read_ahead_end = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+/* read up to len bytes, from the read ahead buffer if there is anything
+   in it, else from the transport. Short reads fill the read ahead buffer
+   first so later PDUs are already there.
+   returns as trans_recv */
+static int
+trans_read(struct trans *self, char *ptr, int len)
+{
+    int bytes;
+
+    bytes = self->read_ahead_end - self->read_ahead_start;
+    if (bytes == 0 && len < self->read_ahead_size)
+    {
+        bytes = self->trans_recv(self, self->read_ahead,
+                                 self->read_ahead_size);
+        if (bytes < 1)
+        {
+            return bytes;
+        }
+        self->read_ahead_start = 0;
+        self->read_ahead_end = bytes;
+    }
+    if (bytes == 0)
+    {
+        return self->trans_recv(self, ptr, len);
+    }
+    bytes = MIN(bytes, len);
+    g_memcpy(ptr, self->read_ahead + self->read_ahead_start, bytes);
+    self->read_ahead_start += bytes;
+    return bytes;
+}
+
+/*****************************************************************************/
+/* read towards header_size bytes in in_s, handing each complete PDU to
+   trans_data_in, for as long as the read ahead buffer has more
+   returns error */
+static int
+trans_read_pdus(struct trans *self)
+{
+    int read_bytes;
+    unsigned int to_read;
+    unsigned int read_so_far;
+    int rv;
+    int cont;
+
+    rv = 0;
+    cont = 1;
+    while (cont)
+    {
+        cont = 0;
+        /* CVE-2022-23479 - check a malicious caller hasn't managed
+         * to set the header_size to an unreasonable value */
+        if (self->header_size > (unsigned int)self->in_s->size)
+        {
+            LOG(LOG_LEVEL_ERROR,
+                "trans_check_wait_objs: Reading %u bytes beyond buffer",
+                self->header_size - (unsigned int)self->in_s->size);
+            trans_set_down(self);
+            return 1;
+        }
+
+        read_so_far = self->in_s->end - self->in_s->data;
+        to_read = self->header_size - read_so_far;
+
+        if (to_read > 0)
+        {
+            read_bytes = trans_read(self, self->in_s->end, to_read);
+
+            if (read_bytes == -1)
+            {
+                if (g_tcp_last_error_would_block(self->sck))
                 {
-                    return 1;
+                    /* ok, but shouldn't happen */
                 }
                 else
                 {
-                    if (!g_tcp_last_error_would_block(self->sck))
-                    {
-                        return 1;
-                    }
+                    /* error */
+                    trans_set_down(self);
+                    return 1;
                 }
             }
-            else if (block)
+            else if (read_bytes == 0)
             {
-                /* check for term here */
-                if (self->is_term != 0)
-                {
-                    if (self->is_term())
-                    {
-                        /* term */
-                        return 1;
-                    }
-                }
+                /* error */
+                trans_set_down(self);
+                return 1;
+            }
+            else
+            {
+                self->in_s->end += read_bytes;
             }
         }
-        else
+
+        read_so_far = self->in_s->end - self->in_s->data;
+
+        if (read_so_far == self->header_size)
         {
-            break;
+            if (self->trans_data_in != 0)
+            {
+                rv = self->trans_data_in(self);
+                if (self->no_stream_init_on_data_in == 0)
+                {
+                    init_stream(self->in_s, 0);
+                }
+            }
         }
-        cont = block;
+        /* carry on while the next PDU may already be here */
+        cont = rv == 0 && self->status == TRANS_STATUS_UP &&
+               self->header_size > 0 &&
+               self->read_ahead_end > self->read_ahead_start;
     }
-    return 0;
+    return rv;
 }
 
 /*****************************************************************************/
@@ -308,9 +850,6 @@ trans_check_wait_objs(struct trans *self)
 {
     tbus in_sck = (tbus) 0;
     struct trans *in_trans = (struct trans *) NULL;
-    int read_bytes = 0;
-    unsigned int to_read = 0;
-    unsigned int read_so_far = 0;
     int rv = 0;
     enum xrdp_source cur_source;
 
@@ -340,7 +879,7 @@ trans_check_wait_objs(struct trans *self)
                 else
                 {
                     /* error */
-                    self->status = TRANS_STATUS_DOWN;
+                    trans_set_down(self);
                     return 1;
                 }
             }
@@ -355,12 +894,17 @@ trans_check_wait_objs(struct trans *self)
                     in_trans->type1 = TRANS_TYPE_SERVER;
                     in_trans->status = TRANS_STATUS_UP;
                     in_trans->is_term = self->is_term;
+                    in_trans->reactor = self->reactor;
                     g_file_set_cloexec(in_sck, 1);
                     g_sck_set_non_blocking(in_sck);
                     if (self->trans_conn_in(self, in_trans) != 0)
                     {
                         trans_delete(in_trans);
                     }
+                    else
+                    {
+                        trans_reactor_update(in_trans);
+                    }
                 }
                 else
                 {
@@ -376,92 +920,75 @@ trans_check_wait_objs(struct trans *self)
         }
         else if (self->trans_can_recv(self, self->sck, 0))
         {
-            /* CVE-2022-23479 - check a malicious caller hasn't managed
-             * to set the header_size to an unreasonable value */
-            if (self->header_size > (unsigned int)self->in_s->size)
-            {
-                LOG(LOG_LEVEL_ERROR,
-                    "trans_check_wait_objs: Reading %u bytes beyond buffer",
-                    self->header_size - (unsigned int)self->in_s->size);
-                self->status = TRANS_STATUS_DOWN;
-                return 1;
-            }
-
             cur_source = XRDP_SOURCE_NONE;
             if (self->si != 0)
             {
                 cur_source = self->si->cur_source;
                 self->si->cur_source = self->my_source;
             }
-            read_so_far = self->in_s->end - self->in_s->data;
-            to_read = self->header_size - read_so_far;
-
-            if (to_read > 0)
-            {
-                read_bytes = self->trans_recv(self, self->in_s->end, to_read);
-
-                if (read_bytes == -1)
-                {
-                    if (g_tcp_last_error_would_block(self->sck))
-                    {
-                        /* ok, but shouldn't happen */
-                    }
-                    else
-                    {
-                        /* error */
-                        self->status = TRANS_STATUS_DOWN;
-                        if (self->si != 0)
-                        {
-                            self->si->cur_source = cur_source;
-                        }
-                        return 1;
-                    }
-                }
-                else if (read_bytes == 0)
-                {
-                    /* error */
-                    self->status = TRANS_STATUS_DOWN;
-                    if (self->si != 0)
-                    {
-                        self->si->cur_source = cur_source;
-                    }
-                    return 1;
-                }
-                else
-                {
-                    self->in_s->end += read_bytes;
-                }
-            }
-
-            read_so_far = self->in_s->end - self->in_s->data;
-
-            if (read_so_far == self->header_size)
-            {
-                if (self->trans_data_in != 0)
-                {
-                    rv = self->trans_data_in(self);
-                    if (self->no_stream_init_on_data_in == 0)
-                    {
-                        init_stream(self->in_s, 0);
-                    }
-                }
-            }
+            rv = trans_read_pdus(self);
             if (self->si != 0)
             {
                 self->si->cur_source = cur_source;
             }
+            if (self->status != TRANS_STATUS_UP)
+            {
+                return 1;
+            }
         }
+        trans_zerocopy_reap(self);
         if (trans_send_waiting(self, 0) != 0)
         {
             /* error */
-            self->status = TRANS_STATUS_DOWN;
+            trans_set_down(self);
             return 1;
         }
+        if (self->send_lowat_wait && self->wait_s == 0 &&
+                g_sck_can_send(self->sck, 0))
+        {
+            self->send_lowat_wait = 0;
+        }
+        trans_reactor_update(self);
     }
 
     return rv;
 }
 
+/*****************************************************************************/
+int
+trans_set_corked(struct trans *self, int corked)
+{
+    self->corked = corked;
+    if (corked || self->status != TRANS_STATUS_UP)
+    {
+        return 0;
+    }
+    /* whatever the socket will take now, the rest goes as it drains */
+    if (trans_send_waiting(self, 0) != 0)
+    {
+        trans_set_down(self);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_set_zerocopy(struct trans *self)
+{
+    if (self->mode != TRANS_MODE_TCP && self->mode != TRANS_MODE_TCP4 &&
+            self->mode != TRANS_MODE_TCP6)
+    {
+        return 1;
+    }
+    if (g_sck_set_zerocopy(self->sck) != 0)
+    {
+        return 1;
+    }
+    self->zerocopy = 1;
+    return 0;
+}
+
 /*****************************************************************************/
 int
 trans_force_read_s(struct trans *self, struct stream *in_s, int size)
@@ -476,7 +1003,7 @@ trans_force_read_s(struct trans *self, struct stream *in_s, int size)
 
     while (size > 0)
     {
-        rcvd = self->trans_recv(self, in_s->end, size);
+        rcvd = trans_read(self, in_s->end, size);
         if (rcvd == -1)
         {
             if (g_tcp_last_error_would_block(self->sck))
@@ -489,7 +1016,7 @@ trans_force_read_s(struct trans *self, struct stream *in_s, int size)
                         if (self->is_term())
                         {
                             /* term */
-                            self->status = TRANS_STATUS_DOWN;
+                            trans_set_down(self);
                             return 1;
                         }
                     }
@@ -498,14 +1025,14 @@ trans_force_read_s(struct trans *self, struct stream *in_s, int size)
             else
             {
                 /* error */
-                self->status = TRANS_STATUS_DOWN;
+                trans_set_down(self);
                 return 1;
             }
         }
         else if (rcvd == 0)
         {
             /* error */
-            self->status = TRANS_STATUS_DOWN;
+            trans_set_down(self);
             return 1;
         }
         else
@@ -538,49 +1065,31 @@ trans_force_write_s(struct trans *self, struct stream *out_s)
     }
     size = (int) (out_s->end - out_s->data);
     total = 0;
-    if (trans_send_waiting(self, 1) != 0)
-    {
-        self->status = TRANS_STATUS_DOWN;
-        return 1;
-    }
-    while (total < size)
+    /* anything left over goes out first, in the same calls as out_s */
+    while (total < size || self->wait_s != 0)
     {
-        sent = self->trans_send(self, out_s->data + total, size - total);
-        if (sent == -1)
+        if (!g_tcp_can_send(self->sck, 100))
         {
-            if (g_tcp_last_error_would_block(self->sck))
+            /* check for term here */
+            if (self->is_term != 0)
             {
-                if (!g_tcp_can_send(self->sck, 100))
+                if (self->is_term())
                 {
-                    /* check for term here */
-                    if (self->is_term != 0)
-                    {
-                        if (self->is_term())
-                        {
-                            /* term */
-                            self->status = TRANS_STATUS_DOWN;
-                            return 1;
-                        }
-                    }
+                    /* term */
+                    trans_set_down(self);
+                    return 1;
                 }
             }
-            else
-            {
-                /* error */
-                self->status = TRANS_STATUS_DOWN;
-                return 1;
-            }
+            continue;
         }
-        else if (sent == 0)
+        sent = trans_send_queue(self, out_s->data + total, size - total);
+        if (sent < 0)
         {
             /* error */
-            self->status = TRANS_STATUS_DOWN;
+            trans_set_down(self);
             return 1;
         }
-        else
-        {
-            total = total + sent;
-        }
+        total += sent;
     }
     return 0;
 }
@@ -592,86 +1101,117 @@ trans_force_write(struct trans *self)
     return trans_force_write_s(self, self->out_s);
 }
 
+/*****************************************************************************/
+/* copy data to the end of the wait queue, joining it to the last stream
+   if that was made with room to spare while corked */
+static void
+trans_wait_s_append(struct trans *self, const char *data, int size)
+{
+    struct stream *wait_s;
+    int *source;
+
+    source = 0;
+    if (self->si != 0)
+    {
+        if ((self->si->cur_source != XRDP_SOURCE_NONE) &&
+                (self->si->cur_source != self->my_source))
+        {
+            source = self->si->source + self->si->cur_source;
+            source[0] += size;
+            if (source[0] > MAX_SBYTES && source[0] - size <= MAX_SBYTES)
+            {
+                trans_source_changed(self->si, source);
+            }
+        }
+    }
+    self->wait_bytes += size;
+    wait_s = self->wait_s_tail;
+    if (wait_s != 0 && wait_s->source == source &&
+            wait_s->size - (int) (wait_s->end - wait_s->data) >= size)
+    {
+        g_memcpy(wait_s->end, data, size);
+        wait_s->end += size;
+        return;
+    }
+    make_stream(wait_s);
+    init_stream(wait_s, self->corked ? MAX(size, TRANS_CORK_BYTES) : size);
+    wait_s->source = source;
+    out_uint8a(wait_s, data, size);
+    s_mark_end(wait_s);
+    wait_s->p = wait_s->data;
+    if (self->wait_s_tail == 0)
+    {
+        self->wait_s = wait_s;
+    }
+    else
+    {
+        self->wait_s_tail->next = wait_s;
+    }
+    self->wait_s_tail = wait_s;
+    trans_reactor_update(self);
+}
+
+/*****************************************************************************/
+/* returns boolean, true if queueing size more bytes would take the wait
+   queue past wait_bytes_max */
+static int
+trans_wait_s_full(struct trans *self, int size)
+{
+    return self->wait_bytes_max > 0 &&
+           self->wait_bytes + size > self->wait_bytes_max;
+}
+
 /*****************************************************************************/
 int
 trans_write_copy_s(struct trans *self, struct stream *out_s)
 {
     int size;
     int sent;
-    struct stream *wait_s;
-    struct stream *temp_s;
     char *out_data;
 
     if (self->status != TRANS_STATUS_UP)
     {
         return 1;
     }
-    /* try to send any left over */
-    if (trans_send_waiting(self, 0) != 0)
-    {
-        /* error */
-        self->status = TRANS_STATUS_DOWN;
-        return 1;
-    }
     out_data = out_s->data;
-    sent = 0;
     size = (int) (out_s->end - out_s->data);
-    if (self->wait_s == 0)
-    {
-        /* if no left over, try to send this new data */
-        if (g_tcp_can_send(self->sck, 0))
-        {
-            sent = self->trans_send(self, out_s->data, size);
-            if (sent > 0)
-            {
-                out_data += sent;
-                size -= sent;
-            }
-            else if (sent == 0)
-            {
-                return 1;
-            }
-            else
-            {
-                if (!g_tcp_last_error_would_block(self->sck))
-                {
-                    return 1;
-                }
-            }
-        }
-    }
-    if (size < 1)
+    if (self->corked && self->wait_bytes + size < TRANS_CORK_BYTES &&
+            !trans_wait_s_full(self, size))
     {
+        /* held back to go out with what follows */
+        trans_wait_s_append(self, out_data, size);
         return 0;
     }
-    /* did not send right away, have to copy */
-    make_stream(wait_s);
-    init_stream(wait_s, size);
-    if (self->si != 0)
+    /* try to send any left over, and as much of the new data after it
+       as the socket will take */
+    if (g_tcp_can_send(self->sck, 0))
     {
-        if ((self->si->cur_source != XRDP_SOURCE_NONE) &&
-                (self->si->cur_source != self->my_source))
+        sent = trans_send_queue(self, out_data, size);
+        if (sent < 0)
         {
-            self->si->source[self->si->cur_source] += size;
-            wait_s->source = self->si->source + self->si->cur_source;
+            /* error */
+            trans_set_down(self);
+            return 1;
         }
+        out_data += sent;
+        size -= sent;
     }
-    out_uint8a(wait_s, out_data, size);
-    s_mark_end(wait_s);
-    wait_s->p = wait_s->data;
-    if (self->wait_s == 0)
+    if (size < 1)
     {
-        self->wait_s = wait_s;
+        return 0;
     }
-    else
+    if (trans_wait_s_full(self, size))
     {
-        temp_s = self->wait_s;
-        while (temp_s->next != 0)
-        {
-            temp_s = temp_s->next;
-        }
-        temp_s->next = wait_s;
+        /* producers hold back while trans_is_congested(), so only a peer
+           which has stopped reading gets here, don't wait for it */
+        LOG(LOG_LEVEL_ERROR, "trans_write_copy_s: %d bytes queued, more "
+            "would go past the limit of %d, disconnecting",
+            self->wait_bytes, self->wait_bytes_max);
+        trans_set_down(self);
+        return 1;
     }
+    /* did not send right away, have to copy */
+    trans_wait_s_append(self, out_data, size);
     return 0;
 }
 
@@ -774,6 +1314,8 @@ trans_connect(struct trans *self, const char *server, const char *port,
             return 1;
     }
 
+    /* the socket is replaced */
+    trans_reactor_remove(self);
     while (1)
     {
         /* Check the program isn't terminating */
@@ -858,6 +1400,7 @@ trans_connect(struct trans *self, const char *server, const char *port,
         self->status = TRANS_STATUS_UP; /* ok */
         self->type1 = TRANS_TYPE_CLIENT; /* client */
     }
+    trans_reactor_update(self);
 
     return error;
 }
@@ -867,8 +1410,8 @@ trans_connect(struct trans *self, const char *server, const char *port,
 /**
  * @return 0 on success, 1 on failure
  */
-int
-trans_listen_address(struct trans *self, const char *port, const char *address)
+static int
+trans_listen_sck(struct trans *self, const char *port, const char *address)
 {
     if (self->sck >= 0)
     {
@@ -986,6 +1529,19 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
     return 1;
 }
 
+/*****************************************************************************/
+int
+trans_listen_address(struct trans *self, const char *port, const char *address)
+{
+    int rv;
+
+    /* the socket is replaced */
+    trans_reactor_remove(self);
+    rv = trans_listen_sck(self, port, address);
+    trans_reactor_update(self);
+    return rv;
+}
+
 /*****************************************************************************/
 int
 trans_listen(struct trans *self, const char *port)
@@ -1034,7 +1590,7 @@ trans_get_out_s(struct trans *self, int size)
 /* returns error */
 int
 trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
-                   long ssl_protocols, const char *tls_ciphers)
+                   long ssl_protocols, const char *tls_ciphers, int ktls)
 {
     self->tls = ssl_tls_create(self, key, cert);
     if (self->tls == NULL)
@@ -1043,7 +1599,7 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
         return 1;
     }
 
-    if (ssl_tls_accept(self->tls, ssl_protocols, tls_ciphers) != 0)
+    if (ssl_tls_accept(self->tls, ssl_protocols, tls_ciphers, ktls) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "trans_set_tls_mode: ssl_tls_accept failed");
         return 1;
@@ -1052,12 +1608,21 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
     /* assign tls functions */
     self->trans_recv = trans_tls_recv;
     self->trans_send = trans_tls_send;
+    self->trans_send_vec = trans_tls_send_vec;
     self->trans_can_recv = trans_tls_can_recv;
+    /* OpenSSL copies to encrypt, and kTLS rejects MSG_ZEROCOPY */
+    self->zerocopy = 0;
+    if (ssl_tls_ktls_send(self->tls))
+    {
+        /* the socket makes the records, without copying through OpenSSL */
+        self->trans_send = trans_tcp_send;
+        self->trans_send_vec = trans_tcp_send_vec;
+    }
 
     self->ssl_protocol = ssl_get_version(self->tls);
     self->cipher_name = ssl_get_cipher_name(self->tls);
 
-    return 0;
+    return trans_reactor_update(self);
 }
 
 /*****************************************************************************/
@@ -1073,6 +1638,7 @@ trans_shutdown_tls_mode(struct trans *self)
     /* assign callback back to tcp cal */
     self->trans_recv = trans_tcp_recv;
     self->trans_send = trans_tcp_send;
+    self->trans_send_vec = trans_tcp_send_vec;
     self->trans_can_recv = trans_tcp_can_recv;
 
     return 0;
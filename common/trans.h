@@ -37,8 +37,12 @@
 #define TRANS_STATUS_DOWN 0
 #define TRANS_STATUS_UP 1
 
+/* a good size for trans_set_read_ahead() */
+#define TRANS_READ_AHEAD_BYTES (16 * 1024)
+
 struct trans; /* forward declaration */
 struct xrdp_tls;
+struct reactor;
 
 typedef int (*ttrans_data_in)(struct trans *self);
 typedef int (*ttrans_conn_in)(struct trans *self,
@@ -46,6 +50,9 @@ typedef int (*ttrans_conn_in)(struct trans *self,
 typedef int (*tis_term)(void);
 typedef int (*trans_recv_proc) (struct trans *self, char *ptr, int len);
 typedef int (*trans_send_proc) (struct trans *self, const char *data, int len);
+typedef int (*trans_send_vec_proc) (struct trans *self,
+                                    const char *const bufs[],
+                                    const int lens[], int count);
 typedef int (*trans_can_recv_proc) (struct trans *self, int sck, int millis);
 
 /* optional source info */
@@ -82,11 +89,16 @@ enum xrdp_source
  * This provides a simple means of providing back-pressure on an input
  * where the data it is providing is being processed and then sent out on
  * a much slower link.
+ *
+ * A transport in a reactor (see trans_set_reactor()) records itself in
+ * source_trans, so it can stop and start waiting for input as the count
+ * for its source changes.
  */
 struct source_info
 {
     enum xrdp_source cur_source;
     int source[XRDP_SOURCE_MAX_COUNT];
+    struct trans *source_trans[XRDP_SOURCE_MAX_COUNT];
 };
 
 struct trans
@@ -103,7 +115,22 @@ struct trans
     struct stream *out_s;
     char *listen_filename;
     tis_term is_term; /* used to test for exit */
-    struct stream *wait_s;
+    struct stream *wait_s; /* queue of output not yet sent */
+    struct stream *wait_s_tail; /* last stream in wait_s */
+    int wait_bytes; /* bytes left to send in wait_s */
+    int wait_bytes_max; /* 0 for no limit, see trans_write_copy_s() */
+    int send_lowat; /* socket has TCP_NOTSENT_LOWAT, see trans_is_congested() */
+    int send_lowat_wait; /* congested until the socket is writeable */
+    int corked; /* small writes are held back, see trans_set_corked() */
+    int zerocopy; /* large queued output is sent with MSG_ZEROCOPY */
+    int zc_front; /* wait_s was sent from with MSG_ZEROCOPY */
+    unsigned int zc_sent; /* MSG_ZEROCOPY sends made */
+    unsigned int zc_done; /* MSG_ZEROCOPY sends the kernel is done with */
+    struct stream *zc_s; /* sent output the kernel may still be reading */
+    char *read_ahead; /* optional, input read but not yet in in_s */
+    int read_ahead_size;
+    int read_ahead_start;
+    int read_ahead_end;
     int no_stream_init_on_data_in;
     int extra_flags; /* user defined */
     void *extra_data; /* user defined */
@@ -114,9 +141,15 @@ struct trans
     const char *cipher_name;  /* e.g. AES256-GCM-SHA384 */
     trans_recv_proc trans_recv;
     trans_send_proc trans_send;
+    trans_send_vec_proc trans_send_vec; /* optional, several buffers */
     trans_can_recv_proc trans_can_recv;
     struct source_info *si;
     enum xrdp_source my_source;
+    struct reactor *reactor; /* optional, see trans_set_reactor() */
+    tbus reactor_sck; /* registered in reactor */
+    int reactor_sck_events;
+    tbus reactor_rwo; /* tls wait obj registered in reactor */
+    int reactor_rwo_events;
 };
 
 struct trans *
@@ -133,6 +166,95 @@ trans_get_wait_objs_rw(struct trans *self,
                        tbus *wobjs, int *wcount, int *timeout);
 int
 trans_check_wait_objs(struct trans *self);
+/**
+ * Keeps a transport registered in a reactor while it is up
+ *
+ * The socket is waited on for reading unless output from this
+ * transport's source is backed up (see struct source_info), and for
+ * writing while there is output queued. The registration follows those
+ * changes, and is removed when the transport goes down or is deleted.
+ * Transports accepted by a listener are put in the listener's reactor.
+ *
+ * @param self Transport
+ * @param reactor Reactor, or NULL to take the transport out of its reactor
+ * @return 0 for success
+ */
+int
+trans_set_reactor(struct trans *self, struct reactor *reactor);
+/**
+ * Sends queued output left over from earlier writes
+ *
+ * @param self Transport
+ * @param block Non-zero to wait until all the queued output is sent
+ * @return 0 for success
+ */
+int
+trans_send_waiting(struct trans *self, int block);
+/**
+ * Checks whether output is backing up in the wait queue
+ *
+ * @param self Transport
+ * @return non-zero once more than half of wait_bytes_max is queued,
+ *         or with send_lowat set, while anything is queued or the socket
+ *         is not writeable
+ *
+ * Producers should hold back output while this is set, as
+ * trans_write_copy_s() does not wait, and fails once the queue would go
+ * past wait_bytes_max. trans_get_wait_objs_rw() and trans_set_reactor()
+ * wait for the socket to become writeable again.
+ */
+int
+trans_is_congested(struct trans *self);
+/**
+ * Checks, without waiting, whether there is input to read
+ *
+ * @param self Transport
+ * @return non-zero if trans_check_wait_objs() has input to hand over
+ */
+int
+trans_input_pending(struct trans *self);
+/**
+ * Reads input in larger blocks than the PDU being assembled
+ *
+ * @param self Transport
+ * @param bytes Size of the read ahead buffer
+ * @return 0 for success
+ *
+ * trans_check_wait_objs() then hands over every complete PDU that has
+ * arrived, not just one. Only use this where all the input is read
+ * through trans, e.g. not before a switch to TLS or where file
+ * descriptors are passed.
+ */
+int
+trans_set_read_ahead(struct trans *self, int bytes);
+/**
+ * Holds back small writes so they go out together
+ *
+ * @param self Transport
+ * @param corked Non-zero to start holding writes back, 0 to send them
+ * @return 0 for success
+ *
+ * While corked, trans_write_copy_s() queues output until
+ * 16 KB is waiting, then sends it with the write that took it over in
+ * one call, much like TCP_CORK. Under TLS that makes full size records
+ * rather than one per write. Anything still held is sent when uncorked,
+ * or by trans_check_wait_objs(), so nothing waits long.
+ */
+int
+trans_set_corked(struct trans *self, int corked);
+/**
+ * Sends large queued output without the kernel copying it
+ *
+ * @param self Transport, TCP only
+ * @return 0 for success
+ *
+ * Streams sent with MSG_ZEROCOPY are kept in zc_s until the kernel says
+ * it has finished with them. This is turned off again by TLS, which
+ * can't use it, and when the kernel reports it copied the data anyway,
+ * e.g. on loopback.
+ */
+int
+trans_set_zerocopy(struct trans *self);
 int
 trans_force_read_s(struct trans *self, struct stream *in_s, int size);
 int
@@ -172,7 +294,7 @@ struct stream *
 trans_get_out_s(struct trans *self, int size);
 int
 trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
-                   long ssl_protocols, const char *tls_ciphers);
+                   long ssl_protocols, const char *tls_ciphers, int ktls);
 int
 trans_shutdown_tls_mode(struct trans *self);
 int
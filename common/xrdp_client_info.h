@@ -215,10 +215,40 @@ struct xrdp_client_info
     unsigned int session_physical_height; /* in mm */
 
     int large_pointer_support_flags;
+
+    /* threads used to compress bitmap updates, 0 to compress in line */
+    int bitmap_compression_threads;
+
+    /* drop hidden rect and mem blt orders and merge neighbours */
+    int order_optimization;
+
+    /* glyph fragment cache from TS_GLYPHCACHE_CAPABILITYSET, 0 if the
+       client can't use it */
+    int glyph_frag_cache_entries;
+    int glyph_frag_cache_size;
+
+    /* highest bulk compression type the client supports, 0 (8K MPPC)
+       to 3 (RDP 6.1), from the info packet */
+    int rdp_compression_type;
+    /* offer RDP 6.1 bulk compression to clients which support it */
+    int use_rdp61_comp;
+
+    /* most bytes of output queued for a slow client, 0 for no limit */
+    int max_send_queue_bytes;
+
+    /* ask for TLS output to be encrypted by the kernel */
+    int ktls;
+
+    /* measure the connection with auto-detect PDUs, see
+       libxrdp/xrdp_autodetect.c. Results are 0 until known */
+    int network_autodetect;
+    int network_base_rtt; /* milliseconds, lowest seen */
+    int network_avg_rtt;  /* milliseconds */
+    int network_bandwidth; /* kbit/s */
 };
 
 /* yyyymmdd of last incompatible change to xrdp_client_info */
 /* also used for changes to all the xrdp installed headers */
-#define CLIENT_INFO_CURRENT_VERSION 20230425
+#define CLIENT_INFO_CURRENT_VERSION 20261018
 
 #endif
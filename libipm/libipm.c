@@ -177,6 +177,8 @@ libipm_init_trans(struct trans *trans,
         priv->msgno_to_str = msgno_to_str;
 
         trans->trans_send = libipm_trans_send_proc;
+        /* file descriptors go with the message header, one send each */
+        trans->trans_send_vec = NULL;
         trans->trans_recv = libipm_trans_recv_proc;
         trans->extra_data = priv;
         trans->extra_destructor = libipm_trans_destructor;
@@ -29,8 +29,90 @@
 #include "ms-rdpbcgr.h"
 
 #define MAX_BITMAP_BUF_SIZE (16 * 1024) /* 16K */
+/* largest compressed rect that fits in an otherwise empty bitmap update */
+#define MAX_BITMAP_RECT_BYTES (MAX_BITMAP_BUF_SIZE - 100 - 26)
+/* room allowed per rect in a tile, compressors can overshoot the limit */
+#define BITMAP_TILE_RECT_SPACE (2 * MAX_BITMAP_BUF_SIZE)
+/* pixels in a tile compressed by one job */
+#define BITMAP_TILE_PIXELS (64 * 64 * 4)
+/* most lines, and so rects, in a tile, a padded line is at least 4 pixels */
+#define BITMAP_TILE_MAX_LINES (BITMAP_TILE_PIXELS / 4)
+
+/* part of a bitmap update compressed by a thread in the bitmap pool */
+struct xrdp_bitmap_tile
+{
+    /* in */
+    char *data; /* first line of the tile */
+    int width;
+    int lines;
+    int bpp;
+    int e;
+    /* out, the rects are bottom up like the lines in the tile */
+    int error;
+    int num_rects;
+    int *rect_lines;
+    int *rect_bytes;
+    struct stream *out_s;
+    struct stream *temp_s;
+};
 #define TS_MONITOR_ATTRIBUTES_SIZE 20 /* [MS-RDPBCGR] 2.2.1.3.9 */
 
+/******************************************************************************/
+static void
+bitmap_tiles_delete(struct xrdp_bitmap_tile *tiles, int num_tiles)
+{
+    struct xrdp_bitmap_tile *tile;
+    int index;
+
+    if (tiles == NULL)
+    {
+        return;
+    }
+    for (index = 0; index < num_tiles; index++)
+    {
+        tile = tiles + index;
+        g_free(tile->rect_lines);
+        g_free(tile->rect_bytes);
+        free_stream(tile->out_s);
+        free_stream(tile->temp_s);
+    }
+    g_free(tiles);
+}
+
+/******************************************************************************/
+/* the tiles and their buffers are made once, with the bitmap pool, and
+   used again for every update */
+static struct xrdp_bitmap_tile *
+bitmap_tiles_create(int num_tiles)
+{
+    struct xrdp_bitmap_tile *tiles;
+    struct xrdp_bitmap_tile *tile;
+    int index;
+
+    tiles = g_new0(struct xrdp_bitmap_tile, num_tiles);
+    if (tiles == NULL)
+    {
+        return NULL;
+    }
+    for (index = 0; index < num_tiles; index++)
+    {
+        tile = tiles + index;
+        tile->rect_lines = g_new(int, BITMAP_TILE_MAX_LINES);
+        tile->rect_bytes = g_new(int, BITMAP_TILE_MAX_LINES);
+        make_stream(tile->out_s);
+        init_stream(tile->out_s, 2 * BITMAP_TILE_RECT_SPACE);
+        make_stream(tile->temp_s);
+        init_stream(tile->temp_s, 65536);
+        if (tile->rect_lines == NULL || tile->rect_bytes == NULL ||
+                tile->out_s->data == NULL || tile->temp_s->data == NULL)
+        {
+            bitmap_tiles_delete(tiles, num_tiles);
+            return NULL;
+        }
+    }
+    return tiles;
+}
+
 /******************************************************************************/
 struct xrdp_session *EXPORT_CC
 libxrdp_init(tbus id, struct trans *trans, const char *xrdp_ini)
@@ -59,13 +141,17 @@ libxrdp_init(tbus id, struct trans *trans, const char *xrdp_ini)
 int EXPORT_CC
 libxrdp_exit(struct xrdp_session *session)
 {
+    struct xrdp_rdp *rdp;
+
     if (session == 0)
     {
         return 0;
     }
 
     xrdp_orders_delete((struct xrdp_orders *)session->orders);
-    xrdp_rdp_delete((struct xrdp_rdp *)session->rdp);
+    rdp = (struct xrdp_rdp *)session->rdp;
+    bitmap_tiles_delete(rdp->bitmap_tiles, rdp->num_bitmap_tiles);
+    xrdp_rdp_delete(rdp);
     g_free(session->xrdp_ini);
     g_free(session);
     return 0;
@@ -406,6 +492,251 @@ libxrdp_send_bell(struct xrdp_session *session)
     return 0;
 }
 
+/*****************************************************************************/
+/* writes the TS_BITMAP_DATA header of a compressed rect
+   returns the header size */
+static int
+out_bitmap_rect_hdr(struct xrdp_session *session, struct stream *s,
+                    int left, int top, int right, int bottom,
+                    int width, int lines, int bpp, int bufsize)
+{
+    int line_size;
+
+    out_uint16_le(s, left);
+    out_uint16_le(s, top);
+    out_uint16_le(s, right);
+    out_uint16_le(s, bottom);
+    out_uint16_le(s, width);
+    out_uint16_le(s, lines); /* height */
+    out_uint16_le(s, bpp);
+    if (session->client_info->op1)
+    {
+        out_uint16_le(s, 0x401); /* compress */
+        out_uint16_le(s, bufsize); /* compressed size */
+        return 18;
+    }
+    line_size = width * ((bpp + 7) / 8);
+    out_uint16_le(s, 0x1); /* compress */
+    out_uint16_le(s, bufsize + 8);
+    out_uint8s(s, 2); /* pad */
+    out_uint16_le(s, bufsize); /* compressed size */
+    out_uint16_le(s, line_size); /* line size */
+    out_uint16_le(s, line_size * lines); /* final size */
+    return 26;
+}
+
+/*****************************************************************************/
+/* called on a bitmap pool thread, compresses all the lines in a tile into
+   rects no bigger than MAX_BITMAP_RECT_BYTES */
+static void
+bitmap_tile_compress(void *job)
+{
+    struct xrdp_bitmap_tile *tile;
+    struct stream *out_s;
+    struct stream rect_s;
+    char *data;
+    int used;
+    int lines;
+    int i;
+
+    tile = (struct xrdp_bitmap_tile *) job;
+    out_s = tile->out_s;
+    out_s->p = out_s->data;
+    tile->num_rects = 0;
+    tile->error = 0;
+    i = tile->lines;
+    while (i > 0)
+    {
+        used = (int) (out_s->p - out_s->data);
+        if (used + BITMAP_TILE_RECT_SPACE > out_s->size)
+        {
+            /* grow keeping the rects already done */
+            data = g_new(char, out_s->size * 2);
+            g_memcpy(data, out_s->data, used);
+            g_free(out_s->data);
+            out_s->data = data;
+            out_s->size *= 2;
+            out_s->p = out_s->data + used;
+        }
+        /* each rect starts its own stream, xrdp_bitmap_compress measures
+           its byte limit from the start of the stream */
+        g_memset(&rect_s, 0, sizeof(rect_s));
+        rect_s.data = out_s->p;
+        rect_s.p = rect_s.data;
+        rect_s.size = BITMAP_TILE_RECT_SPACE;
+        rect_s.end = rect_s.data + rect_s.size;
+        if (tile->bpp > 24)
+        {
+            lines = xrdp_bitmap32_compress(tile->data, tile->width,
+                                           tile->lines, &rect_s, 32,
+                                           MAX_BITMAP_RECT_BYTES, i - 1,
+                                           tile->temp_s, tile->e, 0x10);
+        }
+        else
+        {
+            lines = xrdp_bitmap_compress(tile->data, tile->width,
+                                         tile->lines, &rect_s, tile->bpp,
+                                         MAX_BITMAP_RECT_BYTES, i - 1,
+                                         tile->temp_s, tile->e);
+        }
+        if (lines == 0)
+        {
+            tile->error = 1;
+            break;
+        }
+        tile->rect_lines[tile->num_rects] = lines;
+        tile->rect_bytes[tile->num_rects] = (int) (rect_s.p - rect_s.data);
+        tile->num_rects++;
+        out_s->p = rect_s.p;
+        i -= lines;
+    }
+}
+
+/*****************************************************************************/
+/* compresses the update in tiles on the bitmap pool threads, then sends
+   the rects in the same bottom up order as the single threaded code
+   returns error */
+static int
+libxrdp_send_bitmap_tiles(struct xrdp_session *session,
+                          struct xrdp_bitmap_pool *pool,
+                          struct xrdp_bitmap_tile *tiles, int batch_size,
+                          int width, int bpp, char *data,
+                          int x, int y, int cx, int cy,
+                          int e, int server_line_bytes, struct stream *s)
+{
+    struct xrdp_bitmap_tile *tile;
+    char *p_num_updates;
+    char *p;
+    int tile_lines;
+    int num_tiles;
+    int bottom;
+    int top;
+    int index;
+    int rect;
+    int i;
+    int hdr_bytes;
+    int bufsize;
+    int num_updates;
+    int total_bufsize;
+    int error;
+
+    tile_lines = BITMAP_TILE_PIXELS / (width + e);
+    if (tile_lines < 1)
+    {
+        tile_lines = 1;
+    }
+    for (index = 0; index < batch_size; index++)
+    {
+        tile = tiles + index;
+        tile->width = width;
+        tile->bpp = bpp;
+        tile->e = e;
+    }
+    hdr_bytes = session->client_info->op1 ? 18 : 26;
+    p_num_updates = NULL;
+    num_updates = 0;
+    total_bufsize = 0;
+    error = 0;
+    bottom = cy;
+    while (bottom > 0 && !error)
+    {
+        /* fill a batch of tiles from the bottom up */
+        num_tiles = 0;
+        while (bottom > 0 && num_tiles < batch_size)
+        {
+            top = bottom - tile_lines;
+            if (top < 0)
+            {
+                top = 0;
+            }
+            tile = tiles + num_tiles;
+            tile->data = data + top * server_line_bytes;
+            tile->lines = bottom - top;
+            num_tiles++;
+            bottom = top;
+        }
+        if (xrdp_bitmap_pool_run(pool, bitmap_tile_compress, tiles,
+                                 sizeof(struct xrdp_bitmap_tile),
+                                 num_tiles) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "libxrdp_send_bitmap_tiles: error, "
+                "bitmap compression threads failed");
+            error = 1;
+            break;
+        }
+        /* serialise in order, packing rects into updates */
+        top = bottom;
+        for (index = num_tiles - 1; index >= 0; index--)
+        {
+            top += tiles[index].lines;
+        }
+        for (index = 0; index < num_tiles && !error; index++)
+        {
+            tile = tiles + index;
+            top -= tile->lines; /* top line of this tile */
+            p = tile->out_s->data;
+            i = tile->lines;
+            for (rect = 0; rect < tile->num_rects; rect++)
+            {
+                bufsize = tile->rect_bytes[rect];
+                if (num_updates > 0 &&
+                        total_bufsize + hdr_bytes + bufsize >
+                        MAX_BITMAP_BUF_SIZE - 100)
+                {
+                    p_num_updates[0] = num_updates;
+                    p_num_updates[1] = num_updates >> 8;
+                    s_mark_end(s);
+                    LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] "
+                              "TS_UPDATE_BITMAP_DATA updateType %d "
+                              "(UPDATETYPE_BITMAP), numberRectangles %d, "
+                              "rectangles <omitted from log>",
+                              RDP_UPDATE_BITMAP, num_updates);
+                    xrdp_rdp_send_data((struct xrdp_rdp *)session->rdp, s,
+                                       RDP_DATA_PDU_UPDATE);
+                    num_updates = 0;
+                }
+                if (num_updates == 0)
+                {
+                    total_bufsize = 0;
+                    xrdp_rdp_init_data((struct xrdp_rdp *)session->rdp, s);
+                    out_uint16_le(s, RDP_UPDATE_BITMAP); /* updateType */
+                    p_num_updates = s->p;
+                    out_uint8s(s, 2); /* num_updates set later */
+                }
+                i -= tile->rect_lines[rect];
+                out_bitmap_rect_hdr(session, s, x, y + top + i,
+                                    (x + cx) - 1,
+                                    (y + top + i + tile->rect_lines[rect]) - 1,
+                                    width + e, tile->rect_lines[rect],
+                                    bpp, bufsize);
+                out_uint8a(s, p, bufsize);
+                p += bufsize;
+                total_bufsize += hdr_bytes + bufsize;
+                num_updates++;
+            }
+            if (tile->error)
+            {
+                LOG(LOG_LEVEL_WARNING, "libxrdp_send_bitmap_tiles: error, "
+                    "could not compress line %d", y + top + i - 1);
+                error = 1;
+            }
+        }
+    }
+    if (num_updates > 0)
+    {
+        p_num_updates[0] = num_updates;
+        p_num_updates[1] = num_updates >> 8;
+        s_mark_end(s);
+        LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] TS_UPDATE_BITMAP_DATA "
+                  "updateType %d (UPDATETYPE_BITMAP), numberRectangles %d, "
+                  "rectangles <omitted from log>",
+                  RDP_UPDATE_BITMAP, num_updates);
+        xrdp_rdp_send_data((struct xrdp_rdp *)session->rdp, s,
+                           RDP_DATA_PDU_UPDATE);
+    }
+    return error;
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
@@ -429,6 +760,8 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
     char *q = (char *)NULL;
     struct stream *s = (struct stream *)NULL;
     struct stream *temp_s = (struct stream *)NULL;
+    struct xrdp_rdp *rdp;
+    int num_threads;
     tui32 pixel;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: sending bitmap");
@@ -456,7 +789,53 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
     make_stream(s);
     init_stream(s, MAX_BITMAP_BUF_SIZE);
 
-    if (session->client_info->use_bitmap_comp)
+    rdp = (struct xrdp_rdp *)session->rdp;
+    num_threads = session->client_info->bitmap_compression_threads;
+    if (session->client_info->use_bitmap_comp && num_threads > 0 &&
+            cy <= height && cy * (width + e) > BITMAP_TILE_PIXELS)
+    {
+        if (rdp->bitmap_pool == NULL)
+        {
+            rdp->bitmap_pool = xrdp_bitmap_pool_create(num_threads);
+            if (rdp->bitmap_pool != NULL)
+            {
+                /* a few tiles per thread keeps them busy without holding
+                   the whole compressed update in memory */
+                rdp->num_bitmap_tiles = (num_threads + 1) * 4;
+                rdp->bitmap_tiles = bitmap_tiles_create(rdp->num_bitmap_tiles);
+                if (rdp->bitmap_tiles == NULL)
+                {
+                    xrdp_bitmap_pool_delete(rdp->bitmap_pool);
+                    rdp->bitmap_pool = NULL;
+                }
+            }
+            if (rdp->bitmap_pool == NULL)
+            {
+                LOG(LOG_LEVEL_WARNING, "libxrdp_send_bitmap: could not start "
+                    "bitmap compression threads, compressing in line");
+                session->client_info->bitmap_compression_threads = 0;
+            }
+        }
+    }
+    else
+    {
+        num_threads = 0;
+    }
+
+    if (num_threads > 0 && rdp->bitmap_pool != NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: tiled compression");
+        if (libxrdp_send_bitmap_tiles(session, rdp->bitmap_pool,
+                                      rdp->bitmap_tiles,
+                                      rdp->num_bitmap_tiles,
+                                      width, bpp, data, x, y, cx, cy,
+                                      e, server_line_bytes, s) != 0)
+        {
+            free_stream(s);
+            return 1;
+        }
+    }
+    else if (session->client_info->use_bitmap_comp)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: compression");
         make_stream(temp_s);
@@ -523,34 +902,13 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
                 i = i - lines_sending;
                 s_mark_end(s);
                 s_pop_layer(s, channel_hdr);
-                out_uint16_le(s, x); /* left */
-                out_uint16_le(s, y + i); /* top */
-                out_uint16_le(s, (x + cx) - 1); /* right */
-                out_uint16_le(s, (y + i + lines_sending) - 1); /* bottom */
-                out_uint16_le(s, width + e); /* width */
-                out_uint16_le(s, lines_sending); /* height */
-                out_uint16_le(s, bpp); /* bpp */
-
-                if (session->client_info->op1)
-                {
-                    out_uint16_le(s, 0x401); /* compress */
-                    out_uint16_le(s, bufsize); /* compressed size */
-                    j = (width + e) * Bpp;
-                    j = j * lines_sending;
-                    total_bufsize += 18; /* bytes since pop layer */
-                }
-                else
-                {
-                    out_uint16_le(s, 0x1); /* compress */
-                    out_uint16_le(s, bufsize + 8);
-                    out_uint8s(s, 2); /* pad */
-                    out_uint16_le(s, bufsize); /* compressed size */
-                    j = (width + e) * Bpp;
-                    out_uint16_le(s, j); /* line size */
-                    j = j * lines_sending;
-                    out_uint16_le(s, j); /* final size */
-                    total_bufsize += 26; /* bytes since pop layer */
-                }
+                /* bytes since pop layer */
+                total_bufsize += out_bitmap_rect_hdr(session, s, x, y + i,
+                                                     (x + cx) - 1,
+                                                     (y + i + lines_sending) - 1,
+                                                     width + e, lines_sending,
+                                                     bpp, bufsize);
+                j = (width + e) * Bpp * lines_sending;
 
                 LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: decompressed pixels %d "
                           "decompressed bytes %d compressed bytes %d",
@@ -1239,6 +1597,65 @@ libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                                     cache_id, cache_idx, hints);
 }
 
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_is_congested(const struct xrdp_session *session)
+{
+    return trans_is_congested(session->trans);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_input_pending(struct xrdp_session *session)
+{
+    return trans_input_pending(session->trans);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_set_corked(struct xrdp_session *session, int corked)
+{
+    return trans_set_corked(session->trans, corked);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_autodetect_check(struct xrdp_session *session)
+{
+    struct xrdp_rdp *rdp;
+    int rv;
+
+    rdp = (struct xrdp_rdp *) (session->rdp);
+    rv = xrdp_autodetect_check(rdp->sec_layer->autodetect);
+    if (rv == -1)
+    {
+        /* connect-time detection timed out, carry on connecting */
+        rv = xrdp_caps_send_demand_active(rdp);
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+void EXPORT_CC
+libxrdp_autodetect_get_timeout(struct xrdp_session *session, int *timeout)
+{
+    struct xrdp_rdp *rdp;
+
+    rdp = (struct xrdp_rdp *) (session->rdp);
+    xrdp_autodetect_get_timeout(rdp->sec_layer->autodetect, timeout);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_load_tls_context(const char *xrdp_ini)
+{
+    if (xrdp_ini == NULL)
+    {
+        xrdp_ini = XRDP_CFG_PATH "/xrdp.ini";
+    }
+    return xrdp_rdp_load_tls_context(xrdp_ini);
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_get_channel_count(const struct xrdp_session *session)
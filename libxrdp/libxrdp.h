@@ -70,6 +70,7 @@ struct xrdp_mcs
     /* This boolean is set to indicate we're expecting channel join
      * requests as part of the connect sequence */
     int expecting_channel_join_requests;
+    int msgchan_id; /* MCS message channel, 0 if not in use */
 };
 
 /* fastpath */
@@ -133,6 +134,28 @@ struct xrdp_sec
     void *decrypt_fips_info;
     void *sign_fips_info;
     int is_security_header_present; /* boolean */
+    struct xrdp_autodetect *autodetect;
+};
+
+/* xrdp_autodetect.bw_state */
+#define AUTODETECT_BW_IDLE     0
+#define AUTODETECT_BW_STARTED  1 /* measuring, stop not sent yet */
+#define AUTODETECT_BW_STOPPED  2 /* waiting for the results */
+
+/* network auto-detection on the message channel [MS-RDPBCGR] 2.2.14 */
+struct xrdp_autodetect
+{
+    struct xrdp_sec *sec_layer; /* owner */
+    int seq_number;      /* of the last request sent */
+    int rtt_seq_number;  /* of the RTT request waiting for a response */
+    tui64 rtt_sent;      /* g_time_usec() it was sent, 0 for none */
+    int bw_state;
+    tui64 bw_changed;    /* g_time_usec() bw_state last changed */
+    tui64 next_rtt;
+    tui64 next_bw;
+    int connect_time;    /* connect-time detection in progress */
+    tui64 connect_deadline; /* g_time_usec() it is given up on */
+    int result_changed;  /* results not yet sent to the client */
 };
 
 struct xrdp_drdynvc
@@ -158,6 +181,18 @@ struct xrdp_channel
     struct xrdp_drdynvc drdynvcs[256];
 };
 
+/* bulk compression bookkeeping for one fast-path update code */
+struct xrdp_bulk_comp
+{
+    int misses;          /* compressions in a row which did not help */
+    int backoff;         /* fragments to send as is before trying again */
+    int next_backoff;
+    tui64 bytes_in;      /* offered to the compressor */
+    tui64 bytes_out;     /* what was sent for them */
+    tui64 bytes_skipped; /* never offered, policy or back off */
+    tui64 usecs;         /* spent compressing */
+};
+
 /* rdp */
 struct xrdp_rdp
 {
@@ -168,6 +203,10 @@ struct xrdp_rdp
     struct xrdp_client_info client_info;
     struct xrdp_mppc_enc *mppc_enc;
     void *rfx_enc;
+    struct xrdp_bitmap_pool *bitmap_pool; /* created on first use */
+    struct xrdp_bitmap_tile *bitmap_tiles; /* made with bitmap_pool */
+    int num_bitmap_tiles;
+    struct xrdp_bulk_comp bulk_comp[16]; /* by fast-path updateCode */
 };
 
 /* state */
@@ -271,6 +310,32 @@ struct xrdp_orders_state
 
 };
 
+/* order held back by the order optimizer, type is 0 once dropped */
+struct xrdp_orders_opt_item
+{
+    int type; /* RDP_ORDER_RECT or RDP_ORDER_MEMBLT */
+    struct xrdp_rect rect; /* area drawn, already clipped */
+    int color;
+    int cache_id;
+    int cache_idx;
+    int color_table;
+    int src_dx; /* x - srcx */
+    int src_dy; /* y - srcy */
+};
+
+#define XRDP_ORDERS_OPT_MAX 64
+
+struct xrdp_orders_opt
+{
+    int enabled;
+    int flushing;
+    int count;
+    struct xrdp_orders_opt_item items[XRDP_ORDERS_OPT_MAX];
+    /* rect and mem blt orders given to and sent by the optimizer */
+    long orders_in;
+    long orders_out;
+};
+
 /* orders */
 struct xrdp_orders
 {
@@ -288,15 +353,19 @@ struct xrdp_orders
     /* shared */
     struct stream *s;
     struct stream *temp_s;
+    struct xrdp_orders_opt opt;
 };
 
 #define PROTO_RDP_40 1
 #define PROTO_RDP_50 2
+#define PROTO_RDP_60 3
+#define PROTO_RDP_61 4
 
 struct xrdp_mppc_enc
 {
     int    protocol_type;    /* PROTO_RDP_40, PROTO_RDP_50 etc */
-    char  *historyBuffer;    /* contains uncompressed data */
+    char  *historyBuffer;    /* contains uncompressed data, nil for
+                                PROTO_RDP_61 which uses l2_enc's */
     char  *outputBuffer;     /* contains compressed data */
     char  *outputBufferPlus;
     int    historyOffset;    /* next free slot in historyBuffer */
@@ -305,13 +374,25 @@ struct xrdp_mppc_enc
     int    flags;            /* PACKET_COMPRESSED, PACKET_AT_FRONT, PACKET_FLUSHED etc */
     int    flagsHold;
     int    first_pkt;        /* this is the first pkt passing through enc */
-    tui16 *hash_table;
+    tui32 *hash_table;       /* hash_gen << 16 | historyBuffer offset,
+                                also nil for PROTO_RDP_61 */
+    int    hash_gen;         /* bumped instead of clearing hash_table */
+    /* PROTO_RDP_61 only, level 1 state and the level 2 (64K MPPC) encoder */
+    struct xrdp_mppc_enc *l2_enc;
+    char  *l1_history;       /* last 2,000,000 bytes sent */
+    int    l1_offset;        /* next free slot in l1_history */
+    int    l1_flags_hold;
+    tui32 *l1_hash;          /* window hash -> l1_history offset + 1 */
+    char  *l1_out;           /* level 1 output, level 2 input */
+    int   *l1_matches;       /* length, output offset, history offset */
 };
 
 int
 compress_rdp(struct xrdp_mppc_enc *enc, tui8 *srcData, int len);
 struct xrdp_mppc_enc *
 mppc_enc_new(int protocol_type);
+struct xrdp_mppc_enc *
+mppc_enc_new_for_client(int compr_type, int use_rdp61);
 void
 mppc_enc_free(struct xrdp_mppc_enc *enc);
 
@@ -401,6 +482,28 @@ int
 xrdp_sec_disconnect(struct xrdp_sec *self);
 int
 xrdp_sec_process_mcs_data_monitors(struct xrdp_sec *self, struct stream *s);
+int
+xrdp_sec_init_msgchannel(struct xrdp_sec *self, struct stream *s);
+int
+xrdp_sec_send_msgchannel(struct xrdp_sec *self, struct stream *s, int flags);
+
+/* xrdp_autodetect.c */
+struct xrdp_autodetect *
+xrdp_autodetect_create(struct xrdp_sec *owner);
+void
+xrdp_autodetect_delete(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_enabled(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_start_connect_time(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_process_rsp(struct xrdp_autodetect *self, struct stream *s);
+int
+xrdp_autodetect_check(struct xrdp_autodetect *self);
+void
+xrdp_autodetect_get_timeout(struct xrdp_autodetect *self, int *timeout);
+int
+xrdp_autodetect_connection_type(int bandwidth, int rtt);
 
 /* xrdp_rdp.c */
 struct xrdp_rdp *
@@ -408,6 +511,8 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans);
 void
 xrdp_rdp_delete(struct xrdp_rdp *self);
 int
+xrdp_rdp_load_tls_context(const char *xrdp_ini);
+int
 xrdp_rdp_init(struct xrdp_rdp *self, struct stream *s);
 int
 xrdp_rdp_init_data(struct xrdp_rdp *self, struct stream *s);
@@ -426,6 +531,11 @@ int
 xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
                        int data_pdu_type);
 int
+xrdp_rdp_bulk_comp_wanted(struct xrdp_rdp *self, int update_code, int len);
+void
+xrdp_rdp_bulk_comp_result(struct xrdp_rdp *self, int update_code, int len,
+                          int comp_len, int usecs);
+int
 xrdp_rdp_send_data_update_sync(struct xrdp_rdp *self);
 int
 xrdp_rdp_incoming(struct xrdp_rdp *self);
@@ -459,6 +569,9 @@ int
 xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
                  int color, struct xrdp_rect *rect);
 int
+xrdp_orders_out_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect);
+int
 xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
                        int cx, int cy, int srcx, int srcy,
                        int rop, struct xrdp_rect *rect);
@@ -483,6 +596,11 @@ xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
                     int rop, int srcx, int srcy,
                     int cache_idx, struct xrdp_rect *rect);
 int
+xrdp_orders_out_mem_blt(struct xrdp_orders *self, int cache_id,
+                        int color_table, int x, int y, int cx, int cy,
+                        int rop, int srcx, int srcy,
+                        int cache_idx, struct xrdp_rect *rect);
+int
 xrdp_orders_composite_blt(struct xrdp_orders *self, int srcidx,
                           int srcformat, int srcwidth,
                           int srcrepeat, int *srctransform, int mskflags,
@@ -544,12 +662,46 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
                      struct stream *s, int bpp, int byte_limit,
                      int start_line, struct stream *temp_s,
                      int e);
+
+/* xrdp_bitmap32_compress.c */
+#define PLANAR_SIMD_AUTO -1
+#define PLANAR_SIMD_NONE 0
+#define PLANAR_SIMD_SSE2 1
+
 int
 xrdp_bitmap32_compress(char *in_data, int width, int height,
                        struct stream *s, int bpp, int byte_limit,
                        int start_line, struct stream *temp_s,
                        int e, int flags);
 int
+xrdp_bitmap32_compress_set_simd(int level);
+
+/* xrdp_bitmap_pool.c */
+typedef void (*xrdp_bitmap_pool_proc)(void *job);
+
+struct xrdp_bitmap_pool *
+xrdp_bitmap_pool_create(int num_threads);
+void
+xrdp_bitmap_pool_delete(struct xrdp_bitmap_pool *self);
+int
+xrdp_bitmap_pool_run(struct xrdp_bitmap_pool *self,
+                     xrdp_bitmap_pool_proc proc,
+                     void *jobs, int job_size, int job_count);
+
+/* xrdp_orders_opt.c */
+int
+xrdp_orders_opt_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect);
+int
+xrdp_orders_opt_mem_blt(struct xrdp_orders *self, int cache_id,
+                        int color_table, int x, int y, int cx, int cy,
+                        int srcx, int srcy, int cache_idx,
+                        struct xrdp_rect *rect);
+int
+xrdp_orders_opt_flush(struct xrdp_orders *self);
+
+/* xrdp_jpeg_compress.c */
+int
 xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    struct stream *s, int bpp, int byte_limit,
                    int start_line, struct stream *temp_s,
@@ -219,6 +219,62 @@ libxrdp_orders_send_bitmap3(struct xrdp_session *session,
  */
 int
 libxrdp_get_channel_count(const struct xrdp_session *session);
+/**
+ * Checks whether output to the client is backing up
+ *
+ * @param session RDP session
+ * @return non-zero if new screen updates should be held back
+ */
+int
+libxrdp_is_congested(const struct xrdp_session *session);
+/**
+ * Checks whether the client has sent input which is not yet processed
+ *
+ * @param session RDP session
+ * @return non-zero if bulk output should stop to let input through
+ */
+int
+libxrdp_input_pending(struct xrdp_session *session);
+/**
+ * Holds back small writes to the client so a frame goes out together
+ *
+ * @param session RDP session
+ * @param corked Non-zero to start, 0 to send what is held back
+ * @return 0 for success
+ */
+int
+libxrdp_set_corked(struct xrdp_session *session, int corked);
+/**
+ * Sends any network auto-detect requests which are due
+ *
+ * @param session RDP session
+ * @return 0 for success
+ *
+ * Results are in the client_info, the session callback gets 0x555a when
+ * they change. Connect-time detection which takes too long is given up
+ * on, and the connection carries on with demand active.
+ */
+int
+libxrdp_autodetect_check(struct xrdp_session *session);
+/**
+ * Gets when libxrdp_autodetect_check() next needs calling
+ *
+ * @param session RDP session
+ * @param timeout Milliseconds, -1 for none. Lowered if the next check
+ *                is due sooner
+ */
+void
+libxrdp_autodetect_get_timeout(struct xrdp_session *session, int *timeout);
+/**
+ * Loads the TLS certificate once for all later connections
+ *
+ * @param xrdp_ini Path to xrdp.ini config file, or NULL for default
+ * @return 0 for success, or if TLS is not configured
+ *
+ * Call again to pick up a new certificate.
+ */
+int
+libxrdp_load_tls_context(const char *xrdp_ini);
 int
 libxrdp_query_channel(struct xrdp_session *session, int channel_id,
                       char *channel_name, int *channel_flags);
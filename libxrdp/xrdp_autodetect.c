@@ -0,0 +1,593 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * network auto-detection [MS-RDPBCGR] 2.2.14, 3.2.5.3.14
+ *
+ * The round trip time and bandwidth are measured with auto-detect
+ * requests on the MCS message channel. If the client leaves the connection
+ * type to the server, this is done after licensing and the result picks
+ * the connection type. In the session the RTT is measured every few
+ * seconds, and the bandwidth over a short window from time to time. The
+ * results are kept in the client_info, and xrdp is told when they change.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+
+#define AUTODETECT_RTT_INTERVAL_MS 2000
+#define AUTODETECT_BW_INTERVAL_MS 30000
+#define AUTODETECT_BW_WINDOW_MS 1000
+/* a request not answered in this time is given up on */
+#define AUTODETECT_TIMEOUT_MS 10000
+/* connect-time detection not done in this time is given up on, and the
+   connection goes on without it */
+#define AUTODETECT_CONNECT_TIME_MS 5000
+/* a continuous measurement which saw less than this did not fill the
+   link, so says nothing about it */
+#define AUTODETECT_BW_MIN_BYTES (64 * 1024)
+/* sent at connect time */
+#define AUTODETECT_PAYLOAD_BYTES 8192
+#define AUTODETECT_PAYLOAD_COUNT 8
+
+/*****************************************************************************/
+struct xrdp_autodetect *
+xrdp_autodetect_create(struct xrdp_sec *owner)
+{
+    struct xrdp_autodetect *self;
+
+    self = (struct xrdp_autodetect *)
+           g_malloc(sizeof(struct xrdp_autodetect), 1);
+    self->sec_layer = owner;
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_autodetect_delete(struct xrdp_autodetect *self)
+{
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* returns boolean, true if the client joined a message channel for
+   auto-detection */
+int
+xrdp_autodetect_enabled(struct xrdp_autodetect *self)
+{
+    return self->sec_layer->mcs_layer != NULL &&
+           self->sec_layer->mcs_layer->msgchan_id != 0;
+}
+
+/*****************************************************************************/
+/* Maps measurements to the connection types of [MS-RDPBCGR] 2.2.1.3.2
+ * @param bandwidth kbit/s
+ * @param rtt milliseconds, 0 if not known */
+int
+xrdp_autodetect_connection_type(int bandwidth, int rtt)
+{
+    if (bandwidth >= 10000 && rtt <= 20)
+    {
+        return CONNECTION_TYPE_LAN;
+    }
+    if (bandwidth >= 2000 && rtt >= 300)
+    {
+        return CONNECTION_TYPE_SATELLITE;
+    }
+    if (bandwidth >= 10000)
+    {
+        return CONNECTION_TYPE_WAN;
+    }
+    if (bandwidth >= 2000)
+    {
+        return CONNECTION_TYPE_BROADBAND_HIGH;
+    }
+    if (bandwidth >= 256)
+    {
+        return CONNECTION_TYPE_BROADBAND_LOW;
+    }
+    return CONNECTION_TYPE_MODEM;
+}
+
+/*****************************************************************************/
+/* starts an [MS-RDPBCGR] Auto-Detect Request PDU, the caller adds any
+   fields after requestType
+   returns error */
+static int
+xrdp_autodetect_init(struct xrdp_autodetect *self, struct stream *s,
+                     int header_length, int request_type)
+{
+    if (xrdp_sec_init_msgchannel(self->sec_layer, s) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_autodetect_init: "
+            "xrdp_sec_init_msgchannel failed");
+        return 1;
+    }
+    self->seq_number = (self->seq_number + 1) & 0xffff;
+    out_uint8(s, header_length);
+    out_uint8(s, TYPE_ID_AUTODETECT_REQUEST);
+    out_uint16_le(s, self->seq_number);
+    out_uint16_le(s, request_type);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Adding header [MS-RDPBCGR] Auto-Detect "
+              "Request headerLength %d, sequenceNumber %d, "
+              "requestType 0x%4.4x",
+              header_length, self->seq_number, request_type);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_autodetect_send(struct xrdp_autodetect *self, struct stream *s)
+{
+    s_mark_end(s);
+    if (xrdp_sec_send_msgchannel(self->sec_layer, s, SEC_AUTODETECT_REQ) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_autodetect_send: "
+            "xrdp_sec_send_msgchannel failed");
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* [MS-RDPBCGR] RDP_RTT_REQUEST, returns error */
+static int
+xrdp_autodetect_send_rtt(struct xrdp_autodetect *self, int request_type)
+{
+    struct stream *s;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    rv = xrdp_autodetect_init(self, s, 6, request_type);
+    if (rv == 0)
+    {
+        self->rtt_seq_number = self->seq_number;
+        self->rtt_sent = g_time_usec();
+        rv = xrdp_autodetect_send(self, s);
+    }
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* [MS-RDPBCGR] RDP_BW_START, RDP_BW_PAYLOAD and RDP_BW_STOP. A payload is
+   only sent at connect time, in the session the measurement is of
+   whatever else is being sent
+   returns error */
+static int
+xrdp_autodetect_send_bw(struct xrdp_autodetect *self, int request_type,
+                        int payload_bytes)
+{
+    struct stream *s;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 8192 + payload_bytes);
+    if (request_type == RDP_BW_START_CONTINUOUS ||
+            request_type == RDP_BW_START_CONNECT_TIME ||
+            request_type == RDP_BW_STOP_CONTINUOUS)
+    {
+        rv = xrdp_autodetect_init(self, s, 6, request_type);
+    }
+    else
+    {
+        rv = xrdp_autodetect_init(self, s, 8, request_type);
+        if (rv == 0)
+        {
+            out_uint16_le(s, payload_bytes); /* payloadLength */
+            out_uint8s(s, payload_bytes);
+        }
+    }
+    if (rv == 0)
+    {
+        rv = xrdp_autodetect_send(self, s);
+    }
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* [MS-RDPBCGR] RDP_NETCHAR_RESULT, returns error */
+static int
+xrdp_autodetect_send_netchar_result(struct xrdp_autodetect *self)
+{
+    struct xrdp_client_info *ci;
+    struct stream *s;
+    int rv;
+
+    ci = &(self->sec_layer->rdp_layer->client_info);
+    make_stream(s);
+    init_stream(s, 8192);
+    rv = xrdp_autodetect_init(self, s, 18, RDP_NETCHAR_RESULT_ALL);
+    if (rv == 0)
+    {
+        out_uint32_le(s, ci->network_base_rtt);
+        out_uint32_le(s, ci->network_bandwidth);
+        out_uint32_le(s, ci->network_avg_rtt);
+        rv = xrdp_autodetect_send(self, s);
+    }
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* Measures the connection before the capabilities are exchanged
+   returns error */
+int
+xrdp_autodetect_start_connect_time(struct xrdp_autodetect *self)
+{
+    int index;
+
+    LOG(LOG_LEVEL_DEBUG, "xrdp_autodetect_start_connect_time:");
+    self->connect_time = 1;
+    if (xrdp_autodetect_send_rtt(self, RDP_RTT_REQUEST_CONNECT_TIME) != 0)
+    {
+        return 1;
+    }
+    if (xrdp_autodetect_send_bw(self, RDP_BW_START_CONNECT_TIME, 0) != 0)
+    {
+        return 1;
+    }
+    for (index = 0; index < AUTODETECT_PAYLOAD_COUNT; index++)
+    {
+        if (xrdp_autodetect_send_bw(self, RDP_BW_PAYLOAD,
+                                    AUTODETECT_PAYLOAD_BYTES) != 0)
+        {
+            return 1;
+        }
+    }
+    if (xrdp_autodetect_send_bw(self, RDP_BW_STOP_CONNECT_TIME, 0) != 0)
+    {
+        return 1;
+    }
+    self->bw_state = AUTODETECT_BW_STOPPED;
+    self->bw_changed = g_time_usec();
+    self->connect_deadline = self->bw_changed +
+                             AUTODETECT_CONNECT_TIME_MS * 1000;
+    return 0;
+}
+
+/*****************************************************************************/
+/* Ends connect-time detection, the connection type is picked from the
+   results, or left to the defaults, as for a client without
+   auto-detection, if there is no bandwidth result
+   returns error, or -1 as demand active should be sent now */
+static int
+xrdp_autodetect_connect_time_done(struct xrdp_autodetect *self, tui64 now)
+{
+    struct xrdp_client_info *ci;
+
+    ci = &(self->sec_layer->rdp_layer->client_info);
+    self->connect_time = 0;
+    self->result_changed = 0;
+    self->rtt_sent = 0;
+    self->bw_state = AUTODETECT_BW_IDLE;
+    self->next_rtt = now + AUTODETECT_RTT_INTERVAL_MS * 1000;
+    self->next_bw = now + AUTODETECT_BW_INTERVAL_MS * 1000;
+    if (ci->network_bandwidth == 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Network auto-detection got no results, "
+            "using the default connection type");
+        return -1;
+    }
+    ci->mcs_connection_type =
+        xrdp_autodetect_connection_type(ci->network_bandwidth,
+                                        ci->network_base_rtt);
+    LOG(LOG_LEVEL_INFO, "Network auto-detection: RTT %d ms, bandwidth "
+        "%d kbit/s, connection type %d", ci->network_base_rtt,
+        ci->network_bandwidth, ci->mcs_connection_type);
+    if (xrdp_autodetect_send_netchar_result(self) != 0)
+    {
+        return 1;
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+static void
+xrdp_autodetect_rtt_result(struct xrdp_client_info *ci, int rtt)
+{
+    rtt = MAX(rtt, 1);
+    if (ci->network_base_rtt == 0 || rtt < ci->network_base_rtt)
+    {
+        ci->network_base_rtt = rtt;
+    }
+    if (ci->network_avg_rtt == 0)
+    {
+        ci->network_avg_rtt = rtt;
+    }
+    else
+    {
+        ci->network_avg_rtt = (ci->network_avg_rtt * 7 + rtt) / 8;
+    }
+}
+
+/*****************************************************************************/
+/* Processes an [MS-RDPBCGR] Auto-Detect Response PDU, after the security
+   header
+   returns error, or -1 if connect-time detection is complete and demand
+   active should be sent */
+int
+xrdp_autodetect_process_rsp(struct xrdp_autodetect *self, struct stream *s)
+{
+    struct xrdp_client_info *ci;
+    struct xrdp_session *session;
+    int type_id;
+    int seq_number;
+    int response_type;
+    unsigned int time_delta;
+    unsigned int byte_count;
+    int bandwidth;
+    int rtt;
+    tui64 now;
+
+    if (!s_check_rem_and_log(s, 6, "Parsing [MS-RDPBCGR] Auto-Detect Response"))
+    {
+        return 1;
+    }
+    in_uint8s(s, 1); /* headerLength */
+    in_uint8(s, type_id);
+    in_uint16_le(s, seq_number);
+    in_uint16_le(s, response_type);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Received header [MS-RDPBCGR] Auto-Detect "
+              "Response headerTypeId %d, sequenceNumber %d, "
+              "responseType 0x%4.4x", type_id, seq_number, response_type);
+    if (type_id != TYPE_ID_AUTODETECT_RESPONSE)
+    {
+        LOG(LOG_LEVEL_WARNING, "Received [MS-RDPBCGR] Auto-Detect Response "
+            "with unexpected headerTypeId %d (ignored)", type_id);
+        return 0;
+    }
+
+    ci = &(self->sec_layer->rdp_layer->client_info);
+    now = g_time_usec();
+    switch (response_type)
+    {
+        case RDP_RTT_RESPONSE:
+            if (self->rtt_sent == 0 || seq_number != self->rtt_seq_number)
+            {
+                LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_process_rsp: "
+                          "unexpected RTT response %d", seq_number);
+                return 0;
+            }
+            xrdp_autodetect_rtt_result(ci, (int)
+                                       ((now - self->rtt_sent + 999) / 1000));
+            self->rtt_sent = 0;
+            break;
+        case RDP_BW_RESULTS_CONNECT_TIME:
+        case RDP_BW_RESULTS_CONTINUOUS:
+            if (!s_check_rem_and_log(s, 8, "Parsing [MS-RDPBCGR] RDP_BW_RESULTS"))
+            {
+                return 1;
+            }
+            in_uint32_le(s, time_delta);
+            in_uint32_le(s, byte_count);
+            LOG_DEVEL(LOG_LEVEL_TRACE, "Received [MS-RDPBCGR] RDP_BW_RESULTS "
+                      "timeDelta %u, byteCount %u", time_delta, byte_count);
+            self->bw_state = AUTODETECT_BW_IDLE;
+            self->bw_changed = now;
+            if (response_type == RDP_BW_RESULTS_CONTINUOUS &&
+                    byte_count < AUTODETECT_BW_MIN_BYTES)
+            {
+                return 0;
+            }
+            bandwidth = (int) ((tui64) byte_count * 8 / MAX(time_delta, 1));
+            bandwidth = MAX(bandwidth, 1);
+            if (ci->network_bandwidth == 0 ||
+                    response_type == RDP_BW_RESULTS_CONNECT_TIME)
+            {
+                ci->network_bandwidth = bandwidth;
+            }
+            else
+            {
+                ci->network_bandwidth = (ci->network_bandwidth * 3 +
+                                         bandwidth) / 4;
+            }
+            self->result_changed = 1;
+            break;
+        case RDP_NETCHAR_SYNC:
+            /* sent instead of the other responses by a reconnecting
+               client which remembers the results */
+            if (!s_check_rem_and_log(s, 8, "Parsing [MS-RDPBCGR] RDP_NETCHAR_SYNC"))
+            {
+                return 1;
+            }
+            in_uint32_le(s, bandwidth);
+            in_uint32_le(s, rtt);
+            ci->network_bandwidth = MAX(bandwidth, 1);
+            xrdp_autodetect_rtt_result(ci, rtt);
+            self->rtt_sent = 0;
+            self->bw_state = AUTODETECT_BW_IDLE;
+            break;
+        default:
+            LOG(LOG_LEVEL_WARNING, "Received [MS-RDPBCGR] Auto-Detect "
+                "Response with unknown responseType 0x%4.4x (ignored)",
+                response_type);
+            return 0;
+    }
+
+    if (self->connect_time)
+    {
+        if (self->rtt_sent != 0 || self->bw_state != AUTODETECT_BW_IDLE)
+        {
+            return 0;
+        }
+        return xrdp_autodetect_connect_time_done(self, now);
+    }
+
+    session = self->sec_layer->rdp_layer->session;
+    if (session != NULL && session->up_and_running &&
+            session->callback != 0)
+    {
+        session->callback(session->id, 0x555a, 0, 0, 0, 0);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Sends any auto-detect requests which are due in the session, and gives
+   up on connect-time detection which is taking too long
+   returns error, or -1 if connect-time detection was given up on and
+   demand active should be sent */
+int
+xrdp_autodetect_check(struct xrdp_autodetect *self)
+{
+    struct xrdp_session *session;
+    tui64 now;
+
+    if (!xrdp_autodetect_enabled(self))
+    {
+        return 0;
+    }
+    now = g_time_usec();
+    if (self->connect_time)
+    {
+        if (now < self->connect_deadline)
+        {
+            return 0;
+        }
+        LOG(LOG_LEVEL_WARNING, "Network auto-detection timed out");
+        return xrdp_autodetect_connect_time_done(self, now);
+    }
+    session = self->sec_layer->rdp_layer->session;
+    if (!session->up_and_running)
+    {
+        return 0;
+    }
+    if (self->rtt_sent != 0 &&
+            now - self->rtt_sent > AUTODETECT_TIMEOUT_MS * 1000)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_check: RTT timed out");
+        self->rtt_sent = 0;
+    }
+    if (self->rtt_sent == 0 && now >= self->next_rtt)
+    {
+        self->next_rtt = now + AUTODETECT_RTT_INTERVAL_MS * 1000;
+        if (xrdp_autodetect_send_rtt(self, RDP_RTT_REQUEST_CONTINUOUS) != 0)
+        {
+            return 1;
+        }
+    }
+    switch (self->bw_state)
+    {
+        case AUTODETECT_BW_IDLE:
+            if (now >= self->next_bw)
+            {
+                self->next_bw = now + AUTODETECT_BW_INTERVAL_MS * 1000;
+                self->bw_state = AUTODETECT_BW_STARTED;
+                self->bw_changed = now;
+                if (xrdp_autodetect_send_bw(self, RDP_BW_START_CONTINUOUS,
+                                            0) != 0)
+                {
+                    return 1;
+                }
+            }
+            break;
+        case AUTODETECT_BW_STARTED:
+            if (now - self->bw_changed >= AUTODETECT_BW_WINDOW_MS * 1000)
+            {
+                self->bw_state = AUTODETECT_BW_STOPPED;
+                self->bw_changed = now;
+                if (xrdp_autodetect_send_bw(self, RDP_BW_STOP_CONTINUOUS,
+                                            0) != 0)
+                {
+                    return 1;
+                }
+            }
+            break;
+        default:
+            if (now - self->bw_changed > AUTODETECT_TIMEOUT_MS * 1000)
+            {
+                LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_check: "
+                          "bandwidth results timed out");
+                self->bw_state = AUTODETECT_BW_IDLE;
+            }
+            break;
+    }
+    if (self->result_changed)
+    {
+        self->result_changed = 0;
+        if (xrdp_autodetect_send_netchar_result(self) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Lowers *timeout (milliseconds, -1 for none) to when
+   xrdp_autodetect_check() next has something to do */
+void
+xrdp_autodetect_get_timeout(struct xrdp_autodetect *self, int *timeout)
+{
+    struct xrdp_session *session;
+    tui64 now;
+    tui64 due;
+    int ms;
+
+    if (!xrdp_autodetect_enabled(self))
+    {
+        return;
+    }
+    session = self->sec_layer->rdp_layer->session;
+    if (self->connect_time)
+    {
+        due = self->connect_deadline;
+    }
+    else if (!session->up_and_running)
+    {
+        return;
+    }
+    else
+    {
+        if (self->rtt_sent != 0)
+        {
+            due = self->rtt_sent + AUTODETECT_TIMEOUT_MS * 1000;
+        }
+        else
+        {
+            due = self->next_rtt;
+        }
+        switch (self->bw_state)
+        {
+            case AUTODETECT_BW_IDLE:
+                due = MIN(due, self->next_bw);
+                break;
+            case AUTODETECT_BW_STARTED:
+                due = MIN(due, self->bw_changed +
+                          AUTODETECT_BW_WINDOW_MS * 1000);
+                break;
+            default:
+                due = MIN(due, self->bw_changed +
+                          AUTODETECT_TIMEOUT_MS * 1000);
+                break;
+        }
+    }
+    now = g_time_usec();
+    /* a timeout of 0 would be no timeout */
+    ms = due > now ? (int) ((due - now + 999) / 1000) : 1;
+    if (*timeout < 0 || ms < *timeout)
+    {
+        *timeout = ms;
+    }
+}
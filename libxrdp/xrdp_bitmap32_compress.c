@@ -28,24 +28,436 @@ http://msdn.microsoft.com/en-us/library/cc241877.aspx
 #include <config_ac.h>
 #endif
 
+#include <pthread.h>
+
 #include "libxrdp.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLANAR_X86_SIMD 1
+#include <emmintrin.h>
+#endif
+
 #define FLAGS_RLE     0x10
 #define FLAGS_NOALPHA 0x20
 
+/* most bytes fpack writes for a line of cx bytes, a code byte for every
+   15 raw bytes and one for what is left */
+#define RLE_LINE_MAX_BYTES(cx) ((cx) + (cx) / 15 + 2)
+
+/* per CPU kernels, each returns how many pixels / bytes it handled,
+   the caller finishes the remainder with the plain C loops below */
+struct planar_funcs
+{
+    const char *name;
+    int (*split3_row)(const int *src, int width,
+                      char *r_data, char *g_data, char *b_data);
+    int (*split4_row)(const int *src, int width,
+                      char *a_data, char *r_data, char *g_data, char *b_data);
+    int (*delta)(const char *src8, char *dst8, int cx, int bytes);
+    /* count of consecutive ptr8[i] == ptr8[i + 1] from ptr8 up to lend */
+    int (*run_equal)(const char *ptr8, const char *lend);
+    /* count of consecutive ptr8[i] != ptr8[i + 1] from ptr8 up to lend */
+    int (*run_differ)(const char *ptr8, const char *lend);
+};
+
+static const struct planar_funcs *g_planar_funcs = NULL;
+/* the bitmap pool threads compress at the same time, so the kernels are
+   picked once, by whichever gets there first */
+static pthread_once_t g_planar_funcs_once = PTHREAD_ONCE_INIT;
 
 
 /*****************************************************************************/
-/* split RGB */
+/* split RGB, 4 pixels at a time */
 static int
-fsplit3(char *in_data, int start_line, int width, int e,
-        char *r_data, char *g_data, char *b_data)
+fsplit3_row_c(const int *src, int width,
+              char *r_data, char *g_data, char *b_data)
 {
+    int index;
 #if defined(L_ENDIAN)
     int rp;
     int gp;
     int bp;
+    int pixel;
+
+    index = 0;
+    while (index + 4 <= width)
+    {
+        pixel = *src;
+        src++;
+        rp  = (pixel >> 16) & 0x000000ff;
+        gp  = (pixel >>  8) & 0x000000ff;
+        bp  = (pixel >>  0) & 0x000000ff;
+        pixel  = *src;
+        src++;
+        rp |= (pixel >>  8) & 0x0000ff00;
+        gp |= (pixel <<  0) & 0x0000ff00;
+        bp |= (pixel <<  8) & 0x0000ff00;
+        pixel = *src;
+        src++;
+        rp |= (pixel >>  0) & 0x00ff0000;
+        gp |= (pixel <<  8) & 0x00ff0000;
+        bp |= (pixel << 16) & 0x00ff0000;
+        pixel = *src;
+        src++;
+        rp |= (pixel <<  8) & 0xff000000;
+        gp |= (pixel << 16) & 0xff000000;
+        bp |= (pixel << 24) & 0xff000000;
+        *((int *)(r_data + index)) = rp;
+        *((int *)(g_data + index)) = gp;
+        *((int *)(b_data + index)) = bp;
+        index += 4;
+    }
+#else
+    index = 0;
 #endif
+    return index;
+}
+
+/*****************************************************************************/
+/* split ARGB, 4 pixels at a time */
+static int
+fsplit4_row_c(const int *src, int width,
+              char *a_data, char *r_data, char *g_data, char *b_data)
+{
+    int index;
+#if defined(L_ENDIAN)
+    int ap;
+    int rp;
+    int gp;
+    int bp;
+    int pixel;
+
+    index = 0;
+    while (index + 4 <= width)
+    {
+        pixel = *src;
+        src++;
+        ap  = (pixel >> 24) & 0x000000ff;
+        rp  = (pixel >> 16) & 0x000000ff;
+        gp  = (pixel >>  8) & 0x000000ff;
+        bp  = (pixel >>  0) & 0x000000ff;
+        pixel  = *src;
+        src++;
+        ap |= (pixel >> 16) & 0x0000ff00;
+        rp |= (pixel >>  8) & 0x0000ff00;
+        gp |= (pixel <<  0) & 0x0000ff00;
+        bp |= (pixel <<  8) & 0x0000ff00;
+        pixel = *src;
+        src++;
+        ap |= (pixel >>  8) & 0x00ff0000;
+        rp |= (pixel >>  0) & 0x00ff0000;
+        gp |= (pixel <<  8) & 0x00ff0000;
+        bp |= (pixel << 16) & 0x00ff0000;
+        pixel = *src;
+        src++;
+        ap |= (pixel <<  0) & 0xff000000;
+        rp |= (pixel <<  8) & 0xff000000;
+        gp |= (pixel << 16) & 0xff000000;
+        bp |= (pixel << 24) & 0xff000000;
+        *((int *)(a_data + index)) = ap;
+        *((int *)(r_data + index)) = rp;
+        *((int *)(g_data + index)) = gp;
+        *((int *)(b_data + index)) = bp;
+        index += 4;
+    }
+#else
+    index = 0;
+#endif
+    return index;
+}
+
+/*****************************************************************************/
+/* nothing to do, the unrolled loop in fdelta does all the work */
+static int
+fdelta_c(const char *src8, char *dst8, int cx, int bytes)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+frun_equal_c(const char *ptr8, const char *lend)
+{
+    const char *start;
+
+    start = ptr8;
+    while ((ptr8 < lend) && (ptr8[0] == ptr8[1]))
+    {
+        ptr8++;
+    }
+    return (int) (ptr8 - start);
+}
+
+/*****************************************************************************/
+static int
+frun_differ_c(const char *ptr8, const char *lend)
+{
+    const char *start;
+
+    start = ptr8;
+    while ((ptr8 < lend) && (ptr8[0] != ptr8[1]))
+    {
+        ptr8++;
+    }
+    return (int) (ptr8 - start);
+}
+
+static const struct planar_funcs g_planar_funcs_c =
+{
+    "c",
+    fsplit3_row_c,
+    fsplit4_row_c,
+    fdelta_c,
+    frun_equal_c,
+    frun_differ_c
+};
+
+#if defined(PLANAR_X86_SIMD)
+
+#define PLANAR_SSE2 __attribute__((target("sse2")))
+
+/*****************************************************************************/
+/* split RGB, 16 pixels at a time */
+static PLANAR_SSE2 int
+fsplit3_row_sse2(const int *src, int width,
+                 char *r_data, char *g_data, char *b_data)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i mask;
+    __m128i lo;
+    __m128i hi;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (src + 0));
+        p1 = _mm_loadu_si128((const __m128i *) (src + 4));
+        p2 = _mm_loadu_si128((const __m128i *) (src + 8));
+        p3 = _mm_loadu_si128((const __m128i *) (src + 12));
+        src += 16;
+        lo = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                             _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+        hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask),
+                             _mm_and_si128(_mm_srli_epi32(p3, 16), mask));
+        _mm_storeu_si128((__m128i *) (r_data + index),
+                         _mm_packus_epi16(lo, hi));
+        lo = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                             _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask),
+                             _mm_and_si128(_mm_srli_epi32(p3, 8), mask));
+        _mm_storeu_si128((__m128i *) (g_data + index),
+                         _mm_packus_epi16(lo, hi));
+        lo = _mm_packs_epi32(_mm_and_si128(p0, mask),
+                             _mm_and_si128(p1, mask));
+        hi = _mm_packs_epi32(_mm_and_si128(p2, mask),
+                             _mm_and_si128(p3, mask));
+        _mm_storeu_si128((__m128i *) (b_data + index),
+                         _mm_packus_epi16(lo, hi));
+        index += 16;
+    }
+    return index;
+}
+
+/*****************************************************************************/
+/* split ARGB, 16 pixels at a time */
+static PLANAR_SSE2 int
+fsplit4_row_sse2(const int *src, int width,
+                 char *a_data, char *r_data, char *g_data, char *b_data)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i mask;
+    __m128i lo;
+    __m128i hi;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (src + 0));
+        p1 = _mm_loadu_si128((const __m128i *) (src + 4));
+        p2 = _mm_loadu_si128((const __m128i *) (src + 8));
+        p3 = _mm_loadu_si128((const __m128i *) (src + 12));
+        src += 16;
+        lo = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+        hi = _mm_packs_epi32(_mm_srli_epi32(p2, 24), _mm_srli_epi32(p3, 24));
+        _mm_storeu_si128((__m128i *) (a_data + index),
+                         _mm_packus_epi16(lo, hi));
+        lo = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                             _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+        hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask),
+                             _mm_and_si128(_mm_srli_epi32(p3, 16), mask));
+        _mm_storeu_si128((__m128i *) (r_data + index),
+                         _mm_packus_epi16(lo, hi));
+        lo = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                             _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask),
+                             _mm_and_si128(_mm_srli_epi32(p3, 8), mask));
+        _mm_storeu_si128((__m128i *) (g_data + index),
+                         _mm_packus_epi16(lo, hi));
+        lo = _mm_packs_epi32(_mm_and_si128(p0, mask),
+                             _mm_and_si128(p1, mask));
+        hi = _mm_packs_epi32(_mm_and_si128(p2, mask),
+                             _mm_and_si128(p3, mask));
+        _mm_storeu_si128((__m128i *) (b_data + index),
+                         _mm_packus_epi16(lo, hi));
+        index += 16;
+    }
+    return index;
+}
+
+/*****************************************************************************/
+/* same as DELTA_ONE, 16 bytes at a time
+   delta >= 0 -> delta * 2, delta < 0 -> -delta * 2 - 1 */
+static PLANAR_SSE2 int
+fdelta_sse2(const char *src8, char *dst8, int cx, int bytes)
+{
+    __m128i above;
+    __m128i below;
+    __m128i delta;
+    __m128i is_neg;
+    __m128i zero;
+    int index;
+
+    zero = _mm_setzero_si128();
+    index = 0;
+    while (index + 16 <= bytes)
+    {
+        above = _mm_loadu_si128((const __m128i *) (src8 + index));
+        below = _mm_loadu_si128((const __m128i *) (src8 + index + cx));
+        delta = _mm_sub_epi8(below, above);
+        is_neg = _mm_cmpgt_epi8(zero, delta);
+        delta = _mm_sub_epi8(_mm_xor_si128(delta, is_neg), is_neg);
+        delta = _mm_add_epi8(_mm_add_epi8(delta, delta), is_neg);
+        _mm_storeu_si128((__m128i *) (dst8 + index + cx), delta);
+        index += 16;
+    }
+    return index;
+}
+
+/*****************************************************************************/
+static PLANAR_SSE2 int
+frun_equal_sse2(const char *ptr8, const char *lend)
+{
+    const char *start;
+    __m128i a;
+    __m128i b;
+    int mask;
+
+    start = ptr8;
+    while (ptr8 + 16 <= lend)
+    {
+        a = _mm_loadu_si128((const __m128i *) ptr8);
+        b = _mm_loadu_si128((const __m128i *) (ptr8 + 1));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (mask != 0xFFFF)
+        {
+            return (int) (ptr8 - start) + __builtin_ctz(~mask);
+        }
+        ptr8 += 16;
+    }
+    return (int) (ptr8 - start) + frun_equal_c(ptr8, lend);
+}
+
+/*****************************************************************************/
+static PLANAR_SSE2 int
+frun_differ_sse2(const char *ptr8, const char *lend)
+{
+    const char *start;
+    __m128i a;
+    __m128i b;
+    int mask;
+
+    start = ptr8;
+    while (ptr8 + 16 <= lend)
+    {
+        a = _mm_loadu_si128((const __m128i *) ptr8);
+        b = _mm_loadu_si128((const __m128i *) (ptr8 + 1));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (mask != 0)
+        {
+            return (int) (ptr8 - start) + __builtin_ctz(mask);
+        }
+        ptr8 += 16;
+    }
+    return (int) (ptr8 - start) + frun_differ_c(ptr8, lend);
+}
+
+static const struct planar_funcs g_planar_funcs_sse2 =
+{
+    "sse2",
+    fsplit3_row_sse2,
+    fsplit4_row_sse2,
+    fdelta_sse2,
+    frun_equal_sse2,
+    frun_differ_sse2
+};
+
+#endif
+
+/*****************************************************************************/
+/* select the compression kernels, level is one of the PLANAR_SIMD_*
+   values, PLANAR_SIMD_AUTO picks the best the CPU supports
+   not for use while anything is compressing, e.g. from tests
+   returns the level in use */
+int
+xrdp_bitmap32_compress_set_simd(int level)
+{
+    const struct planar_funcs *funcs;
+    int rv;
+
+    funcs = &g_planar_funcs_c;
+    rv = PLANAR_SIMD_NONE;
+#if defined(PLANAR_X86_SIMD)
+    if (level == PLANAR_SIMD_AUTO || level == PLANAR_SIMD_SSE2)
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+        {
+            funcs = &g_planar_funcs_sse2;
+            rv = PLANAR_SIMD_SSE2;
+        }
+    }
+#endif
+    LOG(LOG_LEVEL_DEBUG, "xrdp_bitmap32_compress_set_simd: using %s kernels",
+        funcs->name);
+    g_planar_funcs = funcs;
+    return rv;
+}
+
+/*****************************************************************************/
+static void
+planar_funcs_init(void)
+{
+    if (g_planar_funcs == NULL)
+    {
+        xrdp_bitmap32_compress_set_simd(PLANAR_SIMD_AUTO);
+    }
+}
+
+/*****************************************************************************/
+static const struct planar_funcs *
+planar_funcs_get(void)
+{
+    pthread_once(&g_planar_funcs_once, planar_funcs_init);
+    return g_planar_funcs;
+}
+
+/*****************************************************************************/
+/* split RGB */
+static int
+fsplit3(const struct planar_funcs *funcs,
+        char *in_data, int start_line, int width, int e,
+        char *r_data, char *g_data, char *b_data)
+{
     int index;
     int out_index;
     int pixel;
@@ -57,37 +469,10 @@ fsplit3(char *in_data, int start_line, int width, int e,
     while (start_line >= 0)
     {
         ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int *)(r_data + out_index)) = rp;
-            *((int *)(g_data + out_index)) = gp;
-            *((int *)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
-        }
-#endif
+        index = funcs->split3_row(ptr32, width, r_data + out_index,
+                                  g_data + out_index, b_data + out_index);
+        ptr32 += index;
+        out_index += index;
         while (index < width)
         {
             pixel = *ptr32;
@@ -118,15 +503,10 @@ fsplit3(char *in_data, int start_line, int width, int e,
 /*****************************************************************************/
 /* split ARGB */
 static int
-fsplit4(char *in_data, int start_line, int width, int e,
+fsplit4(const struct planar_funcs *funcs,
+        char *in_data, int start_line, int width, int e,
         char *a_data, char *r_data, char *g_data, char *b_data)
 {
-#if defined(L_ENDIAN)
-    int ap;
-    int rp;
-    int gp;
-    int bp;
-#endif
     int index;
     int out_index;
     int pixel;
@@ -138,42 +518,11 @@ fsplit4(char *in_data, int start_line, int width, int e,
     while (start_line >= 0)
     {
         ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            ap  = (pixel >> 24) & 0x000000ff;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            ap |= (pixel >> 16) & 0x0000ff00;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel >>  8) & 0x00ff0000;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel <<  0) & 0xff000000;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int *)(a_data + out_index)) = ap;
-            *((int *)(r_data + out_index)) = rp;
-            *((int *)(g_data + out_index)) = gp;
-            *((int *)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
-        }
-#endif
+        index = funcs->split4_row(ptr32, width, a_data + out_index,
+                                  r_data + out_index, g_data + out_index,
+                                  b_data + out_index);
+        ptr32 += index;
+        out_index += index;
         while (index < width)
         {
             pixel = *ptr32;
@@ -215,18 +564,21 @@ fsplit4(char *in_data, int start_line, int width, int e,
 
 /*****************************************************************************/
 static int
-fdelta(char *in_plane, char *out_plane, int cx, int cy)
+fdelta(const struct planar_funcs *funcs,
+       char *in_plane, char *out_plane, int cx, int cy)
 {
     char delta;
     char is_neg;
     char *src8;
     char *dst8;
     char *src8_end;
+    int done;
 
     g_memcpy(out_plane, in_plane, cx);
-    src8 = in_plane;
-    dst8 = out_plane;
-    src8_end = src8 + (cx * cy - cx);
+    done = funcs->delta(in_plane, out_plane, cx, cx * cy - cx);
+    src8 = in_plane + done;
+    dst8 = out_plane + done;
+    src8_end = in_plane + (cx * cy - cx);
     while (src8 + 8 <= src8_end)
     {
         DELTA_ONE;
@@ -312,7 +664,8 @@ fout(int collen, int replen, char *colptr, struct stream *s)
 
 /*****************************************************************************/
 static int
-fpack(char *plane, int cx, int cy, struct stream *s)
+fpack(const struct planar_funcs *funcs,
+      char *plane, int cx, int cy, struct stream *s)
 {
     char *ptr8;
     char *colptr;
@@ -321,6 +674,7 @@ fpack(char *plane, int cx, int cy, struct stream *s)
     int jndex;
     int collen;
     int replen;
+    int count;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "fpack:");
     holdp = s->p;
@@ -345,31 +699,34 @@ fpack(char *plane, int cx, int cy, struct stream *s)
         {
             if (ptr8[0] == ptr8[1])
             {
-                replen++;
+                /* whole run of repeats */
+                count = funcs->run_equal(ptr8, lend);
+                replen += count;
+                ptr8 += count;
             }
-            else
+            else if (replen > 0)
             {
-                if (replen > 0)
+                if (replen < 3)
                 {
-                    if (replen < 3)
-                    {
-                        collen += replen + 1;
-                        replen = 0;
-                    }
-                    else
-                    {
-                        fout(collen, replen, colptr, s);
-                        colptr = ptr8 + 1;
-                        replen = 0;
-                        collen = 1;
-                    }
+                    collen += replen + 1;
+                    replen = 0;
                 }
                 else
                 {
-                    collen++;
+                    fout(collen, replen, colptr, s);
+                    colptr = ptr8 + 1;
+                    replen = 0;
+                    collen = 1;
                 }
+                ptr8++;
+            }
+            else
+            {
+                /* whole run of raw bytes */
+                count = funcs->run_differ(ptr8, lend);
+                collen += count;
+                ptr8 += count;
             }
-            ptr8++;
         }
         /* end of line */
         fout(collen, replen, colptr, s);
@@ -432,8 +789,11 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     int max_bytes;
     int total_bytes;
     int header;
+    int room;
+    const struct planar_funcs *funcs;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_bitmap32_compress:");
+    funcs = planar_funcs_get();
     max_bytes = 4 * 1024;
     /* need max 8, 4K planes for work */
     if (max_bytes * 8 > temp_s->size)
@@ -451,23 +811,26 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     g_data = r_data + max_bytes;
     b_data = g_data + max_bytes;
     hold_p = s->p;
+    room = s->size - (int) (s->p - s->data) - 1;
 
     if (header & FLAGS_NOALPHA)
     {
-        cy = fsplit3(in_data, start_line, width, e,
+        cy = fsplit3(funcs, in_data, start_line, width, e,
                      sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
+            /* each try is packed into s before the size is checked */
+            cy = MIN(cy, room / (3 * RLE_LINE_MAX_BYTES(cx)));
+            fdelta(funcs, sr_data, r_data, cx, cy);
+            fdelta(funcs, sg_data, g_data, cx, cy);
+            fdelta(funcs, sb_data, b_data, cx, cy);
             while (cy > 0)
             {
                 s->p = hold_p;
                 out_uint8(s, header);
-                r_bytes = fpack(r_data, cx, cy, s);
-                g_bytes = fpack(g_data, cx, cy, s);
-                b_bytes = fpack(b_data, cx, cy, s);
+                r_bytes = fpack(funcs, r_data, cx, cy, s);
+                g_bytes = fpack(funcs, g_data, cx, cy, s);
+                b_bytes = fpack(funcs, b_data, cx, cy, s);
                 max_bytes = cx * cy * 3;
                 total_bytes = r_bytes + g_bytes + b_bytes;
                 if (total_bytes > max_bytes)
@@ -503,22 +866,24 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     }
     else
     {
-        cy = fsplit4(in_data, start_line, width, e,
+        cy = fsplit4(funcs, in_data, start_line, width, e,
                      sa_data, sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
-            fdelta(sa_data, a_data, cx, cy);
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
+            /* each try is packed into s before the size is checked */
+            cy = MIN(cy, room / (4 * RLE_LINE_MAX_BYTES(cx)));
+            fdelta(funcs, sa_data, a_data, cx, cy);
+            fdelta(funcs, sr_data, r_data, cx, cy);
+            fdelta(funcs, sg_data, g_data, cx, cy);
+            fdelta(funcs, sb_data, b_data, cx, cy);
             while (cy > 0)
             {
                 s->p = hold_p;
                 out_uint8(s, header);
-                a_bytes = fpack(a_data, cx, cy, s);
-                r_bytes = fpack(r_data, cx, cy, s);
-                g_bytes = fpack(g_data, cx, cy, s);
-                b_bytes = fpack(b_data, cx, cy, s);
+                a_bytes = fpack(funcs, a_data, cx, cy, s);
+                r_bytes = fpack(funcs, r_data, cx, cy, s);
+                g_bytes = fpack(funcs, g_data, cx, cy, s);
+                b_bytes = fpack(funcs, b_data, cx, cy, s);
                 max_bytes = cx * cy * 4;
                 total_bytes = a_bytes + r_bytes + g_bytes + b_bytes;
                 if (total_bytes > max_bytes)
@@ -0,0 +1,185 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * worker threads used to compress bitmap tiles in parallel
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "thread_calls.h"
+
+struct xrdp_bitmap_pool
+{
+    int num_threads;
+    int shutdown;
+    tbus mutex;
+    tbus work_sem; /* posted once per thread when a batch is ready */
+    tbus done_sem; /* posted once per thread when it has finished a batch */
+    /* current batch, protected by mutex */
+    xrdp_bitmap_pool_proc proc;
+    char *jobs;
+    int job_size;
+    int job_count;
+    int next_job;
+};
+
+/*****************************************************************************/
+/* take jobs from the current batch until there are none left */
+static void
+xrdp_bitmap_pool_run_jobs(struct xrdp_bitmap_pool *self)
+{
+    int index;
+
+    for (;;)
+    {
+        tc_mutex_lock(self->mutex);
+        index = self->next_job;
+        if (index < self->job_count)
+        {
+            self->next_job++;
+        }
+        tc_mutex_unlock(self->mutex);
+        if (index >= self->job_count)
+        {
+            break;
+        }
+        self->proc(self->jobs + index * self->job_size);
+    }
+}
+
+/*****************************************************************************/
+static THREAD_RV THREAD_CC
+xrdp_bitmap_pool_thread(void *arg)
+{
+    struct xrdp_bitmap_pool *self;
+
+    self = (struct xrdp_bitmap_pool *) arg;
+    for (;;)
+    {
+        tc_sem_dec(self->work_sem);
+        if (self->shutdown)
+        {
+            break;
+        }
+        xrdp_bitmap_pool_run_jobs(self);
+        tc_sem_inc(self->done_sem);
+    }
+    tc_sem_inc(self->done_sem);
+    return 0;
+}
+
+/*****************************************************************************/
+struct xrdp_bitmap_pool *
+xrdp_bitmap_pool_create(int num_threads)
+{
+    struct xrdp_bitmap_pool *self;
+    int index;
+
+    if (num_threads < 1)
+    {
+        return NULL;
+    }
+    self = g_new0(struct xrdp_bitmap_pool, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->mutex = tc_mutex_create();
+    self->work_sem = tc_sem_create(0);
+    self->done_sem = tc_sem_create(0);
+    for (index = 0; index < num_threads; index++)
+    {
+        if (tc_thread_create(xrdp_bitmap_pool_thread, self) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_bitmap_pool_create: only %d of %d "
+                "threads started", index, num_threads);
+            break;
+        }
+        self->num_threads++;
+    }
+    if (self->num_threads == 0)
+    {
+        xrdp_bitmap_pool_delete(self);
+        return NULL;
+    }
+    LOG(LOG_LEVEL_INFO, "xrdp_bitmap_pool_create: %d bitmap compression "
+        "threads", self->num_threads);
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_bitmap_pool_delete(struct xrdp_bitmap_pool *self)
+{
+    int index;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    /* threads are detached, wait for each one to say it is leaving */
+    self->shutdown = 1;
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_inc(self->work_sem);
+    }
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+    tc_sem_delete(self->work_sem);
+    tc_sem_delete(self->done_sem);
+    tc_mutex_delete(self->mutex);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* calls proc for each of the job_count jobs, each job_size bytes, in the
+   array jobs, the calling thread helps out
+   returns when all the jobs are done */
+int
+xrdp_bitmap_pool_run(struct xrdp_bitmap_pool *self,
+                     xrdp_bitmap_pool_proc proc,
+                     void *jobs, int job_size, int job_count)
+{
+    int index;
+
+    if (self == NULL || proc == NULL || job_count < 1)
+    {
+        return 1;
+    }
+    tc_mutex_lock(self->mutex);
+    self->proc = proc;
+    self->jobs = (char *) jobs;
+    self->job_size = job_size;
+    self->job_count = job_count;
+    self->next_job = 0;
+    tc_mutex_unlock(self->mutex);
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_inc(self->work_sem);
+    }
+    xrdp_bitmap_pool_run_jobs(self);
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+    return 0;
+}
@@ -1114,6 +1114,18 @@ xrdp_mcs_out_gcc_data(struct xrdp_sec *self)
             "will not be sent a [MS-RDPBCGR] TS_UD_SC_SEC1 message.",
             self->rsa_key_bytes);
     }
+
+    if (self->mcs_layer->msgchan_id != 0)
+    {
+        /* [MS-RDPBCGR] TS_UD_HEADER */
+        out_uint16_le(s, SEC_TAG_SRV_MCS_MSGCHANNEL); /* type */
+        out_uint16_le(s, 6); /* length */
+        /* [MS-RDPBCGR] TS_UD_SC_MCS_MSGCHANNEL */
+        out_uint16_le(s, self->mcs_layer->msgchan_id); /* MCSChannelID */
+        LOG_DEVEL(LOG_LEVEL_TRACE, "Adding struct [MS-RDPBCGR] "
+                  "TS_UD_SC_MCS_MSGCHANNEL MCSChannelID %d",
+                  self->mcs_layer->msgchan_id);
+    }
     s_mark_end(s);
 
     gcc_size = (int)(s->end - ud_ptr) | 0x8000;
@@ -1262,14 +1274,20 @@ static int
 handle_tls_client_channel_join_requests(struct xrdp_mcs *self)
 {
     int index;
+    int count;
     int rv = 0;
 
     static const char *tag = "[MCS Connection Sequence (TLS)]";
     /*
      * Expect a channel join request PDU for each of the static virtual
      * channels, plus the user channel (self->chanid) and the I/O channel
-     * (MCS_GLOBAL_CHANNEL) */
-    for (index = 0; index < self->channel_list->count + 2; index++)
+     * (MCS_GLOBAL_CHANNEL), and the message channel if there is one */
+    count = self->channel_list->count + 2;
+    if (self->msgchan_id != 0)
+    {
+        count++;
+    }
+    for (index = 0; index < count; index++)
     {
         int channel_id;
         LOG(LOG_LEVEL_DEBUG, "%s receive channel join request", tag);
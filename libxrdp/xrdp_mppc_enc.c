@@ -28,6 +28,9 @@
 
 #define RDP_40_HIST_BUF_LEN (1024 * 8) /* RDP 4.0 uses 8K history buf */
 #define RDP_50_HIST_BUF_LEN (1024 * 64) /* RDP 5.0 uses 64K history buf */
+#define RDP_61_HIST_BUF_LEN 2000000 /* RDP 6.1 level 1 history buf */
+#define RDP_61_MAX_LEN 65535 /* MatchOutputOffset is 16 bits */
+#define MPPC_HASH_LEN (1024 * 64) /* hash slots, 16 bit hash */
 
 /* Compression Types */
 #define PACKET_COMPRESSED       0x20
@@ -39,388 +42,71 @@
 #define PACKET_COMPR_TYPE_RDP61 0x03
 #define CompressionTypeMask     0x0F
 
-#define CRC_INIT 0xFFFF
-#define CRC(_crcval, _newchar) _crcval = \
-        ((_crcval) >> 8) ^ g_crc_table[((_crcval) ^ (_newchar)) & 0x00ff]
-
-/* CRC16 defs */
-static const tui16 g_crc_table[256] =
-{
-    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
+/* RDP 6.1 Level1ComprFlags */
+#define L1_COMPRESSED           0x01
+#define L1_NO_COMPRESSION       0x02
+#define L1_PACKET_AT_FRONT      0x04
+#define L1_INNER_COMPRESSION    0x10
+
+/* RDP 6.1 level 1 matching, every input offset is looked up but only every
+   XCRUSH_STEP history offset is added so the table lasts longer */
+#define XCRUSH_WINDOW           32 /* bytes hashed, also the shortest match */
+#define XCRUSH_STEP             8
+#define XCRUSH_HASH_BITS        16
+#define XCRUSH_HASH_MULT        0x01000193
+#define XCRUSH_SLOT(_hash) \
+    (((tui32) ((_hash) * 0x9E3779B1)) >> (32 - XCRUSH_HASH_BITS))
+
+/* hash of the 3 bytes at _p, the shortest match, MPPC_HASH_LEN slots */
+#define MPPC_HASH(_p) \
+    ((((tui32) (tui8) (_p)[0] << 16 | (tui32) (tui8) (_p)[1] << 8 | \
+       (tui32) (tui8) (_p)[2]) * 0x9E3779B1) >> 16)
 
 /*****************************************************************************
-                     insert 2 bits into outputBuffer
+           insert the low _nbits (at most 16) of _data into outputBuffer
 ******************************************************************************/
-#define insert_2_bits(_data) \
+/* most bytes one literal or copy item can add to the output, a 64K copy
+   is 49 bits, on top of up to 7 already in bit_acc */
+#define MPPC_ITEM_MAX_BYTES 8
+/* shorter data is sent as is, it can't gain anything worth having and
+   failing to compress it would throw the history away */
+#define MPPC_MIN_LEN 8
+
+#define insert_bits(_data, _nbits) \
     do \
     { \
-        if ((bits_left >= 3) && (bits_left <= 8)) \
-        { \
-            i = bits_left - 2; \
-            outputBuffer[opb_index] |= _data << i; \
-            bits_left = i; \
-        } \
-        else \
+        bit_acc = (bit_acc << (_nbits)) | (_data); \
+        bit_count += (_nbits); \
+        while (bit_count >= 8) \
         { \
-            i = 2 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= _data >> i; \
-            outputBuffer[opb_index] |= _data << j; \
-            bits_left = j; \
+            bit_count -= 8; \
+            outputBuffer[opb_index++] = (char) (bit_acc >> bit_count); \
         } \
     } while (0)
 
-/*****************************************************************************
-                     insert 3 bits into outputBuffer
-******************************************************************************/
-#define insert_3_bits(_data) \
-    do \
-    { \
-        if ((bits_left >= 4) && (bits_left <= 8)) \
-        { \
-            i = bits_left - 3; \
-            outputBuffer[opb_index] |= _data << i; \
-            bits_left = i; \
-        } \
-        else \
-        { \
-            i = 3 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= _data >> i; \
-            outputBuffer[opb_index] |= _data << j; \
-            bits_left = j; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 4 bits into outputBuffer
-******************************************************************************/
-#define insert_4_bits(_data) \
-    do \
-    { \
-        if ((bits_left >= 5) && (bits_left <= 8)) \
-        { \
-            i = bits_left - 4; \
-            outputBuffer[opb_index] |= _data << i; \
-            bits_left = i; \
-        } \
-        else \
-        { \
-            i = 4 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= _data >> i; \
-            outputBuffer[opb_index] |= _data << j; \
-            bits_left = j; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 5 bits into outputBuffer
-******************************************************************************/
-#define insert_5_bits(_data) \
-    do \
-    { \
-        if ((bits_left >= 6) && (bits_left <= 8)) \
-        { \
-            i = bits_left - 5; \
-            outputBuffer[opb_index] |= _data << i; \
-            bits_left = i; \
-        } \
-        else \
-        { \
-            i = 5 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= _data >> i; \
-            outputBuffer[opb_index] |= _data << j; \
-            bits_left = j; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 6 bits into outputBuffer
-******************************************************************************/
-#define insert_6_bits(_data) \
-    do \
-    { \
-        if ((bits_left >= 7) && (bits_left <= 8)) \
-        { \
-            i = bits_left - 6; \
-            outputBuffer[opb_index] |= (_data << i); \
-            bits_left = i; \
-        } \
-        else \
-        { \
-            i = 6 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (_data >> i); \
-            outputBuffer[opb_index] |= (_data << j); \
-            bits_left = j; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 7 bits into outputBuffer
-******************************************************************************/
-#define insert_7_bits(_data) \
-    do \
-    { \
-        if (bits_left == 8) \
-        { \
-            outputBuffer[opb_index] |= _data << 1; \
-            bits_left = 1; \
-        } \
-        else \
-        { \
-            i = 7 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= _data >> i; \
-            outputBuffer[opb_index] |= _data << j; \
-            bits_left = j; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 8 bits into outputBuffer
-******************************************************************************/
-#define insert_8_bits(_data) \
-    do \
-    { \
-        if (bits_left == 8) \
-        { \
-            outputBuffer[opb_index++] |= _data; \
-            bits_left = 8; \
-        } \
-        else \
-        { \
-            i = 8 - bits_left; \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= _data >> i; \
-            outputBuffer[opb_index] |= _data << j; \
-            bits_left = j; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 9 bits into outputBuffer
-******************************************************************************/
-#define insert_9_bits(_data16) \
-    do \
-    { \
-        i = 9 - bits_left; \
-        j = 8 - i; \
-        outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-        outputBuffer[opb_index] |= (char) (_data16 << j); \
-        bits_left = j; \
-        if (bits_left == 0) \
-        { \
-            opb_index++; \
-            bits_left = 8; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 10 bits into outputBuffer
-******************************************************************************/
-#define insert_10_bits(_data16) \
-    do \
-    { \
-        i = 10 - bits_left; \
-        if ((bits_left >= 3) && (bits_left <= 8)) \
-        { \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index] |= (char) (_data16 << j); \
-            bits_left = j; \
-        } \
-        else \
-        { \
-            j = i - 8; \
-            k = 8 - j; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-            outputBuffer[opb_index] |= (char) (_data16 << k); \
-            bits_left = k; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 11 bits into outputBuffer
-******************************************************************************/
-#define insert_11_bits(_data16) \
-    do \
-    { \
-        i = 11 - bits_left; \
-        if ((bits_left >= 4) && (bits_left <= 8)) \
-        { \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index] |= (char) (_data16 << j); \
-            bits_left = j; \
-        } \
-        else \
-        { \
-            j = i - 8;                                \
-            k = 8 - j; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-            outputBuffer[opb_index] |= (char) (_data16 << k); \
-            bits_left = k; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 12 bits into outputBuffer
-******************************************************************************/
-#define insert_12_bits(_data16) \
-    do \
-    { \
-        i = 12 - bits_left; \
-        if ((bits_left >= 5) && (bits_left <= 8)) \
-        { \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index] |= (char) (_data16 << j); \
-            bits_left = j; \
-        } \
-        else \
-        { \
-            j = i - 8; \
-            k = 8 - j; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-            outputBuffer[opb_index] |= (char) (_data16 << k); \
-            bits_left = k; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 13 bits into outputBuffer
-******************************************************************************/
-#define insert_13_bits(_data16) \
-    do \
-    { \
-        i = 13 - bits_left; \
-        if ((bits_left >= 6) && (bits_left <= 8)) \
-        { \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index] |= (char) (_data16 << j); \
-            bits_left = j; \
-        } \
-        else \
-        { \
-            j = i - 8; \
-            k = 8 - j; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-            outputBuffer[opb_index] |= (char) (_data16 << k); \
-            bits_left = k; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 14 bits into outputBuffer
-******************************************************************************/
-#define insert_14_bits(_data16) \
-    do \
-    { \
-        i = 14 - bits_left; \
-        if ((bits_left >= 7) && (bits_left <= 8)) \
-        { \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index] |= (char) (_data16 << j); \
-            bits_left = j; \
-        } \
-        else \
-        { \
-            j = i - 8; \
-            k = 8 - j; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-            outputBuffer[opb_index] |= (char) (_data16 << k); \
-            bits_left = k; \
-        } \
-    } while (0)
-
-/*****************************************************************************
-                     insert 15 bits into outputBuffer
-******************************************************************************/
-#define insert_15_bits(_data16) \
-    do \
-    { \
-        i = 15 - bits_left; \
-        if (bits_left == 8) \
-        { \
-            j = 8 - i; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index] |= (char) (_data16 << j); \
-            bits_left = j; \
-        } \
-        else \
-        { \
-            j = i - 8; \
-            k = 8 - j; \
-            outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-            outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-            outputBuffer[opb_index] |= (char) (_data16 << k); \
-            bits_left = k; \
-        } \
-    } while (0)
+/**
+ * @param   protocol_type   PROTO_RDP_*
+ *
+ * @return  boolean, true if mppc_enc_new() implements protocol_type
+ *
+ * PROTO_RDP_60 (NCRUSH, [MS-RDPEGDI] 3.1.8.1.1) is not implemented, so
+ * clients which ask for it are sent 64K MPPC
+ */
 
-/*****************************************************************************
-                     insert 16 bits into outputBuffer
-******************************************************************************/
-#define insert_16_bits(_data16) \
-    do \
-    { \
-        i = 16 - bits_left; \
-        j = i - 8; \
-        k = 8 - j; \
-        outputBuffer[opb_index++] |= (char) (_data16 >> i); \
-        outputBuffer[opb_index++] |= (char) (_data16 >> j); \
-        outputBuffer[opb_index] |= (char) (_data16 << k); \
-        bits_left = k; \
-    } while (0)
+static int
+mppc_enc_implemented(int protocol_type)
+{
+    return protocol_type == PROTO_RDP_40 || protocol_type == PROTO_RDP_50 ||
+           protocol_type == PROTO_RDP_61;
+}
 
 /**
  * Initialize mppc_enc structure
  *
- * @param   protocol_type   PROTO_RDP_40 or PROTO_RDP_50
+ * @param   protocol_type   PROTO_RDP_40, PROTO_RDP_50 or PROTO_RDP_61
  *
- * @return  struct xrdp_mppc_enc* or nil on failure
+ * @return  struct xrdp_mppc_enc* or nil on failure, including for
+ *          protocols which are not implemented
  */
 
 struct xrdp_mppc_enc *
@@ -447,40 +133,97 @@ mppc_enc_new(int protocol_type)
             enc->buf_len = RDP_50_HIST_BUF_LEN;
             break;
 
+        case PROTO_RDP_61:
+            enc->protocol_type = PROTO_RDP_61;
+            enc->buf_len = RDP_61_MAX_LEN;
+            break;
+
         default:
             g_free(enc);
             return 0;
     }
 
     enc->flagsHold = PACKET_AT_FRONT;
-    enc->historyBuffer = (char *) g_malloc(enc->buf_len, 1);
+    enc->outputBufferPlus = (char *) g_malloc(enc->buf_len + 64, 1);
 
-    if (enc->historyBuffer == 0)
+    if (enc->outputBufferPlus == 0)
     {
         g_free(enc);
         return 0;
     }
 
-    enc->outputBufferPlus = (char *) g_malloc(enc->buf_len + 64, 1);
+    enc->outputBuffer = enc->outputBufferPlus + 64;
 
-    if (enc->outputBufferPlus == 0)
+    if (protocol_type != PROTO_RDP_61)
     {
-        g_free(enc->historyBuffer);
-        g_free(enc);
-        return 0;
+        enc->historyBuffer = (char *) g_malloc(enc->buf_len, 1);
+        enc->hash_table = g_new0(tui32, MPPC_HASH_LEN);
+        enc->hash_gen = 1;
+        if (enc->historyBuffer == 0 || enc->hash_table == 0)
+        {
+            mppc_enc_free(enc);
+            return 0;
+        }
+    }
+    else
+    {
+        /* level 1 output goes through 64K MPPC as level 2, which has the
+           history and hash table */
+        enc->l2_enc = mppc_enc_new(PROTO_RDP_50);
+        enc->l1_history = (char *) g_malloc(RDP_61_HIST_BUF_LEN, 1);
+        enc->l1_hash = g_new0(tui32, 1 << XCRUSH_HASH_BITS);
+        enc->l1_out = (char *) g_malloc(enc->buf_len, 0);
+        enc->l1_matches = g_new(int, 3 * (enc->buf_len / XCRUSH_WINDOW + 1));
+        if (enc->l2_enc == 0 || enc->l1_history == 0 || enc->l1_hash == 0 ||
+                enc->l1_out == 0 || enc->l1_matches == 0)
+        {
+            mppc_enc_free(enc);
+            return 0;
+        }
     }
 
-    enc->outputBuffer = enc->outputBufferPlus + 64;
-    enc->hash_table = (tui16 *) g_malloc(enc->buf_len * 2, 1);
+    return enc;
+}
 
-    if (enc->hash_table == 0)
+/**
+ * Initialize mppc_enc structure for the best compression type both the
+ * client and xrdp support
+ *
+ * @param   compr_type   highest PACKET_COMPR_TYPE_* the client supports
+ * @param   use_rdp61    boolean, true if RDP 6.1 may be used, it has only
+ *                       been checked against the decoder in the tests so
+ *                       is off unless bulk_compression_rdp61 is set
+ *
+ * @return  struct xrdp_mppc_enc* or nil if out of memory, types which are
+ *          not implemented are passed over, every client takes 8K MPPC
+ */
+
+struct xrdp_mppc_enc *
+mppc_enc_new_for_client(int compr_type, int use_rdp61)
+{
+    /* each type implies support for the ones before it */
+    static const int protocols[] =
     {
-        g_free(enc->historyBuffer);
-        g_free(enc->outputBufferPlus);
-        g_free(enc);
+        PROTO_RDP_40, PROTO_RDP_50, PROTO_RDP_60, PROTO_RDP_61
+    };
+    struct xrdp_mppc_enc *enc;
+    int index;
+
+    index = MIN(compr_type & CompressionTypeMask, PACKET_COMPR_TYPE_RDP61);
+    while (index > 0 && (!mppc_enc_implemented(protocols[index]) ||
+                         (protocols[index] == PROTO_RDP_61 && !use_rdp61)))
+    {
+        index--;
+    }
+    enc = mppc_enc_new(protocols[index]);
+    if (enc == 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "mppc_enc_new_for_client: out of memory for "
+            "compression type %d", index);
         return 0;
     }
-
+    LOG(LOG_LEVEL_INFO, "mppc_enc_new_for_client: client supports "
+        "compression type %d, using type %d", compr_type, index);
     return enc;
 }
 
@@ -500,28 +243,73 @@ mppc_enc_free(struct xrdp_mppc_enc *enc)
     g_free(enc->historyBuffer);
     g_free(enc->outputBufferPlus);
     g_free(enc->hash_table);
+    mppc_enc_free(enc->l2_enc);
+    g_free(enc->l1_history);
+    g_free(enc->l1_hash);
+    g_free(enc->l1_out);
+    g_free(enc->l1_matches);
     g_free(enc);
 }
 
 /**
- * encode (compress) data using RDP 4.0 protocol
+ * forget the history, the next packet tells the client to do the same
  *
- * @param   enc           encoder state info
- * @param   srcData       uncompressed data
- * @param   len           length of srcData
+ * @param   enc  MPPC encoder
+ */
+
+static void
+mppc_enc_reset_history(struct xrdp_mppc_enc *enc)
+{
+    enc->historyOffset = 0;
+    /* hash slots from older generations are ignored, only clear them when
+       the generation number wraps */
+    enc->hash_gen++;
+    if (enc->hash_gen > 0xFFFF)
+    {
+        g_memset(enc->hash_table, 0, MPPC_HASH_LEN * sizeof(tui32));
+        enc->hash_gen = 1;
+    }
+    enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
+}
+
+/**
+ * count matching bytes, a word at a time while there is room
  *
- * @return  TRUE on success, FALSE on failure
+ * @param   cptr1   data being compressed
+ * @param   cptr2   earlier data, may overlap cptr1
+ * @param   max     don't look past this many bytes
+ *
+ * @return  number of bytes that match
  */
 
 static int
-compress_rdp_4(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+mppc_match_len(const char *cptr1, const char *cptr2, int max)
 {
-    /* RDP 4.0 encoding not yet implemented */
-    return 0;
+    tui64 word1;
+    tui64 word2;
+    int lom;
+
+    lom = 0;
+    while (lom + 8 <= max)
+    {
+        g_memcpy(&word1, cptr1 + lom, 8);
+        g_memcpy(&word2, cptr2 + lom, 8);
+        if (word1 != word2)
+        {
+            break;
+        }
+        lom += 8;
+    }
+    while (lom < max && cptr1[lom] == cptr2[lom])
+    {
+        lom++;
+    }
+    return lom;
 }
 
 /**
- * encode (compress) data using RDP 5.0 protocol using hash table
+ * encode (compress) data using RDP 4.0 (8K) or RDP 5.0 (64K) protocol
+ * using hash table, the two only differ in how copy offsets are encoded
  *
  * @param   enc           encoder state info
  * @param   srcData       uncompressed data
@@ -531,53 +319,61 @@ compress_rdp_4(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
  */
 
 static int
-compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+compress_mppc(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 {
     char *outputBuffer;     /* points to enc->outputBuffer */
-    char *hptr_end;         /* points to end of history data */
     char *historyPointer;   /* points to first byte of srcData in
                              * historyBuffer */
     char *hbuf_start;       /* points to start of history buffer */
     char *cptr1;
     char *cptr2;
     int opb_index;          /* index into outputBuffer */
-    int bits_left;          /* unused bits in current byte in outputBuffer */
+    int opb_limit;          /* stop encoding before opb_index gets here */
+    tui32 bit_acc;          /* bits not yet in outputBuffer... */
+    int bit_count;          /* ...and how many of them there are */
     tui32 copy_offset;      /* pattern match starts here... */
     tui32 lom;              /* ...and matches this many bytes */
-    int last_crc_index;     /* don't compute CRC beyond this index */
-    tui16 *hash_table;      /* hash table for pattern matching */
+    int last_hash_index;    /* don't hash beyond this index */
+    tui32 *hash_table;      /* hash table for pattern matching */
+    tui32 hash_tag;         /* generation, top 16 bits of a live slot */
+    tui32 hash_slot;
 
     tui32 i;
     tui32 j;
-    tui32 k;
-    tui32 x;
     tui8 data;
     tui16 data16;
     tui32 historyOffset;
-    tui16 crc;
+    tui32 hash;
     tui32 ctr;
     tui32 saved_ctr;
     tui32 data_end;
-    tui8 byte_val;
 
-    crc = 0;
+    if (len <= MPPC_MIN_LEN)
+    {
+        /* nothing has been added to the history yet, so it stays valid */
+        return 0;
+    }
+
     opb_index = 0;
-    bits_left = 8;
+    /* output longer than the input is no use, and outputBuffer is buf_len
+       bytes, so leave room for the item which takes opb_index past the
+       limit */
+    opb_limit = MIN(len, enc->buf_len - MPPC_ITEM_MAX_BYTES);
+    bit_acc = 0;
+    bit_count = 0;
     copy_offset = 0;
     hash_table = enc->hash_table;
     hbuf_start = enc->historyBuffer;
     outputBuffer = enc->outputBuffer;
-    g_memset(outputBuffer, 0, len);
-    enc->flags = PACKET_COMPR_TYPE_64K;
+    enc->flags = (enc->protocol_type == PROTO_RDP_40) ?
+                 PACKET_COMPR_TYPE_8K : PACKET_COMPR_TYPE_64K;
 
     if ((enc->historyOffset + len) >= enc->buf_len - 3)
     {
         /* historyBuffer cannot hold srcData - rewind it */
-        enc->historyOffset = 0;
-        g_memset(hash_table, 0, enc->buf_len * 2);
-        g_memset(enc->historyBuffer, 0, enc->buf_len); // added
-        enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
+        mppc_enc_reset_history(enc);
     }
+    hash_tag = (tui32) enc->hash_gen << 16;
 
     /* point to next free byte in historyBuffer */
     historyOffset = enc->historyOffset;
@@ -590,86 +386,32 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 
     ctr = copy_offset = lom = 0;
 
-    /* if we are at start of history buffer, do not attempt to compress */
-    /* first 2 bytes, because minimum LoM is 3                          */
-    if (historyOffset == 0)
-    {
-        /* encode first two bytes as literals */
-        for (x = 0; x < 2; x++)
-        {
-            data = *(historyPointer + x);
-            LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", (tui8) data);
-            if (data & 0x80)
-            {
-                /* insert encoded literal */
-                insert_2_bits(0x02);
-                data &= 0x7f;
-                insert_7_bits(data);
-            }
-            else
-            {
-                /* insert literal */
-                insert_8_bits(data);
-            }
-        }
-
-        /* store hash for first two entries in historyBuffer */
-        crc = CRC_INIT;
-        byte_val = enc->historyBuffer[0];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[1];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[2];
-        CRC(crc, byte_val);
-        hash_table[crc] = 0;
-
-        crc = CRC_INIT;
-        byte_val = enc->historyBuffer[1];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[2];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[3];
-        CRC(crc, byte_val);
-        hash_table[crc] = 1;
-
-        /* first two bytes have already been processed */
-        ctr = 2;
-    }
-
     enc->historyOffset += len;
 
-    /* point to last byte in new data */
-    hptr_end = &(enc->historyBuffer[enc->historyOffset - 1]);
-
-    /* do not compute CRC beyond this */
-    last_crc_index = enc->historyOffset - 3;
+    /* do not hash beyond this */
+    last_hash_index = enc->historyOffset - 3;
 
     /* do not search for pattern match beyond this */
     data_end = len - 2;
 
     /* start compressing data */
 
-    while (ctr < data_end)
+    while (ctr < data_end && opb_index < opb_limit)
     {
         cptr1 = historyPointer + ctr;
 
-        crc = CRC_INIT;
-        byte_val = *cptr1;
-        CRC(crc, byte_val);
-        byte_val = *(cptr1 + 1);
-        CRC(crc, byte_val);
-        byte_val = *(cptr1 + 2);
-        CRC(crc, byte_val);
-
-        /* cptr2 points to start of pattern match */
-        cptr2 = hbuf_start + hash_table[crc];
-        copy_offset = cptr1 - cptr2;
+        hash = MPPC_HASH(cptr1);
+        hash_slot = hash_table[hash];
 
         /* save current entry */
-        hash_table[crc] = cptr1 - hbuf_start;
+        hash_table[hash] = hash_tag | (tui32) (cptr1 - hbuf_start);
+
+        /* cptr2 points to start of pattern match */
+        cptr2 = hbuf_start + (hash_slot & 0xFFFF);
 
         /* double check that we have a pattern match */
-        if ((*cptr1 != *cptr2) ||
+        if (((hash_slot & 0xFFFF0000) != hash_tag) ||
+                (*cptr1 != *cptr2) ||
                 (*(cptr1 + 1) != *(cptr2 + 1)) ||
                 (*(cptr1 + 2) != *(cptr2 + 2)))
         {
@@ -680,38 +422,33 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
             if (data < 0x80)
             {
                 /* literal byte < 0x80 */
-                insert_8_bits(data);
+                insert_bits(data, 8);
             }
             else
             {
                 /* literal byte >= 0x80 */
-                insert_2_bits(0x02);
+                insert_bits(0x02, 2);
                 data &= 0x7f;
-                insert_7_bits(data);
+                insert_bits(data, 7);
             }
             ctr++;
             continue;
         }
+        copy_offset = cptr1 - cptr2;
 
         /* we have a match - compute Length of Match */
-        cptr1 += 3;
-        cptr2 += 3;
-        lom = 3;
-        while ((cptr1 <= hptr_end) && (*(cptr1++) == *(cptr2++)))
-        {
-            lom++;
-        }
+        lom = 3 + mppc_match_len(cptr1 + 3, cptr2 + 3, len - (ctr + 3));
         saved_ctr = ctr + lom;
         LOG_DEVEL(LOG_LEVEL_TRACE, "<%ld: %u,%d> ",  (historyPointer + ctr) - hbuf_start,
                   copy_offset, lom);
 
-        /* compute CRC for matching segment and store in hash table */
+        /* hash the matching segment and store in hash table */
 
         cptr1 = historyPointer + ctr;
-        if (cptr1 + lom > hbuf_start + last_crc_index)
+        if (cptr1 + lom > hbuf_start + last_hash_index)
         {
-            /* we have gone beyond last_crc_index - go back */
-            j = last_crc_index - (cptr1 - hbuf_start);
+            /* we have gone beyond last_hash_index - go back */
+            j = last_hash_index - (cptr1 - hbuf_start);
         }
         else
         {
@@ -722,17 +459,9 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
         {
             cptr1 = historyPointer + ctr;
 
-            /* compute CRC on triplet */
-            crc = CRC_INIT;
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-
             /* save current entry */
-            hash_table[crc] = (cptr1 - 3) - hbuf_start;
+            hash_table[MPPC_HASH(cptr1)] = hash_tag |
+                                           (tui32) (cptr1 - hbuf_start);
 
             /* point to next triplet */
             ctr++;
@@ -741,35 +470,70 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 
         /* encode copy_offset and insert into output buffer */
 
-        if (copy_offset <= 63) /* (copy_offset >= 0) is always true */
+        if (enc->protocol_type == PROTO_RDP_40)
+        {
+            if (copy_offset <= 63)
+            {
+                /* insert binary header */
+                data = 0x0f;
+                insert_bits(data, 4);
+
+                /* insert 6 bits of copy_offset */
+                data = (char) (copy_offset & 0x3f);
+                insert_bits(data, 6);
+            }
+            else if (copy_offset <= 319)
+            {
+                /* insert binary header */
+                data = 0x0e;
+                insert_bits(data, 4);
+
+                /* insert 8 bits of copy offset */
+                data = (char) (copy_offset - 64);
+                insert_bits(data, 8);
+            }
+            else
+            {
+                /* copy_offset is 320 - 8191 */
+
+                /* insert binary header */
+                data = 0x06;
+                insert_bits(data, 3);
+
+                /* insert 13 bits of copy offset */
+                data16 = copy_offset - 320;
+                insert_bits(data16, 13);
+            }
+        }
+        else if (copy_offset <= 63) /* (copy_offset >= 0) is always true */
         {
             /* insert binary header */
             data = 0x1f;
-            insert_5_bits(data);
+            insert_bits(data, 5);
 
             /* insert 6 bits of copy_offset */
             data = (char) (copy_offset & 0x3f);
-            insert_6_bits(data);
+            insert_bits(data, 6);
         }
         else if ((copy_offset >= 64) && (copy_offset <= 319))
         {
             /* insert binary header */
             data = 0x1e;
-            insert_5_bits(data);
+            insert_bits(data, 5);
 
             /* insert 8 bits of copy offset */
             data = (char) (copy_offset - 64);
-            insert_8_bits(data);
+            insert_bits(data, 8);
         }
         else if ((copy_offset >= 320) && (copy_offset <= 2367))
         {
             /* insert binary header */
             data = 0x0e;
-            insert_4_bits(data);
+            insert_bits(data, 4);
 
             /* insert 11 bits of copy offset */
             data16 = copy_offset - 320;;
-            insert_11_bits(data16);
+            insert_bits(data16, 11);
         }
         else
         {
@@ -777,195 +541,189 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 
             /* insert binary header */
             data = 0x06;
-            insert_3_bits(data);
+            insert_bits(data, 3);
 
             /* insert 16 bits of copy offset */
             data16 = copy_offset - 2368;;
-            insert_16_bits(data16);
+            insert_bits(data16, 16);
         }
 
         /* encode length of match and insert into output buffer */
 
         if (lom == 3)
         {
-            /* binary header is 'zero'; since outputBuffer is zero */
-            /* filled, all we have to do is update bits_left */
-            bits_left--;
-            if (bits_left == 0)
-            {
-                opb_index++;
-                bits_left = 8;
-            }
+            /* binary header is 'zero' */
+            insert_bits(0, 1);
         }
         else if ((lom >= 4) && (lom <= 7))
         {
             /* insert binary header */
             data = 0x02;
-            insert_2_bits(data);
+            insert_bits(data, 2);
 
             /* insert lower 2 bits of LoM */
             data = (char) (lom - 4);
-            insert_2_bits(data);
+            insert_bits(data, 2);
         }
         else if ((lom >= 8) && (lom <= 15))
         {
             /* insert binary header */
             data = 0x06;
-            insert_3_bits(data);
+            insert_bits(data, 3);
 
             /* insert lower 3 bits of LoM */
             data = (char) (lom - 8);
-            insert_3_bits(data);
+            insert_bits(data, 3);
         }
         else if ((lom >= 16) && (lom <= 31))
         {
             /* insert binary header */
             data = 0x0e;
-            insert_4_bits(data);
+            insert_bits(data, 4);
 
             /* insert lower 4 bits of LoM */
             data = (char) (lom - 16);
-            insert_4_bits(data);
+            insert_bits(data, 4);
         }
         else if ((lom >= 32) && (lom <= 63))
         {
             /* insert binary header */
             data = 0x1e;
-            insert_5_bits(data);
+            insert_bits(data, 5);
 
             /* insert lower 5 bits of LoM */
             data = (char) (lom - 32);
-            insert_5_bits(data);
+            insert_bits(data, 5);
         }
         else if ((lom >= 64) && (lom <= 127))
         {
             /* insert binary header */
             data = 0x3e;
-            insert_6_bits(data);
+            insert_bits(data, 6);
 
             /* insert lower 6 bits of LoM */
             data = (char) (lom - 64);
-            insert_6_bits(data);
+            insert_bits(data, 6);
         }
         else if ((lom >= 128) && (lom <= 255))
         {
             /* insert binary header */
             data = 0x7e;
-            insert_7_bits(data);
+            insert_bits(data, 7);
 
             /* insert lower 7 bits of LoM */
             data = (char) (lom - 128);
-            insert_7_bits(data);
+            insert_bits(data, 7);
         }
         else if ((lom >= 256) && (lom <= 511))
         {
             /* insert binary header */
             data = 0xfe;
-            insert_8_bits(data);
+            insert_bits(data, 8);
 
             /* insert lower 8 bits of LoM */
             data = (char) (lom - 256);
-            insert_8_bits(data);
+            insert_bits(data, 8);
         }
         else if ((lom >= 512) && (lom <= 1023))
         {
             /* insert binary header */
             data16 = 0x1fe;
-            insert_9_bits(data16);
+            insert_bits(data16, 9);
 
             /* insert lower 9 bits of LoM */
             data16 = lom - 512;
-            insert_9_bits(data16);
+            insert_bits(data16, 9);
         }
         else if ((lom >= 1024) && (lom <= 2047))
         {
             /* insert binary header */
             data16 = 0x3fe;
-            insert_10_bits(data16);
+            insert_bits(data16, 10);
 
             /* insert 10 lower bits of LoM */
             data16 = lom - 1024;
-            insert_10_bits(data16);
+            insert_bits(data16, 10);
         }
         else if ((lom >= 2048) && (lom <= 4095))
         {
             /* insert binary header */
             data16 = 0x7fe;
-            insert_11_bits(data16);
+            insert_bits(data16, 11);
 
             /* insert 11 lower bits of LoM */
             data16 = lom - 2048;
-            insert_11_bits(data16);
+            insert_bits(data16, 11);
         }
         else if ((lom >= 4096) && (lom <= 8191))
         {
             /* insert binary header */
             data16 = 0xffe;
-            insert_12_bits(data16);
+            insert_bits(data16, 12);
 
             /* insert 12 lower bits of LoM */
             data16 = lom - 4096;
-            insert_12_bits(data16);
+            insert_bits(data16, 12);
         }
         else if ((lom >= 8192) && (lom <= 16383))
         {
             /* insert binary header */
             data16 = 0x1ffe;
-            insert_13_bits(data16);
+            insert_bits(data16, 13);
 
             /* insert 13 lower bits of LoM */
             data16 = lom - 8192;
-            insert_13_bits(data16);
+            insert_bits(data16, 13);
         }
         else if ((lom >= 16384) && (lom <= 32767))
         {
             /* insert binary header */
             data16 = 0x3ffe;
-            insert_14_bits(data16);
+            insert_bits(data16, 14);
 
             /* insert 14 lower bits of LoM */
             data16 = lom - 16384;
-            insert_14_bits(data16);
+            insert_bits(data16, 14);
         }
         else if ((lom >= 32768) && (lom <= 65535))
         {
             /* insert binary header */
             data16 = 0x7ffe;
-            insert_15_bits(data16);
+            insert_bits(data16, 15);
 
             /* insert 15 lower bits of LoM */
             data16 = lom - 32768;
-            insert_15_bits(data16);
+            insert_bits(data16, 15);
         }
     } /* end while (ctr < data_end) */
 
     /* add remaining data to the output */
-    while (len - ctr > 0)
+    while (len - ctr > 0 && opb_index < opb_limit)
     {
         data = srcData[ctr];
         LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", data);
         if (data < 0x80)
         {
             /* literal byte < 0x80 */
-            insert_8_bits(data);
+            insert_bits(data, 8);
         }
         else
         {
             /* literal byte >= 0x80 */
-            insert_2_bits(0x02);
+            insert_bits(0x02, 2);
             data &= 0x7f;
-            insert_7_bits(data);
+            insert_bits(data, 7);
         }
         ctr++;
     }
 
-    /* if bits_left != 8, increment opb_index, which is zero indexed */
-    if (bits_left != 8)
+    /* pad the last byte with zeros */
+    if (bit_count > 0)
     {
-        opb_index++;
+        outputBuffer[opb_index++] = (char) (bit_acc << (8 - bit_count));
     }
 
-    if (opb_index > len)
+    if (ctr < (tui32) len || opb_index > len)
     {
         /* compressed data longer than uncompressed data */
         /* give up */
@@ -973,10 +731,7 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
                   "buffer which is larger than the uncompressed buffer. "
                   "compression ratio %f, flags 0x%x",
                   (float) len / (float) opb_index, enc->flags);
-        enc->historyOffset = 0;
-        g_memset(hash_table, 0, enc->buf_len * 2);
-        g_memset(enc->historyBuffer, 0, enc->buf_len);
-        enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
+        mppc_enc_reset_history(enc);
         return 0;
     }
 
@@ -993,6 +748,225 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     return 1;
 }
 
+/**
+ * hash XCRUSH_WINDOW bytes
+ */
+
+static tui32
+xcrush_hash(const tui8 *data)
+{
+    tui32 hash;
+    int index;
+
+    hash = 0;
+    for (index = 0; index < XCRUSH_WINDOW; index++)
+    {
+        hash = hash * XCRUSH_HASH_MULT + data[index];
+    }
+    return hash;
+}
+
+/**
+ * find runs of the new data, already appended to l1_history, which were
+ * sent before and write RDP61_MATCH_DETAILS and literals to l1_out
+ *
+ * @param   enc           encoder state info
+ * @param   len           length of the new data
+ *
+ * @return  bytes in l1_out, 0 if there is nothing worth matching
+ */
+
+static int
+xcrush_compress_l1(struct xrdp_mppc_enc *enc, int len)
+{
+    struct stream ls;
+    tui8 *history;
+    tui8 *data;
+    int *matches;
+    int match_count;
+    int lit_start;
+    int literals;
+    int base;
+    int index;
+    int src;
+    int mlen;
+    int p;
+    tui32 hash;
+    tui32 top;
+    tui32 slot;
+
+    if (len < XCRUSH_WINDOW)
+    {
+        return 0;
+    }
+    history = (tui8 *) enc->l1_history;
+    base = enc->l1_offset;
+    data = history + base;
+    matches = enc->l1_matches;
+    match_count = 0;
+    lit_start = 0;
+    literals = 0;
+    /* weight of the byte leaving the window */
+    top = 1;
+    for (index = 1; index < XCRUSH_WINDOW; index++)
+    {
+        top *= XCRUSH_HASH_MULT;
+    }
+    hash = xcrush_hash(data);
+    p = 0;
+    for (;;)
+    {
+        slot = XCRUSH_SLOT(hash);
+        src = (int) enc->l1_hash[slot] - 1;
+        /* the source must be complete before the output reaches it */
+        if (src >= 0 && src + XCRUSH_WINDOW <= base + p &&
+                g_memcmp(history + src, data + p, XCRUSH_WINDOW) == 0)
+        {
+            mlen = XCRUSH_WINDOW;
+            while (p + mlen < len && src + mlen < base + p &&
+                    mlen < 0xFFFF && history[src + mlen] == data[p + mlen])
+            {
+                mlen++;
+            }
+            while (p > lit_start && src > 0 && src + mlen < base + p &&
+                    mlen < 0xFFFF && history[src - 1] == data[p - 1])
+            {
+                p--;
+                src--;
+                mlen++;
+            }
+            literals += p - lit_start;
+            matches[match_count * 3 + 0] = mlen;
+            matches[match_count * 3 + 1] = p;
+            matches[match_count * 3 + 2] = src;
+            match_count++;
+            p += mlen;
+            lit_start = p;
+            if (p + XCRUSH_WINDOW > len)
+            {
+                break;
+            }
+            hash = xcrush_hash(data + p);
+            continue;
+        }
+        if (((base + p) % XCRUSH_STEP) == 0)
+        {
+            enc->l1_hash[slot] = base + p + 1;
+        }
+        if (p + XCRUSH_WINDOW >= len)
+        {
+            break;
+        }
+        hash = (hash - data[p] * top) * XCRUSH_HASH_MULT +
+               data[p + XCRUSH_WINDOW];
+        p++;
+    }
+    literals += len - lit_start;
+    if (match_count == 0 || 2 + match_count * 8 + literals >= len)
+    {
+        return 0;
+    }
+
+    /* RDP61_MATCH_DETAILS then the bytes not covered by a match */
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = enc->l1_out;
+    ls.p = ls.data;
+    ls.size = enc->buf_len;
+    out_uint16_le(&ls, match_count);
+    for (index = 0; index < match_count; index++)
+    {
+        out_uint16_le(&ls, matches[index * 3 + 0]);
+        out_uint16_le(&ls, matches[index * 3 + 1]);
+        out_uint32_le(&ls, matches[index * 3 + 2]);
+    }
+    lit_start = 0;
+    for (index = 0; index < match_count; index++)
+    {
+        p = matches[index * 3 + 1];
+        out_uint8a(&ls, data + lit_start, p - lit_start);
+        lit_start = p + matches[index * 3 + 0];
+    }
+    out_uint8a(&ls, data + lit_start, len - lit_start);
+    return (int) (ls.p - ls.data);
+}
+
+/**
+ * encode (compress) data using RDP 6.1 protocol (XCRUSH), runs repeated
+ * from anywhere in the last 2,000,000 bytes are replaced by references
+ * (level 1) and the result is compressed with 64K MPPC (level 2)
+ *
+ * @param   enc           encoder state info
+ * @param   srcData       uncompressed data
+ * @param   len           length of srcData
+ *
+ * @return  TRUE on success, FALSE on failure
+ */
+
+static int
+compress_rdp_61(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+{
+    struct xrdp_mppc_enc *l2_enc;
+    char *payload;
+    int payload_len;
+    int l1_flags;
+    int l2_flags;
+
+    l2_enc = enc->l2_enc;
+    if (enc->l1_offset + len > RDP_61_HIST_BUF_LEN)
+    {
+        enc->l1_offset = 0;
+        g_memset(enc->l1_hash, 0, sizeof(tui32) << XCRUSH_HASH_BITS);
+        enc->l1_flags_hold |= L1_PACKET_AT_FRONT;
+    }
+    g_memcpy(enc->l1_history + enc->l1_offset, srcData, len);
+
+    payload_len = xcrush_compress_l1(enc, len);
+    if (payload_len > 0)
+    {
+        l1_flags = L1_COMPRESSED;
+        payload = enc->l1_out;
+    }
+    else
+    {
+        l1_flags = L1_NO_COMPRESSION;
+        payload = (char *) srcData;
+        payload_len = len;
+    }
+
+    l2_flags = 0;
+    if (compress_rdp(l2_enc, (tui8 *) payload, payload_len))
+    {
+        l1_flags |= L1_INNER_COMPRESSION;
+        l2_flags = l2_enc->flags;
+        payload = l2_enc->outputBuffer;
+        payload_len = l2_enc->bytes_in_opb;
+    }
+
+    if (payload_len + 2 >= len)
+    {
+        /* the client will not see this data, so neither history may
+           keep it */
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "compress_rdp_61: no gain, len %d", len);
+        if (l2_flags != 0)
+        {
+            mppc_enc_reset_history(l2_enc);
+        }
+        return 0;
+    }
+
+    enc->l1_offset += len;
+    enc->outputBuffer[0] = l1_flags | enc->l1_flags_hold;
+    enc->outputBuffer[1] = l2_flags;
+    g_memcpy(enc->outputBuffer + 2, payload, payload_len);
+    enc->l1_flags_hold = 0;
+    enc->bytes_in_opb = payload_len + 2;
+    enc->flags = PACKET_COMPR_TYPE_RDP61 | PACKET_COMPRESSED;
+    LOG_DEVEL(LOG_LEVEL_TRACE, "compress_rdp_61: len %d compressed %d "
+              "l1 flags 0x%2.2x l2 flags 0x%2.2x", len, enc->bytes_in_opb,
+              l1_flags, l2_flags);
+    return 1;
+}
+
 /**
  * encode (compress) data
  *
@@ -1014,11 +988,12 @@ compress_rdp(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     switch (enc->protocol_type)
     {
         case PROTO_RDP_40:
-            return compress_rdp_4(enc, srcData, len);
+        case PROTO_RDP_50:
+            return compress_mppc(enc, srcData, len);
             break;
 
-        case PROTO_RDP_50:
-            return compress_rdp_5(enc, srcData, len);
+        case PROTO_RDP_61:
+            return compress_rdp_61(enc, srcData, len);
             break;
     }
 
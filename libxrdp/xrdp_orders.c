@@ -54,6 +54,7 @@ xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
     {
         self->rfx_min_pixel = 64 * 32;
     }
+    self->opt.enabled = rdp_layer->client_info.order_optimization;
     make_stream(self->s);
     make_stream(self->temp_s);
     return self;
@@ -67,6 +68,12 @@ xrdp_orders_delete(struct xrdp_orders *self)
     {
         return;
     }
+    if (self->opt.orders_in > 0)
+    {
+        LOG(LOG_LEVEL_DEBUG, "xrdp_orders_delete: order optimizer sent %ld "
+            "of %ld rect and mem blt orders", self->opt.orders_out,
+            self->opt.orders_in);
+    }
     xrdp_jpeg_deinit(self->jpeg_han);
     free_stream(self->out_s);
     free_stream(self->s);
@@ -148,6 +155,10 @@ xrdp_orders_send(struct xrdp_orders *self)
     rv = 0;
     if (self->order_level > 0)
     {
+        if (self->order_level == 1)
+        {
+            rv = xrdp_orders_opt_flush(self);
+        }
         self->order_level--;
         if ((self->order_level == 0) && (self->order_count > 0))
         {
@@ -190,6 +201,10 @@ xrdp_orders_force_send(struct xrdp_orders *self)
     {
         return 1;
     }
+    if (self->order_level > 0 && xrdp_orders_opt_flush(self) != 0)
+    {
+        return 1;
+    }
     if ((self->order_level > 0) && (self->order_count > 0))
     {
         s_mark_end(self->out_s);
@@ -232,6 +247,12 @@ xrdp_orders_check(struct xrdp_orders *self, int max_size)
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
+    /* held orders go before this one */
+    if (xrdp_orders_opt_flush(self) != 0)
+    {
+        return 1;
+    }
+
     if (self->order_level < 1)
     {
         if (max_size > max_order_size)
@@ -497,11 +518,26 @@ xrdp_order_pack_small_or_tiny(struct xrdp_orders *self,
 
 /*****************************************************************************/
 /* returns error */
-/* send a solid rect to client */
-/* max size 23 */
+/* send a solid rect to client, held back by the order optimizer if it
+   is on */
 int
 xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
                  int color, struct xrdp_rect *rect)
+{
+    if (self->opt.enabled)
+    {
+        return xrdp_orders_opt_rect(self, x, y, cx, cy, color, rect);
+    }
+    return xrdp_orders_out_rect(self, x, y, cx, cy, color, rect);
+}
+
+/*****************************************************************************/
+/* returns error */
+/* write a solid rect order */
+/* max size 23 */
+int
+xrdp_orders_out_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect)
 {
     int order_flags;
     int vals[8];
@@ -1448,13 +1484,33 @@ xrdp_orders_line(struct xrdp_orders *self, int mix_mode,
 
 /*****************************************************************************/
 /* returns error */
-/* send a mem blt order */
-/* max size  30 */
+/* send a mem blt order, plain copies from the bitmap cache are held back
+   by the order optimizer if it is on */
 int
 xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
                     int color_table, int x, int y, int cx, int cy,
                     int rop, int srcx, int srcy,
                     int cache_idx, struct xrdp_rect *rect)
+{
+    if (self->opt.enabled && rop == 0xcc && cache_id != 255)
+    {
+        return xrdp_orders_opt_mem_blt(self, cache_id, color_table,
+                                       x, y, cx, cy, srcx, srcy,
+                                       cache_idx, rect);
+    }
+    return xrdp_orders_out_mem_blt(self, cache_id, color_table, x, y, cx, cy,
+                                   rop, srcx, srcy, cache_idx, rect);
+}
+
+/*****************************************************************************/
+/* returns error */
+/* write a mem blt order */
+/* max size  30 */
+int
+xrdp_orders_out_mem_blt(struct xrdp_orders *self, int cache_id,
+                        int color_table, int x, int y, int cx, int cy,
+                        int rop, int srcx, int srcy,
+                        int cache_idx, struct xrdp_rect *rect)
 {
     int order_flags = 0;
     int vals[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
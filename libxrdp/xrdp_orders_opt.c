@@ -0,0 +1,362 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * order optimizer
+ *
+ * Opaque rect and mem blt orders are held back until something else
+ * needs the order stream. Before they are written out, orders hidden by
+ * later ones are dropped and neighbours which draw the same thing are
+ * merged. All the orders held are opaque, so only the last order to
+ * touch a pixel matters.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+
+/*****************************************************************************/
+static int
+opt_rect_empty(const struct xrdp_rect *rect)
+{
+    return rect->left >= rect->right || rect->top >= rect->bottom;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if in is inside out */
+static int
+opt_rect_contains(const struct xrdp_rect *out, const struct xrdp_rect *in)
+{
+    return in->left >= out->left && in->right <= out->right &&
+           in->top >= out->top && in->bottom <= out->bottom;
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+opt_rect_overlaps(const struct xrdp_rect *r1, const struct xrdp_rect *r2)
+{
+    return r1->left < r2->right && r2->left < r1->right &&
+           r1->top < r2->bottom && r2->top < r1->bottom;
+}
+
+/*****************************************************************************/
+/* if the union of r1 and r2 is a rectangle, put it in out
+   returns boolean */
+static int
+opt_rect_union(const struct xrdp_rect *r1, const struct xrdp_rect *r2,
+               struct xrdp_rect *out)
+{
+    if (r1->top == r2->top && r1->bottom == r2->bottom &&
+            r1->left <= r2->right && r2->left <= r1->right)
+    {
+        out->top = r1->top;
+        out->bottom = r1->bottom;
+        out->left = MIN(r1->left, r2->left);
+        out->right = MAX(r1->right, r2->right);
+        return 1;
+    }
+    if (r1->left == r2->left && r1->right == r2->right &&
+            r1->top <= r2->bottom && r2->top <= r1->bottom)
+    {
+        out->left = r1->left;
+        out->right = r1->right;
+        out->top = MIN(r1->top, r2->top);
+        out->bottom = MAX(r1->bottom, r2->bottom);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if the two orders draw the same pixels wherever
+   they are placed */
+static int
+opt_item_same_source(const struct xrdp_orders_opt_item *i1,
+                     const struct xrdp_orders_opt_item *i2)
+{
+    if (i1->type != i2->type)
+    {
+        return 0;
+    }
+    if (i1->type == RDP_ORDER_RECT)
+    {
+        return i1->color == i2->color;
+    }
+    return i1->cache_id == i2->cache_id &&
+           i1->cache_idx == i2->cache_idx &&
+           i1->color_table == i2->color_table &&
+           i1->src_dx == i2->src_dx &&
+           i1->src_dy == i2->src_dy;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if any live order between first and last, not
+   including them, overlaps rect */
+static int
+opt_overlapped_between(struct xrdp_orders_opt *opt, int first, int last,
+                       const struct xrdp_rect *rect)
+{
+    int index;
+
+    for (index = first + 1; index < last; index++)
+    {
+        if (opt->items[index].type != 0 &&
+                opt_rect_overlaps(&(opt->items[index].rect), rect))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* drop orders hidden by a later order
+   returns the number dropped */
+static int
+opt_drop_covered(struct xrdp_orders_opt *opt)
+{
+    int index;
+    int jndex;
+    int dropped;
+
+    dropped = 0;
+    for (index = opt->count - 1; index > 0; index--)
+    {
+        if (opt->items[index].type == 0)
+        {
+            continue;
+        }
+        for (jndex = 0; jndex < index; jndex++)
+        {
+            if (opt->items[jndex].type != 0 &&
+                    opt_rect_contains(&(opt->items[index].rect),
+                                      &(opt->items[jndex].rect)))
+            {
+                opt->items[jndex].type = 0;
+                dropped++;
+            }
+        }
+    }
+    return dropped;
+}
+
+/*****************************************************************************/
+/* merge pairs of orders which together draw a rectangle
+   returns the number merged away */
+static int
+opt_merge(struct xrdp_orders_opt *opt)
+{
+    struct xrdp_orders_opt_item *i1;
+    struct xrdp_orders_opt_item *i2;
+    struct xrdp_rect rect;
+    int index;
+    int jndex;
+    int merged;
+    int changed;
+
+    merged = 0;
+    do
+    {
+        changed = 0;
+        for (index = 0; index < opt->count; index++)
+        {
+            i1 = opt->items + index;
+            if (i1->type == 0)
+            {
+                continue;
+            }
+            for (jndex = index + 1; jndex < opt->count; jndex++)
+            {
+                i2 = opt->items + jndex;
+                if (i2->type == 0 || !opt_item_same_source(i1, i2) ||
+                        !opt_rect_union(&(i1->rect), &(i2->rect), &rect))
+                {
+                    continue;
+                }
+                /* the merged order goes where one of the pair was, so
+                   nothing drawn in between can touch the other */
+                if (!opt_overlapped_between(opt, index, jndex, &(i2->rect)))
+                {
+                    i1->rect = rect;
+                    i2->type = 0;
+                }
+                else if (!opt_overlapped_between(opt, index, jndex,
+                                                 &(i1->rect)))
+                {
+                    i2->rect = rect;
+                    i1->type = 0;
+                }
+                else
+                {
+                    continue;
+                }
+                merged++;
+                changed = 1;
+                break;
+            }
+        }
+    }
+    while (changed);
+    return merged;
+}
+
+/*****************************************************************************/
+/* add an order to the list, clip is optional
+   returns error */
+static int
+opt_add(struct xrdp_orders *self, const struct xrdp_orders_opt_item *item,
+        const struct xrdp_rect *clip)
+{
+    struct xrdp_orders_opt *opt;
+    struct xrdp_orders_opt_item *dst;
+
+    opt = &(self->opt);
+    if (self->order_level < 1)
+    {
+        /* same as xrdp_orders_check would do */
+        if (xrdp_orders_init(self) != 0)
+        {
+            return 1;
+        }
+    }
+    if (opt->count >= XRDP_ORDERS_OPT_MAX)
+    {
+        if (xrdp_orders_opt_flush(self) != 0)
+        {
+            return 1;
+        }
+    }
+    opt->orders_in++;
+    dst = opt->items + opt->count;
+    *dst = *item;
+    if (clip != NULL)
+    {
+        dst->rect.left = MAX(dst->rect.left, clip->left);
+        dst->rect.top = MAX(dst->rect.top, clip->top);
+        dst->rect.right = MIN(dst->rect.right, clip->right);
+        dst->rect.bottom = MIN(dst->rect.bottom, clip->bottom);
+    }
+    if (opt_rect_empty(&(dst->rect)))
+    {
+        /* nothing would be drawn */
+        return 0;
+    }
+    opt->count++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_orders_opt_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect)
+{
+    struct xrdp_orders_opt_item item;
+
+    g_memset(&item, 0, sizeof(item));
+    item.type = RDP_ORDER_RECT;
+    item.rect.left = x;
+    item.rect.top = y;
+    item.rect.right = x + cx;
+    item.rect.bottom = y + cy;
+    item.color = color;
+    return opt_add(self, &item, rect);
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_orders_opt_mem_blt(struct xrdp_orders *self, int cache_id,
+                        int color_table, int x, int y, int cx, int cy,
+                        int srcx, int srcy, int cache_idx,
+                        struct xrdp_rect *rect)
+{
+    struct xrdp_orders_opt_item item;
+
+    g_memset(&item, 0, sizeof(item));
+    item.type = RDP_ORDER_MEMBLT;
+    item.rect.left = x;
+    item.rect.top = y;
+    item.rect.right = x + cx;
+    item.rect.bottom = y + cy;
+    item.cache_id = cache_id;
+    item.cache_idx = cache_idx;
+    item.color_table = color_table;
+    item.src_dx = x - srcx;
+    item.src_dy = y - srcy;
+    return opt_add(self, &item, rect);
+}
+
+/*****************************************************************************/
+/* write out the held orders
+   returns error */
+int
+xrdp_orders_opt_flush(struct xrdp_orders *self)
+{
+    struct xrdp_orders_opt *opt;
+    struct xrdp_orders_opt_item *item;
+    int index;
+    int count;
+    int rv;
+
+    opt = &(self->opt);
+    if (opt->count < 1 || opt->flushing)
+    {
+        return 0;
+    }
+    opt->flushing = 1;
+    count = opt->count;
+    if (count > 1)
+    {
+        count -= opt_drop_covered(opt);
+        count -= opt_merge(opt);
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_orders_opt_flush: %d orders held, "
+              "%d sent", opt->count, count);
+    rv = 0;
+    for (index = 0; index < opt->count && rv == 0; index++)
+    {
+        item = opt->items + index;
+        if (item->type == RDP_ORDER_RECT)
+        {
+            rv = xrdp_orders_out_rect(self, item->rect.left, item->rect.top,
+                                      item->rect.right - item->rect.left,
+                                      item->rect.bottom - item->rect.top,
+                                      item->color, NULL);
+            opt->orders_out++;
+        }
+        else if (item->type == RDP_ORDER_MEMBLT)
+        {
+            rv = xrdp_orders_out_mem_blt(self, item->cache_id,
+                                         item->color_table,
+                                         item->rect.left, item->rect.top,
+                                         item->rect.right - item->rect.left,
+                                         item->rect.bottom - item->rect.top,
+                                         0xcc,
+                                         item->rect.left - item->src_dx,
+                                         item->rect.top - item->src_dy,
+                                         item->cache_idx, NULL);
+            opt->orders_out++;
+        }
+    }
+    opt->count = 0;
+    opt->flushing = 0;
+    return rv;
+}
@@ -35,7 +35,24 @@
 
 
 
+/* fast-path fragment sizes, rdp header and data, the first is used for
+   clients which did not ask for more, the second is as big as the 15 bit
+   fast-path PDU length allows with room for the security header */
 #define FASTPATH_FRAG_SIZE (16 * 1024 - 128)
+#define FASTPATH_MAX_FRAG_SIZE (32 * 1024 - 128)
+
+/* fragments to be bulk compressed stay this far inside the history, so
+   neither it nor the output buffer are ever filled to the last byte */
+#define FASTPATH_COMP_SLACK 128
+
+/* fast-path update codes never bulk compressed, surface bits carry
+   RemoteFX, JPEG and the like which MPPC can not shrink */
+#define BULK_COMP_SKIP_MASK (1 << FASTPATH_UPDATETYPE_SURFCMDS)
+/* misses in a row, then skip this many fragments, doubling up to the max
+   while the misses continue */
+#define BULK_COMP_MISS_LIMIT 4
+#define BULK_COMP_BACKOFF_MIN 16
+#define BULK_COMP_BACKOFF_MAX 1024
 
 /*****************************************************************************/
 static int
@@ -53,6 +70,8 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
     client_info->xrdp_keyboard_overrides.type = -1;
     client_info->xrdp_keyboard_overrides.subtype = -1;
     client_info->xrdp_keyboard_overrides.layout = -1;
+    client_info->order_optimization = 1;
+    client_info->max_send_queue_bytes = 4 * 1024 * 1024;
 
     /* initialize (zero out) local variables: */
     items = list_create();
@@ -76,10 +95,39 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->use_bitmap_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "bitmap_compression_threads") == 0)
+        {
+            client_info->bitmap_compression_threads = g_atoi(value);
+            if (client_info->bitmap_compression_threads < 0 ||
+                    client_info->bitmap_compression_threads > 64)
+            {
+                LOG(LOG_LEVEL_WARNING, "bitmap_compression_threads=%s is "
+                    "out of range, bitmaps will be compressed in line", value);
+                client_info->bitmap_compression_threads = 0;
+            }
+        }
+        else if (g_strcasecmp(item, "order_optimization") == 0)
+        {
+            client_info->order_optimization = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "max_send_queue_bytes") == 0)
+        {
+            client_info->max_send_queue_bytes = g_atoi(value);
+            if (client_info->max_send_queue_bytes < 0)
+            {
+                LOG(LOG_LEVEL_WARNING, "max_send_queue_bytes=%s is out of "
+                    "range, output will not be limited", value);
+                client_info->max_send_queue_bytes = 0;
+            }
+        }
         else if (g_strcasecmp(item, "bulk_compression") == 0)
         {
             client_info->use_bulk_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "bulk_compression_rdp61") == 0)
+        {
+            client_info->use_rdp61_comp = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "crypt_level") == 0)
         {
             if (g_strcasecmp(value, "none") == 0)
@@ -189,6 +237,14 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->tls_ciphers = g_strdup(value);
         }
+        else if (g_strcasecmp(item, "ktls") == 0)
+        {
+            client_info->ktls = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "network_autodetect") == 0)
+        {
+            client_info->network_autodetect = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "security_layer") == 0)
         {
             if (g_strcasecmp(value, "rdp") == 0)
@@ -369,6 +425,7 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     xrdp_rdp_read_config(session->xrdp_ini, &self->client_info);
     /* create sec layer */
     self->sec_layer = xrdp_sec_create(self, trans);
+    trans->wait_bytes_max = self->client_info.max_send_queue_bytes;
     /* default 8 bit v1 color bitmap cache entries and size */
     self->client_info.cache1_entries = 600;
     self->client_info.cache1_size = 256;
@@ -395,16 +452,63 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     return self;
 }
 
+/*****************************************************************************/
+/* build the TLS context connections share, if TLS can be used
+   returns error */
+int
+xrdp_rdp_load_tls_context(const char *xrdp_ini)
+{
+    struct xrdp_client_info *client_info;
+    int rv;
+
+    client_info = g_new0(struct xrdp_client_info, 1);
+    if (client_info == NULL)
+    {
+        return 1;
+    }
+    xrdp_rdp_read_config(xrdp_ini, client_info);
+    rv = 0;
+    if (client_info->security_layer != PROTOCOL_RDP &&
+            g_file_readable(client_info->certificate) &&
+            g_file_readable(client_info->key_file))
+    {
+        rv = ssl_tls_ctx_load(client_info->key_file,
+                              client_info->certificate,
+                              client_info->ssl_protocols,
+                              client_info->tls_ciphers);
+    }
+    g_free(client_info->tls_ciphers);
+    g_free(client_info);
+    return rv;
+}
+
 /*****************************************************************************/
 void
 xrdp_rdp_delete(struct xrdp_rdp *self)
 {
+    struct xrdp_bulk_comp *bc;
+    int index;
+
     if (self == 0)
     {
         return;
     }
 
+    for (index = 0; index < 16; index++)
+    {
+        bc = self->bulk_comp + index;
+        if (bc->bytes_in > 0 || bc->bytes_skipped > 0)
+        {
+            LOG(LOG_LEVEL_DEBUG, "xrdp_rdp_delete: bulk compression, update "
+                "code %d, %llu bytes in %llu out in %llu ms, %llu bytes "
+                "skipped", index, (unsigned long long) bc->bytes_in,
+                (unsigned long long) bc->bytes_out,
+                (unsigned long long) (bc->usecs / 1000),
+                (unsigned long long) bc->bytes_skipped);
+        }
+    }
     xrdp_sec_delete(self->sec_layer);
+    xrdp_bitmap_pool_delete(self->bitmap_pool);
     mppc_enc_free(self->mppc_enc);
 #if defined(XRDP_NEUTRINORDP)
     rfx_context_free((RFX_CONTEXT *)(self->rfx_enc));
@@ -712,6 +816,84 @@ xrdp_rdp_init_fastpath(struct xrdp_rdp *self, struct stream *s)
     return 0;
 }
 
+/*****************************************************************************/
+/* returns boolean, true if a fast-path fragment of update_code and len
+   bytes should go through the bulk compressor */
+int
+xrdp_rdp_bulk_comp_wanted(struct xrdp_rdp *self, int update_code, int len)
+{
+    struct xrdp_bulk_comp *bc;
+
+    bc = self->bulk_comp + (update_code & 15);
+    if ((BULK_COMP_SKIP_MASK & (1 << (update_code & 15))) || bc->backoff > 0)
+    {
+        if (bc->backoff > 0)
+        {
+            bc->backoff--;
+        }
+        bc->bytes_skipped += len;
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* record what compressing len bytes did, comp_len is 0 if the compressor
+   gave up, after a few misses in a row stop trying for a while */
+void
+xrdp_rdp_bulk_comp_result(struct xrdp_rdp *self, int update_code, int len,
+                          int comp_len, int usecs)
+{
+    struct xrdp_bulk_comp *bc;
+
+    bc = self->bulk_comp + (update_code & 15);
+    bc->bytes_in += len;
+    bc->usecs += usecs;
+    if (comp_len > 0 && comp_len < len - len / 32)
+    {
+        bc->bytes_out += comp_len;
+        bc->misses = 0;
+        bc->next_backoff = BULK_COMP_BACKOFF_MIN;
+        return;
+    }
+    bc->bytes_out += comp_len > 0 ? comp_len : len;
+    bc->misses++;
+    if (bc->misses >= BULK_COMP_MISS_LIMIT)
+    {
+        bc->backoff = MAX(bc->next_backoff, BULK_COMP_BACKOFF_MIN);
+        bc->next_backoff = MIN(bc->backoff * 2, BULK_COMP_BACKOFF_MAX);
+        /* one more miss after the back off and it is doubled */
+        bc->misses = BULK_COMP_MISS_LIMIT - 1;
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_rdp_bulk_comp_result: update code "
+                  "%d not compressing, skipping %d fragments", update_code,
+                  bc->backoff);
+    }
+}
+
+/*****************************************************************************/
+/* returns the most bytes, rdp header included, one fast-path fragment of
+   update_code may have */
+static int
+xrdp_rdp_fastpath_frag_size(struct xrdp_rdp *self, int update_code,
+                            int header_bytes)
+{
+    int bytes;
+
+    /* MaxRequestSize from TS_MULTIFRAGMENTUPDATE_CAPABILITYSET bounds the
+       whole update, so any fragment of a valid update fits */
+    bytes = self->client_info.max_fastpath_frag_bytes;
+    bytes = MIN(bytes, FASTPATH_MAX_FRAG_SIZE);
+    bytes = MAX(bytes, FASTPATH_FRAG_SIZE);
+    if (self->client_info.rdp_compression && self->mppc_enc != NULL &&
+            !(BULK_COMP_SKIP_MASK & (1 << (update_code & 15))))
+    {
+        /* a fragment bigger than the history is sent uncompressed */
+        bytes = MIN(bytes, self->mppc_enc->buf_len - FASTPATH_COMP_SLACK +
+                    header_bytes);
+    }
+    return bytes;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* 2.2.9.1.2.1 Fast-Path Update (TS_FP_UPDATE)
@@ -734,6 +916,9 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
     int to_comp_len;
     int sec_offset;
     int rdp_offset;
+    int comp_ok;
+    int frag_size;
+    tui64 comp_start;
     struct stream frag_s;
     struct stream comp_s;
     struct stream send_s;
@@ -754,6 +939,7 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         header_bytes = 3;
     }
     sec_bytes = xrdp_sec_get_fastpath_bytes(self->sec_layer);
+    frag_size = xrdp_rdp_fastpath_frag_size(self, updateCode, header_bytes);
     fragmentation = 0;
     frag_s = *s;
     sec_offset = (int)(frag_s.sec_hdr - frag_s.data);
@@ -764,9 +950,9 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         comp_type = 0;
         send_s = frag_s;
         no_comp_len = (int)(frag_s.end - frag_s.p);
-        if (no_comp_len > FASTPATH_FRAG_SIZE)
+        if (no_comp_len > frag_size)
         {
-            no_comp_len = FASTPATH_FRAG_SIZE;
+            no_comp_len = frag_size;
             if (fragmentation == 0)
             {
                 fragmentation = 2; /* FASTPATH_FRAGMENT_FIRST */
@@ -786,12 +972,20 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         send_len = no_comp_len;
         LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_rdp_send_fastpath: no_comp_len %d, fragmentation %d",
                   no_comp_len, fragmentation);
-        if ((compression != 0) && (no_comp_len > header_bytes + 16))
+        if ((compression != 0) && (no_comp_len > header_bytes + 16) &&
+                xrdp_rdp_bulk_comp_wanted(self, updateCode,
+                                          no_comp_len - header_bytes))
         {
             to_comp_len = no_comp_len - header_bytes;
             mppc_enc = self->mppc_enc;
-            if (compress_rdp(mppc_enc, (tui8 *)(frag_s.p + header_bytes),
-                             to_comp_len))
+            comp_start = g_time_usec();
+            comp_ok = compress_rdp(mppc_enc,
+                                   (tui8 *)(frag_s.p + header_bytes),
+                                   to_comp_len);
+            xrdp_rdp_bulk_comp_result(self, updateCode, to_comp_len,
+                                      comp_ok ? mppc_enc->bytes_in_opb : 0,
+                                      (int) (g_time_usec() - comp_start));
+            if (comp_ok)
             {
                 comp_len = mppc_enc->bytes_in_opb + header_bytes;
                 send_len = comp_len;
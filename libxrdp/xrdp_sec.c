@@ -610,6 +610,7 @@ xrdp_sec_create(struct xrdp_rdp *owner, struct trans *trans)
                                       &(self->server_mcs_data));
     self->fastpath_layer = xrdp_fastpath_create(self, trans);
     self->chan_layer = xrdp_channel_create(self, self->mcs_layer);
+    self->autodetect = xrdp_autodetect_create(self);
     self->is_security_header_present = 1;
 
     return self;
@@ -624,6 +625,7 @@ xrdp_sec_delete(struct xrdp_sec *self)
         return;
     }
 
+    xrdp_autodetect_delete(self->autodetect);
     xrdp_channel_delete(self->chan_layer);
     xrdp_mcs_delete(self->mcs_layer);
     xrdp_fastpath_delete(self->fastpath_layer);
@@ -890,13 +892,25 @@ xrdp_sec_process_logon_info(struct xrdp_sec *self, struct stream *s)
     if (flags & RDP_COMPRESSION)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "[MS-RDPBCGR] TS_INFO_PACKET flag INFO_COMPRESSION found, "
-                  "CompressionType 0x%1.1x", (flags & 0x00001E00) >> 9);
-        /* TODO: check the client's supported compression type vs the server
-           compression used */
+                  "CompressionType 0x%1.1x",
+                  (flags & RDP_COMPRESSION_TYPE_MASK) >> 9);
         if (self->rdp_layer->client_info.use_bulk_comp)
         {
 
             self->rdp_layer->client_info.rdp_compression = 1;
+            self->rdp_layer->client_info.rdp_compression_type =
+                (flags & RDP_COMPRESSION_TYPE_MASK) >> 9;
+            /* the client may not understand every type we can send */
+            mppc_enc_free(self->rdp_layer->mppc_enc);
+            self->rdp_layer->mppc_enc = mppc_enc_new_for_client(
+                                            self->rdp_layer->client_info.rdp_compression_type,
+                                            self->rdp_layer->client_info.use_rdp61_comp);
+            if (self->rdp_layer->mppc_enc == 0)
+            {
+                LOG(LOG_LEVEL_ERROR, "xrdp_sec_process_logon_info: "
+                    "mppc_enc_new_for_client failed");
+                return 1;
+            }
             LOG(LOG_LEVEL_DEBUG, "Client requested compression enabled.");
         }
         else
@@ -1521,6 +1535,34 @@ xrdp_sec_recv_fastpath(struct xrdp_sec *self, struct stream *s)
 
     return 0;
 }
+/*****************************************************************************/
+/* Process a PDU on the message channel, after its security header
+   returns error, or -1 for send demand active */
+static int
+xrdp_sec_process_msgchannel(struct xrdp_sec *self, struct stream *s,
+                            int flags, int *chan)
+{
+    int rv;
+
+    rv = 0;
+    if (flags & SEC_AUTODETECT_RSP)
+    {
+        rv = xrdp_autodetect_process_rsp(self->autodetect, s);
+        if (rv > 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "xrdp_sec_process_msgchannel: "
+                "xrdp_autodetect_process_rsp failed");
+        }
+    }
+    else
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_sec_process_msgchannel: "
+                  "flags 0x%8.8x ignored", flags);
+    }
+    *chan = 1; /* just set a non existing channel and exit */
+    return rv;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -1548,7 +1590,9 @@ xrdp_sec_recv(struct xrdp_sec *self, struct stream *s, int *chan)
         return 1;
     }
 
-    if (!(self->is_security_header_present))
+    if (!(self->is_security_header_present) &&
+            (self->mcs_layer->msgchan_id == 0 ||
+             *chan != self->mcs_layer->msgchan_id))
     {
         /* noisy log statement with no real info since this is an
            expected state for TLS connections
@@ -1607,6 +1651,12 @@ xrdp_sec_recv(struct xrdp_sec *self, struct stream *s, int *chan)
         }
     }
 
+    if (self->mcs_layer->msgchan_id != 0 &&
+            *chan == self->mcs_layer->msgchan_id)
+    {
+        return xrdp_sec_process_msgchannel(self, s, flags, chan);
+    }
+
     if (flags & SEC_CLIENT_RANDOM) /* 0x01 TS_SECURITY_PACKET */
     {
         if (!s_check_rem_and_log(s, 4, "Parsing [MS-RDPBCGR] TS_SECURITY_PACKET"))
@@ -1692,6 +1742,23 @@ xrdp_sec_recv(struct xrdp_sec *self, struct stream *s, int *chan)
             self->is_security_header_present = 0;
         }
 
+        if (xrdp_autodetect_enabled(self->autodetect) &&
+                self->rdp_layer->client_info.mcs_connection_type ==
+                CONNECTION_TYPE_AUTODETECT)
+        {
+            /* the client wants the server to find the connection type,
+               demand active is sent once the results are in, or by
+               libxrdp_autodetect_check() if they take too long */
+            if (xrdp_autodetect_start_connect_time(self->autodetect) != 0)
+            {
+                LOG(LOG_LEVEL_ERROR, "xrdp_sec_recv: "
+                    "xrdp_autodetect_start_connect_time failed");
+                return 1;
+            }
+            *chan = 1; /* just set a non existing channel and exit */
+            return 0;
+        }
+
         LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_sec_recv: out 'send demand active'");
         return -1; /* special error that means send demand active */
     }
@@ -1759,9 +1826,12 @@ xrdp_sec_sign(struct xrdp_sec *self, char *out, int out_len,
 }
 
 /*****************************************************************************/
-/* returns error */
-int
-xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
+/* flags are added to the security header, which must be present if they
+   are not 0
+   returns error */
+static int
+xrdp_sec_send_flags(struct xrdp_sec *self, struct stream *s, int chan,
+                    int flags)
 {
     int datalen;
     int pad;
@@ -1772,7 +1842,7 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
     {
         if (self->crypt_level == CRYPT_LEVEL_FIPS)
         {
-            out_uint32_le(s, SEC_ENCRYPT);
+            out_uint32_le(s, SEC_ENCRYPT | flags);
             datalen = (int)((s->end - s->p) - 12);
             out_uint16_le(s, 16); /* crypto header size */
             out_uint8(s, 1); /* fips version */
@@ -1790,7 +1860,7 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
         }
         else if (self->crypt_level > CRYPT_LEVEL_LOW)
         {
-            out_uint32_le(s, SEC_ENCRYPT);
+            out_uint32_le(s, SEC_ENCRYPT | flags);
             datalen = (int)((s->end - s->p) - 8);
             xrdp_sec_sign(self, s->p, 8, s->p + 8, datalen);
             xrdp_sec_encrypt(self, s->p + 8, datalen);
@@ -1801,11 +1871,17 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
         }
         else
         {
-            out_uint32_le(s, 0);
+            out_uint32_le(s, flags);
             LOG_DEVEL(LOG_LEVEL_TRACE, "Adding header [MS-RDPBCGR] TS_SECURITY_HEADER "
-                      "flags 0x0000, flagsHi 0x0000");
+                      "flags 0x%4.4x, flagsHi 0x0000", flags);
         }
     }
+    else if (flags != 0)
+    {
+        out_uint32_le(s, flags);
+        LOG_DEVEL(LOG_LEVEL_TRACE, "Adding header [MS-RDPBCGR] TS_SECURITY_HEADER "
+                  "flags 0x%4.4x, flagsHi 0x0000", flags);
+    }
 
     if (xrdp_mcs_send(self->mcs_layer, s, chan) != 0)
     {
@@ -1816,6 +1892,42 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
+{
+    return xrdp_sec_send_flags(self, s, chan, 0);
+}
+
+/*****************************************************************************/
+/* Like xrdp_sec_init(), for a PDU on the message channel. These always
+   have a security header, even when TLS is used
+   returns error */
+int
+xrdp_sec_init_msgchannel(struct xrdp_sec *self, struct stream *s)
+{
+    if (xrdp_sec_init(self, s) != 0)
+    {
+        return 1;
+    }
+    if (self->crypt_level == CRYPT_LEVEL_NONE)
+    {
+        s_push_layer(s, sec_hdr, 4);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Send a PDU on the message channel with the given security header flags,
+   e.g. SEC_AUTODETECT_REQ
+   returns error */
+int
+xrdp_sec_send_msgchannel(struct xrdp_sec *self, struct stream *s, int flags)
+{
+    return xrdp_sec_send_flags(self, s, self->mcs_layer->msgchan_id, flags);
+}
+
 /*****************************************************************************/
 /* returns the fastpath sec byte count */
 int
@@ -2514,6 +2626,7 @@ xrdp_sec_process_mcs_data(struct xrdp_sec *self)
     char *hold_p = (char *)NULL;
     int tag = 0;
     int size = 0;
+    int msgchannel = 0;
     struct xrdp_client_info *client_info = &self->rdp_layer->client_info;
 
     s = &(self->client_mcs_data);
@@ -2591,8 +2704,13 @@ xrdp_sec_process_mcs_data(struct xrdp_sec *self)
                     return 1;
                 }
                 break;
-            /* CS_MCS_MSGCHANNEL 0xC006
-               CS_MULTITRANSPORT 0xC00A
+            case SEC_TAG_CLI_MCS_MSGCHANNEL: /* CS_MCS_MSGCHANNEL 0xC006 */
+                /* flags field is unused */
+                LOG_DEVEL(LOG_LEVEL_TRACE, "Received [MS-RDPBCGR] "
+                          "TS_UD_CS_MCS_MSGCHANNEL");
+                msgchannel = 1;
+                break;
+            /* CS_MULTITRANSPORT 0xC00A
                SC_CORE           0x0C01
                SC_SECURITY       0x0C02
                SC_NET            0x0C03
@@ -2608,6 +2726,18 @@ xrdp_sec_process_mcs_data(struct xrdp_sec *self)
         s->p = hold_p + size;
     }
 
+    /* the message channel is only wanted for auto-detection, it gets the
+       id after the static virtual channels */
+    if (msgchannel && client_info->network_autodetect &&
+            (client_info->mcs_early_capability_flags &
+             RNS_UD_CS_SUPPORT_NETCHAR_AUTODETECT))
+    {
+        self->mcs_layer->msgchan_id = MCS_GLOBAL_CHANNEL + 1 +
+                                      self->mcs_layer->channel_list->count;
+        LOG(LOG_LEVEL_DEBUG, "Network auto-detection on MCS message "
+            "channel %d", self->mcs_layer->msgchan_id);
+    }
+
     if (client_info->max_bpp > 0)
     {
         if (client_info->bpp > client_info->max_bpp)
@@ -2804,7 +2934,8 @@ xrdp_sec_incoming(struct xrdp_sec *self)
                                self->rdp_layer->client_info.key_file,
                                self->rdp_layer->client_info.certificate,
                                self->rdp_layer->client_info.ssl_protocols,
-                               self->rdp_layer->client_info.tls_ciphers) != 0)
+                               self->rdp_layer->client_info.tls_ciphers,
+                               self->rdp_layer->client_info.ktls) != 0)
         {
             LOG(LOG_LEVEL_ERROR, "xrdp_sec_incoming: trans_set_tls_mode failed");
             return 1;
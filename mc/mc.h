@@ -30,6 +30,7 @@
 #define CURRENT_MOD_VER 3
 
 struct source_info;
+struct reactor;
 
 struct mod
 {
@@ -99,6 +100,7 @@ struct mod
     tintptr wm;
     tintptr painter;
     struct source_info *si;
+    struct reactor *reactor;
     /* mod data */
     int sck;
     int width;
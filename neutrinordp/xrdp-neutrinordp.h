@@ -65,6 +65,7 @@ struct pointer_item
 #define CURRENT_MOD_VER 4
 
 struct source_info;
+struct reactor;
 
 struct kbd_overrides
 {
@@ -205,6 +206,7 @@ struct mod
     tintptr wm;
     tintptr painter;
     struct source_info *si;
+    struct reactor *reactor;
 
     /* mod data */
     int sck;
@@ -23,6 +23,7 @@
 
 #include "arch.h"
 #include "os_calls.h"
+#include "reactor.h"
 #include "string_calls.h"
 #include "thread_calls.h"
 #include "trans.h"
@@ -60,6 +61,10 @@ static tbus g_term_event = 0;
 static tintptr g_sigchld_event = 0;
 static tbus g_thread_done_event = 0;
 
+/* everything channel_thread_loop() waits on, objects are added to it as
+   they are made */
+struct reactor *g_reactor = NULL;
+
 struct config_chansrv *g_cfg = NULL;
 
 int g_display_num = -1;
@@ -1199,6 +1204,7 @@ my_trans_conn_in(struct trans *trans, struct trans *new_trans)
     g_con_trans = new_trans;
     g_con_trans->trans_data_in = my_trans_data_in;
     g_con_trans->header_size = 8;
+    trans_set_read_ahead(g_con_trans, TRANS_READ_AHEAD_BYTES);
     /* stop listening */
     trans_delete(g_lis_trans);
     g_lis_trans = 0;
@@ -1251,6 +1257,7 @@ setup_listen(void)
     g_snprintf(port, 255, XRDP_CHANSRV_STR, g_display_num);
 
     g_lis_trans->trans_conn_in = my_trans_conn_in;
+    trans_set_reactor(g_lis_trans, g_reactor);
     error = trans_listen(g_lis_trans, port);
 
     if (error != 0)
@@ -1274,6 +1281,7 @@ setup_api_listen(void)
     g_api_lis_trans->is_term = g_is_term;
     g_snprintf(port, 255, CHANSRV_API_STR, g_display_num);
     g_api_lis_trans->trans_conn_in = my_api_trans_conn_in;
+    trans_set_reactor(g_api_lis_trans, g_reactor);
     error = trans_listen(g_api_lis_trans, port);
 
     if (error != 0)
@@ -1286,30 +1294,6 @@ setup_api_listen(void)
     return 0;
 }
 
-/*****************************************************************************/
-static int
-api_con_trans_list_get_wait_objs_rw(intptr_t *robjs, int *rcount,
-                                    intptr_t *wobjs, int *wcount,
-                                    int *timeout)
-{
-    int api_con_index;
-    struct trans *ltran;
-
-    for (api_con_index = g_api_con_trans_list->count - 1;
-            api_con_index >= 0;
-            api_con_index--)
-    {
-        ltran = (struct trans *)
-                list_get_item(g_api_con_trans_list, api_con_index);
-        if (ltran != NULL)
-        {
-            trans_get_wait_objs_rw(ltran, robjs, rcount, wobjs, wcount,
-                                   timeout);
-        }
-    }
-    return 0;
-}
-
 /*****************************************************************************/
 static int
 api_con_trans_list_check_wait_objs(void)
@@ -1380,10 +1364,6 @@ api_con_trans_list_remove_all(void)
 THREAD_RV THREAD_CC
 channel_thread_loop(void *in_val)
 {
-    tbus objs[32];
-    tbus wobjs[32];
-    int num_objs;
-    int num_wobjs;
     int timeout;
     int error;
     THREAD_RV rv;
@@ -1391,21 +1371,25 @@ channel_thread_loop(void *in_val)
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread start");
     rv = 0;
     g_api_con_trans_list = list_create();
-    setup_api_listen();
-    error = setup_listen();
+    g_reactor = reactor_create();
+    if (g_reactor == NULL ||
+            reactor_add(g_reactor, g_term_event, REACTOR_READ) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "channel_thread_loop: can't set up the reactor");
+        error = 1;
+    }
+    else
+    {
+        setup_api_listen();
+        error = setup_listen();
+    }
 
     if (error == 0)
     {
         timeout = -1;
-        num_objs = 0;
-        num_wobjs = 0;
-        objs[num_objs] = g_term_event;
-        num_objs++;
-        trans_get_wait_objs(g_lis_trans, objs, &num_objs);
-        trans_get_wait_objs(g_api_lis_trans, objs, &num_objs);
 
         //g_writeln("timeout %d", timeout);
-        while (g_obj_wait(objs, num_objs, wobjs, num_wobjs, timeout) == 0)
+        while (reactor_wait(g_reactor, NULL, 0, timeout) >= 0)
         {
             check_timeout();
             if (g_is_wait_obj_set(g_term_event))
@@ -1464,26 +1448,8 @@ channel_thread_loop(void *in_val)
             devredir_check_wait_objs();
             xfuse_check_wait_objs();
             timeout = -1;
-            num_objs = 0;
-            num_wobjs = 0;
-            objs[num_objs] = g_term_event;
-            num_objs++;
-            trans_get_wait_objs_rw(g_lis_trans, objs, &num_objs,
-                                   wobjs, &num_wobjs, &timeout);
-            trans_get_wait_objs_rw(g_con_trans, objs, &num_objs,
-                                   wobjs, &num_wobjs, &timeout);
-            trans_get_wait_objs_rw(g_api_lis_trans, objs, &num_objs,
-                                   wobjs, &num_wobjs, &timeout);
-            /* get the wait_objs from in g_api_con_trans_list */
-            api_con_trans_list_get_wait_objs_rw(objs, &num_objs,
-                                                wobjs, &num_wobjs,
-                                                &timeout);
-            xcommon_get_wait_objs(objs, &num_objs, &timeout);
-            sound_get_wait_objs(objs, &num_objs, &timeout);
-            devredir_get_wait_objs(objs, &num_objs, &timeout);
-            xfuse_get_wait_objs(objs, &num_objs, &timeout);
             get_timeout(&timeout);
-        } /* end while (g_obj_wait(objs, num_objs, 0, 0, timeout) == 0) */
+        } /* end while (reactor_wait(g_reactor, NULL, 0, timeout) >= 0) */
     }
 
     trans_delete(g_lis_trans);
@@ -1494,6 +1460,8 @@ channel_thread_loop(void *in_val)
     g_api_lis_trans = 0;
     api_con_trans_list_remove_all();
     list_delete(g_api_con_trans_list);
+    reactor_delete(g_reactor);
+    g_reactor = NULL;
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread stop");
     g_set_wait_obj(g_thread_done_event);
     return rv;
@@ -58,10 +58,6 @@ int xfuse_check_wait_objs(void)
 {
     return 0;
 }
-int xfuse_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    return 0;
-}
 int xfuse_create_share(tui32 device_id, const char *dirname)
 {
     return 0;
@@ -168,6 +164,7 @@ int xfuse_path_in_xfuse_fs(const char *path)
 #include "devredir.h"
 #include "list.h"
 #include "file.h"
+#include "reactor.h"
 
 #ifndef EREMOTEIO
 #define EREMOTEIO EIO
@@ -321,6 +318,7 @@ struct req_list_item
 };
 
 extern struct config_chansrv *g_cfg; /* in chansrv.c */
+extern struct reactor *g_reactor;    /* in chansrv.c */
 
 static struct list *g_req_list = 0;
 static struct xfs_fs *g_xfs;                 /* an inst of xrdp file system */
@@ -631,6 +629,10 @@ xfuse_deinit(void)
 {
     if (g_ch != 0)
     {
+        if (g_reactor != 0)
+        {
+            reactor_del(g_reactor, g_fd);
+        }
         fuse_session_remove_chan(g_ch);
         fuse_unmount(g_mount_point, g_ch);
         g_ch = 0;
@@ -701,29 +703,6 @@ int xfuse_check_wait_objs(void)
     return 0;
 }
 
-/**
- *
- *
- * @return 0 on success, -1 on failure
- *****************************************************************************/
-
-int xfuse_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    int lcount;
-
-    if (g_ch == 0)
-    {
-        return 0;
-    }
-
-    lcount = *count;
-    objs[lcount] = g_fd;
-    lcount++;
-    *count = lcount;
-
-    return 0;
-}
-
 /**
  * @brief Create specified share directory.
  *
@@ -934,6 +913,10 @@ static int xfuse_init_lib(struct fuse_args *args)
 
     g_buffer = g_new0(char, g_bufsize);
     g_fd = fuse_chan_fd(g_ch);
+    if (g_reactor != 0)
+    {
+        reactor_add(g_reactor, g_fd, REACTOR_READ);
+    }
 
     g_req_list = list_create();
     g_req_list->auto_free = 1;
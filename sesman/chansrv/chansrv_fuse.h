@@ -49,7 +49,6 @@ typedef struct xfuse_info XFUSE_INFO;
 int xfuse_init(void);
 int xfuse_deinit(void);
 int xfuse_check_wait_objs(void);
-int xfuse_get_wait_objs(tbus *objs, int *count, int *timeout);
 int xfuse_create_share(tui32 share_id, const char *dirname);
 void xfuse_delete_share(tui32 share_id);
 
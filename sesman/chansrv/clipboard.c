@@ -475,6 +475,7 @@ clipboard_init(void)
     if (rv == 0)
     {
         g_clip_up = 1;
+        xcommon_update_wait_obj();
         make_stream(g_ins);
         init_stream(g_ins, 8192);
     }
@@ -507,6 +508,7 @@ clipboard_deinit(void)
     free_stream(g_ins);
     g_ins = 0;
     g_clip_up = 0;
+    xcommon_update_wait_obj();
     return 0;
 }
 
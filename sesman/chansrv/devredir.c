@@ -420,17 +420,6 @@ done:
     return rv;
 }
 
-/*****************************************************************************/
-int
-devredir_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    if (g_is_smartcard_redir_supported)
-    {
-        return scard_get_wait_objs(objs, count, timeout);
-    }
-    return 0;
-}
-
 /*****************************************************************************/
 int
 devredir_check_wait_objs(void)
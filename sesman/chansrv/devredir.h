@@ -30,7 +30,6 @@ int devredir_deinit(void);
 int devredir_data_in(struct stream *s, int chan_id, int chan_flags,
                      int length, int total_length);
 
-int devredir_get_wait_objs(tbus *objs, int *count, int *timeout);
 int devredir_check_wait_objs(void);
 
 /* misc stuff */
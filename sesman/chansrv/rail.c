@@ -325,6 +325,7 @@ rail_is_another_wm_running(void)
     XSync(g_display, 0);
     XSetErrorHandler((XErrorHandler)old);
     g_rail_up = g_rail_running;
+    xcommon_update_wait_obj();
 
     if (!g_rail_up)
     {
@@ -355,6 +356,7 @@ rail_deinit(void)
         /* no longer window manager */
         XSelectInput(g_display, g_root_window, 0);
         g_rail_up = 0;
+        xcommon_update_wait_obj();
     }
 
     return 0;
@@ -378,6 +380,7 @@ rail_startup(void)
     g_window_list = list_create();
     rail_send_init();
     g_rail_up = 1;
+    xcommon_update_wait_obj();
     g_rwd_atom = XInternAtom(g_display, "XRDP_RAIL_WINDOW_DATA", 0);
 
     if (!XRRQueryExtension(g_display, &g_xrr_event_base, &dummy))
@@ -286,15 +286,6 @@ scard_device_announce(tui32 device_id)
     }
 }
 
-/**
- *
- *****************************************************************************/
-int
-scard_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    return scard_pcsc_get_wait_objs(objs, count, timeout);
-}
-
 /**
  *
  *****************************************************************************/
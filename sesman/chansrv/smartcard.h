@@ -106,7 +106,6 @@ typedef struct reader_state
 } READER_STATE;
 
 void scard_device_announce(tui32 device_id);
-int  scard_get_wait_objs(tbus *objs, int *count, int *timeout);
 int  scard_check_wait_objs(void);
 int  scard_init(void);
 int  scard_deinit(void);
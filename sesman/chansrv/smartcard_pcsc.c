@@ -46,6 +46,7 @@
 
 
 extern int g_display_num; /* in chansrv.c */
+extern struct reactor *g_reactor; /* in chansrv.c */
 
 static int g_autoinc = 0; /* general purpose autoinc */
 
@@ -364,33 +365,6 @@ context_add_card(struct pcsc_uds_client *uds_client,
     return pcscCard;
 }
 
-/*****************************************************************************/
-int
-scard_pcsc_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    struct pcsc_uds_client *uds_client;
-    int index;
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "scard_pcsc_get_wait_objs:");
-    if (g_lis != 0)
-    {
-        trans_get_wait_objs(g_lis, objs, count);
-    }
-    if (g_uds_clients != 0)
-    {
-        for (index = 0; index < g_uds_clients->count; index++)
-        {
-            uds_client = (struct pcsc_uds_client *)
-                         list_get_item(g_uds_clients, index);
-            if (uds_client != 0)
-            {
-                trans_get_wait_objs(uds_client->con, objs, count);
-            }
-        }
-    }
-    return 0;
-}
-
 /*****************************************************************************/
 int
 scard_pcsc_check_wait_objs(void)
@@ -1928,6 +1902,7 @@ scard_pcsc_init(void)
         g_chmod_hex(g_pcsclite_ipc_dir, 0x700);
         g_snprintf(g_pcsclite_ipc_file, 255, "%s/pcscd.comm", g_pcsclite_ipc_dir);
         g_lis->trans_conn_in = my_pcsc_trans_conn_in;
+        trans_set_reactor(g_lis, g_reactor);
         error = trans_listen(g_lis, g_pcsclite_ipc_file);
         if (error != 0)
         {
@@ -1966,11 +1941,6 @@ scard_pcsc_deinit(void)
 
 #else
 
-int
-scard_pcsc_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    return 0;
-}
 int
 scard_pcsc_check_wait_objs(void)
 {
@@ -24,7 +24,6 @@
 #ifndef _SMARTCARD_PCSC_H
 #define _SMARTCARD_PCSC_H
 
-int scard_pcsc_get_wait_objs(tbus *objs, int *count, int *timeout);
 int scard_pcsc_check_wait_objs(void);
 int scard_pcsc_init(void);
 int scard_pcsc_deinit(void);
@@ -62,6 +62,7 @@ static lame_global_flags *g_lame_encoder = 0;
 extern int g_rdpsnd_chan_id;    /* in chansrv.c */
 extern int g_display_num;       /* in chansrv.c */
 extern struct config_chansrv *g_cfg; /* in chansrv.c */
+extern struct reactor *g_reactor; /* in chansrv.c */
 
 /* audio out: sound_server -> xrdp -> NeutrinoRDP */
 static struct trans *g_audio_l_trans_out = 0; /* listener */
@@ -1414,42 +1415,6 @@ sound_data_in(struct stream *s, int chan_id, int chan_flags, int length,
     return 0;
 }
 
-/*****************************************************************************/
-int
-sound_get_wait_objs(tbus *objs, int *count, int *timeout)
-{
-    int lcount;
-
-    lcount = *count;
-
-    if (g_audio_l_trans_out != 0)
-    {
-        objs[lcount] = g_audio_l_trans_out->sck;
-        lcount++;
-    }
-
-    if (g_audio_c_trans_out != 0)
-    {
-        objs[lcount] = g_audio_c_trans_out->sck;
-        lcount++;
-    }
-
-    if (g_audio_l_trans_in != 0)
-    {
-        objs[lcount] = g_audio_l_trans_in->sck;
-        lcount++;
-    }
-
-    if (g_audio_c_trans_in != 0)
-    {
-        objs[lcount] = g_audio_c_trans_in->sck;
-        lcount++;
-    }
-
-    *count = lcount;
-    return 0;
-}
-
 /*****************************************************************************/
 int
 sound_check_wait_objs(void)
@@ -1900,6 +1865,7 @@ sound_start_source_listener(void)
     g_audio_l_trans_in->is_term = g_is_term;
     g_snprintf(port, 255, CHANSRV_PORT_IN_STR, g_display_num);
     g_audio_l_trans_in->trans_conn_in = sound_sndsrvr_source_conn_in;
+    trans_set_reactor(g_audio_l_trans_in, g_reactor);
     if (trans_listen(g_audio_l_trans_in, port) != 0)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "trans_listen failed");
@@ -1919,6 +1885,7 @@ sound_start_sink_listener(void)
     g_audio_l_trans_out->is_term = g_is_term;
     g_snprintf(port, 255, CHANSRV_PORT_OUT_STR, g_display_num);
     g_audio_l_trans_out->trans_conn_in = sound_sndsrvr_sink_conn_in;
+    trans_set_reactor(g_audio_l_trans_out, g_reactor);
     if (trans_listen(g_audio_l_trans_out, port) != 0)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "trans_listen failed");
@@ -52,7 +52,6 @@
 
 int sound_init(void);
 int sound_deinit(void);
-int sound_get_wait_objs(tbus *objs, int *count, int *timeout);
 int sound_check_wait_objs(void);
 
 int sound_data_in(struct stream *s, int chan_id, int chan_flags,
@@ -26,6 +26,7 @@
 #include "os_calls.h"
 #include "chansrv.h"
 #include "log.h"
+#include "reactor.h"
 #include "clipboard.h"
 #include "rail.h"
 #include "xcommon.h"
@@ -34,6 +35,8 @@ extern int g_clip_up;                         /* in clipboard.c */
 
 extern int g_rail_up;                         /* in rail.c */
 
+extern struct reactor *g_reactor;             /* in chansrv.c */
+
 Display *g_display = 0;
 int g_x_socket = 0;
 tbus g_x_wait_obj = 0;
@@ -147,21 +150,31 @@ xcommon_init(void)
 
 /*****************************************************************************/
 /* returns error
-   this is called to get any wait objects for the main loop
-   timeout can be nil */
+   registers the X connection with the channel loop while clipboard or
+   rail is up, call it after either of them starts or stops */
 int
-xcommon_get_wait_objs(tbus *objs, int *count, int *timeout)
+xcommon_update_wait_obj(void)
 {
-    int lcount;
+    static int registered = 0;
+    int want;
 
-    if (((!g_clip_up) && (!g_rail_up)) || (objs == 0) || (count == 0))
+    want = (g_clip_up || g_rail_up) && (g_reactor != 0);
+    if (want == registered)
     {
         return 0;
     }
-    lcount = *count;
-    objs[lcount] = g_x_wait_obj;
-    lcount++;
-    *count = lcount;
+    if (want)
+    {
+        if (reactor_add(g_reactor, g_x_wait_obj, REACTOR_READ) != 0)
+        {
+            return 1;
+        }
+    }
+    else if (g_reactor != 0)
+    {
+        reactor_del(g_reactor, g_x_wait_obj);
+    }
+    registered = want;
     return 0;
 }
 
@@ -33,7 +33,7 @@ xcommon_get_local_time(void);
 int
 xcommon_init(void);
 int
-xcommon_get_wait_objs(tbus *objs, int *count, int *timeout);
+xcommon_update_wait_obj(void);
 int
 xcommon_check_wait_objs(void);
 void
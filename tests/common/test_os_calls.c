@@ -7,9 +7,11 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <poll.h>
+#include <unistd.h>
 
 #include "os_calls.h"
 #include "list.h"
+#include "thread_calls.h"
 
 #include "test_common.h"
 
@@ -487,6 +489,138 @@ START_TEST(test_g_sck_fd_overflow)
 }
 END_TEST
 
+/******************************************************************************/
+/***
+ * Asks the kernel whether a wait object is set, bypassing os_calls */
+static int
+wait_obj_signalled(tintptr obj)
+{
+    struct pollfd pfd;
+
+    pfd.fd = obj & 0xffff;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1;
+}
+
+/******************************************************************************/
+START_TEST(test_g_wait_obj)
+{
+    unsigned int base_fd_count = get_open_fd_count();
+    tintptr obj;
+
+    obj = g_create_wait_obj("test_g_wait_obj");
+    ck_assert_int_ne(obj, 0);
+#if defined(__linux__)
+    // An eventfd is used where there is one
+    ck_assert_int_eq(get_open_fd_count(), base_fd_count + 1);
+#endif
+    ck_assert_int_eq(g_is_wait_obj_set(obj), 0);
+    ck_assert_int_eq(g_set_wait_obj(obj), 0);
+    ck_assert_int_ne(g_is_wait_obj_set(obj), 0);
+    ck_assert_int_ne(wait_obj_signalled(obj), 0);
+    // Setting it again is not counted
+    ck_assert_int_eq(g_set_wait_obj(obj), 0);
+    ck_assert_int_eq(g_reset_wait_obj(obj), 0);
+    ck_assert_int_eq(g_is_wait_obj_set(obj), 0);
+    ck_assert_int_eq(wait_obj_signalled(obj), 0);
+    ck_assert_int_eq(g_set_wait_obj(obj), 0);
+    ck_assert_int_ne(g_is_wait_obj_set(obj), 0);
+    g_delete_wait_obj(obj);
+    ck_assert_int_eq(get_open_fd_count(), base_fd_count);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_g_wait_obj_fork)
+{
+    struct exit_status e;
+    tintptr obj;
+    int pid;
+
+    obj = g_create_wait_obj("test_g_wait_obj_fork");
+    g_set_wait_obj(obj);
+    pid = g_fork();
+    ck_assert_int_ge(pid, 0);
+    if (pid == 0)
+    {
+        // Reset it behind the parent's back
+        g_reset_wait_obj(obj);
+        _exit(g_is_wait_obj_set(obj));
+    }
+    e = g_waitpid_status(pid);
+    ck_assert_int_eq(e.reason, E_XR_STATUS_CODE);
+    ck_assert_int_eq(e.val, 0);
+    // The parent must not assume it is still set
+    ck_assert_int_eq(g_is_wait_obj_set(obj), 0);
+    g_set_wait_obj(obj);
+    ck_assert_int_ne(wait_obj_signalled(obj), 0);
+    g_delete_wait_obj(obj);
+}
+END_TEST
+
+/******************************************************************************/
+struct wait_obj_setter
+{
+    tintptr obj;
+    int rounds;
+    int round; /* set by the test to start a round */
+    int round_done; /* set by the setter when its set is done */
+};
+
+/******************************************************************************/
+static THREAD_RV THREAD_CC
+wait_obj_setter_proc(void *arg)
+{
+    struct wait_obj_setter *setter;
+    int round;
+
+    setter = (struct wait_obj_setter *) arg;
+    for (round = 1; round <= setter->rounds; round++)
+    {
+        while (__atomic_load_n(&setter->round, __ATOMIC_ACQUIRE) != round)
+        {
+            g_sleep(0);
+        }
+        g_set_wait_obj(setter->obj);
+        __atomic_store_n(&setter->round_done, round, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+START_TEST(test_g_wait_obj_set_during_reset)
+{
+    struct wait_obj_setter setter;
+    int round;
+
+    setter.obj = g_create_wait_obj("test_g_wait_obj_set_during_reset");
+    setter.rounds = 2000;
+    setter.round = 0;
+    setter.round_done = 0;
+    ck_assert_int_eq(tc_thread_create(wait_obj_setter_proc, &setter), 0);
+    for (round = 1; round <= setter.rounds; round++)
+    {
+        // Each round races one set against one reset
+        g_set_wait_obj(setter.obj);
+        __atomic_store_n(&setter.round, round, __ATOMIC_RELEASE);
+        ck_assert_int_eq(g_reset_wait_obj(setter.obj), 0);
+        while (__atomic_load_n(&setter.round_done, __ATOMIC_ACQUIRE) != round)
+        {
+            g_sleep(0);
+        }
+        // Whatever the order, the flag and the kernel must agree
+        ck_assert_int_eq(g_is_wait_obj_set(setter.obj) != 0,
+                         wait_obj_signalled(setter.obj));
+    }
+    // and a set is never skipped as already done
+    ck_assert_int_eq(g_reset_wait_obj(setter.obj), 0);
+    ck_assert_int_eq(g_set_wait_obj(setter.obj), 0);
+    ck_assert_int_ne(wait_obj_signalled(setter.obj), 0);
+    g_delete_wait_obj(setter.obj);
+}
+END_TEST
+
 /******************************************************************************/
 Suite *
 make_suite_test_os_calls(void)
@@ -512,5 +646,8 @@ make_suite_test_os_calls(void)
     tcase_add_test(tc_os_calls, test_g_file_is_open);
     tcase_add_test(tc_os_calls, test_g_sck_fd_passing);
     tcase_add_test(tc_os_calls, test_g_sck_fd_overflow);
+    tcase_add_test(tc_os_calls, test_g_wait_obj);
+    tcase_add_test(tc_os_calls, test_g_wait_obj_fork);
+    tcase_add_test(tc_os_calls, test_g_wait_obj_set_during_reset);
     return s;
 }
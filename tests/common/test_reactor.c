@@ -0,0 +1,206 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <unistd.h>
+
+#include "os_calls.h"
+#include "reactor.h"
+
+#include "test_common.h"
+
+/* more than g_obj_wait() can manage */
+#define MANY_OBJS 300
+
+static struct reactor *g_reactor;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_reactor = reactor_create();
+    ck_assert_ptr_nonnull(g_reactor);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    reactor_delete(g_reactor);
+}
+
+/******************************************************************************/
+START_TEST(test_reactor__add_del)
+{
+    struct reactor_event ev[4];
+    tintptr obj;
+
+    obj = g_create_wait_obj("test_reactor");
+    ck_assert_int_eq(reactor_add(g_reactor, obj, REACTOR_READ), 0);
+    ck_assert_int_ne(reactor_add(g_reactor, obj, REACTOR_READ), 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 0);
+    g_set_wait_obj(obj);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(ev[0].obj, obj);
+    ck_assert_int_eq(ev[0].events, REACTOR_READ);
+    ck_assert_int_eq(reactor_del(g_reactor, obj), 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 0);
+    ck_assert_int_ne(reactor_del(g_reactor, obj), 0);
+    g_delete_wait_obj(obj);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_reactor__mod)
+{
+    struct reactor_event ev[4];
+    int sck[2];
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    ck_assert_int_eq(reactor_add(g_reactor, sck[0], REACTOR_READ), 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 0);
+    ck_assert_int_eq(reactor_mod(g_reactor, sck[0],
+                                 REACTOR_READ | REACTOR_WRITE), 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(ev[0].events, REACTOR_WRITE);
+    ck_assert_int_ne(reactor_mod(g_reactor, sck[1], REACTOR_READ), 0);
+    ck_assert_int_eq(reactor_del(g_reactor, sck[0]), 0);
+    g_sck_close(sck[0]);
+    g_sck_close(sck[1]);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_reactor__reused_descriptor)
+{
+    struct reactor_event ev[4];
+    tintptr obj;
+    tintptr new_obj;
+
+    obj = g_create_wait_obj("test_reactor1");
+    ck_assert_int_eq(reactor_add(g_reactor, obj, REACTOR_READ), 0);
+    ck_assert_int_eq(reactor_del(g_reactor, obj), 0);
+    g_delete_wait_obj(obj);
+    new_obj = g_create_wait_obj("test_reactor2");
+    /* the kernel hands out the lowest free descriptors */
+    ck_assert_int_eq(new_obj, obj);
+    ck_assert_int_eq(reactor_add(g_reactor, new_obj, REACTOR_READ), 0);
+    g_set_wait_obj(new_obj);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(ev[0].obj, new_obj);
+    ck_assert_int_eq(reactor_del(g_reactor, new_obj), 0);
+    g_delete_wait_obj(new_obj);
+}
+END_TEST
+
+#if defined(__linux__)
+/******************************************************************************/
+START_TEST(test_reactor__closed_elsewhere)
+{
+    struct reactor_event ev[4];
+    int sck[2];
+    int new_sck[2];
+    int dup_fd;
+    tintptr obj;
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    obj = sck[0];
+    ck_assert_int_eq(reactor_add(g_reactor, obj, REACTOR_READ), 0);
+    /* the file stays open through dup_fd, and readable */
+    dup_fd = dup(sck[0]);
+    ck_assert_int_ge(dup_fd, 0);
+    g_sck_send(sck[1], "x", 1, 0);
+    /* closed before it is removed, then the descriptor is reused */
+    close(sck[0]);
+    reactor_del(g_reactor, obj);
+    ck_assert_int_eq(g_sck_local_socketpair(new_sck), 0);
+    ck_assert_int_eq(new_sck[0], sck[0]);
+    ck_assert_int_eq(reactor_add(g_reactor, new_sck[0], REACTOR_READ), 0);
+    /* the old file must not be reported for the new object */
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 0);
+    g_sck_send(new_sck[1], "x", 1, 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(ev[0].obj, new_sck[0]);
+    ck_assert_int_eq(reactor_del(g_reactor, new_sck[0]), 0);
+    g_sck_close(new_sck[0]);
+    g_sck_close(new_sck[1]);
+    g_sck_close(sck[1]);
+    g_sck_close(dup_fd);
+}
+END_TEST
+#endif
+
+/******************************************************************************/
+START_TEST(test_reactor__many_objs)
+{
+    struct reactor_event ev[4];
+    tintptr objs[MANY_OBJS];
+    int index;
+
+    for (index = 0; index < MANY_OBJS; index++)
+    {
+        objs[index] = g_create_wait_obj("test_reactor");
+        ck_assert_int_ne(objs[index], 0);
+        ck_assert_int_eq(reactor_add(g_reactor, objs[index], REACTOR_READ),
+                         0);
+    }
+    g_set_wait_obj(objs[MANY_OBJS - 1]);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(ev[0].obj, objs[MANY_OBJS - 1]);
+    for (index = 0; index < MANY_OBJS; index++)
+    {
+        ck_assert_int_eq(reactor_del(g_reactor, objs[index]), 0);
+        g_delete_wait_obj(objs[index]);
+    }
+}
+END_TEST
+
+#if defined(__linux__)
+/******************************************************************************/
+START_TEST(test_reactor__edge)
+{
+    struct reactor_event ev[4];
+    int sck[2];
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    ck_assert_int_eq(reactor_add(g_reactor, sck[0],
+                                 REACTOR_READ | REACTOR_EDGE), 0);
+    g_sck_send(sck[1], "x", 1, 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    /* still readable, but not reported again until more arrives */
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 0);
+    g_sck_send(sck[1], "x", 1, 0);
+    ck_assert_int_eq(reactor_wait(g_reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(reactor_del(g_reactor, sck[0]), 0);
+    g_sck_close(sck[0]);
+    g_sck_close(sck[1]);
+}
+END_TEST
+#endif
+
+/******************************************************************************/
+Suite *
+make_suite_test_reactor(void)
+{
+    Suite *s;
+    TCase *tc_reactor;
+
+    s = suite_create("Reactor");
+
+    tc_reactor = tcase_create("reactor");
+    tcase_add_checked_fixture(tc_reactor, setup, teardown);
+    tcase_add_test(tc_reactor, test_reactor__add_del);
+    tcase_add_test(tc_reactor, test_reactor__mod);
+    tcase_add_test(tc_reactor, test_reactor__reused_descriptor);
+#if defined(__linux__)
+    tcase_add_test(tc_reactor, test_reactor__closed_elsewhere);
+#endif
+    tcase_add_test(tc_reactor, test_reactor__many_objs);
+#if defined(__linux__)
+    tcase_add_test(tc_reactor, test_reactor__edge);
+#endif
+
+    suite_add_tcase(s, tc_reactor);
+
+    return s;
+}
@@ -3,9 +3,14 @@
 #include "config_ac.h"
 #endif
 
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+
 #include "os_calls.h"
 #include "string_calls.h"
 #include "ssl_calls.h"
+#include "trans.h"
 
 #include "test_common.h"
 
@@ -364,6 +369,219 @@ START_TEST(test_gen_key_xrdp1)
 }
 END_TEST
 
+#define TLS_TEST_BYTES (256 * 1024)
+
+/******************************************************************************/
+/* writes a throwaway key and self signed certificate */
+static void
+make_cert(const char *key_file, const char *cert_file)
+{
+    EVP_PKEY_CTX *pctx;
+    EVP_PKEY *pkey;
+    X509 *x509;
+    BIO *bio;
+
+    pkey = NULL;
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    ck_assert(pctx != NULL);
+    ck_assert_int_eq(EVP_PKEY_keygen_init(pctx), 1);
+    ck_assert_int_eq(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(
+                         pctx, NID_X9_62_prime256v1), 1);
+    ck_assert_int_eq(EVP_PKEY_keygen(pctx, &pkey), 1);
+    EVP_PKEY_CTX_free(pctx);
+
+    x509 = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(x509), "CN",
+                               MBSTRING_ASC,
+                               (const unsigned char *) "xrdp-test",
+                               -1, -1, 0);
+    X509_set_issuer_name(x509, X509_get_subject_name(x509));
+    ck_assert_int_ne(X509_sign(x509, pkey, EVP_sha256()), 0);
+
+    bio = BIO_new_file(key_file, "w");
+    ck_assert(bio != NULL);
+    PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL);
+    BIO_free(bio);
+    bio = BIO_new_file(cert_file, "w");
+    ck_assert(bio != NULL);
+    PEM_write_bio_X509(bio, x509);
+    BIO_free(bio);
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+}
+
+/******************************************************************************/
+/* server side of tls_connect(), sends TLS_TEST_BYTES
+   returns the exit status for the child */
+static int
+tls_serve(int sck, const char *key_file, const char *cert_file, int ktls)
+{
+    struct trans *trans;
+    char *data;
+    int index;
+    int sent;
+    int rv;
+
+    trans = trans_create(TRANS_MODE_UNIX, 1024, 1024);
+    trans->sck = sck;
+    trans->status = TRANS_STATUS_UP;
+    rv = trans_set_tls_mode(trans, key_file, cert_file, 0, "", ktls);
+    if (rv == 0)
+    {
+        /* there's no kernel TLS on a unix socket */
+        rv = ssl_tls_ktls_send(trans->tls);
+    }
+    data = (char *) g_malloc(TLS_TEST_BYTES, 0);
+    for (index = 0; index < TLS_TEST_BYTES; index++)
+    {
+        data[index] = (char) (index * 3);
+    }
+    index = 0;
+    while (rv == 0 && index < TLS_TEST_BYTES)
+    {
+        sent = trans->trans_send(trans, data + index, TLS_TEST_BYTES - index);
+        if (sent > 0)
+        {
+            index += sent;
+        }
+        else if (sent < 0 && g_sck_last_error_would_block(sck))
+        {
+            g_sck_can_send(sck, 100);
+        }
+        else
+        {
+            rv = 1;
+        }
+    }
+    g_free(data);
+    trans_delete(trans);
+    return rv;
+}
+
+/******************************************************************************/
+/* one connection to a forked server, as xrdp forks for each client
+   returns boolean, true if the session was resumed */
+static int
+tls_connect(SSL_CTX *ctx, SSL_SESSION **session, const char *key_file,
+            const char *cert_file, int ktls)
+{
+    struct exit_status e;
+    SSL *ssl;
+    char buf[4096];
+    int sck[2];
+    int pid;
+    int rv;
+    int total;
+    int index;
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    pid = g_fork();
+    ck_assert_int_ge(pid, 0);
+    if (pid == 0)
+    {
+        g_sck_close(sck[1]);
+        g_sck_set_non_blocking(sck[0]);
+        _exit(tls_serve(sck[0], key_file, cert_file, ktls));
+    }
+    g_sck_close(sck[0]);
+    ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, sck[1]);
+    if (*session != NULL)
+    {
+        SSL_set_session(ssl, *session);
+    }
+    ck_assert_int_eq(SSL_connect(ssl), 1);
+    /* TLS 1.3 tickets arrive after the handshake */
+    total = 0;
+    while (total < TLS_TEST_BYTES)
+    {
+        rv = SSL_read(ssl, buf, sizeof(buf));
+        ck_assert_int_gt(rv, 0);
+        for (index = 0; index < rv; index++)
+        {
+            ck_assert_int_eq(buf[index], (char) ((total + index) * 3));
+        }
+        total += rv;
+    }
+    rv = SSL_session_reused(ssl);
+    SSL_SESSION_free(*session);
+    *session = SSL_get1_session(ssl);
+    /* a session closed without a shutdown can't be resumed, the server
+       may have gone already so don't send one */
+    SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN);
+    SSL_free(ssl);
+    g_sck_close(sck[1]);
+    e = g_waitpid_status(pid);
+    ck_assert_int_eq(e.reason, E_XR_STATUS_CODE);
+    ck_assert_int_eq(e.val, 0);
+    return rv;
+}
+
+/******************************************************************************/
+START_TEST(test_tls_ctx_resume)
+{
+    char key_file[256];
+    char cert_file[256];
+    SSL_CTX *ctx;
+    SSL_SESSION *session;
+
+    g_snprintf(key_file, sizeof(key_file), "/tmp/xrdp_test_%d_key.pem",
+               g_getpid());
+    g_snprintf(cert_file, sizeof(cert_file), "/tmp/xrdp_test_%d_cert.pem",
+               g_getpid());
+    make_cert(key_file, cert_file);
+    ctx = SSL_CTX_new(TLS_client_method());
+    session = NULL;
+
+    ck_assert_int_eq(ssl_tls_ctx_load(key_file, cert_file, 0, ""), 0);
+    ck_assert(!tls_connect(ctx, &session, key_file, cert_file, 0));
+    ck_assert(tls_connect(ctx, &session, key_file, cert_file, 0));
+    /* a failed reload leaves the working context in place */
+    ck_assert_int_ne(ssl_tls_ctx_load(key_file, "/nonexistent.pem", 0, ""),
+                     0);
+    ck_assert(tls_connect(ctx, &session, key_file, cert_file, 0));
+    /* each connection builds its own context without one */
+    ssl_tls_ctx_free();
+    ck_assert(!tls_connect(ctx, &session, key_file, cert_file, 0));
+    ck_assert(!tls_connect(ctx, &session, key_file, cert_file, 0));
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+    g_file_delete(key_file);
+    g_file_delete(cert_file);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tls_ktls_fallback)
+{
+    char key_file[256];
+    char cert_file[256];
+    SSL_CTX *ctx;
+    SSL_SESSION *session;
+
+    g_snprintf(key_file, sizeof(key_file), "/tmp/xrdp_test_%d_key.pem",
+               g_getpid());
+    g_snprintf(cert_file, sizeof(cert_file), "/tmp/xrdp_test_%d_cert.pem",
+               g_getpid());
+    make_cert(key_file, cert_file);
+    ctx = SSL_CTX_new(TLS_client_method());
+    session = NULL;
+
+    /* asked for, but not possible, so OpenSSL encrypts as before */
+    ck_assert(!tls_connect(ctx, &session, key_file, cert_file, 1));
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+    g_file_delete(key_file);
+    g_file_delete(cert_file);
+}
+END_TEST
+
 /******************************************************************************/
 Suite *
 make_suite_test_ssl_calls(void)
@@ -386,6 +604,8 @@ make_suite_test_ssl_calls(void)
     tcase_add_test(tc_ssl_calls, test_des3_enc_ok);
     tcase_add_test(tc_ssl_calls, test_hmac_sha1_dgst_ok);
     tcase_add_test(tc_ssl_calls, test_gen_key_xrdp1);
+    tcase_add_test(tc_ssl_calls, test_tls_ctx_resume);
+    tcase_add_test(tc_ssl_calls, test_tls_ktls_fallback);
 
     return s;
 }
@@ -0,0 +1,629 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "reactor.h"
+#include "trans.h"
+
+#include "test_common.h"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#define PDU_COUNT 64
+#define PDU_SIZE 3000
+
+static struct trans *g_trans;
+static int g_peer;
+static struct source_info g_si;
+static int g_pdus_in;
+
+/******************************************************************************/
+/* a transport on one end of a socket pair, the test reads the other end */
+static void
+setup(void)
+{
+    int sck[2];
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    g_sck_set_non_blocking(sck[0]);
+    g_sck_set_non_blocking(sck[1]);
+    g_sck_set_send_buffer_bytes(sck[0], 4096);
+    g_trans = trans_create(TRANS_MODE_UNIX, 1024, 1024);
+    g_trans->sck = sck[0];
+    g_trans->status = TRANS_STATUS_UP;
+    g_memset(&g_si, 0, sizeof(g_si));
+    g_trans->si = &g_si;
+    g_trans->my_source = XRDP_SOURCE_CLIENT;
+    g_peer = sck[1];
+    g_pdus_in = 0;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    trans_delete(g_trans);
+    g_sck_close(g_peer);
+}
+
+/******************************************************************************/
+static char
+pdu_byte(int pdu, int offset)
+{
+    return (char) (pdu * 7 + offset);
+}
+
+/******************************************************************************/
+/* queue PDU_COUNT pdus, much more than the socket will take */
+static void
+write_pdus(void)
+{
+    struct stream *s;
+    int pdu;
+    int index;
+
+    make_stream(s);
+    init_stream(s, PDU_SIZE);
+    for (pdu = 0; pdu < PDU_COUNT; pdu++)
+    {
+        init_stream(s, 0);
+        for (index = 0; index < PDU_SIZE; index++)
+        {
+            out_uint8(s, pdu_byte(pdu, index));
+        }
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_copy_s(g_trans, s), 0);
+    }
+    free_stream(s);
+}
+
+/******************************************************************************/
+/* read until all the pdus have arrived, in order */
+static void
+read_pdus(void)
+{
+    char buf[8192];
+    int total;
+    int rcvd;
+    int index;
+
+    total = 0;
+    while (total < PDU_COUNT * PDU_SIZE)
+    {
+        ck_assert_int_eq(trans_send_waiting(g_trans, 0), 0);
+        rcvd = g_sck_recv(g_peer, buf, sizeof(buf), 0);
+        if (rcvd < 0)
+        {
+            ck_assert(g_sck_last_error_would_block(g_peer));
+            ck_assert(g_trans->wait_s != NULL);
+            continue;
+        }
+        ck_assert_int_gt(rcvd, 0);
+        for (index = 0; index < rcvd; index++)
+        {
+            ck_assert_int_eq(buf[index], pdu_byte((total + index) / PDU_SIZE,
+                                                  (total + index) % PDU_SIZE));
+        }
+        total += rcvd;
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_trans__queue_in_order)
+{
+    struct stream *temp_s;
+
+    write_pdus();
+    ck_assert(g_trans->wait_s != NULL);
+    temp_s = g_trans->wait_s;
+    while (temp_s->next != NULL)
+    {
+        temp_s = temp_s->next;
+    }
+    ck_assert_ptr_eq(temp_s, g_trans->wait_s_tail);
+    read_pdus();
+    ck_assert_ptr_null(g_trans->wait_s);
+    ck_assert_ptr_null(g_trans->wait_s_tail);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__source_accounting)
+{
+    g_si.cur_source = XRDP_SOURCE_MOD;
+    write_pdus();
+    ck_assert_int_gt(g_si.source[XRDP_SOURCE_MOD], 0);
+    ck_assert_int_lt(g_si.source[XRDP_SOURCE_MOD], PDU_COUNT * PDU_SIZE);
+    read_pdus();
+    ck_assert_int_eq(g_si.source[XRDP_SOURCE_MOD], 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__write_after_drain)
+{
+    write_pdus();
+    read_pdus();
+    /* the queue can be used again once empty */
+    write_pdus();
+    read_pdus();
+    ck_assert_ptr_null(g_trans->wait_s_tail);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__congested)
+{
+    g_trans->wait_bytes_max = 256 * 1024;
+    write_pdus();
+    ck_assert_int_gt(g_trans->wait_bytes, 128 * 1024);
+    ck_assert(trans_is_congested(g_trans));
+    read_pdus();
+    ck_assert_int_eq(g_trans->wait_bytes, 0);
+    ck_assert(!trans_is_congested(g_trans));
+}
+END_TEST
+
+/******************************************************************************/
+/* writes count pdus of size bytes, pdu numbers from first */
+static void
+write_small_pdus(int first, int count, int size)
+{
+    struct stream *s;
+    int pdu;
+    int index;
+
+    make_stream(s);
+    init_stream(s, size);
+    for (pdu = first; pdu < first + count; pdu++)
+    {
+        init_stream(s, 0);
+        for (index = 0; index < size; index++)
+        {
+            out_uint8(s, pdu_byte(pdu, index));
+        }
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_copy_s(g_trans, s), 0);
+    }
+    free_stream(s);
+}
+
+/******************************************************************************/
+START_TEST(test_trans__corked)
+{
+    char buf[8192];
+    int rcvd;
+    int index;
+
+    ck_assert_int_eq(trans_set_corked(g_trans, 1), 0);
+    write_small_pdus(0, 20, 100);
+    /* all held back, in one stream */
+    ck_assert_int_lt(g_sck_recv(g_peer, buf, sizeof(buf), 0), 0);
+    ck_assert_int_eq(g_trans->wait_bytes, 20 * 100);
+    ck_assert_ptr_eq(g_trans->wait_s, g_trans->wait_s_tail);
+    ck_assert(!trans_is_congested(g_trans));
+    ck_assert_int_eq(trans_set_corked(g_trans, 0), 0);
+    ck_assert_ptr_null(g_trans->wait_s);
+    /* and sent with one call */
+    rcvd = g_sck_recv(g_peer, buf, sizeof(buf), 0);
+    ck_assert_int_eq(rcvd, 20 * 100);
+    for (index = 0; index < rcvd; index++)
+    {
+        ck_assert_int_eq(buf[index], pdu_byte(index / 100, index % 100));
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__corked_full)
+{
+    char buf[8192];
+    int total;
+    int rcvd;
+    int index;
+
+    ck_assert_int_eq(trans_set_corked(g_trans, 1), 0);
+    write_small_pdus(0, 3, 100);
+    /* taking it over 16K sends what is held along with it */
+    write_small_pdus(3, 1, 20000);
+    ck_assert_int_lt(g_trans->wait_bytes, 300 + 20000);
+    total = 0;
+    while (total < 300 + 20000)
+    {
+        ck_assert_int_eq(trans_send_waiting(g_trans, 0), 0);
+        rcvd = g_sck_recv(g_peer, buf, sizeof(buf), 0);
+        if (rcvd < 0)
+        {
+            continue;
+        }
+        for (index = 0; index < rcvd; index++)
+        {
+            if (total + index < 300)
+            {
+                ck_assert_int_eq(buf[index], pdu_byte((total + index) / 100,
+                                                      (total + index) % 100));
+            }
+            else
+            {
+                ck_assert_int_eq(buf[index],
+                                 pdu_byte(3, total + index - 300));
+            }
+        }
+        total += rcvd;
+    }
+    ck_assert_int_eq(trans_set_corked(g_trans, 0), 0);
+}
+END_TEST
+
+/******************************************************************************/
+/* returns the number of write objects wanted */
+static int
+count_wobjs(void)
+{
+    tbus robjs[8];
+    tbus wobjs[8];
+    int rcount;
+    int wcount;
+    int timeout;
+
+    rcount = 0;
+    wcount = 0;
+    timeout = -1;
+    trans_get_wait_objs_rw(g_trans, robjs, &rcount, wobjs, &wcount, &timeout);
+    return wcount;
+}
+
+/******************************************************************************/
+START_TEST(test_trans__send_lowat)
+{
+    char buf[1024];
+    int rcvd;
+
+    g_trans->send_lowat = 1;
+    ck_assert(!trans_is_congested(g_trans));
+    ck_assert_int_eq(count_wobjs(), 0);
+    /* the socket fills up without anything queued in the transport */
+    g_memset(buf, 0, sizeof(buf));
+    while (g_sck_send(g_trans->sck, buf, sizeof(buf), 0) > 0)
+    {
+    }
+    ck_assert_ptr_null(g_trans->wait_s);
+    ck_assert(trans_is_congested(g_trans));
+    ck_assert_int_eq(count_wobjs(), 1);
+    do
+    {
+        rcvd = g_sck_recv(g_peer, buf, sizeof(buf), 0);
+    }
+    while (rcvd > 0);
+    ck_assert(!trans_is_congested(g_trans));
+    ck_assert_int_eq(count_wobjs(), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__queue_full)
+{
+    struct stream *s;
+    int index;
+
+    /* nothing reads the other end and the writer ignores congestion, the
+       write which would go past the limit fails rather than waiting */
+    g_trans->wait_bytes_max = 32 * 1024;
+    make_stream(s);
+    init_stream(s, PDU_SIZE);
+    s->end += PDU_SIZE;
+    for (index = 0; index < PDU_COUNT; index++)
+    {
+        if (trans_write_copy_s(g_trans, s) != 0)
+        {
+            break;
+        }
+        ck_assert_int_le(g_trans->wait_bytes, 32 * 1024);
+    }
+    ck_assert_int_lt(index, PDU_COUNT);
+    ck_assert(trans_is_congested(g_trans));
+    ck_assert_int_le(g_trans->wait_bytes, 32 * 1024);
+    ck_assert_int_eq(g_trans->status, TRANS_STATUS_DOWN);
+    /* and the trans stays down */
+    ck_assert_int_ne(trans_write_copy_s(g_trans, s), 0);
+    free_stream(s);
+    ck_assert_int_le(g_trans->wait_bytes, 32 * 1024);
+}
+END_TEST
+
+/******************************************************************************/
+/* input is a 4 byte length, including itself, then the data */
+static int
+data_in(struct trans *self)
+{
+    struct stream *s;
+    int len;
+
+    s = self->in_s;
+    if (self->extra_flags == 0)
+    {
+        in_uint32_le(s, len);
+        self->header_size = len;
+        self->extra_flags = 1;
+        return 0;
+    }
+    ck_assert_int_eq((int) (s->end - s->data), self->header_size);
+    ck_assert_int_eq(s->data[4], (char) g_pdus_in);
+    g_pdus_in++;
+    init_stream(s, 0);
+    self->header_size = 4;
+    self->extra_flags = 0;
+    return 0;
+}
+
+/******************************************************************************/
+static void
+send_input_pdus(int count)
+{
+    char buf[4096];
+    char *p;
+    int index;
+    int len;
+
+    p = buf;
+    for (index = 0; index < count; index++)
+    {
+        len = 6 + index;
+        p[0] = len;
+        p[1] = 0;
+        p[2] = 0;
+        p[3] = 0;
+        g_memset(p + 4, index, len - 4);
+        p += len;
+    }
+    ck_assert_int_eq(g_sck_send(g_peer, buf, p - buf, 0), p - buf);
+}
+
+/******************************************************************************/
+START_TEST(test_trans__read_ahead)
+{
+    g_trans->trans_data_in = data_in;
+    g_trans->no_stream_init_on_data_in = 1;
+    g_trans->header_size = 4;
+    ck_assert_int_eq(trans_set_read_ahead(g_trans, TRANS_READ_AHEAD_BYTES),
+                     0);
+    send_input_pdus(50);
+    ck_assert_int_eq(trans_check_wait_objs(g_trans), 0);
+    ck_assert_int_eq(g_pdus_in, 50);
+    ck_assert_int_eq(g_trans->extra_flags, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__input_pending)
+{
+    g_trans->trans_data_in = data_in;
+    g_trans->no_stream_init_on_data_in = 1;
+    g_trans->header_size = 4;
+    ck_assert_int_eq(trans_set_read_ahead(g_trans, 32), 0);
+    ck_assert(!trans_input_pending(g_trans));
+    send_input_pdus(10);
+    ck_assert(trans_input_pending(g_trans));
+    /* more is read than fits in the read ahead buffer */
+    ck_assert_int_eq(trans_check_wait_objs(g_trans), 0);
+    ck_assert_int_gt(g_pdus_in, 0);
+    ck_assert(trans_input_pending(g_trans));
+    while (trans_input_pending(g_trans))
+    {
+        ck_assert_int_eq(trans_check_wait_objs(g_trans), 0);
+    }
+    ck_assert_int_eq(g_pdus_in, 10);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__no_read_ahead)
+{
+    g_trans->trans_data_in = data_in;
+    g_trans->no_stream_init_on_data_in = 1;
+    g_trans->header_size = 4;
+    send_input_pdus(50);
+    ck_assert_int_eq(trans_check_wait_objs(g_trans), 0);
+    /* one read per call */
+    ck_assert_int_eq(g_pdus_in, 0);
+    ck_assert_int_eq(g_trans->extra_flags, 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__force_read_after_read_ahead)
+{
+    char *data;
+
+    ck_assert_int_eq(trans_set_read_ahead(g_trans, TRANS_READ_AHEAD_BYTES),
+                     0);
+    send_input_pdus(3);
+    init_stream(g_trans->in_s, 0);
+    ck_assert_int_eq(trans_force_read(g_trans, 4), 0);
+    /* the rest is read ahead, but must still come out in order */
+    ck_assert_int_eq(trans_force_read(g_trans, 2 + 7), 0);
+    data = g_trans->in_s->data;
+    ck_assert_int_eq(data[0], 6);
+    ck_assert_int_eq(data[4], 0);
+    ck_assert_int_eq(data[6], 7);
+    ck_assert_int_eq(data[10], 1);
+    ck_assert_int_eq(trans_set_read_ahead(g_trans, 1024), 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__reactor)
+{
+    struct reactor *reactor;
+    struct reactor_event ev[4];
+    struct trans *mod_trans;
+    int sck[2];
+
+    reactor = reactor_create();
+    ck_assert_ptr_nonnull(reactor);
+    ck_assert_int_eq(trans_set_reactor(g_trans, reactor), 0);
+    ck_assert_int_eq(g_trans->reactor_sck_events, REACTOR_READ);
+    ck_assert_int_eq(reactor_wait(reactor, ev, 4, 1), 0);
+    /* a second transport, reading what is written to g_trans */
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    mod_trans = trans_create(TRANS_MODE_UNIX, 1024, 1024);
+    mod_trans->sck = sck[0];
+    mod_trans->status = TRANS_STATUS_UP;
+    mod_trans->si = &g_si;
+    mod_trans->my_source = XRDP_SOURCE_MOD;
+    ck_assert_int_eq(trans_set_reactor(mod_trans, reactor), 0);
+    ck_assert_int_eq(mod_trans->reactor_sck_events, REACTOR_READ);
+    /* g_trans waits to write, and mod_trans stops reading until the
+       queue has gone */
+    g_si.cur_source = XRDP_SOURCE_MOD;
+    write_pdus();
+    ck_assert_int_eq(g_trans->reactor_sck_events,
+                     REACTOR_READ | REACTOR_WRITE);
+    ck_assert_int_eq(mod_trans->reactor_sck_events, 0);
+    g_sck_send(sck[1], "x", 1, 0);
+    ck_assert_int_eq(reactor_wait(reactor, ev, 4, 1), 0);
+    read_pdus();
+    ck_assert_int_eq(g_trans->reactor_sck_events, REACTOR_READ);
+    ck_assert_int_eq(mod_trans->reactor_sck_events, REACTOR_READ);
+    ck_assert_int_eq(reactor_wait(reactor, ev, 4, 1), 1);
+    ck_assert_int_eq(ev[0].obj, mod_trans->sck);
+    ck_assert_int_eq(ev[0].events, REACTOR_READ);
+    /* and both come out again before the reactor goes */
+    trans_delete(mod_trans);
+    ck_assert_ptr_null(g_si.source_trans[XRDP_SOURCE_MOD]);
+    g_sck_close(sck[1]);
+    ck_assert_int_eq(trans_set_reactor(g_trans, NULL), 0);
+    ck_assert_int_eq(g_trans->reactor_sck_events, 0);
+    send_input_pdus(1);
+    ck_assert_int_eq(reactor_wait(reactor, ev, 4, 1), 0);
+    reactor_delete(reactor);
+}
+END_TEST
+
+#if defined(__linux__)
+/******************************************************************************/
+/* MSG_ZEROCOPY needs TCP, so replace the socket pair with a loopback
+   connection */
+static void
+setup_tcp(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    int lsck;
+
+    setup();
+    g_sck_close(g_trans->sck);
+    g_sck_close(g_peer);
+    lsck = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_ge(lsck, 0);
+    g_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr_len = sizeof(addr);
+    ck_assert_int_eq(bind(lsck, (struct sockaddr *) &addr, addr_len), 0);
+    ck_assert_int_eq(listen(lsck, 1), 0);
+    ck_assert_int_eq(getsockname(lsck, (struct sockaddr *) &addr,
+                                 &addr_len), 0);
+    g_trans->sck = socket(AF_INET, SOCK_STREAM, 0);
+    g_trans->mode = TRANS_MODE_TCP4;
+    ck_assert_int_eq(connect(g_trans->sck, (struct sockaddr *) &addr,
+                             addr_len), 0);
+    g_peer = accept(lsck, NULL, NULL);
+    ck_assert_int_ge(g_peer, 0);
+    g_sck_close(lsck);
+    g_sck_set_non_blocking(g_trans->sck);
+    g_sck_set_non_blocking(g_peer);
+}
+
+/******************************************************************************/
+START_TEST(test_trans__zerocopy)
+{
+    struct stream *s;
+    char buf[8192];
+    int index;
+
+    if (trans_set_zerocopy(g_trans) != 0)
+    {
+        /* not supported by this kernel */
+        return;
+    }
+    /* fill the socket, so the big pdu is queued */
+    g_memset(buf, 0, sizeof(buf));
+    while (g_sck_send(g_trans->sck, buf, sizeof(buf), 0) > 0)
+    {
+    }
+    make_stream(s);
+    init_stream(s, 256 * 1024);
+    for (index = 0; index < 256 * 1024; index++)
+    {
+        out_uint8(s, index % 251);
+    }
+    s_mark_end(s);
+    ck_assert_int_eq(trans_write_copy_s(g_trans, s), 0);
+    free_stream(s);
+    ck_assert_int_eq(g_trans->wait_bytes, 256 * 1024);
+    /* drain what was put straight on the socket */
+    do
+    {
+        ck_assert_int_eq(trans_send_waiting(g_trans, 0), 0);
+    }
+    while (g_sck_recv(g_peer, buf, sizeof(buf), 0) > 0);
+    index = 0;
+    while (g_trans->wait_s != 0 || g_trans->zc_s != 0)
+    {
+        ck_assert_int_eq(trans_check_wait_objs(g_trans), 0);
+        while (g_sck_recv(g_peer, buf, sizeof(buf), 0) > 0)
+        {
+        }
+        ck_assert_int_lt(index++, 100000);
+    }
+    /* at least the first send went out with MSG_ZEROCOPY, and the kernel
+       has finished with everything that did */
+    ck_assert_uint_gt(g_trans->zc_sent, 0);
+    ck_assert_uint_eq(g_trans->zc_sent, g_trans->zc_done);
+    /* loopback always copies, so it gets turned off */
+    ck_assert_int_eq(g_trans->zerocopy, 0);
+}
+END_TEST
+#endif
+
+/******************************************************************************/
+Suite *
+make_suite_test_trans(void)
+{
+    Suite *s;
+    TCase *tc_trans;
+
+    s = suite_create("Trans");
+
+    tc_trans = tcase_create("trans");
+    tcase_add_checked_fixture(tc_trans, setup, teardown);
+    tcase_add_test(tc_trans, test_trans__queue_in_order);
+    tcase_add_test(tc_trans, test_trans__source_accounting);
+    tcase_add_test(tc_trans, test_trans__write_after_drain);
+    tcase_add_test(tc_trans, test_trans__congested);
+    tcase_add_test(tc_trans, test_trans__corked);
+    tcase_add_test(tc_trans, test_trans__corked_full);
+    tcase_add_test(tc_trans, test_trans__send_lowat);
+    tcase_add_test(tc_trans, test_trans__queue_full);
+    tcase_add_test(tc_trans, test_trans__read_ahead);
+    tcase_add_test(tc_trans, test_trans__input_pending);
+    tcase_add_test(tc_trans, test_trans__no_read_ahead);
+    tcase_add_test(tc_trans, test_trans__force_read_after_read_ahead);
+    tcase_add_test(tc_trans, test_trans__reactor);
+
+    suite_add_tcase(s, tc_trans);
+
+#if defined(__linux__)
+    tc_trans = tcase_create("trans_zerocopy");
+    tcase_add_checked_fixture(tc_trans, setup_tcp, teardown);
+    tcase_add_test(tc_trans, test_trans__zerocopy);
+    suite_add_tcase(s, tc_trans);
+#endif
+
+    return s;
+}
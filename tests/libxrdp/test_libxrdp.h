@@ -5,5 +5,11 @@
 
 Suite *make_suite_test_xrdp_sec_process_mcs_data_monitors(void);
 Suite *make_suite_test_monitor_processing(void);
+Suite *make_suite_test_xrdp_bitmap32_compress(void);
+Suite *make_suite_test_xrdp_bitmap_pool(void);
+Suite *make_suite_test_xrdp_orders_opt(void);
+Suite *make_suite_test_xrdp_mppc_enc(void);
+Suite *make_suite_test_xrdp_rdp_bulk_comp(void);
+Suite *make_suite_test_xrdp_autodetect(void);
 
 #endif /* TEST_LIBXRDP_H */
@@ -14,6 +14,12 @@ int main (void)
 
     sr = srunner_create(make_suite_test_xrdp_sec_process_mcs_data_monitors());
     srunner_add_suite(sr, make_suite_test_monitor_processing());
+    srunner_add_suite(sr, make_suite_test_xrdp_bitmap32_compress());
+    srunner_add_suite(sr, make_suite_test_xrdp_bitmap_pool());
+    srunner_add_suite(sr, make_suite_test_xrdp_orders_opt());
+    srunner_add_suite(sr, make_suite_test_xrdp_mppc_enc());
+    srunner_add_suite(sr, make_suite_test_xrdp_rdp_bulk_comp());
+    srunner_add_suite(sr, make_suite_test_xrdp_autodetect());
 
     srunner_set_tap(sr, "-");
 
@@ -0,0 +1,233 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "ms-rdpbcgr.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *g_rdp;
+static struct xrdp_sec *g_sec;
+static struct xrdp_autodetect *g_ad;
+static struct xrdp_client_info *g_ci;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_rdp = g_new0(struct xrdp_rdp, 1);
+    g_sec = g_new0(struct xrdp_sec, 1);
+    g_sec->rdp_layer = g_rdp;
+    g_ad = xrdp_autodetect_create(g_sec);
+    g_ci = &(g_rdp->client_info);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_autodetect_delete(g_ad);
+    g_free(g_sec);
+    g_free(g_rdp);
+}
+
+/******************************************************************************/
+/* an Auto-Detect Response PDU, after the security header */
+static int
+process_rsp(int type_id, int seq_number, int response_type,
+            int extra_count, unsigned int extra1, unsigned int extra2)
+{
+    struct stream *s;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 64);
+    out_uint8(s, 6 + extra_count * 4);
+    out_uint8(s, type_id);
+    out_uint16_le(s, seq_number);
+    out_uint16_le(s, response_type);
+    if (extra_count > 0)
+    {
+        out_uint32_le(s, extra1);
+    }
+    if (extra_count > 1)
+    {
+        out_uint32_le(s, extra2);
+    }
+    s_mark_end(s);
+    s->p = s->data;
+    rv = xrdp_autodetect_process_rsp(g_ad, s);
+    free_stream(s);
+    return rv;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__connection_type)
+{
+    ck_assert_int_eq(xrdp_autodetect_connection_type(100000, 1),
+                     CONNECTION_TYPE_LAN);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(100000, 80),
+                     CONNECTION_TYPE_WAN);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(8000, 600),
+                     CONNECTION_TYPE_SATELLITE);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(5000, 30),
+                     CONNECTION_TYPE_BROADBAND_HIGH);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(1000, 30),
+                     CONNECTION_TYPE_BROADBAND_LOW);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(56, 150),
+                     CONNECTION_TYPE_MODEM);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__rtt)
+{
+    g_ad->rtt_seq_number = 5;
+    g_ad->rtt_sent = g_time_usec() - 30000;
+    /* not the outstanding request */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 4,
+                                 RDP_RTT_RESPONSE, 0, 0, 0), 0);
+    ck_assert_int_eq(g_ci->network_avg_rtt, 0);
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 5,
+                                 RDP_RTT_RESPONSE, 0, 0, 0), 0);
+    ck_assert_int_ge(g_ci->network_base_rtt, 30);
+    ck_assert_int_lt(g_ci->network_base_rtt, 1000);
+    ck_assert_int_eq(g_ci->network_avg_rtt, g_ci->network_base_rtt);
+    ck_assert(g_ad->rtt_sent == 0);
+    /* a repeat is ignored */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 5,
+                                 RDP_RTT_RESPONSE, 0, 0, 0), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__bandwidth)
+{
+    g_ad->bw_state = AUTODETECT_BW_STOPPED;
+    /* 1.25 MB in 1 second */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 1,
+                                 RDP_BW_RESULTS_CONTINUOUS, 2,
+                                 1000, 1250000), 0);
+    ck_assert_int_eq(g_ci->network_bandwidth, 10000);
+    ck_assert_int_eq(g_ad->bw_state, AUTODETECT_BW_IDLE);
+    ck_assert(g_ad->result_changed);
+    /* too little traffic to say anything */
+    g_ad->result_changed = 0;
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 2,
+                                 RDP_BW_RESULTS_CONTINUOUS, 2,
+                                 1000, 1000), 0);
+    ck_assert_int_eq(g_ci->network_bandwidth, 10000);
+    ck_assert(!g_ad->result_changed);
+    /* at connect time a small payload is expected, and replaces what
+       was there */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 3,
+                                 RDP_BW_RESULTS_CONNECT_TIME, 2,
+                                 0, 65536), 0);
+    ck_assert_int_eq(g_ci->network_bandwidth, 65536 * 8);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__netchar_sync)
+{
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 1,
+                                 RDP_NETCHAR_SYNC, 2, 20000, 15), 0);
+    ck_assert_int_eq(g_ci->network_bandwidth, 20000);
+    ck_assert_int_eq(g_ci->network_base_rtt, 15);
+    ck_assert_int_eq(g_ci->network_avg_rtt, 15);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__bad_pdus)
+{
+    struct stream *s;
+
+    /* a request is not a response */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_REQUEST, 1,
+                                 RDP_NETCHAR_SYNC, 2, 20000, 15), 0);
+    ck_assert_int_eq(g_ci->network_bandwidth, 0);
+    /* results missing */
+    ck_assert_int_ne(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 1,
+                                 RDP_BW_RESULTS_CONTINUOUS, 1, 1000, 0), 0);
+    make_stream(s);
+    init_stream(s, 8);
+    out_uint8(s, 6);
+    s_mark_end(s);
+    s->p = s->data;
+    ck_assert_int_ne(xrdp_autodetect_process_rsp(g_ad, s), 0);
+    free_stream(s);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__connect_time_deadline)
+{
+    struct xrdp_mcs *mcs;
+    int timeout;
+
+    mcs = g_new0(struct xrdp_mcs, 1);
+    mcs->msgchan_id = MCS_GLOBAL_CHANNEL + 1;
+    g_sec->mcs_layer = mcs;
+    g_ci->mcs_connection_type = CONNECTION_TYPE_AUTODETECT;
+    g_ad->connect_time = 1;
+    g_ad->rtt_seq_number = 1;
+    g_ad->rtt_sent = g_time_usec();
+    g_ad->bw_state = AUTODETECT_BW_STOPPED;
+    g_ad->connect_deadline = g_time_usec() + 60 * 1000 * 1000;
+
+    /* still waiting, the session loop is woken for the deadline */
+    ck_assert_int_eq(xrdp_autodetect_check(g_ad), 0);
+    ck_assert(g_ad->connect_time);
+    g_ad->connect_deadline = g_time_usec() + 1000 * 1000;
+    timeout = -1;
+    xrdp_autodetect_get_timeout(g_ad, &timeout);
+    ck_assert_int_gt(timeout, 0);
+    ck_assert_int_le(timeout, 1000);
+
+    /* the RTT came back but the bandwidth results never do */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 1,
+                                 RDP_RTT_RESPONSE, 0, 0, 0), 0);
+    ck_assert(g_ad->connect_time);
+    g_ad->connect_deadline = g_time_usec() - 1;
+    ck_assert_int_eq(xrdp_autodetect_check(g_ad), -1);
+    ck_assert(!g_ad->connect_time);
+    ck_assert_int_eq(g_ad->bw_state, AUTODETECT_BW_IDLE);
+    ck_assert_int_eq(g_ci->mcs_connection_type, CONNECTION_TYPE_AUTODETECT);
+    ck_assert_int_gt(g_ci->network_base_rtt, 0);
+
+    /* results arriving late don't finish it a second time */
+    ck_assert_int_eq(process_rsp(TYPE_ID_AUTODETECT_RESPONSE, 2,
+                                 RDP_BW_RESULTS_CONNECT_TIME, 2,
+                                 0, 65536), 0);
+    ck_assert_int_eq(g_ci->mcs_connection_type, CONNECTION_TYPE_AUTODETECT);
+
+    g_sec->mcs_layer = NULL;
+    g_free(mcs);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_autodetect(void)
+{
+    Suite *s;
+    TCase *tc_autodetect;
+
+    s = suite_create("test_xrdp_autodetect");
+
+    tc_autodetect = tcase_create("xrdp_autodetect");
+    tcase_add_checked_fixture(tc_autodetect, setup, teardown);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__connection_type);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__rtt);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__bandwidth);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__netchar_sync);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__bad_pdus);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__connect_time_deadline);
+
+    suite_add_tcase(s, tc_autodetect);
+
+    return s;
+}
@@ -0,0 +1,553 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "trans.h"
+
+#include "test_libxrdp.h"
+
+#define FLAGS_RLE     0x10
+#define FLAGS_NOALPHA 0x20
+
+#define IMAGE_PATTERN_NOISE    0
+#define IMAGE_PATTERN_GRADIENT 1
+#define IMAGE_PATTERN_TEXT     2
+#define IMAGE_PATTERN_FLAT     3
+#define IMAGE_PATTERN_COUNT    4
+
+static const int g_widths[] = { 1, 3, 4, 15, 16, 17, 31, 33, 47, 64 };
+
+/* what libxrdp_send_bitmap sent, see capture_send */
+static struct stream *g_sent;
+static const int g_flags[] =
+{
+    FLAGS_RLE | FLAGS_NOALPHA, FLAGS_RLE, FLAGS_NOALPHA, 0
+};
+
+/******************************************************************************/
+/* small deterministic generator so failures are reproducible */
+static unsigned int
+next_random(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) & 0xFFFFFF;
+}
+
+/******************************************************************************/
+static int *
+make_image(int width, int height, int pattern)
+{
+    int *image;
+    int x;
+    int y;
+    int pixel;
+    unsigned int seed;
+
+    image = g_new(int, width * height);
+    seed = width * 131 + height * 7 + pattern;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            switch (pattern)
+            {
+                case IMAGE_PATTERN_NOISE:
+                    pixel = next_random(&seed) | (next_random(&seed) << 24);
+                    break;
+                case IMAGE_PATTERN_GRADIENT:
+                    pixel = 0xFF000000 | ((x * 4) << 16) |
+                            ((y * 4) << 8) | ((x + y) & 0xFF);
+                    break;
+                case IMAGE_PATTERN_TEXT:
+                    /* mostly background with a few foreground pixels */
+                    pixel = (next_random(&seed) % 7 == 0) ?
+                            0xFF202020 : 0xFFF0F0F0;
+                    break;
+                default:
+                    pixel = 0x80336699;
+                    break;
+            }
+            image[y * width + x] = pixel;
+        }
+    }
+    return image;
+}
+
+/******************************************************************************/
+/* decode one RLE plane as described in [MS-RDPEGDI] 2.2.2.5.1 */
+static int
+decode_rle_plane(struct stream *s, char *plane, int cx, int cy)
+{
+    int x;
+    int y;
+    int code;
+    int raw;
+    int run;
+    int prev;
+    int value;
+    char *line;
+
+    for (y = 0; y < cy; y++)
+    {
+        line = plane + y * cx;
+        x = 0;
+        prev = 0;
+        while (x < cx)
+        {
+            if (!s_check_rem(s, 1))
+            {
+                return 1;
+            }
+            in_uint8(s, code);
+            raw = code >> 4;
+            run = code & 0xF;
+            if (run == 1)
+            {
+                run = 16 + raw;
+                raw = 0;
+            }
+            else if (run == 2)
+            {
+                run = 32 + raw;
+                raw = 0;
+            }
+            if (x + raw + run > cx || !s_check_rem(s, raw))
+            {
+                return 1;
+            }
+            while (raw > 0)
+            {
+                in_uint8(s, prev);
+                line[x++] = prev;
+                raw--;
+            }
+            while (run > 0)
+            {
+                line[x++] = prev;
+                run--;
+            }
+        }
+        if (y > 0)
+        {
+            for (x = 0; x < cx; x++)
+            {
+                value = (unsigned char) line[x];
+                value = (value & 1) ? -((value + 1) >> 1) : (value >> 1);
+                line[x] = line[x - cx] + value;
+            }
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* decode a planar bitmap and check it against the lines of image it was
+   made from, lines are stored bottom up starting at start_line */
+static void
+check_decoded(struct stream *s, const int *image, int width, int e,
+              int start_line, int lines, int flags)
+{
+    char planes[4][64 * 64];
+    int header;
+    int cx;
+    int plane;
+    int first_plane;
+    int x;
+    int y;
+    int src_x;
+    int pixel;
+    int shift;
+
+    cx = width + e;
+    in_uint8(s, header);
+    first_plane = (header & FLAGS_NOALPHA) ? 1 : 0;
+    ck_assert_int_eq(header & FLAGS_NOALPHA, flags & FLAGS_NOALPHA);
+    for (plane = first_plane; plane < 4; plane++)
+    {
+        if (header & FLAGS_RLE)
+        {
+            ck_assert_int_eq(decode_rle_plane(s, planes[plane], cx, lines), 0);
+        }
+        else
+        {
+            ck_assert(s_check_rem(s, cx * lines));
+            in_uint8a(s, planes[plane], cx * lines);
+        }
+    }
+    for (y = 0; y < lines; y++)
+    {
+        for (x = 0; x < cx; x++)
+        {
+            src_x = (x < width) ? x : width - 1;
+            pixel = image[(start_line - y) * width + src_x];
+            for (plane = first_plane; plane < 4; plane++)
+            {
+                shift = (3 - plane) * 8;
+                ck_assert_int_eq((unsigned char) planes[plane][y * cx + x],
+                                 (pixel >> shift) & 0xFF);
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+static int
+compress_image(const int *image, int width, int height, int e, int flags,
+               int byte_limit, struct stream *out_s, struct stream *temp_s)
+{
+    init_stream(out_s, 32 * 1024);
+    init_stream(temp_s, 32 * 1024);
+    return xrdp_bitmap32_compress((char *) image, width, height, out_s, 32,
+                                  byte_limit, height - 1, temp_s, e, flags);
+}
+
+/******************************************************************************/
+static void
+compare_kernels(int byte_limit)
+{
+    struct stream *c_s;
+    struct stream *simd_s;
+    struct stream *temp_s;
+    unsigned int findex;
+    unsigned int windex;
+    int pattern;
+    int height;
+    int width;
+    int e;
+    int c_lines;
+    int simd_lines;
+    int *image;
+
+    make_stream(c_s);
+    make_stream(simd_s);
+    make_stream(temp_s);
+    for (windex = 0; windex < sizeof(g_widths) / sizeof(g_widths[0]); windex++)
+    {
+        width = g_widths[windex];
+        height = 64;
+        for (pattern = 0; pattern < IMAGE_PATTERN_COUNT; pattern++)
+        {
+            image = make_image(width, height, pattern);
+            for (e = 0; e < 4; e++)
+            {
+                for (findex = 0; findex < sizeof(g_flags) / sizeof(g_flags[0]);
+                        findex++)
+                {
+                    xrdp_bitmap32_compress_set_simd(PLANAR_SIMD_NONE);
+                    c_lines = compress_image(image, width, height, e,
+                                             g_flags[findex], byte_limit,
+                                             c_s, temp_s);
+                    xrdp_bitmap32_compress_set_simd(PLANAR_SIMD_AUTO);
+                    simd_lines = compress_image(image, width, height, e,
+                                                g_flags[findex], byte_limit,
+                                                simd_s, temp_s);
+                    ck_assert_int_eq(c_lines, simd_lines);
+                    ck_assert_int_eq(c_s->p - c_s->data,
+                                     simd_s->p - simd_s->data);
+                    ck_assert(g_memcmp(c_s->data, simd_s->data,
+                                       c_s->p - c_s->data) == 0);
+                }
+            }
+            g_free(image);
+        }
+    }
+    free_stream(c_s);
+    free_stream(simd_s);
+    free_stream(temp_s);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap32_compress__simd_matches_c)
+{
+    compare_kernels(16 * 1024);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap32_compress__simd_matches_c_small_limit)
+{
+    /* forces the line count to be reduced until the output fits */
+    compare_kernels(1024);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap32_compress__round_trip)
+{
+    struct stream *out_s;
+    struct stream *temp_s;
+    unsigned int findex;
+    unsigned int windex;
+    int pattern;
+    int height;
+    int width;
+    int e;
+    int lines;
+    int *image;
+
+    make_stream(out_s);
+    make_stream(temp_s);
+    xrdp_bitmap32_compress_set_simd(PLANAR_SIMD_AUTO);
+    for (windex = 0; windex < sizeof(g_widths) / sizeof(g_widths[0]); windex++)
+    {
+        width = g_widths[windex];
+        height = 37;
+        for (pattern = 0; pattern < IMAGE_PATTERN_COUNT; pattern++)
+        {
+            image = make_image(width, height, pattern);
+            for (e = 0; e < 4; e++)
+            {
+                for (findex = 0; findex < sizeof(g_flags) / sizeof(g_flags[0]);
+                        findex++)
+                {
+                    lines = compress_image(image, width, height, e,
+                                           g_flags[findex], 16 * 1024,
+                                           out_s, temp_s);
+                    ck_assert_int_gt(lines, 0);
+                    s_mark_end(out_s);
+                    out_s->p = out_s->data;
+                    check_decoded(out_s, image, width, e, height - 1, lines,
+                                  g_flags[findex]);
+                }
+            }
+            g_free(image);
+        }
+    }
+    free_stream(out_s);
+    free_stream(temp_s);
+}
+END_TEST
+
+/******************************************************************************/
+/* stands in for the socket, keeps everything sent */
+static int
+capture_send(struct trans *self, const char *data, int len)
+{
+    ck_assert(s_check_rem_out(g_sent, len));
+    out_uint8a(g_sent, data, len);
+    return len;
+}
+
+/******************************************************************************/
+/* decodes one planar rect of a bitmap update onto screen, the lines are
+   bottom up */
+static void
+decode_update_rect(struct stream *s, int *screen, int screen_width,
+                   int left, int bottom, int cx, int width, int lines)
+{
+    char *planes[4];
+    int header;
+    int plane;
+    int first_plane;
+    int x;
+    int y;
+    int pixel;
+
+    in_uint8(s, header);
+    first_plane = (header & FLAGS_NOALPHA) ? 1 : 0;
+    for (plane = 0; plane < 4; plane++)
+    {
+        planes[plane] = g_new0(char, width * lines);
+    }
+    for (plane = first_plane; plane < 4; plane++)
+    {
+        if (header & FLAGS_RLE)
+        {
+            ck_assert_int_eq(decode_rle_plane(s, planes[plane], width, lines),
+                             0);
+        }
+        else
+        {
+            ck_assert(s_check_rem(s, width * lines));
+            in_uint8a(s, planes[plane], width * lines);
+        }
+    }
+    if (!(header & FLAGS_RLE))
+    {
+        in_uint8s(s, 1); /* pad */
+    }
+    for (y = 0; y < lines; y++)
+    {
+        for (x = 0; x < cx; x++)
+        {
+            pixel = first_plane ? 0xFF : (unsigned char) planes[0][y * width + x];
+            for (plane = 1; plane < 4; plane++)
+            {
+                pixel = (pixel << 8) |
+                        (unsigned char) planes[plane][y * width + x];
+            }
+            screen[(bottom - y) * screen_width + left + x] = pixel;
+        }
+    }
+    for (plane = 0; plane < 4; plane++)
+    {
+        g_free(planes[plane]);
+    }
+}
+
+/******************************************************************************/
+/* decodes the slow path bitmap updates in g_sent onto screen */
+static void
+decode_sent(int *screen, int screen_width)
+{
+    struct stream *s;
+    char *pdu_end;
+    char *rect_end;
+    int len;
+    int per_len;
+    int pdu_type2;
+    int update_type;
+    int num_rects;
+    int left;
+    int top;
+    int right;
+    int bottom;
+    int width;
+    int lines;
+    int bpp;
+    int flags;
+
+    s = g_sent;
+    s_mark_end(s);
+    s->p = s->data;
+    while (s_check_rem(s, 4))
+    {
+        in_uint8s(s, 2); /* TPKT version, reserved */
+        in_uint16_be(s, len);
+        pdu_end = s->p - 4 + len;
+        ck_assert(pdu_end <= s->end);
+        /* X.224 data, MCS send data indication up to the PER length */
+        in_uint8s(s, 3 + 6);
+        in_uint8(s, per_len);
+        if (per_len & 0x80)
+        {
+            in_uint8s(s, 1);
+        }
+        /* TS_SHARECONTROLHEADER and TS_SHAREDATAHEADER */
+        in_uint8s(s, 14);
+        in_uint8(s, pdu_type2);
+        ck_assert_int_eq(pdu_type2, RDP_DATA_PDU_UPDATE);
+        in_uint8s(s, 3);
+        in_uint16_le(s, update_type);
+        ck_assert_int_eq(update_type, RDP_UPDATE_BITMAP);
+        in_uint16_le(s, num_rects);
+        ck_assert_int_gt(num_rects, 0);
+        while (num_rects > 0)
+        {
+            in_uint16_le(s, left);
+            in_uint16_le(s, top);
+            in_uint16_le(s, right);
+            in_uint16_le(s, bottom);
+            in_uint16_le(s, width);
+            in_uint16_le(s, lines);
+            in_uint16_le(s, bpp);
+            in_uint16_le(s, flags);
+            in_uint16_le(s, len);
+            ck_assert_int_eq(bpp, 32);
+            ck_assert_int_eq(bottom - top + 1, lines);
+            rect_end = s->p + len;
+            ck_assert(rect_end <= pdu_end);
+            if (!(flags & NO_BITMAP_COMPRESSION_HDR))
+            {
+                in_uint8s(s, 8);
+            }
+            decode_update_rect(s, screen, screen_width, left, bottom,
+                               right - left + 1, width, lines);
+            ck_assert(s->p == rect_end);
+            num_rects--;
+        }
+        ck_assert(s->p == pdu_end);
+    }
+}
+
+/******************************************************************************/
+/* sends image with libxrdp_send_bitmap, then decodes what was sent */
+static void
+send_and_decode(struct xrdp_session *session, int *image, int width,
+                int height, int *screen)
+{
+    init_stream(g_sent, 8 * 1024 * 1024);
+    ck_assert_int_eq(libxrdp_send_bitmap(session, width, height, 32,
+                                         (char *) image, 0, 0,
+                                         width, height), 0);
+    g_memset(screen, 0, width * height * sizeof(int));
+    decode_sent(screen, width);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap32_compress__tiled_matches_single_thread)
+{
+    struct xrdp_session *session;
+    struct trans *trans;
+    int sck[2];
+    int pattern;
+    int width;
+    int height;
+    int op1;
+    int *image;
+    int *single_screen;
+    int *tiled_screen;
+
+    width = 201; /* padded to 204 */
+    height = 300;
+    make_stream(g_sent);
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    trans = trans_create(TRANS_MODE_TCP, 8192, 8192);
+    trans->sck = sck[0];
+    trans->status = TRANS_STATUS_UP;
+    trans->trans_send = capture_send;
+    trans->trans_send_vec = NULL;
+    session = libxrdp_init(0, trans, "/nonexistent/xrdp.ini");
+    session->client_info->use_bitmap_comp = 1;
+    single_screen = g_new(int, width * height);
+    tiled_screen = g_new(int, width * height);
+    xrdp_bitmap32_compress_set_simd(PLANAR_SIMD_AUTO);
+    for (op1 = 0; op1 < 2; op1++)
+    {
+        session->client_info->op1 = op1;
+        for (pattern = 0; pattern < IMAGE_PATTERN_COUNT; pattern++)
+        {
+            image = make_image(width, height, pattern);
+            session->client_info->bitmap_compression_threads = 0;
+            send_and_decode(session, image, width, height, single_screen);
+            ck_assert(g_memcmp(single_screen, image,
+                               width * height * sizeof(int)) == 0);
+            session->client_info->bitmap_compression_threads = 3;
+            send_and_decode(session, image, width, height, tiled_screen);
+            ck_assert(((struct xrdp_rdp *) session->rdp)->bitmap_tiles != NULL);
+            ck_assert(g_memcmp(tiled_screen, single_screen,
+                               width * height * sizeof(int)) == 0);
+            g_free(image);
+        }
+    }
+    g_free(single_screen);
+    g_free(tiled_screen);
+    libxrdp_exit(session);
+    trans_delete(trans);
+    g_sck_close(sck[1]);
+    free_stream(g_sent);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_bitmap32_compress(void)
+{
+    Suite *s;
+    TCase *tc_planar;
+
+    s = suite_create("test_xrdp_bitmap32_compress");
+
+    tc_planar = tcase_create("xrdp_bitmap32_compress");
+    tcase_add_test(tc_planar, test_xrdp_bitmap32_compress__simd_matches_c);
+    tcase_add_test(tc_planar, test_xrdp_bitmap32_compress__simd_matches_c_small_limit);
+    tcase_add_test(tc_planar, test_xrdp_bitmap32_compress__round_trip);
+    tcase_add_test(tc_planar,
+                   test_xrdp_bitmap32_compress__tiled_matches_single_thread);
+
+    suite_add_tcase(s, tc_planar);
+
+    return s;
+}
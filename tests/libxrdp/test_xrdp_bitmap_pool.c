@@ -0,0 +1,92 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define POOL_TEST_JOBS 1000
+
+struct pool_test_job
+{
+    int index;
+    int result;
+    int calls;
+};
+
+/******************************************************************************/
+static void
+pool_test_proc(void *job)
+{
+    struct pool_test_job *ptj = (struct pool_test_job *)job;
+
+    ptj->result = ptj->index * ptj->index;
+    ptj->calls++;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap_pool__no_threads)
+{
+    ck_assert_ptr_eq(xrdp_bitmap_pool_create(0), NULL);
+    /* should not crash */
+    xrdp_bitmap_pool_delete(NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap_pool__all_jobs_run_once)
+{
+    struct xrdp_bitmap_pool *pool;
+    struct pool_test_job *jobs;
+    int batch;
+    int index;
+
+    pool = xrdp_bitmap_pool_create(3);
+    ck_assert_ptr_ne(pool, NULL);
+    jobs = g_new0(struct pool_test_job, POOL_TEST_JOBS);
+    ck_assert_ptr_ne(jobs, NULL);
+
+    /* the pool is reused between updates */
+    for (batch = 1; batch <= 3; batch++)
+    {
+        for (index = 0; index < POOL_TEST_JOBS; index++)
+        {
+            jobs[index].index = index;
+            jobs[index].result = -1;
+        }
+        ck_assert_int_eq(xrdp_bitmap_pool_run(pool, pool_test_proc, jobs,
+                                              sizeof(struct pool_test_job),
+                                              POOL_TEST_JOBS), 0);
+        for (index = 0; index < POOL_TEST_JOBS; index++)
+        {
+            ck_assert_int_eq(jobs[index].result, index * index);
+            ck_assert_int_eq(jobs[index].calls, batch);
+        }
+    }
+
+    ck_assert_int_ne(xrdp_bitmap_pool_run(pool, pool_test_proc, jobs,
+                                          sizeof(struct pool_test_job), 0), 0);
+    g_free(jobs);
+    xrdp_bitmap_pool_delete(pool);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_bitmap_pool(void)
+{
+    Suite *s;
+    TCase *tc_pool;
+
+    s = suite_create("test_xrdp_bitmap_pool");
+
+    tc_pool = tcase_create("xrdp_bitmap_pool");
+    tcase_add_test(tc_pool, test_xrdp_bitmap_pool__no_threads);
+    tcase_add_test(tc_pool, test_xrdp_bitmap_pool__all_jobs_run_once);
+
+    suite_add_tcase(s, tc_pool);
+
+    return s;
+}
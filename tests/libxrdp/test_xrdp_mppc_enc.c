@@ -0,0 +1,754 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define PACKET_COMPRESSED       0x20
+#define PACKET_AT_FRONT         0x40
+#define PACKET_FLUSHED          0x80
+#define PACKET_COMPR_TYPE_8K    0x00
+#define PACKET_COMPR_TYPE_64K   0x01
+#define PACKET_COMPR_TYPE_RDP61 0x03
+
+#define L1_COMPRESSED           0x01
+#define L1_NO_COMPRESSION       0x02
+#define L1_PACKET_AT_FRONT      0x04
+#define L1_INNER_COMPRESSION    0x10
+
+#define MPPC_HIST_LEN  (64 * 1024)
+#define L1_HIST_LEN    2000000
+
+/* reference decoders, written from [MS-RDPBCGR] 3.1.8 and [MS-RDPEGDI]
+   3.1.8.1 rather than from the encoder */
+struct mppc_dec
+{
+    char history[MPPC_HIST_LEN];
+    int offset;
+    int rdp4; /* 8K history, shorter copy offsets */
+};
+
+struct xcrush_dec
+{
+    struct mppc_dec l2;
+    char *history;
+    int offset;
+};
+
+struct bit_reader
+{
+    const unsigned char *data;
+    int bits;
+    int pos;
+};
+
+/******************************************************************************/
+static int
+get_bits(struct bit_reader *br, int count)
+{
+    int rv;
+
+    rv = 0;
+    while (count > 0)
+    {
+        ck_assert_int_lt(br->pos, br->bits);
+        rv = (rv << 1) | ((br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1);
+        br->pos++;
+        count--;
+    }
+    return rv;
+}
+
+/******************************************************************************/
+/* decode one MPPC packet, the output is left in the history
+   returns the number of bytes output */
+static int
+mppc_decode(struct mppc_dec *dec, int flags, const char *data, int len,
+            char **out)
+{
+    struct bit_reader br;
+    int start;
+    int offset;
+    int lom;
+    int ones;
+
+    if (flags & PACKET_FLUSHED)
+    {
+        g_memset(dec->history, 0, MPPC_HIST_LEN);
+        dec->offset = 0;
+    }
+    if (flags & PACKET_AT_FRONT)
+    {
+        dec->offset = 0;
+    }
+    ck_assert(flags & PACKET_COMPRESSED);
+    start = dec->offset;
+    br.data = (const unsigned char *) data;
+    br.bits = len * 8;
+    br.pos = 0;
+    /* every token is at least 8 bits, the end is padded with less */
+    while (br.bits - br.pos >= 8)
+    {
+        if (get_bits(&br, 1) == 0)
+        {
+            dec->history[dec->offset++] = get_bits(&br, 7);
+            continue;
+        }
+        if (get_bits(&br, 1) == 0)
+        {
+            dec->history[dec->offset++] = 0x80 | get_bits(&br, 7);
+            continue;
+        }
+        if (dec->rdp4)
+        {
+            if (get_bits(&br, 1) == 0)
+            {
+                offset = 320 + get_bits(&br, 13);
+            }
+            else if (get_bits(&br, 1) == 0)
+            {
+                offset = 64 + get_bits(&br, 8);
+            }
+            else
+            {
+                offset = get_bits(&br, 6);
+            }
+        }
+        else if (get_bits(&br, 1) == 0)
+        {
+            offset = 2368 + get_bits(&br, 16);
+        }
+        else if (get_bits(&br, 1) == 0)
+        {
+            offset = 320 + get_bits(&br, 11);
+        }
+        else if (get_bits(&br, 1) == 0)
+        {
+            offset = 64 + get_bits(&br, 8);
+        }
+        else
+        {
+            offset = get_bits(&br, 6);
+        }
+        ones = 0;
+        while (get_bits(&br, 1) == 1)
+        {
+            ones++;
+        }
+        lom = (ones == 0) ? 3 : (1 << (ones + 1)) + get_bits(&br, ones + 1);
+        ck_assert_int_le(offset, dec->offset);
+        ck_assert_int_le(dec->offset + lom,
+                         dec->rdp4 ? 8 * 1024 : MPPC_HIST_LEN);
+        while (lom > 0)
+        {
+            dec->history[dec->offset] = dec->history[dec->offset - offset];
+            dec->offset++;
+            lom--;
+        }
+    }
+    *out = dec->history + start;
+    return dec->offset - start;
+}
+
+/******************************************************************************/
+/* returns the number of bytes output */
+static int
+xcrush_decode(struct xcrush_dec *dec, int flags, const char *data, int len,
+              char **out)
+{
+    struct stream ls;
+    char *l1_data;
+    char *dst;
+    char *literals;
+    int l1_flags;
+    int l2_flags;
+    int l1_len;
+    int match_count;
+    int index;
+    int mlen;
+    int moff;
+    int hoff;
+    int out_len;
+    int lit_len;
+
+    ck_assert_int_eq(flags, PACKET_COMPR_TYPE_RDP61 | PACKET_COMPRESSED);
+    ck_assert_int_ge(len, 2);
+    l1_flags = (unsigned char) data[0];
+    l2_flags = (unsigned char) data[1];
+    if (l2_flags & PACKET_COMPRESSED)
+    {
+        ck_assert(l1_flags & L1_INNER_COMPRESSION);
+        l1_len = mppc_decode(&(dec->l2), l2_flags, data + 2, len - 2,
+                             &l1_data);
+    }
+    else
+    {
+        l1_data = (char *) data + 2;
+        l1_len = len - 2;
+    }
+    if (l1_flags & L1_PACKET_AT_FRONT)
+    {
+        dec->offset = 0;
+    }
+    dst = dec->history + dec->offset;
+    if (l1_flags & L1_NO_COMPRESSION)
+    {
+        ck_assert_int_le(dec->offset + l1_len, L1_HIST_LEN);
+        g_memcpy(dst, l1_data, l1_len);
+        out_len = l1_len;
+    }
+    else
+    {
+        ck_assert(l1_flags & L1_COMPRESSED);
+        g_memset(&ls, 0, sizeof(ls));
+        ls.data = l1_data;
+        ls.p = ls.data;
+        ls.end = ls.data + l1_len;
+        ls.size = l1_len;
+        in_uint16_le(&ls, match_count);
+        ck_assert(s_check_rem(&ls, match_count * 8));
+        literals = ls.p + match_count * 8;
+        out_len = 0;
+        for (index = 0; index < match_count; index++)
+        {
+            in_uint16_le(&ls, mlen);
+            in_uint16_le(&ls, moff);
+            in_uint32_le(&ls, hoff);
+            ck_assert_int_ge(moff, out_len);
+            lit_len = moff - out_len;
+            g_memcpy(dst + out_len, literals, lit_len);
+            literals += lit_len;
+            ck_assert_int_le(hoff + mlen, dec->offset + moff);
+            g_memcpy(dst + moff, dec->history + hoff, mlen);
+            out_len = moff + mlen;
+        }
+        lit_len = (int) (l1_data + l1_len - literals);
+        g_memcpy(dst + out_len, literals, lit_len);
+        out_len += lit_len;
+    }
+    dec->offset += out_len;
+    *out = dst;
+    return out_len;
+}
+
+/******************************************************************************/
+/* small deterministic generator so failures are reproducible */
+static unsigned int
+next_random(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) & 0xFFFFFF;
+}
+
+/******************************************************************************/
+/* text like data, some repeats close by, some noise */
+static void
+make_data(char *data, int len, unsigned int seed)
+{
+    static const char *words[] =
+    {
+        "xrdp ", "remote ", "desktop ", "protocol ", "\r\n", "\x01\x01\x01",
+        "\xff\xff\xfe", "bitmap ", "order "
+    };
+    const char *word;
+    int index;
+
+    index = 0;
+    while (index < len)
+    {
+        if (next_random(&seed) % 4 == 0)
+        {
+            data[index++] = next_random(&seed);
+            continue;
+        }
+        word = words[next_random(&seed) % 9];
+        while (*word != 0 && index < len)
+        {
+            data[index++] = *(word++);
+        }
+    }
+}
+
+/******************************************************************************/
+/* replace the encoder's output buffer with one followed by guard bytes,
+   to catch anything written past the end */
+#define GUARD_BYTES 64
+static void
+add_output_guard(struct xrdp_mppc_enc *enc)
+{
+    g_free(enc->outputBufferPlus);
+    enc->outputBufferPlus = g_new(char, 64 + enc->buf_len + GUARD_BYTES);
+    enc->outputBuffer = enc->outputBufferPlus + 64;
+    g_memset(enc->outputBuffer + enc->buf_len, 0xa5, GUARD_BYTES);
+}
+
+/******************************************************************************/
+static void
+check_output_guard(struct xrdp_mppc_enc *enc)
+{
+    int index;
+
+    for (index = 0; index < GUARD_BYTES; index++)
+    {
+        ck_assert_int_eq((unsigned char) enc->outputBuffer[enc->buf_len + index],
+                         0xa5);
+    }
+}
+
+/******************************************************************************/
+/* incompressible data as long as the history, the encoder has to give
+   up without writing past the end of its output buffer */
+static void
+check_noise(int protocol_type)
+{
+    struct xrdp_mppc_enc *enc;
+    char *data;
+    unsigned int seed;
+    int len;
+    int index;
+
+    enc = mppc_enc_new(protocol_type);
+    ck_assert_ptr_ne(enc, NULL);
+    add_output_guard(enc);
+    len = enc->buf_len;
+    data = g_new(char, len);
+    for (seed = 1; seed < 8; seed++)
+    {
+        for (index = 0; index < len; index++)
+        {
+            data[index] = next_random(&seed);
+        }
+        ck_assert(!compress_rdp(enc, (tui8 *) data, len));
+        check_output_guard(enc);
+    }
+    g_free(data);
+    mppc_enc_free(enc);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__noise)
+{
+    check_noise(PROTO_RDP_40);
+    check_noise(PROTO_RDP_50);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp5_round_trip)
+{
+    struct xrdp_mppc_enc *enc;
+    struct mppc_dec *dec;
+    char *data;
+    char *out;
+    int len;
+    int index;
+    int compressed;
+
+    enc = mppc_enc_new(PROTO_RDP_50);
+    ck_assert_ptr_ne(enc, NULL);
+    dec = g_new0(struct mppc_dec, 1);
+    data = g_new(char, 16 * 1024);
+    compressed = 0;
+    for (index = 0; index < 64; index++)
+    {
+        len = 100 + (index * 997) % (16 * 1024 - 100);
+        make_data(data, len, index % 8);
+        if (!compress_rdp(enc, (tui8 *) data, len))
+        {
+            continue;
+        }
+        compressed++;
+        ck_assert_int_eq(enc->flags & 0x0F, PACKET_COMPR_TYPE_64K);
+        ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                     enc->bytes_in_opb, &out), len);
+        ck_assert(g_memcmp(out, data, len) == 0);
+    }
+    ck_assert_int_gt(compressed, 32);
+    g_free(data);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+/* something like the PDUs of a desktop session, order runs with changing
+   coordinates, bitmap rows and text, returns the PDU length */
+static int
+make_trace_pdu(char *data, int index)
+{
+    unsigned int seed;
+    int len;
+    int offset;
+    int x;
+    int y;
+
+    seed = index * 7919;
+    switch (index % 4)
+    {
+        case 0:
+            /* mem blt and rect orders */
+            len = 600 + next_random(&seed) % 3000;
+            for (offset = 0; offset + 12 <= len; offset += 12)
+            {
+                x = next_random(&seed) % 1920;
+                y = next_random(&seed) % 1080;
+                data[offset + 0] = 0x19;
+                data[offset + 1] = 0x0d;
+                data[offset + 2] = (next_random(&seed) % 3) ? 0x3f : 0x1f;
+                data[offset + 3] = x;
+                data[offset + 4] = x >> 8;
+                data[offset + 5] = y;
+                data[offset + 6] = y >> 8;
+                data[offset + 7] = 64;
+                data[offset + 8] = 0;
+                data[offset + 9] = 0xcc;
+                data[offset + 10] = next_random(&seed) % 8;
+                data[offset + 11] = 2;
+            }
+            break;
+        case 1:
+            /* 32 bpp gradient rows */
+            len = 16 * 1024;
+            for (offset = 0; offset < len; offset++)
+            {
+                x = (offset / 4) % 64;
+                y = offset / 256;
+                data[offset] = (offset & 3) == 3 ? 0xff : x + y * (offset & 3);
+            }
+            break;
+        case 2:
+            len = 2000 + next_random(&seed) % 6000;
+            make_data(data, len, seed);
+            break;
+        default:
+            /* mostly background with some noise */
+            len = 12 * 1024;
+            for (offset = 0; offset < len; offset++)
+            {
+                data[offset] = (next_random(&seed) % 16 == 0) ?
+                               next_random(&seed) : 0xf0;
+            }
+            break;
+    }
+    return len;
+}
+
+/******************************************************************************/
+/* compress a trace, checking every PDU decodes and logging the speed */
+static void
+run_trace(int protocol_type, int pdus)
+{
+    struct xrdp_mppc_enc *enc;
+    struct mppc_dec *dec;
+    char *data;
+    char *out;
+    int index;
+    int len;
+    int in_bytes;
+    int out_bytes;
+    int start;
+    int ms;
+
+    enc = mppc_enc_new(protocol_type);
+    ck_assert_ptr_ne(enc, NULL);
+    dec = g_new0(struct mppc_dec, 1);
+    dec->rdp4 = protocol_type == PROTO_RDP_40;
+    data = g_new(char, 16 * 1024);
+    in_bytes = 0;
+    out_bytes = 0;
+    ms = 0;
+    for (index = 0; index < pdus; index++)
+    {
+        len = make_trace_pdu(data, index);
+        if (len > enc->buf_len)
+        {
+            len = enc->buf_len;
+        }
+        in_bytes += len;
+        start = g_time3();
+        if (!compress_rdp(enc, (tui8 *) data, len))
+        {
+            ms += g_time3() - start;
+            out_bytes += len;
+            continue;
+        }
+        ms += g_time3() - start;
+        out_bytes += enc->bytes_in_opb;
+        ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                     enc->bytes_in_opb, &out), len);
+        ck_assert(g_memcmp(out, data, len) == 0);
+    }
+    LOG(LOG_LEVEL_INFO, "mppc trace, protocol %d, %d bytes in %d out, "
+        "%d ms, %d KB/ms", protocol_type, in_bytes, out_bytes, ms,
+        in_bytes / 1024 / (ms > 0 ? ms : 1));
+    ck_assert_int_lt(out_bytes, in_bytes);
+    g_free(data);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__trace)
+{
+    run_trace(PROTO_RDP_40, 2000);
+    run_trace(PROTO_RDP_50, 2000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp4_round_trip)
+{
+    struct xrdp_mppc_enc *enc;
+    struct mppc_dec *dec;
+    char *data;
+    char *out;
+    int len;
+    int index;
+    int compressed;
+    unsigned int seed;
+
+    enc = mppc_enc_new(PROTO_RDP_40);
+    ck_assert_ptr_ne(enc, NULL);
+    add_output_guard(enc);
+    dec = g_new0(struct mppc_dec, 1);
+    dec->rdp4 = 1;
+    data = g_new(char, 8 * 1024);
+    compressed = 0;
+    for (index = 0; index < 64; index++)
+    {
+        len = 3 + (index * 997) % (8 * 1024 - 3);
+        make_data(data, len, index % 8);
+        if (!compress_rdp(enc, (tui8 *) data, len))
+        {
+            continue;
+        }
+        compressed++;
+        ck_assert_int_eq(enc->flags & 0x0F, PACKET_COMPR_TYPE_8K);
+        ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                     enc->bytes_in_opb, &out), len);
+        ck_assert(g_memcmp(out, data, len) == 0);
+    }
+    ck_assert_int_gt(compressed, 32);
+    /* too big for the history, sent as is */
+    ck_assert(!compress_rdp(enc, (tui8 *) data, 8 * 1024 + 1));
+    /* noise filling the whole history expands, the encoder must give up
+       without writing past its output buffer */
+    seed = 3;
+    for (index = 0; index < 8 * 1024; index++)
+    {
+        data[index] = next_random(&seed);
+    }
+    ck_assert(!compress_rdp(enc, (tui8 *) data, 8 * 1024));
+    check_output_guard(enc);
+    make_data(data, 4096, 1);
+    ck_assert(compress_rdp(enc, (tui8 *) data, 4096));
+    ck_assert(enc->flags & PACKET_FLUSHED);
+    ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                 enc->bytes_in_opb, &out), 4096);
+    ck_assert(g_memcmp(out, data, 4096) == 0);
+    g_free(data);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp61_round_trip)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xcrush_dec *dec;
+    char *data;
+    char *out;
+    int len;
+    int index;
+    int compressed;
+    int at_front;
+
+    enc = mppc_enc_new(PROTO_RDP_61);
+    ck_assert_ptr_ne(enc, NULL);
+    dec = g_new0(struct xcrush_dec, 1);
+    dec->history = g_new0(char, L1_HIST_LEN);
+    data = g_new(char, 60000);
+    compressed = 0;
+    at_front = 0;
+    /* enough to wrap the level 1 history */
+    for (index = 0; index < 48; index++)
+    {
+        len = 60000 - (index * 1237) % 20000;
+        make_data(data, len, index % 5);
+        if (!compress_rdp(enc, (tui8 *) data, len))
+        {
+            continue;
+        }
+        compressed++;
+        at_front |= enc->outputBuffer[0] & L1_PACKET_AT_FRONT;
+        ck_assert_int_eq(xcrush_decode(dec, enc->flags, enc->outputBuffer,
+                                       enc->bytes_in_opb, &out), len);
+        ck_assert(g_memcmp(out, data, len) == 0);
+    }
+    ck_assert_int_eq(compressed, 48);
+    ck_assert(at_front);
+    g_free(data);
+    g_free(dec->history);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp61_far_repeat)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xcrush_dec *dec;
+    char *block;
+    char *noise;
+    char *out;
+    unsigned int seed;
+    int index;
+
+    enc = mppc_enc_new(PROTO_RDP_61);
+    ck_assert_ptr_ne(enc, NULL);
+    dec = g_new0(struct xcrush_dec, 1);
+    dec->history = g_new0(char, L1_HIST_LEN);
+    block = g_new(char, 32 * 1024);
+    noise = g_new(char, 32 * 1024);
+    seed = 1;
+    /* noise, repeated once, so only level 1 can do anything with it */
+    for (index = 0; index < 16 * 1024; index++)
+    {
+        block[index] = next_random(&seed);
+        block[index + 16 * 1024] = block[index];
+    }
+    ck_assert(compress_rdp(enc, (tui8 *) block, 32 * 1024));
+    ck_assert_int_lt(enc->bytes_in_opb, 17 * 1024);
+    ck_assert_int_eq(xcrush_decode(dec, enc->flags, enc->outputBuffer,
+                                   enc->bytes_in_opb, &out), 32 * 1024);
+    ck_assert(g_memcmp(out, block, 32 * 1024) == 0);
+    /* further back than the 64K MPPC history can reach */
+    for (index = 0; index < 4; index++)
+    {
+        make_data(noise, 32 * 1024, index + 10);
+        ck_assert(compress_rdp(enc, (tui8 *) noise, 32 * 1024));
+        ck_assert_int_eq(xcrush_decode(dec, enc->flags, enc->outputBuffer,
+                                       enc->bytes_in_opb, &out), 32 * 1024);
+    }
+    ck_assert(compress_rdp(enc, (tui8 *) block, 32 * 1024));
+    ck_assert_int_lt(enc->bytes_in_opb, 1024);
+    ck_assert_int_eq(xcrush_decode(dec, enc->flags, enc->outputBuffer,
+                                   enc->bytes_in_opb, &out), 32 * 1024);
+    ck_assert(g_memcmp(out, block, 32 * 1024) == 0);
+    g_free(block);
+    g_free(noise);
+    g_free(dec->history);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+/* short PDUs in between must not cost the history */
+START_TEST(test_xrdp_mppc_enc__short_keeps_history)
+{
+    static const char text[] = "short, but sent";
+    struct xrdp_mppc_enc *enc;
+    struct mppc_dec *dec;
+    char *data;
+    char *out;
+    char tiny[8];
+    int len;
+
+    enc = mppc_enc_new(PROTO_RDP_50);
+    ck_assert_ptr_ne(enc, NULL);
+    dec = g_new0(struct mppc_dec, 1);
+    data = g_new(char, 4096);
+    make_data(data, 4096, 1);
+    ck_assert(compress_rdp(enc, (tui8 *) data, 4096));
+    ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                 enc->bytes_in_opb, &out), 4096);
+
+    /* too short to be worth it, sent as is */
+    g_memset(tiny, 0xfe, sizeof(tiny));
+    for (len = 1; len <= (int) sizeof(tiny); len++)
+    {
+        ck_assert(!compress_rdp(enc, (tui8 *) tiny, len));
+    }
+    /* as long compressed as not, still worth keeping */
+    len = sizeof(text) - 1;
+    ck_assert(compress_rdp(enc, (tui8 *) text, len));
+    ck_assert(!(enc->flags & PACKET_FLUSHED));
+    ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                 enc->bytes_in_opb, &out), len);
+    ck_assert(g_memcmp(out, text, len) == 0);
+
+    /* the first PDU is still there to copy from */
+    ck_assert(compress_rdp(enc, (tui8 *) data, 4096));
+    ck_assert(!(enc->flags & PACKET_FLUSHED));
+    ck_assert_int_lt(enc->bytes_in_opb, 64);
+    ck_assert_int_eq(mppc_decode(dec, enc->flags, enc->outputBuffer,
+                                 enc->bytes_in_opb, &out), 4096);
+    ck_assert(g_memcmp(out, data, 4096) == 0);
+    g_free(data);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__for_client)
+{
+    /* CompressionType, RDP 6.1 allowed, what is used */
+    static const int types[][3] =
+    {
+        { 0, 1, PROTO_RDP_40 },
+        { 1, 1, PROTO_RDP_50 },
+        { 2, 1, PROTO_RDP_50 }, /* no NCRUSH, 64K MPPC is the next best */
+        { 3, 1, PROTO_RDP_61 },
+        { 0xf, 1, PROTO_RDP_61 },
+        { 3, 0, PROTO_RDP_50 },
+        { 0xf, 0, PROTO_RDP_50 }
+    };
+    struct xrdp_mppc_enc *enc;
+    int index;
+
+    for (index = 0; index < (int) (sizeof(types) / sizeof(types[0])); index++)
+    {
+        enc = mppc_enc_new_for_client(types[index][0], types[index][1]);
+        ck_assert_ptr_ne(enc, NULL);
+        ck_assert_int_eq(enc->protocol_type, types[index][2]);
+        mppc_enc_free(enc);
+    }
+    ck_assert_ptr_eq(mppc_enc_new(PROTO_RDP_60), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_mppc_enc(void)
+{
+    Suite *s;
+    TCase *tc_mppc;
+
+    s = suite_create("test_xrdp_mppc_enc");
+
+    tc_mppc = tcase_create("xrdp_mppc_enc");
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__rdp4_round_trip);
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__rdp5_round_trip);
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__rdp61_round_trip);
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__rdp61_far_repeat);
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__noise);
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__short_keeps_history);
+    tcase_add_test(tc_mppc, test_xrdp_mppc_enc__for_client);
+    /* the trace is a synthetic benchmark, only run when asked for */
+    if (g_getenv("TEST_MPPC_TRACE") != NULL)
+    {
+        tcase_add_test(tc_mppc, test_xrdp_mppc_enc__trace);
+        tcase_set_timeout(tc_mppc, 60);
+    }
+
+    suite_add_tcase(s, tc_mppc);
+
+    return s;
+}
@@ -0,0 +1,173 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "ms-rdpegdi.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *g_rdp;
+static struct xrdp_orders *g_orders;
+
+/******************************************************************************/
+/* an orders object which writes into its buffer but never sends */
+static void
+setup(void)
+{
+    g_rdp = g_new0(struct xrdp_rdp, 1);
+    g_rdp->client_info.max_fastpath_frag_bytes = 16 * 1024;
+    g_rdp->client_info.order_optimization = 1;
+    g_orders = xrdp_orders_create(NULL, g_rdp);
+    g_orders->order_level = 1;
+    g_orders->order_count_ptr = g_orders->out_s->p;
+    out_uint8s(g_orders->out_s, 2);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_orders->order_level = 0;
+    xrdp_orders_delete(g_orders);
+    g_free(g_rdp);
+}
+
+/******************************************************************************/
+static struct xrdp_rect
+make_rect(int left, int top, int right, int bottom)
+{
+    struct xrdp_rect rect;
+
+    rect.left = left;
+    rect.top = top;
+    rect.right = right;
+    rect.bottom = bottom;
+    return rect;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__covered_dropped)
+{
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 10, 10, 20, 20, 1, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 0, 0, 100, 100, 2, NULL), 0);
+    ck_assert_int_eq(g_orders->order_count, 0);
+    ck_assert_int_eq(xrdp_orders_opt_flush(g_orders), 0);
+    ck_assert_int_eq(g_orders->order_count, 1);
+    ck_assert_int_eq(g_orders->orders_state.rect_cx, 100);
+    ck_assert_int_eq(g_orders->opt.orders_in, 2);
+    ck_assert_int_eq(g_orders->opt.orders_out, 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__later_not_dropped)
+{
+    /* the small rect is drawn on top so it must stay */
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 0, 0, 100, 100, 2, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 10, 10, 20, 20, 1, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_opt_flush(g_orders), 0);
+    ck_assert_int_eq(g_orders->order_count, 2);
+    ck_assert_int_eq(g_orders->orders_state.rect_x, 10);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__clipped_rects_merged)
+{
+    struct xrdp_rect clip;
+    int index;
+
+    /* one fill split by the painter into bands */
+    for (index = 0; index < 4; index++)
+    {
+        clip = make_rect(0, index * 10, 64, index * 10 + 10);
+        ck_assert_int_eq(xrdp_orders_rect(g_orders, 0, 0, 64, 40, 7, &clip),
+                         0);
+    }
+    ck_assert_int_eq(xrdp_orders_opt_flush(g_orders), 0);
+    ck_assert_int_eq(g_orders->order_count, 1);
+    ck_assert_int_eq(g_orders->orders_state.rect_y, 0);
+    ck_assert_int_eq(g_orders->orders_state.rect_cy, 40);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__overlap_blocks_merge)
+{
+    /* the middle order covers part of both others, neither can move */
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 0, 0, 10, 10, 1, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 5, 5, 10, 10, 2, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 10, 0, 10, 10, 1, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_opt_flush(g_orders), 0);
+    ck_assert_int_eq(g_orders->order_count, 3);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__mem_blt_merged)
+{
+    struct xrdp_rect clip;
+
+    clip = make_rect(100, 100, 116, 108);
+    ck_assert_int_eq(xrdp_orders_mem_blt(g_orders, 1, 0, 100, 100, 16, 16,
+                                         0xcc, 0, 0, 5, &clip), 0);
+    clip = make_rect(100, 108, 116, 116);
+    ck_assert_int_eq(xrdp_orders_mem_blt(g_orders, 1, 0, 100, 100, 16, 16,
+                                         0xcc, 0, 0, 5, &clip), 0);
+    /* same bitmap, different source offset */
+    ck_assert_int_eq(xrdp_orders_mem_blt(g_orders, 1, 0, 116, 100, 16, 16,
+                                         0xcc, 4, 0, 5, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_opt_flush(g_orders), 0);
+    ck_assert_int_eq(g_orders->order_count, 2);
+    ck_assert_int_eq(g_orders->orders_state.mem_blt_srcx, 4);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__other_order_flushes)
+{
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 0, 0, 10, 10, 1, NULL), 0);
+    /* not an opaque copy, sent straight away after the held rect */
+    ck_assert_int_eq(xrdp_orders_mem_blt(g_orders, 1, 0, 0, 0, 10, 10,
+                                         0x66, 0, 0, 5, NULL), 0);
+    ck_assert_int_eq(g_orders->opt.count, 0);
+    ck_assert_int_eq(g_orders->order_count, 2);
+    ck_assert_int_eq(g_orders->orders_state.last_order, RDP_ORDER_MEMBLT);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_opt__disabled)
+{
+    g_orders->opt.enabled = 0;
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 10, 10, 20, 20, 1, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(g_orders, 0, 0, 100, 100, 2, NULL), 0);
+    ck_assert_int_eq(g_orders->order_count, 2);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_orders_opt(void)
+{
+    Suite *s;
+    TCase *tc_opt;
+
+    s = suite_create("test_xrdp_orders_opt");
+
+    tc_opt = tcase_create("xrdp_orders_opt");
+    tcase_add_checked_fixture(tc_opt, setup, teardown);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__covered_dropped);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__later_not_dropped);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__clipped_rects_merged);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__overlap_blocks_merge);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__mem_blt_merged);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__other_order_flushes);
+    tcase_add_test(tc_opt, test_xrdp_orders_opt__disabled);
+
+    suite_add_tcase(s, tc_opt);
+
+    return s;
+}
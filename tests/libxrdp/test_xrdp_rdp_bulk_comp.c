@@ -0,0 +1,120 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "ms-rdpbcgr.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *g_rdp;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_rdp = g_new0(struct xrdp_rdp, 1);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_free(g_rdp);
+}
+
+/******************************************************************************/
+/* returns the number of fragments skipped before the compressor is
+   offered one again */
+static int
+count_skipped(int update_code)
+{
+    int skipped;
+
+    skipped = 0;
+    while (!xrdp_rdp_bulk_comp_wanted(g_rdp, update_code, 1000))
+    {
+        skipped++;
+        ck_assert_int_lt(skipped, 100000);
+    }
+    return skipped;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_rdp_bulk_comp__surface_bits_skipped)
+{
+    ck_assert(!xrdp_rdp_bulk_comp_wanted(g_rdp, FASTPATH_UPDATETYPE_SURFCMDS,
+                                         1000));
+    ck_assert(xrdp_rdp_bulk_comp_wanted(g_rdp, FASTPATH_UPDATETYPE_ORDERS,
+                                        1000));
+    ck_assert_int_eq(g_rdp->bulk_comp[FASTPATH_UPDATETYPE_SURFCMDS].
+                     bytes_skipped, 1000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_rdp_bulk_comp__back_off)
+{
+    int index;
+    int first;
+    int second;
+
+    /* a bit of a saving each time */
+    for (index = 0; index < 10; index++)
+    {
+        ck_assert(xrdp_rdp_bulk_comp_wanted(g_rdp, FASTPATH_UPDATETYPE_BITMAP,
+                                            1000));
+        xrdp_rdp_bulk_comp_result(g_rdp, FASTPATH_UPDATETYPE_BITMAP, 1000,
+                                  900, 10);
+    }
+    /* now it stops working */
+    for (index = 0; index < 4; index++)
+    {
+        ck_assert(xrdp_rdp_bulk_comp_wanted(g_rdp, FASTPATH_UPDATETYPE_BITMAP,
+                                            1000));
+        xrdp_rdp_bulk_comp_result(g_rdp, FASTPATH_UPDATETYPE_BITMAP, 1000,
+                                  0, 10);
+    }
+    first = count_skipped(FASTPATH_UPDATETYPE_BITMAP);
+    ck_assert_int_gt(first, 0);
+    /* still not working, a single miss backs off for longer */
+    xrdp_rdp_bulk_comp_result(g_rdp, FASTPATH_UPDATETYPE_BITMAP, 1000,
+                              995, 10);
+    second = count_skipped(FASTPATH_UPDATETYPE_BITMAP);
+    ck_assert_int_eq(second, first * 2);
+    /* other update codes are not affected */
+    ck_assert(xrdp_rdp_bulk_comp_wanted(g_rdp, FASTPATH_UPDATETYPE_ORDERS,
+                                        1000));
+    /* a saving puts it back as it was */
+    xrdp_rdp_bulk_comp_result(g_rdp, FASTPATH_UPDATETYPE_BITMAP, 1000,
+                              500, 10);
+    ck_assert(xrdp_rdp_bulk_comp_wanted(g_rdp, FASTPATH_UPDATETYPE_BITMAP,
+                                        1000));
+    ck_assert_int_eq(g_rdp->bulk_comp[FASTPATH_UPDATETYPE_BITMAP].bytes_in,
+                     16 * 1000);
+    ck_assert_int_eq(g_rdp->bulk_comp[FASTPATH_UPDATETYPE_BITMAP].bytes_out,
+                     10 * 900 + 4 * 1000 + 995 + 500);
+    ck_assert_int_eq(g_rdp->bulk_comp[FASTPATH_UPDATETYPE_BITMAP].usecs,
+                     16 * 10);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_rdp_bulk_comp(void)
+{
+    Suite *s;
+    TCase *tc_bulk;
+
+    s = suite_create("test_xrdp_rdp_bulk_comp");
+
+    tc_bulk = tcase_create("xrdp_rdp_bulk_comp");
+    tcase_add_checked_fixture(tc_bulk, setup, teardown);
+    tcase_add_test(tc_bulk, test_xrdp_rdp_bulk_comp__surface_bits_skipped);
+    tcase_add_test(tc_bulk, test_xrdp_rdp_bulk_comp__back_off);
+
+    suite_add_tcase(s, tc_bulk);
+
+    return s;
+}
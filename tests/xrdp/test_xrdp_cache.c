@@ -0,0 +1,354 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "log.h"
+#include "os_calls.h"
+#include "trans.h"
+#include "xrdp.h"
+#include "test_xrdp.h"
+
+/* 64x64 at 32 bpp */
+#define SURFACE_BYTES (64 * 64 * 4)
+
+static struct trans *g_trans;
+static int g_sck[2];
+static struct xrdp_session *g_session;
+static struct xrdp_cache *g_cache;
+
+/******************************************************************************/
+static int
+discard_send(struct trans *self, const char *data, int len)
+{
+    return len;
+}
+
+/******************************************************************************/
+/* a client with room for two surfaces and three glyph fragments */
+static void
+setup(void)
+{
+    struct xrdp_client_info client_info;
+
+    ck_assert_int_eq(g_sck_local_socketpair(g_sck), 0);
+    g_trans = trans_create(TRANS_MODE_TCP, 8192, 8192);
+    g_trans->sck = g_sck[0];
+    g_trans->status = TRANS_STATUS_UP;
+    g_trans->trans_send = discard_send;
+    g_trans->trans_send_vec = NULL;
+    g_session = libxrdp_init(0, g_trans, "/nonexistent/xrdp.ini");
+    ck_assert_ptr_nonnull(g_session);
+    g_memset(&client_info, 0, sizeof(client_info));
+    client_info.offscreen_cache_size = 2 * SURFACE_BYTES;
+    client_info.glyph_frag_cache_entries = 3;
+    client_info.glyph_frag_cache_size = 256;
+    g_cache = xrdp_cache_create(NULL, g_session, &client_info);
+    ck_assert_ptr_nonnull(g_cache);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_cache_delete(g_cache);
+    libxrdp_exit(g_session);
+    trans_delete(g_trans);
+    g_sck_close(g_sck[1]);
+}
+
+/******************************************************************************/
+static struct xrdp_bitmap *
+add_surface(int rdpindex)
+{
+    struct xrdp_bitmap *bitmap;
+
+    bitmap = xrdp_bitmap_create(64, 64, 32, WND_TYPE_OFFSCREEN, NULL);
+    ck_assert_int_eq(xrdp_cache_add_os_bitmap(g_cache, bitmap, rdpindex), 0);
+    bitmap->item_index = rdpindex;
+    bitmap->id = rdpindex;
+    return bitmap;
+}
+
+/******************************************************************************/
+/* returns boolean, true if any of x, y, cx, cy on rdpindex is lost */
+static int
+is_lost(int rdpindex, int x, int y, int cx, int cy)
+{
+    struct xrdp_region *region;
+    struct xrdp_rect rect;
+
+    MAKERECT(rect, x, y, cx, cy);
+    region = xrdp_cache_os_bitmap_get_lost(g_cache, rdpindex, &rect, x, y);
+    xrdp_region_delete(region);
+    return region != NULL;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__os_bitmap_evicts_lru)
+{
+    struct xrdp_bitmap *b1;
+    struct xrdp_bitmap *b2;
+    struct xrdp_bitmap *b3;
+
+    b1 = add_surface(1);
+    b2 = add_surface(2);
+    b3 = add_surface(3);
+    ck_assert_int_eq(xrdp_cache_use_os_bitmap(g_cache, 1, -1), 0);
+    ck_assert_int_eq(xrdp_cache_use_os_bitmap(g_cache, 2, -1), 0);
+    ck_assert_int_eq(xrdp_cache_use_os_bitmap(g_cache, 1, -1), 0);
+    ck_assert_int_eq(g_cache->os_bitmap_count, 2);
+
+    /* 2 is the least recently used */
+    ck_assert_int_eq(xrdp_cache_use_os_bitmap(g_cache, 3, -1), 0);
+    ck_assert_int_eq(b1->tab_stop, 1);
+    ck_assert_int_eq(b2->tab_stop, 0);
+    ck_assert_int_eq(b3->tab_stop, 1);
+    ck_assert_int_eq(g_cache->os_bitmap_count, 2);
+    ck_assert_int_eq(g_cache->os_bitmap_bytes, 2 * SURFACE_BYTES);
+    ck_assert(!is_lost(1, 0, 0, 64, 64));
+    ck_assert(is_lost(2, 0, 0, 64, 64));
+    ck_assert(!is_lost(3, 0, 0, 64, 64));
+
+    /* 1 is older than 3, but it is being drawn on */
+    ck_assert_int_eq(xrdp_cache_use_os_bitmap(g_cache, 2, 1), 0);
+    ck_assert_int_eq(b1->tab_stop, 1);
+    ck_assert_int_eq(b2->tab_stop, 1);
+    ck_assert_int_eq(b3->tab_stop, 0);
+    ck_assert(is_lost(3, 0, 0, 64, 64));
+
+    /* deleting a surface gives its room back */
+    ck_assert_int_eq(xrdp_cache_remove_os_bitmap(g_cache, 1), 0);
+    ck_assert_int_eq(g_cache->os_bitmap_count, 1);
+    ck_assert_int_eq(g_cache->os_bitmap_bytes, SURFACE_BYTES);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__os_bitmap_recreated_and_redrawn)
+{
+    struct xrdp_os_bitmap_item *bi;
+    struct xrdp_rect rect;
+
+    add_surface(1);
+    add_surface(2);
+    add_surface(3);
+    xrdp_cache_use_os_bitmap(g_cache, 1, -1);
+    xrdp_cache_use_os_bitmap(g_cache, 2, -1);
+    xrdp_cache_use_os_bitmap(g_cache, 3, -1);
+    bi = xrdp_cache_get_os_bitmap(g_cache, 1);
+    ck_assert_ptr_nonnull(bi->lost);
+
+    /* made again on the client, but blank until drawn */
+    xrdp_cache_use_os_bitmap(g_cache, 1, -1);
+    ck_assert_int_eq(bi->bitmap->tab_stop, 1);
+    ck_assert(is_lost(1, 0, 0, 64, 64));
+
+    MAKERECT(rect, 0, 0, 64, 32);
+    ck_assert_int_eq(xrdp_cache_os_bitmap_drawn(g_cache, 1, &rect), 0);
+    ck_assert(!is_lost(1, 0, 0, 64, 32));
+    ck_assert(is_lost(1, 0, 32, 64, 32));
+    ck_assert_ptr_nonnull(bi->lost);
+
+    MAKERECT(rect, 0, 32, 64, 32);
+    ck_assert_int_eq(xrdp_cache_os_bitmap_drawn(g_cache, 1, &rect), 0);
+    ck_assert_ptr_null(bi->lost);
+    ck_assert(!is_lost(1, 0, 0, 64, 64));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__os_bitmap_lost_asked_for_once)
+{
+    struct xrdp_rect rect;
+
+    add_surface(1);
+    MAKERECT(rect, 0, 0, 64, 64);
+    ck_assert_int_eq(xrdp_cache_os_bitmap_set_lost(g_cache, 1, &rect), 0);
+
+    /* a module redrawing the screen from the same surface gets the blank
+       copy rather than asking again */
+    MAKERECT(rect, 10, 10, 20, 20);
+    ck_assert(xrdp_cache_os_bitmap_take_lost(g_cache, 1, &rect));
+    ck_assert(!xrdp_cache_os_bitmap_take_lost(g_cache, 1, &rect));
+    MAKERECT(rect, 40, 40, 10, 10);
+    ck_assert(xrdp_cache_os_bitmap_take_lost(g_cache, 1, &rect));
+
+    /* nothing lost from a surface which was never evicted */
+    add_surface(2);
+    ck_assert(!xrdp_cache_os_bitmap_take_lost(g_cache, 2, &rect));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__os_bitmap_lost_copied)
+{
+    struct xrdp_region *region;
+    struct xrdp_rect rect;
+
+    add_surface(1);
+    add_surface(2);
+    MAKERECT(rect, 0, 0, 16, 16);
+    ck_assert_int_eq(xrdp_cache_os_bitmap_set_lost(g_cache, 1, &rect), 0);
+
+    /* 8, 8, 16, 16 on 1 copied to 40, 40 on 2 */
+    MAKERECT(rect, 8, 8, 16, 16);
+    region = xrdp_cache_os_bitmap_get_lost(g_cache, 1, &rect, 40, 40);
+    ck_assert_ptr_nonnull(region);
+    ck_assert_int_eq(xrdp_cache_os_bitmap_add_lost(g_cache, 2, region), 0);
+    xrdp_region_delete(region);
+    ck_assert(is_lost(2, 40, 40, 8, 8));
+    ck_assert(!is_lost(2, 48, 48, 8, 8));
+    ck_assert(!is_lost(2, 0, 0, 40, 64));
+
+    /* a copy within one surface */
+    MAKERECT(rect, 0, 0, 16, 16);
+    region = xrdp_cache_os_bitmap_get_lost(g_cache, 1, &rect, 32, 0);
+    xrdp_cache_os_bitmap_drawn(g_cache, 1, &rect);
+    xrdp_cache_os_bitmap_add_lost(g_cache, 1, region);
+    xrdp_region_delete(region);
+    ck_assert(!is_lost(1, 0, 0, 16, 16));
+    ck_assert(is_lost(1, 32, 0, 16, 16));
+
+    /* nothing lost in the source, nothing to carry */
+    MAKERECT(rect, 0, 32, 16, 16);
+    ck_assert_ptr_null(xrdp_cache_os_bitmap_get_lost(g_cache, 1, &rect,
+                       0, 0));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__glyph_frag_reused)
+{
+    static const char text1[] = "\x01\x00\x02\x08\x03\x08";
+    static const char text2[] = "\x04\x00\x05\x08\x06\x08";
+    int found;
+    int index1;
+    int index2;
+
+    index1 = xrdp_cache_add_glyph_frag(g_cache, 1, text1, 6, &found);
+    ck_assert_int_ge(index1, 0);
+    ck_assert(!found);
+    index2 = xrdp_cache_add_glyph_frag(g_cache, 1, text2, 6, &found);
+    ck_assert_int_ge(index2, 0);
+    ck_assert_int_ne(index2, index1);
+    ck_assert(!found);
+
+    /* sent again, the client has it */
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text1, 6, &found),
+                     index1);
+    ck_assert(found);
+
+    /* the same glyph indexes in another font are other glyphs */
+    ck_assert_int_ne(xrdp_cache_add_glyph_frag(g_cache, 2, text1, 6, &found),
+                     index1);
+    ck_assert(!found);
+
+    /* too short to be worth it, too long for cbData */
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text1, 2, &found),
+                     -1);
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text1, 253,
+                     &found), -1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__glyph_frag_evicts_lru)
+{
+    static const char text[4][5] =
+    {
+        "\x01\x00\x02\x08", "\x03\x00\x04\x08",
+        "\x05\x00\x06\x08", "\x07\x00\x08\x08"
+    };
+    int found;
+    int index[4];
+
+    index[0] = xrdp_cache_add_glyph_frag(g_cache, 1, text[0], 4, &found);
+    index[1] = xrdp_cache_add_glyph_frag(g_cache, 1, text[1], 4, &found);
+    index[2] = xrdp_cache_add_glyph_frag(g_cache, 1, text[2], 4, &found);
+    /* 0 is used, so 1 is the oldest once the cache is full */
+    xrdp_cache_add_glyph_frag(g_cache, 1, text[0], 4, &found);
+    ck_assert(found);
+    index[3] = xrdp_cache_add_glyph_frag(g_cache, 1, text[3], 4, &found);
+    ck_assert(!found);
+    ck_assert_int_eq(index[3], index[1]);
+
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text[0], 4,
+                     &found), index[0]);
+    ck_assert(found);
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text[2], 4,
+                     &found), index[2]);
+    ck_assert(found);
+    /* 1 was replaced, added again in place of 3, the oldest now */
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text[1], 4,
+                     &found), index[3]);
+    ck_assert(!found);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_cache__glyph_frag_no_client_cache)
+{
+    static const char text[] = "\x01\x00\x02\x08";
+    struct xrdp_client_info client_info;
+    int found;
+
+    g_memset(&client_info, 0, sizeof(client_info));
+    ck_assert_int_eq(xrdp_cache_reset(g_cache, &client_info), 0);
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text, 4, &found),
+                     -1);
+    ck_assert(!found);
+    ck_assert_int_eq(xrdp_cache_add_glyph_frag(g_cache, 1, text, 4, &found),
+                     -1);
+    ck_assert(!found);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_cache(void)
+{
+    Suite *s;
+    TCase *tc_os_bitmap;
+    TCase *tc_glyph_frag;
+
+    s = suite_create("test_xrdp_cache");
+
+    tc_os_bitmap = tcase_create("xrdp_cache_os_bitmap");
+    tcase_add_checked_fixture(tc_os_bitmap, setup, teardown);
+    tcase_add_test(tc_os_bitmap, test_xrdp_cache__os_bitmap_evicts_lru);
+    tcase_add_test(tc_os_bitmap,
+                   test_xrdp_cache__os_bitmap_recreated_and_redrawn);
+    tcase_add_test(tc_os_bitmap, test_xrdp_cache__os_bitmap_lost_asked_for_once);
+    tcase_add_test(tc_os_bitmap, test_xrdp_cache__os_bitmap_lost_copied);
+
+    suite_add_tcase(s, tc_os_bitmap);
+
+    tc_glyph_frag = tcase_create("xrdp_cache_glyph_frag");
+    tcase_add_checked_fixture(tc_glyph_frag, setup, teardown);
+    tcase_add_test(tc_glyph_frag, test_xrdp_cache__glyph_frag_reused);
+    tcase_add_test(tc_glyph_frag, test_xrdp_cache__glyph_frag_evicts_lru);
+    tcase_add_test(tc_glyph_frag, test_xrdp_cache__glyph_frag_no_client_cache);
+    suite_add_tcase(s, tc_glyph_frag);
+
+    return s;
+}
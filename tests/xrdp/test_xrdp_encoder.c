@@ -0,0 +1,192 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "log.h"
+#include "os_calls.h"
+#include "xrdp.h"
+#include "xrdp_encoder.h"
+#include "test_xrdp.h"
+
+/* usec */
+#define BASE_RTT 10000
+
+static struct xrdp_encoder *g_enc;
+static int g_frame_id;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_enc = g_new0(struct xrdp_encoder, 1);
+    g_frame_id = 0;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_free(g_enc);
+}
+
+/******************************************************************************/
+/* sends a frame and has it acked rtt usec later */
+static void
+frame_round_trip(int rtt, int queue_depth)
+{
+    int index;
+
+    g_frame_id++;
+    xrdp_encoder_frame_sent(g_enc, g_frame_id);
+    index = g_frame_id & (XRDP_ENC_ACK_SAMPLES - 1);
+    g_enc->frame_sent_usec[index] -= rtt;
+    xrdp_encoder_frame_acked(g_enc, g_frame_id, queue_depth);
+}
+
+/******************************************************************************/
+/* a window of acks, as many as frames in flight */
+static void
+window_round_trip(int rtt, int queue_depth)
+{
+    int count;
+
+    count = MIN(g_enc->frames_in_flight, XRDP_ENC_ACK_SAMPLES);
+    while (count > 0)
+    {
+        frame_round_trip(rtt, queue_depth);
+        count--;
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_encoder__acks_grow_to_max)
+{
+    g_enc->frames_in_flight = 2;
+    g_enc->frames_in_flight_max = 4;
+
+    /* nothing queues while the round trip stays at the base */
+    frame_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, 2);
+    frame_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, 3);
+    window_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, 4);
+    window_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, 4);
+    ck_assert_int_ge(g_enc->ack_base_rtt, BASE_RTT);
+    ck_assert_int_lt(g_enc->ack_base_rtt, BASE_RTT * 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_encoder__acks_shrink_when_queued)
+{
+    g_enc->frames_in_flight = 8;
+    g_enc->frames_in_flight_max = 8;
+    window_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, 8);
+
+    /* the client says 4 frames are waiting */
+    window_round_trip(BASE_RTT, 4);
+    ck_assert_int_eq(g_enc->frames_in_flight, 7);
+
+    /* the round trip is three times the base, so about two thirds of
+       the frames in flight are queued on the way */
+    window_round_trip(BASE_RTT * 3, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, 6);
+
+    /* 3 queued is tolerated */
+    window_round_trip(BASE_RTT, 3);
+    ck_assert_int_eq(g_enc->frames_in_flight, 6);
+
+    /* never below 1 */
+    g_enc->frames_in_flight = 1;
+    window_round_trip(BASE_RTT, 10);
+    ck_assert_int_eq(g_enc->frames_in_flight, 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_encoder__acks_stale_ignored)
+{
+    int index;
+
+    g_enc->frames_in_flight = 4;
+    g_enc->frames_in_flight_max = 8;
+
+    /* never sent */
+    xrdp_encoder_frame_acked(g_enc, 100, 0);
+    ck_assert_int_eq(g_enc->ack_count, 0);
+    ck_assert_int_eq(g_enc->ack_base_rtt, 0);
+
+    /* acked twice */
+    frame_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->ack_count, 1);
+    xrdp_encoder_frame_acked(g_enc, g_frame_id, 0);
+    ck_assert_int_eq(g_enc->ack_count, 1);
+
+    /* overwritten by a frame XRDP_ENC_ACK_SAMPLES later */
+    xrdp_encoder_frame_sent(g_enc, 200);
+    xrdp_encoder_frame_sent(g_enc, 200 + XRDP_ENC_ACK_SAMPLES);
+    xrdp_encoder_frame_acked(g_enc, 200, 0);
+    ck_assert_int_eq(g_enc->ack_count, 1);
+    index = (200 + XRDP_ENC_ACK_SAMPLES) & (XRDP_ENC_ACK_SAMPLES - 1);
+    g_enc->frame_sent_usec[index] -= BASE_RTT;
+    xrdp_encoder_frame_acked(g_enc, 200 + XRDP_ENC_ACK_SAMPLES, 0);
+    ck_assert_int_eq(g_enc->ack_count, 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_encoder__acks_more_in_flight_than_samples)
+{
+    /* the client allows more frames in flight than can be timed */
+    g_enc->frames_in_flight = XRDP_ENC_ACK_SAMPLES * 2;
+    g_enc->frames_in_flight_max = XRDP_ENC_ACK_SAMPLES * 4;
+    window_round_trip(BASE_RTT, 0);
+    ck_assert_int_eq(g_enc->ack_count, 0);
+    ck_assert_int_eq(g_enc->frames_in_flight, XRDP_ENC_ACK_SAMPLES * 2 + 1);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_encoder(void)
+{
+    Suite *s;
+    TCase *tc_acks;
+
+    s = suite_create("test_xrdp_encoder");
+
+    tc_acks = tcase_create("xrdp_encoder_frame_acked");
+    tcase_add_checked_fixture(tc_acks, setup, teardown);
+    tcase_add_test(tc_acks, test_xrdp_encoder__acks_grow_to_max);
+    tcase_add_test(tc_acks, test_xrdp_encoder__acks_shrink_when_queued);
+    tcase_add_test(tc_acks, test_xrdp_encoder__acks_stale_ignored);
+    tcase_add_test(tc_acks,
+                   test_xrdp_encoder__acks_more_in_flight_than_samples);
+
+    suite_add_tcase(s, tc_acks);
+
+    return s;
+}
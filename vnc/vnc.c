@@ -2036,6 +2036,8 @@ lib_mod_connect(struct vnc *v)
         v->trans->trans_data_in = lib_data_in;
         v->trans->header_size = 1;
         v->trans->callback_data = v;
+        /* the session loop waits on it from now on */
+        trans_set_reactor(v->trans, v->reactor);
     }
 
     return error;
@@ -2146,26 +2148,6 @@ lib_mod_set_param(struct vnc *v, const char *name, const char *value)
     return 0;
 }
 
-/******************************************************************************/
-/* return error */
-int
-lib_mod_get_wait_objs(struct vnc *v, tbus *read_objs, int *rcount,
-                      tbus *write_objs, int *wcount, int *timeout)
-{
-    LOG_DEVEL(LOG_LEVEL_TRACE, "lib_mod_get_wait_objs:");
-
-    if (v != 0)
-    {
-        if (v->trans != 0)
-        {
-            trans_get_wait_objs_rw(v->trans, read_objs, rcount,
-                                   write_objs, wcount, timeout);
-        }
-    }
-
-    return 0;
-}
-
 /******************************************************************************/
 /* return error */
 int
@@ -2265,7 +2247,6 @@ mod_init(void)
     v->mod_signal = lib_mod_signal;
     v->mod_end = lib_mod_end;
     v->mod_set_param = lib_mod_set_param;
-    v->mod_get_wait_objs = lib_mod_get_wait_objs;
     v->mod_check_wait_objs = lib_mod_check_wait_objs;
     v->mod_frame_ack = lib_mod_frame_ack;
     v->mod_suppress_output = lib_mod_suppress_output;
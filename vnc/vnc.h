@@ -61,6 +61,7 @@ enum vnc_resize_status
 };
 
 struct source_info;
+struct reactor;
 
 /* Defined in vnc_clip.c */
 struct vnc_clipboard_data;
@@ -141,6 +142,7 @@ struct vnc
     tintptr wm;
     tintptr painter;
     struct source_info *si;
+    struct reactor *reactor;
     /* mod data */
     int server_width;
     int server_height;
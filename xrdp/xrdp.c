@@ -105,6 +105,20 @@ xrdp_child(int sig)
     g_set_sigchld(1);
 }
 
+/*****************************************************************************/
+/* Signal handler for SIGHUP
+ * Note: only signal safe code (eg. setting wait event) should be executed in
+ * this function. For more details see `man signal-safety`
+ */
+static void
+xrdp_reload(int sig)
+{
+    if (g_listen != 0 && g_listen->reload_event != 0)
+    {
+        g_set_wait_obj(g_listen->reload_event);
+    }
+}
+
 /*****************************************************************************/
 /**
  * @brief looks for a case-insensitive match of a string in a list
@@ -547,7 +561,7 @@ main(int argc, char **argv)
     g_signal_pipe(xrdp_sig_no_op);          /* SIGPIPE */
     g_signal_terminate(xrdp_shutdown);      /* SIGTERM */
     g_signal_child_stop(xrdp_child);        /* SIGCHLD */
-    g_signal_hang_up(xrdp_sig_no_op);       /* SIGHUP */
+    g_signal_hang_up(xrdp_reload);          /* SIGHUP */
     g_set_sync_mutex(tc_mutex_create());
     g_set_sync1_mutex(tc_mutex_create());
     pid = g_getpid();
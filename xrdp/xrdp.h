@@ -95,6 +95,9 @@ int
 xrdp_cache_add_char(struct xrdp_cache *self,
                     struct xrdp_font_char *font_item);
 int
+xrdp_cache_add_glyph_frag(struct xrdp_cache *self, int font,
+                          const char *data, int data_len, int *found);
+int
 xrdp_cache_add_pointer(struct xrdp_cache *self,
                        struct xrdp_pointer_item *pointer_item);
 int
@@ -111,6 +114,23 @@ int
 xrdp_cache_remove_os_bitmap(struct xrdp_cache *self, int rdpindex);
 struct xrdp_os_bitmap_item *
 xrdp_cache_get_os_bitmap(struct xrdp_cache *self, int rdpindex);
+int
+xrdp_cache_use_os_bitmap(struct xrdp_cache *self, int rdpindex, int keep);
+int
+xrdp_cache_os_bitmap_set_lost(struct xrdp_cache *self, int rdpindex,
+                              struct xrdp_rect *rect);
+int
+xrdp_cache_os_bitmap_drawn(struct xrdp_cache *self, int rdpindex,
+                           struct xrdp_rect *rect);
+struct xrdp_region *
+xrdp_cache_os_bitmap_get_lost(struct xrdp_cache *self, int rdpindex,
+                              struct xrdp_rect *rect, int dx, int dy);
+int
+xrdp_cache_os_bitmap_add_lost(struct xrdp_cache *self, int rdpindex,
+                              struct xrdp_region *region);
+int
+xrdp_cache_os_bitmap_take_lost(struct xrdp_cache *self, int rdpindex,
+                               struct xrdp_rect *rect);
 
 /* xrdp_wm.c */
 struct xrdp_wm *
@@ -171,9 +191,6 @@ int
 xrdp_wm_log_msg(struct xrdp_wm *self, enum logLevels loglevel,
                 const char *fmt, ...) printflike(3, 4);
 int
-xrdp_wm_get_wait_objs(struct xrdp_wm *self, tbus *robjs, int *rc,
-                      tbus *wobjs, int *wc, int *timeout);
-int
 xrdp_wm_check_wait_objs(struct xrdp_wm *self);
 const char *
 xrdp_wm_login_state_to_str(enum wm_login_state login_state);
@@ -459,6 +476,8 @@ xrdp_mm_drdynvc_up(struct xrdp_mm *self);
 int
 xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
                         int left, int top, int right, int bottom);
+int
+xrdp_mm_network_update(struct xrdp_mm *self);
 struct xrdp_mm *
 xrdp_mm_create(struct xrdp_wm *owner);
 void
@@ -469,10 +488,6 @@ int
 xrdp_mm_process_channel_data(struct xrdp_mm *self, tbus param1, tbus param2,
                              tbus param3, tbus param4);
 int
-xrdp_mm_get_wait_objs(struct xrdp_mm *self,
-                      tbus *read_objs, int *rcount,
-                      tbus *write_objs, int *wcount, int *timeout);
-int
 xrdp_mm_check_chan(struct xrdp_mm *self);
 int
 xrdp_mm_check_wait_objs(struct xrdp_mm *self);
@@ -111,6 +111,11 @@ xrdp_cache_create(struct xrdp_wm *owner,
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
+    self->glyph_frag_entries = MIN(XRDP_MAX_GLYPH_FRAGS,
+                                   client_info->glyph_frag_cache_entries);
+    self->glyph_frag_size = client_info->glyph_frag_cache_size;
+    self->offscreen_cache_size = client_info->offscreen_cache_size;
+    self->offscreen_cache_entries = client_info->offscreen_cache_entries;
     self->xrdp_os_del_list = list_create();
     xrdp_cache_reset_lru(self);
     xrdp_cache_reset_crc(self);
@@ -153,6 +158,7 @@ clear_all_cached_items(struct xrdp_cache *self)
     for (i = 0; i < 2000; i++)
     {
         xrdp_bitmap_delete(self->os_bitmap_items[i].bitmap);
+        xrdp_region_delete(self->os_bitmap_items[i].lost);
     }
 
     list_delete(self->xrdp_os_del_list);
@@ -203,6 +209,11 @@ xrdp_cache_reset(struct xrdp_cache *self,
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
+    self->glyph_frag_entries = MIN(XRDP_MAX_GLYPH_FRAGS,
+                                   client_info->glyph_frag_cache_entries);
+    self->glyph_frag_size = client_info->glyph_frag_cache_size;
+    self->offscreen_cache_size = client_info->offscreen_cache_size;
+    self->offscreen_cache_entries = client_info->offscreen_cache_entries;
     xrdp_cache_reset_lru(self);
     xrdp_cache_reset_crc(self);
     return 0;
@@ -593,6 +604,61 @@ xrdp_cache_add_char(struct xrdp_cache *self,
     return MAKELONG(c, f);
 }
 
+/*****************************************************************************/
+/* look for a run of GlyphIndex order data in the fragment cache, if it is
+   not there add it in place of the oldest entry
+   only call this when the data is about to be sent, with a
+   GLYPH_FRAGMENT_ADD after it if found is not set
+   returns the fragment cache index or -1 if data can not be a fragment */
+int
+xrdp_cache_add_glyph_frag(struct xrdp_cache *self, int font,
+                          const char *data, int data_len, int *found)
+{
+    int index;
+    int oldest;
+    int oldest_index;
+    struct xrdp_glyph_frag_item *item;
+
+    *found = 0;
+    /* GLYPH_FRAGMENT_ADD is 3 bytes and cbData is 1 byte, a single glyph
+       is no bigger than a GLYPH_FRAGMENT_USE */
+    if (data_len < 4 || data_len > 255 - 3 ||
+            data_len > self->glyph_frag_size)
+    {
+        return -1;
+    }
+    self->glyph_frag_stamp++;
+    oldest = 0x7fffffff;
+    oldest_index = -1;
+    for (index = 0; index < self->glyph_frag_entries; index++)
+    {
+        item = self->glyph_frag_items + index;
+        if (item->size == data_len && item->font == font &&
+                g_memcmp(item->data, data, data_len) == 0)
+        {
+            item->stamp = self->glyph_frag_stamp;
+            *found = 1;
+            return index;
+        }
+        if (item->stamp < oldest)
+        {
+            oldest = item->stamp;
+            oldest_index = index;
+        }
+    }
+    if (oldest_index < 0)
+    {
+        return -1;
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "adding glyph fragment at %d", oldest_index);
+    item = self->glyph_frag_items + oldest_index;
+    item->stamp = self->glyph_frag_stamp;
+    item->font = font;
+    item->size = data_len;
+    g_memcpy(item->data, data, data_len);
+    return oldest_index;
+}
+
 /*****************************************************************************/
 /* added the pointer to the cache and send it to client, it also sets the
    client if it finds it
@@ -769,6 +835,11 @@ xrdp_cache_add_os_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     }
 
     bi = self->os_bitmap_items + rdpindex;
+    if (bi->bitmap != 0)
+    {
+        /* replaced without being deleted first */
+        xrdp_cache_remove_os_bitmap(self, rdpindex);
+    }
     bi->bitmap = bitmap;
     return 0;
 }
@@ -796,9 +867,13 @@ xrdp_cache_remove_os_bitmap(struct xrdp_cache *self, int rdpindex)
         {
             list_add_item(self->xrdp_os_del_list, rdpindex);
         }
+
+        self->os_bitmap_bytes -= bi->client_bytes;
+        self->os_bitmap_count--;
     }
 
     xrdp_bitmap_delete(bi->bitmap);
+    xrdp_region_delete(bi->lost);
     g_memset(bi, 0, sizeof(struct xrdp_os_bitmap_item));
     return 0;
 }
@@ -817,3 +892,257 @@ xrdp_cache_get_os_bitmap(struct xrdp_cache *self, int rdpindex)
     bi = self->os_bitmap_items + rdpindex;
     return bi;
 }
+
+/*****************************************************************************/
+/* rect on surface rdpindex no longer has its content on the client
+   returns error */
+int
+xrdp_cache_os_bitmap_set_lost(struct xrdp_cache *self, int rdpindex,
+                              struct xrdp_rect *rect)
+{
+    struct xrdp_os_bitmap_item *bi;
+
+    bi = xrdp_cache_get_os_bitmap(self, rdpindex);
+    if (bi == 0 || bi->bitmap == 0)
+    {
+        return 1;
+    }
+    if (bi->lost == 0)
+    {
+        bi->lost = xrdp_region_create(self->wm);
+    }
+    return xrdp_region_add_rect(bi->lost, rect);
+}
+
+/*****************************************************************************/
+/* rect on surface rdpindex has been drawn over on the client, once all of
+   a lost surface has been, the surface is whole again
+   returns error */
+int
+xrdp_cache_os_bitmap_drawn(struct xrdp_cache *self, int rdpindex,
+                           struct xrdp_rect *rect)
+{
+    struct xrdp_os_bitmap_item *bi;
+    struct xrdp_rect lost_rect;
+
+    bi = xrdp_cache_get_os_bitmap(self, rdpindex);
+    if (bi == 0 || bi->lost == 0)
+    {
+        return 0;
+    }
+    if (xrdp_region_subtract_rect(bi->lost, rect) != 0)
+    {
+        return 1;
+    }
+    if (xrdp_region_get_rect(bi->lost, 0, &lost_rect) != 0)
+    {
+        xrdp_region_delete(bi->lost);
+        bi->lost = 0;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns the lost part of rect on surface rdpindex, moved so rect starts
+   at dx, dy, or 0 if none of it was lost
+   free with xrdp_region_delete() */
+struct xrdp_region *
+xrdp_cache_os_bitmap_get_lost(struct xrdp_cache *self, int rdpindex,
+                              struct xrdp_rect *rect, int dx, int dy)
+{
+    struct xrdp_os_bitmap_item *bi;
+    struct xrdp_region *region;
+    struct xrdp_rect lost_rect;
+    struct xrdp_rect part;
+    int index;
+
+    bi = xrdp_cache_get_os_bitmap(self, rdpindex);
+    if (bi == 0 || bi->lost == 0)
+    {
+        return 0;
+    }
+    region = 0;
+    index = 0;
+    while (xrdp_region_get_rect(bi->lost, index, &lost_rect) == 0)
+    {
+        if (rect_intersect(&lost_rect, rect, &part))
+        {
+            if (region == 0)
+            {
+                region = xrdp_region_create(self->wm);
+            }
+            part.left += dx - rect->left;
+            part.top += dy - rect->top;
+            part.right += dx - rect->left;
+            part.bottom += dy - rect->top;
+            xrdp_region_add_rect(region, &part);
+        }
+        index++;
+    }
+    return region;
+}
+
+/*****************************************************************************/
+/* region on surface rdpindex no longer has its content on the client,
+   region can be 0
+   returns error */
+int
+xrdp_cache_os_bitmap_add_lost(struct xrdp_cache *self, int rdpindex,
+                              struct xrdp_region *region)
+{
+    struct xrdp_rect rect;
+    int index;
+
+    if (region == 0)
+    {
+        return 0;
+    }
+    index = 0;
+    while (xrdp_region_get_rect(region, index, &rect) == 0)
+    {
+        if (xrdp_cache_os_bitmap_set_lost(self, rdpindex, &rect) != 0)
+        {
+            return 1;
+        }
+        index++;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if any of rect on surface rdpindex was lost, that
+   part is then given up on so the module is only asked to redraw it once,
+   a module which redraws from the same surface can not loop */
+int
+xrdp_cache_os_bitmap_take_lost(struct xrdp_cache *self, int rdpindex,
+                               struct xrdp_rect *rect)
+{
+    struct xrdp_region *region;
+
+    region = xrdp_cache_os_bitmap_get_lost(self, rdpindex, rect, 0, 0);
+    if (region == 0)
+    {
+        return 0;
+    }
+    xrdp_region_delete(region);
+    xrdp_cache_os_bitmap_drawn(self, rdpindex, rect);
+    return 1;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if there is room on the client for another
+   offscreen surface of bytes size */
+static int
+xrdp_cache_os_bitmap_fits(struct xrdp_cache *self, int bytes)
+{
+    if (self->offscreen_cache_size > 0 &&
+            self->os_bitmap_bytes + bytes > self->offscreen_cache_size)
+    {
+        return 0;
+    }
+    if (self->offscreen_cache_entries > 0 &&
+            self->os_bitmap_count + 1 > self->offscreen_cache_entries)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* delete the least recently used surface on the client, other than
+   rdpindex and keep, it stays on the server and is made again when
+   next used
+   returns error, 1 if there is nothing to delete */
+static int
+xrdp_cache_evict_os_bitmap(struct xrdp_cache *self, int rdpindex, int keep)
+{
+    struct xrdp_os_bitmap_item *bi;
+    struct xrdp_rect rect;
+    int oldest;
+    int oldest_index;
+    int index;
+
+    oldest = 0x7fffffff;
+    oldest_index = -1;
+    for (index = 0; index < 2000; index++)
+    {
+        bi = self->os_bitmap_items + index;
+        if (bi->bitmap == 0 || bi->bitmap->tab_stop == 0 ||
+                index == rdpindex || index == keep)
+        {
+            continue;
+        }
+        if (bi->stamp < oldest)
+        {
+            oldest = bi->stamp;
+            oldest_index = index;
+        }
+    }
+    if (oldest_index < 0)
+    {
+        return 1;
+    }
+    LOG(LOG_LEVEL_DEBUG, "xrdp_cache_evict_os_bitmap: deleting surface %d "
+        "from the client to make room", oldest_index);
+    bi = self->os_bitmap_items + oldest_index;
+    if (list_index_of(self->xrdp_os_del_list, oldest_index) == -1)
+    {
+        list_add_item(self->xrdp_os_del_list, oldest_index);
+    }
+    bi->bitmap->tab_stop = 0; /* tab_stop is hack */
+    MAKERECT(rect, 0, 0, bi->bitmap->width, bi->bitmap->height);
+    xrdp_cache_os_bitmap_set_lost(self, oldest_index, &rect);
+    self->os_bitmap_bytes -= bi->client_bytes;
+    self->os_bitmap_count--;
+    bi->client_bytes = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+/* mark offscreen surface rdpindex as used and create it on the client if
+   it is not there, least recently used surfaces other than keep are
+   deleted from the client first if it would not fit
+   keep can be -1
+   returns error */
+int
+xrdp_cache_use_os_bitmap(struct xrdp_cache *self, int rdpindex, int keep)
+{
+    struct xrdp_os_bitmap_item *bi;
+    struct xrdp_bitmap *bitmap;
+    int bytes;
+    int index;
+
+    bi = xrdp_cache_get_os_bitmap(self, rdpindex);
+    if (bi == 0 || bi->bitmap == 0)
+    {
+        return 1;
+    }
+    self->os_bitmap_stamp++;
+    bi->stamp = self->os_bitmap_stamp;
+    bitmap = bi->bitmap;
+    if (bitmap->tab_stop) /* tab_stop is hack */
+    {
+        return 0;
+    }
+    bytes = bitmap->width * bitmap->height * ((bitmap->bpp + 7) / 8);
+    while (!xrdp_cache_os_bitmap_fits(self, bytes))
+    {
+        if (xrdp_cache_evict_os_bitmap(self, rdpindex, keep) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_cache_use_os_bitmap: surface %d "
+                "does not fit in the client offscreen cache", rdpindex);
+            break;
+        }
+    }
+    index = list_index_of(self->xrdp_os_del_list, rdpindex);
+    list_remove_item(self->xrdp_os_del_list, index);
+    libxrdp_orders_send_create_os_surface(self->session, rdpindex,
+                                          bitmap->width, bitmap->height,
+                                          self->xrdp_os_del_list);
+    list_clear(self->xrdp_os_del_list);
+    bitmap->tab_stop = 1;
+    bi->client_bytes = bytes;
+    self->os_bitmap_bytes += bytes;
+    self->os_bitmap_count++;
+    return 0;
+}
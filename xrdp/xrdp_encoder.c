@@ -147,9 +147,11 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     g_snprintf(buf, 1024, "xrdp_%8.8x_encoder_term", pid);
     self->xrdp_encoder_term = g_create_wait_obj(buf);
     self->max_compressed_bytes = client_info->max_fastpath_frag_bytes & ~15;
-    self->frames_in_flight = client_info->max_unacknowledged_frame_count;
+    self->frames_in_flight_max = client_info->max_unacknowledged_frame_count;
     /* make sure frames_in_flight is at least 1 */
-    self->frames_in_flight = MAX(self->frames_in_flight, 1);
+    self->frames_in_flight_max = MAX(self->frames_in_flight_max, 1);
+    self->frames_in_flight = self->frames_in_flight_max;
+    xrdp_encoder_network_update(self);
 
     /* create thread to process messages */
     tc_thread_create(proc_enc_msg, self);
@@ -157,6 +159,117 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     return self;
 }
 
+/*****************************************************************************/
+/* Adjusts to the network measured by libxrdp, if it has been */
+void
+xrdp_encoder_network_update(struct xrdp_encoder *self)
+{
+    struct xrdp_client_info *client_info;
+    int fif;
+
+    client_info = self->mm->wm->client_info;
+    if (client_info->network_avg_rtt > 0 && self->ack_base_rtt == 0)
+    {
+        /* until frame acks can be timed, enough frames in flight to keep
+           about 30 a second going over the round trip */
+        fif = client_info->network_avg_rtt * 30 / 1000 + 1;
+        self->frames_in_flight = MIN(fif, self->frames_in_flight_max);
+    }
+    if (client_info->network_bandwidth > 0 &&
+            self->process_enc == process_enc_jpg)
+    {
+        /* smaller frames on slower links */
+        self->codec_quality = client_info->jpeg_prop[0];
+        if (client_info->network_bandwidth < 2000)
+        {
+            self->codec_quality = MIN(self->codec_quality, 50);
+        }
+        else if (client_info->network_bandwidth < 10000)
+        {
+            self->codec_quality = MIN(self->codec_quality, 75);
+        }
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_encoder_network_update: "
+              "frames_in_flight %d codec_quality %d",
+              self->frames_in_flight, self->codec_quality);
+}
+
+/*****************************************************************************/
+/* Remembers when the last part of a frame went to the client. This is when
+   it is handed to trans, so time it spends corked or queued there counts
+   in the round trip, as it is a queue like any other on the way */
+void
+xrdp_encoder_frame_sent(struct xrdp_encoder *self, int frame_id)
+{
+    int index;
+
+    index = frame_id & (XRDP_ENC_ACK_SAMPLES - 1);
+    self->frame_sent_id[index] = frame_id;
+    self->frame_sent_usec[index] = g_time_usec();
+}
+
+/*****************************************************************************/
+/* Sizes the frames in flight window from frame ack round trips, much like
+   TCP Vegas sizes its congestion window.  Round trips above the lowest seen
+   are frames queued somewhere on the way, as is any queue_depth the client
+   reports.  The window grows while nothing queues and shrinks once more
+   than a few frames do, at most once per window of acks.  Only the last
+   XRDP_ENC_ACK_SAMPLES frames sent can be timed, the client may allow more
+   in flight than that, so a window is never more acks than that either. */
+void
+xrdp_encoder_frame_acked(struct xrdp_encoder *self, int frame_id,
+                         int queue_depth)
+{
+    int index;
+    int rtt;
+    int queued;
+
+    index = frame_id & (XRDP_ENC_ACK_SAMPLES - 1);
+    if (self->frame_sent_id[index] != frame_id ||
+            self->frame_sent_usec[index] == 0)
+    {
+        return;
+    }
+    rtt = (int) (g_time_usec() - self->frame_sent_usec[index]);
+    self->frame_sent_usec[index] = 0;
+    rtt = MAX(rtt, 1);
+    if (self->ack_base_rtt == 0 || rtt < self->ack_base_rtt)
+    {
+        self->ack_base_rtt = rtt;
+    }
+    else
+    {
+        /* drift up slowly, in case the route got longer */
+        self->ack_base_rtt += (rtt - self->ack_base_rtt) / 256;
+    }
+    if (self->ack_count == 0 || rtt < self->ack_min_rtt)
+    {
+        self->ack_min_rtt = rtt;
+    }
+    self->ack_count++;
+    if (self->ack_count < MIN(self->frames_in_flight, XRDP_ENC_ACK_SAMPLES))
+    {
+        return;
+    }
+    queued = self->frames_in_flight *
+             (self->ack_min_rtt - self->ack_base_rtt) / self->ack_min_rtt;
+    queued += queue_depth;
+    if (queued < 1)
+    {
+        self->frames_in_flight = MIN(self->frames_in_flight + 1,
+                                     self->frames_in_flight_max);
+    }
+    else if (queued > 3)
+    {
+        self->frames_in_flight = MAX(self->frames_in_flight - 1, 1);
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_encoder_frame_acked: base rtt %d "
+              "min rtt %d queued %d frames_in_flight %d",
+              self->ack_base_rtt, self->ack_min_rtt, queued,
+              self->frames_in_flight);
+    self->ack_count = 0;
+}
+
 /*****************************************************************************/
 void
 xrdp_encoder_delete(struct xrdp_encoder *self)
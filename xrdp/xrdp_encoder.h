@@ -7,6 +7,10 @@ struct fifo;
 
 struct xrdp_enc_data;
 
+/* frames remembered for timing their acks, a power of 2, with more than
+   this in flight the acks of the oldest are not timed */
+#define XRDP_ENC_ACK_SAMPLES 16
+
 /* for codec mode operations */
 struct xrdp_encoder
 {
@@ -27,6 +31,13 @@ struct xrdp_encoder
     int frame_id_server; /* last frame id received from Xorg */
     int frame_id_server_sent;
     int frames_in_flight;
+    int processed_held; /* fifo_processed left while the client is slow */
+    int frames_in_flight_max; /* what the client allows */
+    int frame_sent_id[XRDP_ENC_ACK_SAMPLES];
+    tui64 frame_sent_usec[XRDP_ENC_ACK_SAMPLES];
+    int ack_base_rtt; /* usec, lowest frame ack round trip seen */
+    int ack_min_rtt; /* usec, lowest in the current window */
+    int ack_count; /* acks timed in the current window */
 };
 
 /* used when scheduling tasks in xrdp_encoder.c */
@@ -69,6 +80,13 @@ struct xrdp_encoder *
 xrdp_encoder_create(struct xrdp_mm *mm);
 void
 xrdp_encoder_delete(struct xrdp_encoder *self);
+void
+xrdp_encoder_network_update(struct xrdp_encoder *self);
+void
+xrdp_encoder_frame_sent(struct xrdp_encoder *self, int frame_id);
+void
+xrdp_encoder_frame_acked(struct xrdp_encoder *self, int frame_id,
+                         int queue_depth);
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg);
 
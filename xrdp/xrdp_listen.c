@@ -58,9 +58,12 @@ struct xrdp_listen *
 xrdp_listen_create(void)
 {
     struct xrdp_listen *self;
+    char text[256];
 
     self = (struct xrdp_listen *)g_malloc(sizeof(struct xrdp_listen), 1);
     xrdp_listen_create_pro_done(self);
+    g_snprintf(text, 255, "xrdp_%8.8x_listen_reload_event", g_getpid());
+    self->reload_event = g_create_wait_obj(text);
     self->trans_list = list_create();
     self->process_list = list_create();
     self->fork_list = list_create();
@@ -100,6 +103,7 @@ xrdp_listen_delete(struct xrdp_listen *self)
     }
 
     g_delete_wait_obj(self->pro_done_event);
+    g_delete_wait_obj(self->reload_event);
     list_delete(self->process_list);
     list_delete(self->fork_list);
     g_free(self);
@@ -226,6 +230,24 @@ xrdp_listen_get_startup_params(struct xrdp_listen *self)
                         startup_params->tcp_recv_buffer_bytes = g_atoi(val);
                     }
 
+                    if (g_strcasecmp(val, "tcp_notsent_lowat") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        startup_params->tcp_notsent_lowat = g_atoi(val);
+                    }
+
+                    if (g_strcasecmp(val, "tcp_max_pacing_rate") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        startup_params->tcp_max_pacing_rate = g_atoi(val);
+                    }
+
+                    if (g_strcasecmp(val, "tcp_zerocopy") == 0)
+                    {
+                        val = (char *)list_get_item(values, index);
+                        startup_params->tcp_zerocopy = g_text2bool(val);
+                    }
+
                     if (g_strcasecmp(val, "use_vsock") == 0)
                     {
                         val = (char *)list_get_item(values, index);
@@ -759,6 +781,27 @@ xrdp_listen_process_startup_params(struct xrdp_listen *self)
                     }
                 }
             }
+            if (startup_params->tcp_notsent_lowat > 0)
+            {
+                bytes = startup_params->tcp_notsent_lowat;
+                LOG(LOG_LEVEL_INFO, "setting unsent data low water mark to "
+                    "%d bytes", bytes);
+                if (g_tcp_set_notsent_lowat(ltrans->sck, bytes) != 0)
+                {
+                    LOG(LOG_LEVEL_WARNING, "error setting tcp_notsent_lowat");
+                }
+            }
+            if (startup_params->tcp_max_pacing_rate > 0)
+            {
+                bytes = startup_params->tcp_max_pacing_rate;
+                LOG(LOG_LEVEL_INFO, "setting maximum pacing rate to %d "
+                    "bytes per second", bytes);
+                if (g_sck_set_max_pacing_rate(ltrans->sck, bytes) != 0)
+                {
+                    LOG(LOG_LEVEL_WARNING, "error setting "
+                        "tcp_max_pacing_rate");
+                }
+            }
         }
         ltrans->trans_conn_in = xrdp_listen_conn_in;
         ltrans->callback_data = self;
@@ -787,6 +830,9 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
         /* close, don't delete this */
         g_close_wait_obj(self->pro_done_event);
         xrdp_listen_create_pro_done(self);
+        /* SIGHUP is for the listener only */
+        g_close_wait_obj(self->reload_event);
+        self->reload_event = 0;
         /* delete listener, child need not listen */
         for (index = 0; index < self->trans_list->count; index++)
         {
@@ -885,6 +931,7 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
     intptr_t sigchld_obj;
     intptr_t sync_obj;
     intptr_t done_obj;
+    intptr_t reload_obj;
     struct trans *ltrans;
 
     self->status = 1;
@@ -900,10 +947,14 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         self->status = -1;
         return 1;
     }
+    /* connections share one TLS context, so the certificate is loaded
+       once and clients can resume sessions */
+    libxrdp_load_tls_context(self->startup_params->xrdp_ini);
     term_obj = g_get_term(); /*Global termination event */
     sigchld_obj = g_get_sigchld();
     sync_obj = g_get_sync_event();
     done_obj = self->pro_done_event;
+    reload_obj = self->reload_event;
     cont = 1;
     while (cont)
     {
@@ -913,6 +964,7 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         robjs[robjs_count++] = sigchld_obj;
         robjs[robjs_count++] = sync_obj;
         robjs[robjs_count++] = done_obj;
+        robjs[robjs_count++] = reload_obj;
         timeout = -1;
 
         for (index = 0; index < self->trans_list->count; index++)
@@ -965,6 +1017,14 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
             xrdp_listen_delete_done_pro(self);
         }
 
+        if (g_is_wait_obj_set(reload_obj)) /* SIGHUP caught */
+        {
+            g_reset_wait_obj(reload_obj);
+            LOG(LOG_LEVEL_INFO, "Received SIGHUP, reloading the TLS "
+                "certificate");
+            libxrdp_load_tls_context(self->startup_params->xrdp_ini);
+        }
+
         /* Run the callback when accept() returns a new socket*/
         for (index = 0; index < self->trans_list->count; index++)
         {
@@ -35,6 +35,7 @@
 #include "xrdp_encoder.h"
 #include "xrdp_sockets.h"
 #include "xrdp_egfx.h"
+#include "reactor.h"
 #include <limits.h>
 
 
@@ -44,6 +45,74 @@ xrdp_mm_chansrv_connect(struct xrdp_mm *self, const char *port);
 static void
 xrdp_mm_connect_sm(struct xrdp_mm *self);
 
+/*****************************************************************************/
+/* the session loop's reactor, each wait object below is in it for as
+   long as the object exists */
+static struct reactor *
+xrdp_mm_get_reactor(struct xrdp_mm *self)
+{
+    return self->wm->pro_layer->reactor;
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_add_wait_obj(struct xrdp_mm *self, tbus obj)
+{
+    if (xrdp_mm_get_reactor(self) != NULL)
+    {
+        reactor_add(xrdp_mm_get_reactor(self), obj, REACTOR_READ);
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_del_wait_obj(struct xrdp_mm *self, tbus obj)
+{
+    if (xrdp_mm_get_reactor(self) != NULL)
+    {
+        reactor_del(xrdp_mm_get_reactor(self), obj);
+    }
+}
+
+/*****************************************************************************/
+/* see xrdp_mm_update_mod_objs() */
+static void
+xrdp_mm_remove_mod_objs(struct xrdp_mm *self)
+{
+    int index;
+
+    for (index = 0; index < self->mod_objs_count; index++)
+    {
+        xrdp_mm_del_wait_obj(self, self->mod_objs[index]);
+    }
+    self->mod_objs_count = 0;
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_encoder_create(struct xrdp_mm *self)
+{
+    self->encoder = xrdp_encoder_create(self);
+    if (self->encoder != NULL)
+    {
+        xrdp_mm_add_wait_obj(self,
+                             self->encoder->xrdp_encoder_event_processed);
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_encoder_delete(struct xrdp_mm *self)
+{
+    if (self->encoder != NULL)
+    {
+        xrdp_mm_del_wait_obj(self,
+                             self->encoder->xrdp_encoder_event_processed);
+        xrdp_encoder_delete(self->encoder);
+        self->encoder = NULL;
+    }
+}
+
 /*****************************************************************************/
 struct xrdp_mm *
 xrdp_mm_create(struct xrdp_wm *owner)
@@ -65,6 +134,7 @@ xrdp_mm_create(struct xrdp_wm *owner)
     /* setup wait objects for signalling */
     g_snprintf(buf, sizeof(buf), "xrdp_%8.8x_resize_ready", pid);
     self->resize_ready = g_create_wait_obj(buf);
+    xrdp_mm_add_wait_obj(self, self->resize_ready);
     self->resize_data = NULL;
 
     LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_mm_create: bpp %d mcs_connection_type %d "
@@ -77,7 +147,7 @@ xrdp_mm_create(struct xrdp_wm *owner)
               self->wm->client_info->rfx_codec_id,
               self->wm->client_info->h264_codec_id);
 
-    self->encoder = xrdp_encoder_create(self);
+    xrdp_mm_encoder_create(self);
 
     return self;
 }
@@ -111,6 +181,8 @@ xrdp_mm_module_cleanup(struct xrdp_mm *self)
 
     if (self->mod != 0)
     {
+        /* the module's objects are about to be closed */
+        xrdp_mm_remove_mod_objs(self);
         if (self->mod_exit != 0)
         {
             /* let the module cleanup */
@@ -153,7 +225,7 @@ xrdp_mm_delete(struct xrdp_mm *self)
     xrdp_mm_module_cleanup(self);
 
     /* shutdown thread */
-    xrdp_encoder_delete(self->encoder);
+    xrdp_mm_encoder_delete(self);
 
     trans_delete(self->sesman_trans);
     self->sesman_trans = 0;
@@ -161,6 +233,7 @@ xrdp_mm_delete(struct xrdp_mm *self)
     list_delete(self->login_values);
     list_delete(self->resize_queue);
     g_free(self->resize_data);
+    xrdp_mm_del_wait_obj(self, self->resize_ready);
     g_delete_wait_obj(self->resize_ready);
     g_free(self);
 }
@@ -425,6 +498,7 @@ xrdp_mm_setup_mod1(struct xrdp_mm *self)
             self->mod->server_set_pointer_large = server_set_pointer_large;
             self->mod->server_paint_rects_ex = server_paint_rects_ex;
             self->mod->si = &(self->wm->session->si);
+            self->mod->reactor = xrdp_mm_get_reactor(self);
         }
     }
 
@@ -1312,11 +1386,7 @@ process_display_control_monitor_layout_data(struct xrdp_wm *wm)
     {
         case WMRZ_ENCODER_DELETE:
             // Disable the encoder until the resize is complete.
-            if (mm->encoder != NULL)
-            {
-                xrdp_encoder_delete(mm->encoder);
-                mm->encoder = NULL;
-            }
+            xrdp_mm_encoder_delete(mm);
             advance_resize_state_machine(mm, WMRZ_SERVER_MONITOR_RESIZE);
             break;
         case WMRZ_SERVER_MONITOR_RESIZE:
@@ -1396,7 +1466,7 @@ process_display_control_monitor_layout_data(struct xrdp_wm *wm)
         case WMRZ_ENCODER_CREATE:
             if (mm->encoder == NULL)
             {
-                mm->encoder = xrdp_encoder_create(mm);
+                xrdp_mm_encoder_create(mm);
             }
             advance_resize_state_machine(mm, WMRZ_SERVER_INVALIDATE);
             break;
@@ -1610,6 +1680,17 @@ xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
     return 0;
 }
 
+/******************************************************************************/
+int
+xrdp_mm_network_update(struct xrdp_mm *self)
+{
+    if (self->encoder != NULL)
+    {
+        xrdp_encoder_network_update(self->encoder);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* open response from client going to channel server */
 static int
@@ -2423,8 +2504,13 @@ xrdp_mm_sesman_connect(struct xrdp_mm *self)
 {
     trans_delete(self->sesman_trans);
     self->sesman_trans = xrdp_mm_scp_connect(self);
+    if (self->sesman_trans == NULL)
+    {
+        return 1;
+    }
+    trans_set_reactor(self->sesman_trans, xrdp_mm_get_reactor(self));
 
-    return (self->sesman_trans == NULL); /* 0 for success */
+    return 0;
 }
 
 /*****************************************************************************/
@@ -2450,6 +2536,8 @@ xrdp_mm_chansrv_connect(struct xrdp_mm *self, const char *port)
     self->chan_trans->callback_data = self;
     self->chan_trans->no_stream_init_on_data_in = 1;
     self->chan_trans->extra_flags = 0;
+    trans_set_read_ahead(self->chan_trans, TRANS_READ_AHEAD_BYTES);
+    trans_set_reactor(self->chan_trans, xrdp_mm_get_reactor(self));
 
     /* try to connect for up to 10 seconds */
     trans_connect(self->chan_trans, NULL, port, 10 * 1000);
@@ -2780,52 +2868,119 @@ xrdp_mm_connect_sm(struct xrdp_mm *self)
 
 
 /*****************************************************************************/
-int
-xrdp_mm_get_wait_objs(struct xrdp_mm *self,
-                      tbus *read_objs, int *rcount,
-                      tbus *write_objs, int *wcount, int *timeout)
+/* returns the events obj is in objs for, 0 if it isn't there */
+static int
+xrdp_mm_find_mod_obj(const tbus *objs, const int *events, int count,
+                     tbus obj)
 {
-    int rv = 0;
+    int index;
 
-    if (self == 0)
+    for (index = 0; index < count; index++)
     {
-        return 0;
+        if (objs[index] == obj)
+        {
+            return events[index];
+        }
     }
+    return 0;
+}
 
-    rv = 0;
+/*****************************************************************************/
+/* adds a list from mod_get_wait_objs() to objs, merging duplicates */
+static void
+xrdp_mm_merge_mod_objs(tbus *objs, int *events, int *count,
+                       const tbus *list, int list_count, int list_events)
+{
+    int index;
+    int found;
 
-    if (self->sesman_trans != 0 &&
-            self->sesman_trans->status == TRANS_STATUS_UP)
+    for (index = 0; index < list_count; index++)
     {
-        trans_get_wait_objs(self->sesman_trans, read_objs, rcount);
+        for (found = 0; found < *count; found++)
+        {
+            if (objs[found] == list[index])
+            {
+                break;
+            }
+        }
+        if (found < *count)
+        {
+            events[found] |= list_events;
+        }
+        else if (*count < XRDP_MM_MOD_OBJS_MAX)
+        {
+            objs[*count] = list[index];
+            events[*count] = list_events;
+            (*count)++;
+        }
     }
+}
 
-    if ((self->chan_trans != 0) && self->chan_trans->status == TRANS_STATUS_UP)
+/*****************************************************************************/
+/* Modules with mod_get_wait_objs() don't put their objects in the reactor
+ * themselves. Each time round the session loop this asks for them, and
+ * adds, changes or removes only the ones which differ from last time.
+ */
+static void
+xrdp_mm_update_mod_objs(struct xrdp_mm *self)
+{
+    tbus robjs[XRDP_MM_MOD_OBJS_MAX];
+    tbus wobjs[XRDP_MM_MOD_OBJS_MAX];
+    tbus objs[XRDP_MM_MOD_OBJS_MAX];
+    int events[XRDP_MM_MOD_OBJS_MAX];
+    struct reactor *reactor;
+    int rcount;
+    int wcount;
+    int count;
+    int timeout;
+    int index;
+    int old_events;
+
+    reactor = xrdp_mm_get_reactor(self);
+    if (reactor == NULL)
     {
-        trans_get_wait_objs_rw(self->chan_trans, read_objs, rcount,
-                               write_objs, wcount, timeout);
+        return;
     }
-
-    if (self->mod != 0)
+    rcount = 0;
+    wcount = 0;
+    timeout = -1;
+    if (self->mod != NULL && self->mod->mod_get_wait_objs != NULL)
     {
-        if (self->mod->mod_get_wait_objs != 0)
-        {
-            rv = self->mod->mod_get_wait_objs(self->mod, read_objs, rcount,
-                                              write_objs, wcount, timeout);
-        }
+        self->mod->mod_get_wait_objs(self->mod, robjs, &rcount,
+                                     wobjs, &wcount, &timeout);
     }
-
-    if (self->encoder != 0)
+    count = 0;
+    xrdp_mm_merge_mod_objs(objs, events, &count, robjs, MIN(rcount,
+                           XRDP_MM_MOD_OBJS_MAX), REACTOR_READ);
+    xrdp_mm_merge_mod_objs(objs, events, &count, wobjs, MIN(wcount,
+                           XRDP_MM_MOD_OBJS_MAX), REACTOR_WRITE);
+    /* gone since last time */
+    for (index = 0; index < self->mod_objs_count; index++)
     {
-        read_objs[(*rcount)++] = self->encoder->xrdp_encoder_event_processed;
+        if (xrdp_mm_find_mod_obj(objs, events, count,
+                                 self->mod_objs[index]) == 0)
+        {
+            reactor_del(reactor, self->mod_objs[index]);
+        }
     }
-
-    if (self->resize_queue != 0)
+    /* new, or waited on for something else */
+    for (index = 0; index < count; index++)
     {
-        read_objs[(*rcount)++] = self->resize_ready;
+        old_events = xrdp_mm_find_mod_obj(self->mod_objs,
+                                          self->mod_objs_events,
+                                          self->mod_objs_count, objs[index]);
+        if (old_events == 0)
+        {
+            reactor_add(reactor, objs[index], events[index]);
+        }
+        else if (old_events != events[index])
+        {
+            reactor_mod(reactor, objs[index], events[index]);
+        }
     }
-
-    return rv;
+    g_memcpy(self->mod_objs, objs, sizeof(tbus) * count);
+    g_memcpy(self->mod_objs_events, events, sizeof(int) * count);
+    self->mod_objs_count = count;
 }
 
 #define DUMP_JPEG 0
@@ -2924,6 +3079,10 @@ xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
     return 0;
 }
 
+/* encoded output sent on each pass of the session loop before client
+   input is let through, so constant input can't stall the screen */
+#define ENC_DONE_MIN_BYTES (64 * 1024)
+
 /*****************************************************************************/
 static int
 xrdp_mm_process_enc_done(struct xrdp_mm *self)
@@ -2933,11 +3092,23 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
     int y;
     int cx;
     int cy;
+    int sent_bytes;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_mm_process_enc_done:");
 
+    self->encoder->processed_held = 0;
+    sent_bytes = 0;
     while (1)
     {
+        if (libxrdp_is_congested(self->wm->session))
+        {
+            /* leave the rest until the client catches up, the module
+               is not acked meanwhile so it sends fewer, larger frames */
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: "
+                      "client congested");
+            self->encoder->processed_held = 1;
+            break;
+        }
         tc_mutex_lock(self->encoder->mutex);
         enc_done = (XRDP_ENC_DATA_DONE *)
                    fifo_remove_item(self->encoder->fifo_processed);
@@ -2946,6 +3117,8 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         {
             break;
         }
+        /* the frame markers and small surface bits go out together */
+        libxrdp_set_corked(self->wm->session, 1);
         /* do something with msg */
         LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: message back bytes %d",
                   enc_done->comp_bytes);
@@ -2971,6 +3144,7 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
             {
                 libxrdp_fastpath_send_frame_marker(self->wm->session, 1,
                                                    enc_done->enc->frame_id);
+                libxrdp_set_corked(self->wm->session, 0);
             }
         }
         /* free enc_done */
@@ -2986,15 +3160,30 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
             else
             {
                 self->encoder->frame_id_server = enc_done->enc->frame_id;
+                xrdp_encoder_frame_sent(self->encoder,
+                                        enc_done->enc->frame_id);
                 xrdp_mm_update_module_frame_ack(self);
             }
             g_free(enc_done->enc->drects);
             g_free(enc_done->enc->crects);
             g_free(enc_done->enc);
         }
+        sent_bytes += enc_done->comp_bytes;
         g_free(enc_done->comp_pad_data);
         g_free(enc_done);
+        if (sent_bytes >= ENC_DONE_MIN_BYTES &&
+                libxrdp_input_pending(self->wm->session))
+        {
+            /* the session loop reads input first, then comes back for
+               the rest */
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: "
+                      "input pending");
+            self->encoder->processed_held = 1;
+            break;
+        }
     }
+    /* don't hold back part of a frame until the rest is encoded */
+    libxrdp_set_corked(self->wm->session, 0);
     return 0;
 }
 
@@ -3074,6 +3263,15 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
         }
     }
 
+    if (self->encoder != NULL && self->encoder->processed_held &&
+            !libxrdp_is_congested(self->wm->session))
+    {
+        /* client has caught up, send the held updates */
+        g_set_wait_obj(self->encoder->xrdp_encoder_event_processed);
+    }
+
+    xrdp_mm_update_mod_objs(self);
+
     if (self->wm->screen_dirty_region != NULL)
     {
         if (xrdp_region_not_empty(self->wm->screen_dirty_region))
@@ -3083,7 +3281,8 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
             int now = g_time3();
             int diff = now - self->wm->last_screen_draw_time;
             LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_mm_check_wait_objs: not empty diff %d", diff);
-            if ((diff < 0) || (diff >= 40))
+            if (((diff < 0) || (diff >= 40)) &&
+                    !libxrdp_is_congested(self->wm->session))
             {
                 if (self->egfx_up)
                 {
@@ -3134,6 +3333,8 @@ xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id)
     {
         /* frame acks can come out of order so ignore older one */
         encoder->frame_id_client = MAX(frame_id, encoder->frame_id_client);
+        /* surface frame acks have no queue depth */
+        xrdp_encoder_frame_acked(encoder, frame_id, 0);
     }
     xrdp_mm_update_module_frame_ack(self);
     return 0;
@@ -3171,6 +3372,7 @@ server_begin_update(struct xrdp_mod *mod)
     p = xrdp_painter_create(wm, wm->session);
     xrdp_painter_begin_update(p);
     mod->painter = (long)p;
+    libxrdp_set_corked(wm->session, 1);
     return 0;
 }
 
@@ -3178,8 +3380,10 @@ server_begin_update(struct xrdp_mod *mod)
 int
 server_end_update(struct xrdp_mod *mod)
 {
+    struct xrdp_wm *wm;
     struct xrdp_painter *p;
 
+    wm = (struct xrdp_wm *)(mod->wm);
     p = (struct xrdp_painter *)(mod->painter);
 
     if (p == 0)
@@ -3190,6 +3394,7 @@ server_end_update(struct xrdp_mod *mod)
     xrdp_painter_end_update(p);
     xrdp_painter_delete(p);
     mod->painter = 0;
+    libxrdp_set_corked(wm->session, 0);
     return 0;
 }
 
@@ -4006,6 +4211,7 @@ server_paint_rect_os(struct xrdp_mod *mod, int x, int y, int cx, int cy,
     struct xrdp_bitmap *b;
     struct xrdp_painter *p;
     struct xrdp_os_bitmap_item *bi;
+    struct xrdp_rect rect;
 
     p = (struct xrdp_painter *)(mod->painter);
 
@@ -4017,7 +4223,18 @@ server_paint_rect_os(struct xrdp_mod *mod, int x, int y, int cx, int cy,
     wm = (struct xrdp_wm *)(mod->wm);
     bi = xrdp_cache_get_os_bitmap(wm->cache, rdpindex);
 
-    if (bi != 0)
+    MAKERECT(rect, srcx, srcy, cx, cy);
+    if (bi != 0 && wm->target_surface->type == WND_TYPE_SCREEN &&
+            mod->mod_event != 0 &&
+            xrdp_cache_os_bitmap_take_lost(wm->cache, rdpindex, &rect))
+    {
+        /* the client copy was deleted to make room, have the module
+           redraw the area instead, copies to other surfaces carry the
+           lost area over in xrdp_painter_copy() */
+        mod->mod_event(mod, WM_INVALIDATE, MAKELONG(y, x), MAKELONG(cy, cx),
+                       0, 0);
+    }
+    else if (bi != 0)
     {
         b = bi->bitmap;
         xrdp_painter_copy(p, b, wm->target_surface, x, y, cx, cy, srcx, srcy);
@@ -23,6 +23,7 @@
 #endif
 
 #include "xrdp.h"
+#include "ms-rdpegdi.h"
 #include "string_calls.h"
 
 #if defined(XRDP_PAINTER)
@@ -114,8 +115,12 @@ xrdp_painter_send_dirty(struct xrdp_painter *self)
         }
         LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_painter_send_dirty: x %d y %d cx %d cy %d",
                   rect.left, rect.top, cx, cy);
-        libxrdp_send_bitmap(self->session, cx, cy, bpp,
-                            ldata, rect.left, rect.top, cx, cy);
+        if (libxrdp_send_bitmap(self->session, cx, cy, bpp,
+                                ldata, rect.left, rect.top, cx, cy) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_painter_send_dirty: error sending "
+                "bitmap x %d y %d cx %d cy %d", rect.left, rect.top, cx, cy);
+        }
         g_free(ldata);
 
         jndex++;
@@ -186,8 +191,6 @@ int
 wm_painter_set_target(struct xrdp_painter *self)
 {
     int surface_index;
-    int index;
-    struct list *del_list;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "wm_painter_set_target:");
 
@@ -210,19 +213,7 @@ wm_painter_set_target(struct xrdp_painter *self)
 
         if (surface_index != self->wm->current_surface_index)
         {
-            if (self->wm->target_surface->tab_stop == 0) /* tab_stop is hack */
-            {
-                del_list = self->wm->cache->xrdp_os_del_list;
-                index = list_index_of(del_list, surface_index);
-                list_remove_item(del_list, index);
-                libxrdp_orders_send_create_os_surface(self->session, surface_index,
-                                                      self->wm->target_surface->width,
-                                                      self->wm->target_surface->height,
-                                                      del_list);
-                self->wm->target_surface->tab_stop = 1;
-                list_clear(del_list);
-            }
-
+            xrdp_cache_use_os_bitmap(self->wm->cache, surface_index, -1);
             libxrdp_orders_send_switch_os_surface(self->session, surface_index);
             self->wm->current_surface_index = surface_index;
         }
@@ -532,6 +523,39 @@ get_rgb_from_rdp_color(struct xrdp_painter *self, int rdp_color)
 
 #endif
 
+/*****************************************************************************/
+/* a draw of x, y, cx, cy on offscreen surface dst that does not depend on
+   what was there makes that part whole again on the client */
+static void
+xrdp_painter_os_drawn(struct xrdp_painter *self, struct xrdp_bitmap *dst,
+                      int x, int y, int cx, int cy,
+                      struct xrdp_rect *clip_rect)
+{
+    struct xrdp_rect rect;
+    struct xrdp_rect draw_rect;
+
+    if (dst->type != WND_TYPE_OFFSCREEN)
+    {
+        return;
+    }
+    switch (self->rop)
+    {
+        case 0x00: /* black */
+        case 0xcc: /* copy */
+        case 0xf0: /* pattern copy */
+        case 0xff: /* white */
+            break;
+        default:
+            return;
+    }
+    MAKERECT(rect, x, y, cx, cy);
+    if (rect_intersect(&rect, clip_rect, &draw_rect))
+    {
+        xrdp_cache_os_bitmap_drawn(self->wm->cache, dst->item_index,
+                                   &draw_rect);
+    }
+}
+
 /*****************************************************************************/
 /* fill in an area of the screen with one color */
 int
@@ -685,6 +709,7 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
 
     x += dx;
     y += dy;
+    xrdp_painter_os_drawn(self, dst, x, y, cx, cy, &clip_rect);
 
     if (self->mix_mode == 0 && self->rop == 0xcc)
     {
@@ -782,6 +807,9 @@ xrdp_painter_draw_text(struct xrdp_painter *self,
     int total_height;
     int dx;
     int dy;
+    int frag;
+    int found;
+    int data_len;
     char *data;
     struct xrdp_region *region;
     struct xrdp_rect rect;
@@ -948,11 +976,38 @@ xrdp_painter_draw_text(struct xrdp_painter *self,
     x += dx;
     y += dy;
     k = 0;
+    frag = -2; /* not looked up yet */
+    found = 0;
+    data_len = len * 2;
 
     while (xrdp_region_get_rect(region, k, &rect) == 0)
     {
         if (rect_intersect(&rect, &clip_rect, &draw_rect))
         {
+            if (frag == -2)
+            {
+                /* the first order sent adds the glyphs to the client's
+                   fragment cache unless they are there already */
+                frag = xrdp_cache_add_glyph_frag(self->wm->cache, f,
+                                                 data, data_len, &found);
+                if (frag >= 0 && !found)
+                {
+                    data[data_len] = GLYPH_FRAGMENT_ADD;
+                    data[data_len + 1] = frag;
+                    data[data_len + 2] = data_len;
+                    data_len += 3;
+                }
+            }
+            else if (frag >= 0)
+            {
+                found = 1;
+            }
+            if (frag >= 0 && found)
+            {
+                data[0] = GLYPH_FRAGMENT_USE;
+                data[1] = frag;
+                data_len = 2;
+            }
             x1 = x;
             y1 = y + font->body_height;
             flags = 0x03; /* 0x03 0x73; TEXT2_IMPLICIT_X and something else */
@@ -960,7 +1015,7 @@ xrdp_painter_draw_text(struct xrdp_painter *self,
                                 self->fg_color, 0,
                                 x - 1, y - 1, x + total_width, y + total_height,
                                 0, 0, 0, 0,
-                                x1, y1, data, len * 2, &draw_rect);
+                                x1, y1, data, data_len, &draw_rect);
         }
 
         k++;
@@ -1076,6 +1131,7 @@ xrdp_painter_copy(struct xrdp_painter *self,
     struct xrdp_rect rect1;
     struct xrdp_rect rect2;
     struct xrdp_region *region;
+    struct xrdp_region *region2;
     struct xrdp_bitmap *b;
     int i;
     int j;
@@ -1090,8 +1146,6 @@ xrdp_painter_copy(struct xrdp_painter *self,
     int dsty;
     int w;
     int h;
-    int index;
-    struct list *del_list;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_painter_copy:");
 
@@ -1189,6 +1243,7 @@ xrdp_painter_copy(struct xrdp_painter *self,
         y += dy;
         srcx += dx;
         srcy += dy;
+        xrdp_painter_os_drawn(self, dst, x, y, cx, cy, &clip_rect);
         k = 0;
 
         while (xrdp_region_get_rect(region, k, &rect1) == 0)
@@ -1233,18 +1288,24 @@ xrdp_painter_copy(struct xrdp_painter *self,
         if (src->tab_stop == 0)
         {
             LOG(LOG_LEVEL_WARNING, "xrdp_painter_copy: warning src not created");
-            del_list = self->wm->cache->xrdp_os_del_list;
-            index = list_index_of(del_list, cache_idx);
-            list_remove_item(del_list, index);
-            libxrdp_orders_send_create_os_surface(self->session,
-                                                  cache_idx,
-                                                  src->width,
-                                                  src->height,
-                                                  del_list);
-            src->tab_stop = 1;
-            list_clear(del_list);
         }
-
+        /* the surface being drawn on must stay on the client */
+        xrdp_cache_use_os_bitmap(self->wm->cache, cache_idx,
+                                 dst->type == WND_TYPE_OFFSCREEN ?
+                                 dst->item_index : -1);
+        if (dst->type == WND_TYPE_OFFSCREEN)
+        {
+            /* anything lost from src is lost from dst too, the client
+               copies from a blank surface there, src can be dst so get
+               it first */
+            MAKERECT(rect1, srcx, srcy, cx, cy);
+            region2 = xrdp_cache_os_bitmap_get_lost(self->wm->cache,
+                                                    cache_idx, &rect1, x, y);
+            xrdp_painter_os_drawn(self, dst, x, y, cx, cy, &clip_rect);
+            xrdp_cache_os_bitmap_add_lost(self->wm->cache, dst->item_index,
+                                          region2);
+            xrdp_region_delete(region2);
+        }
 
         k = 0;
 
@@ -1285,6 +1346,7 @@ xrdp_painter_copy(struct xrdp_painter *self,
 
         x += dx;
         y += dy;
+        xrdp_painter_os_drawn(self, dst, x, y, cx, cy, &clip_rect);
         palette_id = 0;
         j = srcy;
 
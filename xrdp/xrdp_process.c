@@ -23,6 +23,7 @@
 #endif
 
 #include "xrdp.h"
+#include "reactor.h"
 
 static int g_session_id = 0;
 
@@ -44,6 +45,7 @@ xrdp_process_create(struct xrdp_listen *owner, tbus done_event)
     g_snprintf(event_name, 255, "xrdp_%8.8x_process_self_term_event_%8.8x",
                pid, self->session_id);
     self->self_term_event = g_create_wait_obj(event_name);
+    self->reactor = reactor_create();
     return self;
 }
 
@@ -56,10 +58,13 @@ xrdp_process_delete(struct xrdp_process *self)
         return;
     }
 
-    g_delete_wait_obj(self->self_term_event);
-    libxrdp_exit(self->session);
+    /* these take their objects out of the reactor, and the
+       transports use the session's source_info */
     xrdp_wm_delete(self->wm);
     trans_delete(self->server_trans);
+    libxrdp_exit(self->session);
+    reactor_delete(self->reactor);
+    g_delete_wait_obj(self->self_term_event);
     g_free(self);
 }
 
@@ -146,6 +151,10 @@ xrdp_process_data_in(struct trans *self)
                 pro->server_trans->header_size = 2;
                 pro->server_trans->extra_flags = 1;
                 init_stream(s, 0);
+                /* TLS is set up by now, so input can be read ahead and
+                   several small PDUs handled per wakeup */
+                trans_set_read_ahead(pro->server_trans,
+                                     TRANS_READ_AHEAD_BYTES);
             }
             break;
 
@@ -220,12 +229,8 @@ xrdp_process_data_in(struct trans *self)
 int
 xrdp_process_main_loop(struct xrdp_process *self)
 {
-    int robjs_count;
-    int wobjs_count;
     int cont;
     int timeout = 0;
-    tbus robjs[32];
-    tbus wobjs[32];
     tbus term_obj;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_process_main_loop");
@@ -240,6 +245,20 @@ xrdp_process_main_loop(struct xrdp_process *self)
                                  self->lis_layer->startup_params->xrdp_ini);
     self->server_trans->si = &(self->session->si);
     self->server_trans->my_source = XRDP_SOURCE_CLIENT;
+    /* the socket inherits tcp_notsent_lowat from the listener, screen
+       updates then wait for it to be writeable */
+    if (self->lis_layer->startup_params->tcp_notsent_lowat > 0 &&
+            (self->server_trans->mode == TRANS_MODE_TCP ||
+             self->server_trans->mode == TRANS_MODE_TCP4 ||
+             self->server_trans->mode == TRANS_MODE_TCP6))
+    {
+        self->server_trans->send_lowat = 1;
+    }
+    if (self->lis_layer->startup_params->tcp_zerocopy &&
+            trans_set_zerocopy(self->server_trans) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "error setting tcp_zerocopy");
+    }
     /* this callback function is in xrdp_wm.c */
     self->session->callback = callback;
     /* this function is just above */
@@ -250,22 +269,26 @@ xrdp_process_main_loop(struct xrdp_process *self)
         init_stream(self->server_trans->in_s, 32 * 1024);
 
         term_obj = g_get_term();
+        /* each object is added once, the wm and mm add theirs as they
+           are made, and the transport keeps its own up to date */
         cont = 1;
+        if (self->reactor == NULL ||
+                reactor_add(self->reactor, term_obj, REACTOR_READ) != 0 ||
+                reactor_add(self->reactor, self->self_term_event,
+                            REACTOR_READ) != 0 ||
+                trans_set_reactor(self->server_trans, self->reactor) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "xrdp_process_main_loop: "
+                "can't set up the reactor");
+            cont = 0;
+        }
 
         while (cont)
         {
-            /* build the wait obj list */
             timeout = -1;
-            robjs_count = 0;
-            wobjs_count = 0;
-            robjs[robjs_count++] = term_obj;
-            robjs[robjs_count++] = self->self_term_event;
-            xrdp_wm_get_wait_objs(self->wm, robjs, &robjs_count,
-                                  wobjs, &wobjs_count, &timeout);
-            trans_get_wait_objs_rw(self->server_trans, robjs, &robjs_count,
-                                   wobjs, &wobjs_count, &timeout);
+            libxrdp_autodetect_get_timeout(self->session, &timeout);
             /* wait */
-            if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
+            if (reactor_wait(self->reactor, NULL, 0, timeout) < 0)
             {
                 /* error, should not get here */
                 g_sleep(100);
@@ -284,12 +307,19 @@ xrdp_process_main_loop(struct xrdp_process *self)
                 break;
             }
 
+            /* client input goes to the module before more screen
+               updates are sent */
+            if (trans_check_wait_objs(self->server_trans) != 0)
+            {
+                break;
+            }
+
             if (xrdp_wm_check_wait_objs(self->wm) != 0)
             {
                 break;
             }
 
-            if (trans_check_wait_objs(self->server_trans) != 0)
+            if (libxrdp_autodetect_check(self->session) != 0)
             {
                 break;
             }
@@ -306,8 +336,7 @@ xrdp_process_main_loop(struct xrdp_process *self)
     }
     /* Run end in module */
     xrdp_process_mod_end(self);
-    libxrdp_exit(self->session);
-    self->session = 0;
+    /* the session goes in xrdp_process_delete(), after the wm */
     self->status = -1;
     g_set_wait_obj(self->done_event);
     return 0;
@@ -32,6 +32,9 @@
 #define MAX_NR_CHANNELS 16
 #define MAX_CHANNEL_NAME 16
 
+/* Most wait objects taken from a module's mod_get_wait_objs() */
+#define XRDP_MM_MOD_OBJS_MAX 16
+
 /* Code values used in 'xrdp_mm->code=' settings */
 #define XVNC_SESSION_CODE 0
 #define XORG_SESSION_CODE 20
@@ -40,6 +43,7 @@
 #define XRDP_MM_IMPLEMENTS_TOUCH(mm) ((mm)->code != XVNC_SESSION_CODE)
 
 struct source_info;
+struct reactor;
 struct list16;
 
 /* lib */
@@ -56,6 +60,7 @@ struct xrdp_mod
     int (*mod_end)(struct xrdp_mod *v);
     int (*mod_set_param)(struct xrdp_mod *v, const char *name, const char *value);
     int (*mod_session_change)(struct xrdp_mod *v, int, int);
+    /* optional, not needed if the module puts its objects in reactor */
     int (*mod_get_wait_objs)(struct xrdp_mod *v, tbus *read_objs, int *rcount,
                              tbus *write_objs, int *wcount, int *timeout);
     int (*mod_check_wait_objs)(struct xrdp_mod *v);
@@ -187,6 +192,7 @@ struct xrdp_mod
     tintptr wm; /* struct xrdp_wm* */
     tintptr painter;
     struct source_info *si;
+    struct reactor *reactor; /* the session loop waits on this */
 };
 
 /**
@@ -238,6 +244,11 @@ struct xrdp_os_bitmap_item
 {
     int id;
     struct xrdp_bitmap *bitmap;
+    int stamp; /* last use, for lru */
+    int client_bytes; /* memory used on the client, 0 if not created there */
+    /* area whose content is gone from the client since the surface was
+       deleted there to make room, 0 if none */
+    struct xrdp_region *lost;
 };
 
 struct xrdp_char_item
@@ -246,6 +257,17 @@ struct xrdp_char_item
     struct xrdp_font_char font_item;
 };
 
+/* run of GlyphIndex order data the client has in its fragment cache */
+struct xrdp_glyph_frag_item
+{
+    int stamp;
+    int font;
+    int size; /* 0 if unused */
+    char data[256];
+};
+
+#define XRDP_MAX_GLYPH_FRAGS 256
+
 struct xrdp_pointer_item
 {
     int stamp;
@@ -306,6 +328,10 @@ struct xrdp_cache
     /* font */
     int char_stamp;
     struct xrdp_char_item char_items[12][256];
+    int glyph_frag_stamp;
+    int glyph_frag_entries;
+    int glyph_frag_size;
+    struct xrdp_glyph_frag_item glyph_frag_items[XRDP_MAX_GLYPH_FRAGS];
     /* pointer */
     int pointer_stamp;
     struct xrdp_pointer_item pointer_items[32];
@@ -314,6 +340,13 @@ struct xrdp_cache
     struct xrdp_brush_item brush_items[64];
     struct xrdp_os_bitmap_item os_bitmap_items[2000];
     struct list *xrdp_os_del_list;
+    /* offscreen surfaces created on the client, limited to what it
+       advertised, 0 is no limit */
+    int os_bitmap_stamp;
+    int os_bitmap_bytes;
+    int os_bitmap_count;
+    int offscreen_cache_size;
+    int offscreen_cache_entries;
 };
 
 /* defined later */
@@ -413,6 +446,11 @@ struct xrdp_mm
     struct display_control_monitor_layout_data *resize_data;
     struct list *resize_queue;
     tbus resize_ready;
+    /* in the reactor for a module with mod_get_wait_objs(), see
+       xrdp_mm_update_mod_objs() */
+    tbus mod_objs[XRDP_MM_MOD_OBJS_MAX];
+    int mod_objs_events[XRDP_MM_MOD_OBJS_MAX];
+    int mod_objs_count;
 };
 
 struct xrdp_key_info
@@ -552,6 +590,7 @@ struct xrdp_process
     struct xrdp_wm *wm;
     //int app_sck;
     tbus done_event;
+    struct reactor *reactor; /* everything the main loop waits on */
     int session_id;
 };
 
@@ -563,6 +602,7 @@ struct xrdp_listen
     struct list *process_list;
     struct list *fork_list;
     tbus pro_done_event;
+    tbus reload_event; /* SIGHUP, load the TLS certificate again */
     struct xrdp_startup_params *startup_params;
 };
 
@@ -699,6 +739,9 @@ struct xrdp_startup_params
     int tcp_recv_buffer_bytes;
     int tcp_nodelay;
     int tcp_keepalive;
+    int tcp_notsent_lowat;
+    int tcp_max_pacing_rate;
+    int tcp_zerocopy;
     int use_vsock;
 };
 
@@ -28,6 +28,7 @@
 #include "ms-rdpbcgr.h"
 #include "log.h"
 #include "string_calls.h"
+#include "reactor.h"
 
 /*****************************************************************************/
 struct xrdp_wm *
@@ -55,6 +56,10 @@ xrdp_wm_create(struct xrdp_process *owner,
                pid, owner->session_id);
     LOG(LOG_LEVEL_DEBUG, "%s", event_name);
     self->login_state_event = g_create_wait_obj(event_name);
+    if (owner->reactor != NULL)
+    {
+        reactor_add(owner->reactor, self->login_state_event, REACTOR_READ);
+    }
     self->painter = xrdp_painter_create(self, self->session);
     self->cache = xrdp_cache_create(self, self->session, self->client_info);
     self->log = list_create();
@@ -90,6 +95,10 @@ xrdp_wm_delete(struct xrdp_wm *self)
     list_delete(self->log);
     /* free default font */
     xrdp_font_delete(self->default_font);
+    if (self->pro_layer->reactor != NULL)
+    {
+        reactor_del(self->pro_layer->reactor, self->login_state_event);
+    }
     g_delete_wait_obj(self->login_state_event);
 
     if (self->xrdp_config)
@@ -2021,6 +2030,9 @@ callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
                                     LOWORD(param2), HIWORD(param2),
                                     LOWORD(param3), HIWORD(param3));
             break;
+        case 0x555a: /* network auto-detection results have changed */
+            xrdp_mm_network_update(wm->mm);
+            break;
     }
     return rv;
 }
@@ -2296,24 +2308,6 @@ xrdp_wm_log_msg(struct xrdp_wm *self, enum logLevels loglevel,
     return 0;
 }
 
-/*****************************************************************************/
-int
-xrdp_wm_get_wait_objs(struct xrdp_wm *self, tbus *robjs, int *rc,
-                      tbus *wobjs, int *wc, int *timeout)
-{
-    int i;
-
-    if (self == 0)
-    {
-        return 0;
-    }
-
-    i = *rc;
-    robjs[i++] = self->login_state_event;
-    *rc = i;
-    return xrdp_mm_get_wait_objs(self->mm, robjs, rc, wobjs, wc, timeout);
-}
-
 /******************************************************************************/
 int
 xrdp_wm_check_wait_objs(struct xrdp_wm *self)
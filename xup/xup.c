@@ -254,6 +254,8 @@ lib_mod_connect(struct mod *mod)
         mod->trans->callback_data = mod;
         mod->trans->no_stream_init_on_data_in = 1;
         mod->trans->extra_flags = 1;
+        /* the session loop waits on it from now on */
+        trans_set_reactor(mod->trans, mod->reactor);
     }
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "out lib_mod_connect");
@@ -1800,23 +1802,6 @@ lib_mod_set_param(struct mod *mod, const char *name, const char *value)
     return 0;
 }
 
-/******************************************************************************/
-/* return error */
-int
-lib_mod_get_wait_objs(struct mod *mod, tbus *read_objs, int *rcount,
-                      tbus *write_objs, int *wcount, int *timeout)
-{
-    if (mod != 0)
-    {
-        if (mod->trans != 0)
-        {
-            trans_get_wait_objs_rw(mod->trans, read_objs, rcount,
-                                   write_objs, wcount, timeout);
-        }
-    }
-    return 0;
-}
-
 /******************************************************************************/
 /* return error */
 int
@@ -1876,7 +1861,6 @@ mod_init(void)
     mod->mod_signal = lib_mod_signal;
     mod->mod_end = lib_mod_end;
     mod->mod_set_param = lib_mod_set_param;
-    mod->mod_get_wait_objs = lib_mod_get_wait_objs;
     mod->mod_check_wait_objs = lib_mod_check_wait_objs;
     mod->mod_frame_ack = lib_mod_frame_ack;
     mod->mod_suppress_output = lib_mod_suppress_output;
@@ -34,6 +34,7 @@
 #define CURRENT_MOD_VER 4
 
 struct source_info;
+struct reactor;
 
 struct mod
 {
@@ -173,6 +174,7 @@ struct mod
     tintptr wm;
     tintptr painter;
     struct source_info *si;
+    struct reactor *reactor;
     /* mod data */
     int width;
     int height;